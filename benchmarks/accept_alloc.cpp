@@ -0,0 +1,93 @@
+#include <iostream>
+#include <boost/asio/steady_timer.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+#include "pool.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Accepts `count` short lived channels and reports how many heap
+// allocations (C++ ones, GNUnet uses malloc directly) the accepting
+// side makes per channel, and how many of the pooled blocks were
+// recycled.
+static int accept_alloc(const vector<string>& args)
+{
+    size_t count  = args.size() > 0 ? stoul(args[0]) : 1000;
+    string config1 = args.size() > 1 ? args[1] : "../scripts/peer1.conf";
+    string config2 = args.size() > 2 ? args[2] : "../scripts/peer2.conf";
+
+    // Channels accepted before this one are not measured, to let the
+    // pool fill up.
+    const size_t warmup = min<size_t>(count / 10, 100);
+
+    const string port = "accept_alloc_" + to_string(getpid());
+    const string server_id = bench::get_id(config1);
+
+    bench::Fork server(config1, [&](Service& service, asio::yield_context yield) {
+            sys::error_code ec;
+            CadetPort p(service);
+
+            uint64_t allocs_before = 0;
+            Pool::Stats pool_before;
+
+            for (size_t i = 0; i < count; ++i) {
+                if (i == warmup) {
+                    allocs_before = bench::allocations();
+                    pool_before   = Pool::instance().stats();
+                }
+
+                Channel channel(service);
+                p.open(channel, port, yield[ec]);
+
+                if (ec) {
+                    cerr << "Failed to accept: " << ec.message() << endl;
+                    _exit(1);
+                }
+            }
+
+            auto n      = count - warmup;
+            auto allocs = bench::allocations() - allocs_before;
+            auto pool   = Pool::instance().stats();
+
+            cout << "accepted channels:              " << n << endl
+                 << "allocations per channel:        " << double(allocs) / n << endl
+                 << "fresh pool blocks per channel:  "
+                 << double(pool.fresh - pool_before.fresh) / n << endl
+                 << "recycled blocks per channel:    "
+                 << double(pool.recycled - pool_before.recycled) / n << endl;
+        });
+
+    bench::Fork client(config2, [&](Service& service, asio::yield_context yield) {
+            sys::error_code ec;
+
+            asio::steady_timer t(service.get_io_service());
+            t.expires_from_now(chrono::seconds(1));
+            t.async_wait(yield[ec]);
+
+            auto pid = PeerId::from_string(server_id);
+            auto port_hash = PortHash::from_secret(port);
+
+            for (size_t i = 0; i < count; ++i) {
+                Channel channel(service);
+                channel.connect(pid, port_hash, yield[ec]);
+
+                if (ec) {
+                    cerr << "Failed to connect: " << ec.message() << endl;
+                    _exit(1);
+                }
+            }
+        });
+
+    int client_ret = client.join();
+    int server_ret = server.join();
+
+    return client_ret ? client_ret : server_ret;
+}
+
+static bench::Register reg( "accept_alloc"
+                          , "allocations per accepted channel "
+                            "[count] [server-config] [client-config]"
+                          , accept_alloc);
@@ -0,0 +1,186 @@
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <atomic>
+#include "bench.h"
+
+using namespace std;
+using namespace bench;
+
+//--------------------------------------------------------------------
+Options Options::parse(const vector<string>& args)
+{
+    Options o;
+
+    for (auto& a : args) {
+        auto eq = a.find('=');
+        auto key = a.substr(0, eq);
+        auto value = eq == string::npos ? string() : a.substr(eq + 1);
+
+        if      (key == "--peers")     o.loopback = false;
+        else if (key == "--loopback")  o.loopback = true;
+        else if (key == "--latency")   o.loopback_options.latency = chrono::microseconds(stoul(value));
+        else if (key == "--bandwidth") o.loopback_options.bandwidth = stoull(value);
+        else if (key == "--handles")   o.sharding.handles = stoul(value);
+        else if (key == "--config1")   o.config1 = value;
+        else if (key == "--config2")   o.config2 = value;
+        else if (key == "--json")      o.json = value;
+        else if (a.compare(0, 2, "--") == 0) {
+            cerr << "Unknown option " << a << endl;
+            exit(1);
+        }
+        else {
+            o.args.push_back(a);
+        }
+    }
+
+    return o;
+}
+
+vector<size_t> bench::parse_list(const string& s)
+{
+    vector<size_t> ret;
+    stringstream ss(s);
+    string item;
+
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) ret.push_back(stoul(item));
+    }
+
+    return ret;
+}
+
+//--------------------------------------------------------------------
+Report::Report(string benchmark, const Options& options)
+    : _benchmark(move(benchmark))
+    , _options(options)
+{
+    cout << _benchmark << " (" << options.backend() << ")" << endl;
+}
+
+void Report::param(const string& name, double value)
+{
+    cout << "    " << name << " = " << value << endl;
+    _params.emplace_back(name, value);
+}
+
+void Report::metric(const string& name, double value, const string& unit)
+{
+    cout << "    " << name << ": " << value << " " << unit << endl;
+    _metrics.emplace_back(name + "_" + unit, value);
+}
+
+static void write_object(ostream& os, const vector<pair<string, double>>& kvs)
+{
+    os << "{";
+    for (size_t i = 0; i < kvs.size(); ++i) {
+        if (i) os << ",";
+        os << "\"" << kvs[i].first << "\":" << kvs[i].second;
+    }
+    os << "}";
+}
+
+Report::~Report()
+{
+    if (_options.json.empty()) return;
+
+    ofstream f(_options.json, ios::app);
+
+    f << "{\"benchmark\":\"" << _benchmark << "\""
+      << ",\"backend\":\"" << _options.backend() << "\"";
+
+    if (_options.sharding.handles > 1) {
+        f << ",\"handles\":" << _options.sharding.handles;
+    }
+
+    if (_options.loopback) {
+        f << ",\"latency_us\":" << _options.loopback_options.latency.count()
+          << ",\"bandwidth\":"  << _options.loopback_options.bandwidth;
+    }
+
+    f << ",\"params\":";
+    write_object(f, _params);
+    f << ",\"metrics\":";
+    write_object(f, _metrics);
+    f << "}" << endl;
+}
+
+//--------------------------------------------------------------------
+// Everything in this process, on one loopback service.
+static int run_loopback(const Options& o, ServerFunc server, ClientFunc client)
+{
+    asio::io_service ios;
+    Service service(o.config1, ios, o.loopback_options);
+    service.set_sharding(o.sharding);
+
+    int ret = 0;
+
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+            asio::io_service::work w(ios);
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+
+            if (ec) {
+                cerr << "Failed to set up gnunet service: "
+                     << ec.message() << endl;
+                ret = 1;
+                return;
+            }
+
+            // The server may finish in another thread (see Options::threads),
+            // so instead of a WaitGroup just poll for it once the client is
+            // done.
+            atomic<bool> server_done{!server};
+
+            if (server) {
+                asio::spawn(ios, [&] (asio::yield_context yield) {
+                        server(service, yield);
+                        server_done = true;
+                    });
+            }
+
+            if (client) {
+                client(service, service.identity(), yield);
+            }
+
+            asio::steady_timer t(ios);
+
+            while (!server_done) {
+                t.expires_from_now(chrono::milliseconds(1));
+                t.async_wait(yield[ec]);
+            }
+        });
+
+    run_threads(ios, o.threads);
+
+    return ret;
+}
+
+int bench::run_pair(const Options& o, ServerFunc server, ClientFunc client)
+{
+    if (o.loopback) return run_loopback(o, move(server), move(client));
+
+    const string server_id = get_id(o.config1);
+
+    Fork s(o.config1, server, o.threads, o.sharding);
+
+    Fork c(o.config2, [&] (Service& service, asio::yield_context yield) {
+            sys::error_code ec;
+            asio::steady_timer t(service.get_io_service());
+            t.expires_from_now(chrono::seconds(1));
+            t.async_wait(yield[ec]);
+
+            client(service, server_id, yield);
+        }, o.threads, o.sharding);
+
+    int client_ret = c.join();
+    int server_ret = s.join();
+
+    return client_ret ? client_ret : server_ret;
+}
+
+int bench::run_single(const Options& o, ServerFunc func)
+{
+    if (o.loopback) return run_loopback(o, move(func), nullptr);
+    return Fork(o.config1, move(func), o.threads, o.sharding).join();
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <iostream>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <gnunet_channels/service.h>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+namespace bench {
+
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Registry of benchmarks, the `benchmarks` executable picks one (or all)
+// of them by name.
+using Main = std::function<int(const std::vector<std::string>& args)>;
+
+struct Entry {
+    std::string description;
+    Main main;
+};
+
+inline std::map<std::string, Entry>& registry()
+{
+    static std::map<std::string, Entry> r;
+    return r;
+}
+
+struct Register {
+    Register(std::string name, std::string description, Main main) {
+        registry()[name] = Entry{std::move(description), std::move(main)};
+    }
+};
+
+//--------------------------------------------------------------------
+// Number of calls to the global operator new made so far by this process
+// (see alloc_counter.cpp).
+uint64_t allocations();
+
+//--------------------------------------------------------------------
+// Runs the io_service in `threads` threads (including this one) until it
+// runs out of work.
+inline void run_threads(asio::io_service& ios, size_t threads)
+{
+    std::vector<std::thread> ts;
+
+    for (size_t i = 1; i < threads; ++i) {
+        ts.emplace_back([&ios] { ios.run(); });
+    }
+
+    ios.run();
+
+    for (auto& t : ts) t.join();
+}
+
+//--------------------------------------------------------------------
+// GNUnet won't let us run more than one node per process, so (as in the
+// tests) each node runs in its own forked process.
+class Fork {
+public:
+    using Func = std::function<void(Service&, asio::yield_context)>;
+
+public:
+    Fork( std::string config
+        , Func func
+        , size_t threads = 1
+        , ShardingOptions sharding = ShardingOptions())
+    {
+        _pid = fork();
+
+        if (_pid != 0) return;
+
+        {
+            asio::io_service ios;
+            Service service(config, ios);
+            service.set_sharding(sharding);
+
+            asio::spawn(ios, [&] (asio::yield_context yield) {
+                    asio::io_service::work w(ios);
+                    sys::error_code ec;
+                    service.async_setup(yield[ec]);
+
+                    if (ec) {
+                        std::cerr << "Failed to set up gnunet service: "
+                                  << ec.message() << std::endl;
+                        _exit(1);
+                    }
+
+                    func(service, yield);
+                });
+
+            run_threads(ios, threads);
+        }
+
+        _exit(0);
+    }
+
+    // Returns the exit code of the child.
+    int join() {
+        int status = 0;
+        if (waitpid(_pid, &status, 0) == -1) return 1;
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+
+private:
+    pid_t _pid;
+};
+
+//--------------------------------------------------------------------
+inline std::string get_id(std::string config)
+{
+    asio::io_service ios;
+    Service service(config, ios);
+
+    std::string result_id;
+
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+            service.async_setup(yield);
+            result_id = service.identity();
+        });
+
+    ios.run();
+
+    return result_id;
+}
+
+//--------------------------------------------------------------------
+// Arguments common to the suite benchmarks. Flags start with "--", the
+// rest is passed to the benchmark as positional arguments:
+//
+//     --peers              Run against two local peers (default)
+//     --loopback           Run against the in-process CADET stand-in
+//     --latency=<us>       One way latency of the stand-in
+//     --bandwidth=<B/s>    Bandwidth of the stand-in
+//     --handles=<n>        CADET handles per service (see set_sharding)
+//     --config1=<path>     Config of the server peer
+//     --config2=<path>     Config of the client peer
+//     --json=<path>        Append results as JSON lines to this file
+struct Options {
+    bool loopback = false;
+    LoopbackOptions loopback_options;
+    ShardingOptions sharding;
+    std::string config1 = "../scripts/peer1.conf";
+    std::string config2 = "../scripts/peer2.conf";
+    std::string json;
+    std::vector<std::string> args;
+
+    // Threads running the io_service. Not a command line flag, benchmarks
+    // which are safe to run with more than one set it themselves.
+    size_t threads = 1;
+
+    static Options parse(const std::vector<std::string>& args);
+
+    std::string backend() const { return loopback ? "loopback" : "peers"; }
+
+    // Positional argument `i` or `def` if not given.
+    std::string arg(size_t i, std::string def) const {
+        return i < args.size() ? args[i] : def;
+    }
+};
+
+// "1,4,16" -> {1, 4, 16}
+std::vector<size_t> parse_list(const std::string&);
+
+//--------------------------------------------------------------------
+// Results of one run, printed as they're added and appended to the
+// --json file (one object per line) when destroyed.
+class Report {
+public:
+    Report(std::string benchmark, const Options&);
+
+    void param(const std::string& name, double value);
+    void metric(const std::string& name, double value, const std::string& unit);
+
+    ~Report();
+
+private:
+    std::string _benchmark;
+    const Options& _options;
+    std::vector<std::pair<std::string, double>> _params;
+    std::vector<std::pair<std::string, double>> _metrics;
+};
+
+//--------------------------------------------------------------------
+// Runs `server` and `client` against each other: in two forked processes
+// with --peers, in this one otherwise. The client is given the server's
+// peer id and starts once the server had a chance to open its port.
+using ServerFunc = std::function<void(Service&, asio::yield_context)>;
+using ClientFunc = std::function<void( Service&
+                                     , const std::string& server_id
+                                     , asio::yield_context)>;
+
+int run_pair(const Options&, ServerFunc server, ClientFunc client);
+
+// Runs `func` with a set up service of the chosen backend.
+int run_single(const Options&, ServerFunc func);
+
+//--------------------------------------------------------------------
+// Lets a coroutine wait for a number of others to finish.
+class WaitGroup {
+public:
+    WaitGroup(asio::io_service& ios)
+        : _timer(ios, asio::steady_timer::clock_type::time_point::max())
+    {}
+
+    void add(size_t n = 1) { _count += n; }
+
+    void done() {
+        if (--_count == 0) _timer.cancel();
+    }
+
+    void wait(asio::yield_context yield) {
+        sys::error_code ec;
+        while (_count) _timer.async_wait(yield[ec]);
+    }
+
+private:
+    size_t _count = 0;
+    asio::steady_timer _timer;
+};
+
+//--------------------------------------------------------------------
+// Benchmarks have nobody to report errors to, so just bail out.
+inline void check(const sys::error_code& ec, const char* what)
+{
+    if (!ec) return;
+    std::cerr << what << ": " << ec.message() << std::endl;
+    _exit(1);
+}
+
+inline double seconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+inline double micros(std::chrono::nanoseconds d)
+{
+    return d.count() / 1000.0;
+}
+
+} // bench namespace
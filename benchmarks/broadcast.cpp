@@ -0,0 +1,132 @@
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include <gnunet_channels/broadcast.h>
+#include "bench.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Publishes `rounds` payloads to `subscribers` channels, once through
+// Broadcast and once by writing to each channel separately, and compares
+// the publishing rate and the allocations made per delivered payload.
+static int broadcast(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t subscribers = stoul(o.arg(0, "100"));
+    size_t rounds      = stoul(o.arg(1, "100"));
+    size_t size        = stoul(o.arg(2, "4096"));
+
+    const string port = "broadcast_" + to_string(getpid());
+
+    // Each subscriber reads both runs.
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+        auto& ios = service.get_io_service();
+
+        vector<unique_ptr<Channel>> chs;
+
+        for (size_t i = 0; i < subscribers; ++i) {
+            chs.push_back(make_unique<Channel>(service));
+            p.open(*chs.back(), port, yield[ec]);
+            bench::check(ec, "Failed to accept");
+        }
+
+        bench::WaitGroup wg(ios);
+        wg.add(subscribers);
+
+        for (auto& ch : chs) {
+            asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                    sys::error_code ec;
+                    vector<uint8_t> buf(size);
+
+                    for (size_t i = 0; i < 2 * rounds; ++i) {
+                        asio::async_read(*ch, asio::buffer(buf), yield[ec]);
+                        bench::check(ec, "Failed to read");
+                    }
+
+                    wg.done();
+                });
+        }
+
+        wg.wait(yield);
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+        auto& ios = service.get_io_service();
+
+        vector<unique_ptr<Channel>> chs;
+        vector<Channel*> targets;
+
+        for (size_t i = 0; i < subscribers; ++i) {
+            chs.push_back(make_unique<Channel>(service));
+            chs.back()->connect(server_id, port, yield[ec]);
+            bench::check(ec, "Failed to connect");
+            targets.push_back(chs.back().get());
+        }
+
+        auto payload = make_shared<const vector<uint8_t>>(size, 'x');
+
+        auto report = [&] (const char* mode, auto elapsed, uint64_t allocs) {
+            bench::Report r(string("broadcast_") + mode, o);
+            r.param("subscribers", subscribers);
+            r.param("rounds", rounds);
+            r.param("size", size);
+            r.metric("publishes", rounds / bench::seconds(elapsed), "per_s");
+            r.metric("allocations_per_delivery"
+                    , double(allocs) / (rounds * subscribers), "count");
+        };
+
+        {
+            auto allocs = bench::allocations();
+            auto start = chrono::steady_clock::now();
+
+            for (size_t i = 0; i < rounds; ++i) {
+                auto results = Broadcast::async_send(targets, payload, yield);
+                for (auto& r : results) bench::check(r, "Failed to broadcast");
+            }
+
+            report( "shared"
+                  , chrono::steady_clock::now() - start
+                  , bench::allocations() - allocs);
+        }
+
+        {
+            auto allocs = bench::allocations();
+            auto start = chrono::steady_clock::now();
+
+            for (size_t i = 0; i < rounds; ++i) {
+                bench::WaitGroup wg(ios);
+                wg.add(subscribers);
+
+                for (auto ch : targets) {
+                    asio::async_write(*ch, asio::buffer(*payload),
+                        [&] (sys::error_code ec, size_t) {
+                            bench::check(ec, "Failed to write");
+                            wg.done();
+                        });
+                }
+
+                wg.wait(yield);
+            }
+
+            report( "per_channel"
+                  , chrono::steady_clock::now() - start
+                  , bench::allocations() - allocs);
+        }
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "broadcast"
+                          , "shared payload fan-out vs per channel writes "
+                            "[subscribers] [rounds] [size]"
+                          , broadcast);
@@ -0,0 +1,101 @@
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// For each message size, the client pushes `total` bytes over a fresh
+// channel in writes of that size and waits for a one byte ack from the
+// server once it received everything. In the `peek` mode the server
+// looks at the received data in place (async_peek/consume) instead of
+// copying it out.
+static int bulk(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t total = stoul(o.arg(0, to_string(16 << 20)));
+    auto sizes = bench::parse_list(o.arg(1, "64,1024,16384,65536"));
+    bool peek = o.arg(2, "read") == "peek";
+
+    const string port = "bulk_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+
+        for (auto size : sizes) {
+            Channel channel(service);
+            p.open(channel, port, yield[ec]);
+            bench::check(ec, "Failed to accept");
+
+            vector<uint8_t> buf(size);
+
+            for (size_t received = 0; received < total;) {
+                if (peek) {
+                    auto views = channel.async_peek(yield[ec]);
+                    bench::check(ec, "Failed to peek");
+                    auto n = min(asio::buffer_size(views), total - received);
+                    channel.consume(n);
+                    received += n;
+                    continue;
+                }
+
+                auto n = min(size, total - received);
+                asio::async_read(channel, asio::buffer(buf.data(), n), yield[ec]);
+                bench::check(ec, "Failed to read");
+                received += n;
+            }
+
+            uint8_t ack = 0;
+            asio::async_write(channel, asio::buffer(&ack, 1), yield[ec]);
+            bench::check(ec, "Failed to write");
+        }
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+
+        for (auto size : sizes) {
+            Channel channel(service);
+            channel.connect(server_id, port, yield[ec]);
+            bench::check(ec, "Failed to connect");
+
+            vector<uint8_t> buf(size);
+            size_t messages = 0;
+
+            auto start = chrono::steady_clock::now();
+
+            for (size_t sent = 0; sent < total; ++messages) {
+                auto n = min(size, total - sent);
+                asio::async_write(channel, asio::buffer(buf.data(), n), yield[ec]);
+                bench::check(ec, "Failed to write");
+                sent += n;
+            }
+
+            uint8_t ack;
+            asio::async_read(channel, asio::buffer(&ack, 1), yield[ec]);
+            bench::check(ec, "Failed to read");
+
+            auto elapsed = bench::seconds(chrono::steady_clock::now() - start);
+
+            bench::Report r("bulk", o);
+            r.param("total", total);
+            r.param("size", size);
+            r.param("peek", peek);
+            r.metric("throughput", total / elapsed / 1e6, "MBps");
+            r.metric("writes", messages / elapsed, "per_s");
+        }
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "bulk"
+                          , "one way throughput [total-bytes] [sizes,...] [read|peek]"
+                          , bulk);
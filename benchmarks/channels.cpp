@@ -0,0 +1,114 @@
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Ping-pong over `n` concurrent channels for each `n` in the list,
+// reports the aggregate rate of round trips.
+static int channels(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    auto counts   = bench::parse_list(o.arg(0, "1,4,16,64"));
+    size_t rounds = stoul(o.arg(1, "1000"));
+    size_t size   = stoul(o.arg(2, "64"));
+
+    const string port = "channels_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+        auto& ios = service.get_io_service();
+
+        for (auto n : counts) {
+            vector<unique_ptr<Channel>> chs;
+
+            for (size_t i = 0; i < n; ++i) {
+                chs.push_back(make_unique<Channel>(service));
+                p.open(*chs.back(), port, yield[ec]);
+                bench::check(ec, "Failed to accept");
+            }
+
+            bench::WaitGroup wg(ios);
+            wg.add(n);
+
+            for (auto& ch : chs) {
+                asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                        sys::error_code ec;
+                        vector<uint8_t> buf(size);
+
+                        for (size_t i = 0; i < rounds; ++i) {
+                            asio::async_read(*ch, asio::buffer(buf), yield[ec]);
+                            bench::check(ec, "Failed to read");
+                            asio::async_write(*ch, asio::buffer(buf), yield[ec]);
+                            bench::check(ec, "Failed to write");
+                        }
+
+                        wg.done();
+                    });
+            }
+
+            wg.wait(yield);
+        }
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+        auto& ios = service.get_io_service();
+
+        for (auto n : counts) {
+            vector<unique_ptr<Channel>> chs;
+
+            for (size_t i = 0; i < n; ++i) {
+                chs.push_back(make_unique<Channel>(service));
+                chs.back()->connect(server_id, port, yield[ec]);
+                bench::check(ec, "Failed to connect");
+            }
+
+            bench::WaitGroup wg(ios);
+            wg.add(n);
+
+            auto start = chrono::steady_clock::now();
+
+            for (auto& ch : chs) {
+                asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                        sys::error_code ec;
+                        vector<uint8_t> buf(size);
+
+                        for (size_t i = 0; i < rounds; ++i) {
+                            asio::async_write(*ch, asio::buffer(buf), yield[ec]);
+                            bench::check(ec, "Failed to write");
+                            asio::async_read(*ch, asio::buffer(buf), yield[ec]);
+                            bench::check(ec, "Failed to read");
+                        }
+
+                        wg.done();
+                    });
+            }
+
+            wg.wait(yield);
+
+            auto elapsed = bench::seconds(chrono::steady_clock::now() - start);
+
+            bench::Report r("channels", o);
+            r.param("channels", n);
+            r.param("rounds", rounds);
+            r.param("size", size);
+            r.metric("round_trips", n * rounds / elapsed, "per_s");
+            r.metric("per_channel", rounds / elapsed, "per_s");
+        }
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "channels"
+                          , "concurrent channel scaling [counts,...] [rounds] [size]"
+                          , channels);
@@ -0,0 +1,65 @@
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+#include "latency_histogram.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// The client connects (and immediately closes) `count` channels one
+// after another while the server accepts them.
+static int connect_rate(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t count = stoul(o.arg(0, "1000"));
+
+    const string port = "connect_rate_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+
+        for (size_t i = 0; i < count; ++i) {
+            Channel channel(service);
+            p.open(channel, port, yield[ec]);
+            bench::check(ec, "Failed to accept");
+        }
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+        auto pid = PeerId::from_string(server_id);
+        auto port_hash = PortHash::from_secret(port);
+
+        LatencyHistogram connect_time;
+
+        auto start = chrono::steady_clock::now();
+
+        for (size_t i = 0; i < count; ++i) {
+            auto t = chrono::steady_clock::now();
+            Channel channel(service);
+            channel.connect(pid, port_hash, yield[ec]);
+            bench::check(ec, "Failed to connect");
+            connect_time.record(chrono::steady_clock::now() - t);
+        }
+
+        auto elapsed = bench::seconds(chrono::steady_clock::now() - start);
+        auto s = connect_time.summary();
+
+        bench::Report r("connect_rate", o);
+        r.param("count", count);
+        r.metric("connects", count / elapsed, "per_s");
+        r.metric("connect_p50", bench::micros(s.p50), "us");
+        r.metric("connect_p99", bench::micros(s.p99), "us");
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "connect_rate"
+                          , "sequential connect/accept rate [count]"
+                          , connect_rate);
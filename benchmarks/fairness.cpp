@@ -0,0 +1,129 @@
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+#include "latency_histogram.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// One channel keeps writing `bulk` bytes at a time while another one,
+// sharing the same CADET handle, does small round trips. Reports the
+// round trip times of the latter (which should stay bounded by a few
+// envelopes' worth of the bulk transfer, not by the size of its writes)
+// and the bulk throughput.
+static int fairness(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t count  = stoul(o.arg(0, "1000"));
+    size_t bulk   = stoul(o.arg(1, "16777216"));
+    uint32_t weight = stoul(o.arg(2, "1"));
+
+    const size_t size = 64;
+    const string port = "fairness_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        auto& ios = service.get_io_service();
+        CadetPort p(service);
+        Channel bulk_ch(service);
+        Channel probe_ch(service);
+
+        p.open(bulk_ch, port, yield[ec]);
+        bench::check(ec, "Failed to accept");
+        p.open(probe_ch, port, yield[ec]);
+        bench::check(ec, "Failed to accept");
+
+        bool done = false;
+
+        asio::spawn(ios, [&] (asio::yield_context yield) {
+                sys::error_code ec;
+                vector<uint8_t> buf(64 * 1024);
+
+                while (!done) {
+                    asio::async_read( bulk_ch, asio::buffer(buf)
+                                    , asio::transfer_at_least(1), yield[ec]);
+                    if (ec) return;
+                }
+            });
+
+        vector<uint8_t> buf(size);
+
+        for (size_t i = 0; i < count; ++i) {
+            asio::async_read(probe_ch, asio::buffer(buf), yield[ec]);
+            bench::check(ec, "Failed to read");
+            asio::async_write(probe_ch, asio::buffer(buf), yield[ec]);
+            bench::check(ec, "Failed to write");
+        }
+
+        done = true;
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+        auto& ios = service.get_io_service();
+        Channel bulk_ch(service);
+        Channel probe_ch(service);
+
+        bulk_ch.connect(server_id, port, yield[ec]);
+        bench::check(ec, "Failed to connect");
+        probe_ch.connect(server_id, port, yield[ec]);
+        bench::check(ec, "Failed to connect");
+
+        probe_ch.set_send_weight(weight);
+
+        bool done = false;
+        uint64_t bulk_bytes = 0;
+
+        asio::spawn(ios, [&] (asio::yield_context yield) {
+                sys::error_code ec;
+                vector<uint8_t> buf(bulk, 'x');
+
+                while (!done) {
+                    asio::async_write(bulk_ch, asio::buffer(buf), yield[ec]);
+                    if (ec) return;
+                    bulk_bytes += buf.size();
+                }
+            });
+
+        vector<uint8_t> buf(size);
+        LatencyHistogram rtt;
+
+        auto start = chrono::steady_clock::now();
+
+        for (size_t i = 0; i < count; ++i) {
+            auto t = chrono::steady_clock::now();
+            asio::async_write(probe_ch, asio::buffer(buf), yield[ec]);
+            bench::check(ec, "Failed to write");
+            asio::async_read(probe_ch, asio::buffer(buf), yield[ec]);
+            bench::check(ec, "Failed to read");
+            rtt.record(chrono::steady_clock::now() - t);
+        }
+
+        auto elapsed = chrono::steady_clock::now() - start;
+        done = true;
+
+        auto s = rtt.summary();
+
+        bench::Report r("fairness", o);
+        r.param("count", count);
+        r.param("bulk", bulk);
+        r.param("weight", weight);
+        r.metric("rtt_p50", bench::micros(s.p50), "us");
+        r.metric("rtt_p99", bench::micros(s.p99), "us");
+        r.metric("rtt_max", bench::micros(s.max), "us");
+        r.metric("bulk_throughput", bulk_bytes / bench::seconds(elapsed), "B/s");
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "fairness"
+                          , "small message latency during a bulk transfer "
+                            "[count] [bulk] [weight]"
+                          , fairness);
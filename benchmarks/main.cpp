@@ -0,0 +1,32 @@
+#include <iostream>
+#include "bench.h"
+
+using namespace std;
+
+static void print_usage(const char* app_name)
+{
+    cerr << "Usage:\n";
+    cerr << "    " << app_name << " <benchmark> [args...]\n";
+    cerr << "Benchmarks:\n";
+
+    for (auto& e : bench::registry()) {
+        cerr << "    " << e.first << " - " << e.second.description << "\n";
+    }
+}
+
+int main(int argc, char* const* argv)
+{
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    auto i = bench::registry().find(argv[1]);
+
+    if (i == bench::registry().end()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    return i->second.main(vector<string>(argv + 2, argv + argc));
+}
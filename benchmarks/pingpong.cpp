@@ -0,0 +1,130 @@
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+#include "latency_histogram.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Reads and writes the whole buffer the reactor way: wait for readiness,
+// then do as much as possible without going through the io_service.
+static void read_ready(Channel& ch, asio::mutable_buffer buf, asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    while (asio::buffer_size(buf)) {
+        size_t n = ch.try_read_some(asio::buffer(buf), ec);
+
+        if (ec == asio::error::would_block) {
+            ch.async_wait_readable(yield[ec]);
+        }
+
+        bench::check(ec, "Failed to read");
+        buf = buf + n;
+    }
+}
+
+static void write_ready(Channel& ch, asio::const_buffer buf, asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    while (asio::buffer_size(buf)) {
+        size_t n = ch.try_write_some(asio::buffer(buf), ec);
+
+        if (ec == asio::error::would_block) {
+            ch.async_wait_writable(yield[ec]);
+        }
+
+        bench::check(ec, "Failed to write");
+        buf = buf + n;
+    }
+}
+
+//--------------------------------------------------------------------
+// The client sends a message, waits for the server to echo it back and
+// repeats. Reports the round trip time distribution. With the `ready`
+// mode both sides use readiness waits and try_read/try_write_some instead
+// of async_read/async_write.
+static int pingpong(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t count = stoul(o.arg(0, "10000"));
+    size_t size  = stoul(o.arg(1, "64"));
+    bool   ready = o.arg(2, "async") == "ready";
+
+    auto read = [&] (Channel& ch, vector<uint8_t>& buf, asio::yield_context yield) {
+        if (ready) return read_ready(ch, asio::buffer(buf), yield);
+        sys::error_code ec;
+        asio::async_read(ch, asio::buffer(buf), yield[ec]);
+        bench::check(ec, "Failed to read");
+    };
+
+    auto write = [&] (Channel& ch, vector<uint8_t>& buf, asio::yield_context yield) {
+        if (ready) return write_ready(ch, asio::buffer(buf), yield);
+        sys::error_code ec;
+        asio::async_write(ch, asio::buffer(buf), yield[ec]);
+        bench::check(ec, "Failed to write");
+    };
+
+    const string port = "pingpong_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+        Channel channel(service);
+        p.open(channel, port, yield[ec]);
+        bench::check(ec, "Failed to accept");
+
+        vector<uint8_t> buf(size);
+
+        for (size_t i = 0; i < count; ++i) {
+            read(channel, buf, yield);
+            write(channel, buf, yield);
+        }
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+        Channel channel(service);
+        channel.connect(server_id, port, yield[ec]);
+        bench::check(ec, "Failed to connect");
+
+        vector<uint8_t> buf(size);
+        LatencyHistogram rtt;
+
+        auto start = chrono::steady_clock::now();
+
+        for (size_t i = 0; i < count; ++i) {
+            auto t = chrono::steady_clock::now();
+            write(channel, buf, yield);
+            read(channel, buf, yield);
+            rtt.record(chrono::steady_clock::now() - t);
+        }
+
+        auto elapsed = chrono::steady_clock::now() - start;
+        auto s = rtt.summary();
+
+        bench::Report r("pingpong", o);
+        r.param("count", count);
+        r.param("size", size);
+        r.param("ready", ready);
+        r.metric("rtt_mean", bench::micros(s.mean), "us");
+        r.metric("rtt_p50",  bench::micros(s.p50),  "us");
+        r.metric("rtt_p99",  bench::micros(s.p99),  "us");
+        r.metric("rtt_p999", bench::micros(s.p999), "us");
+        r.metric("rtt_max",  bench::micros(s.max),  "us");
+        r.metric("round_trips", count / bench::seconds(elapsed), "per_s");
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "pingpong"
+                          , "round trip latency [count] [size] [async|ready]"
+                          , pingpong);
@@ -0,0 +1,123 @@
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+#if GNUNET_CHANNELS_SINGLE_THREADED
+static const bool single_threaded = true;
+#else
+static const bool single_threaded = false;
+#endif
+
+//--------------------------------------------------------------------
+// Small messages echoed over `channels` channels at once, each with one
+// message in flight, so that the per message overhead of the channel
+// (its executor, queues and the hops to GNUnet's thread and back)
+// dominates. The channel policy is picked at build time, compare the
+// `benchmarks` executable with `benchmarks-single-threaded` (built with
+// GNUNET_CHANNELS_SINGLE_THREADED, see CMakeLists.txt).
+static int policies(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t channels = stoul(o.arg(0, "100"));
+    size_t count    = stoul(o.arg(1, "100000"));
+    size_t size     = stoul(o.arg(2, "16"));
+
+    // Round trips per channel.
+    size_t per_channel = max<size_t>(1, count / channels);
+
+    const string port = "policies_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        auto& ios = service.get_io_service();
+        sys::error_code ec;
+        CadetPort p(service);
+        bench::WaitGroup wg(ios);
+
+        for (size_t i = 0; i < channels; ++i) {
+            auto ch = make_shared<Channel>(service);
+            p.open(*ch, port, yield[ec]);
+            bench::check(ec, "Failed to accept");
+
+            wg.add();
+            asio::spawn(ios, [&, ch] (asio::yield_context yield) {
+                    sys::error_code ec;
+                    vector<uint8_t> buf(size);
+
+                    for (size_t j = 0; j < per_channel; ++j) {
+                        asio::async_read(*ch, asio::buffer(buf), yield[ec]);
+                        bench::check(ec, "Failed to read");
+                        asio::async_write(*ch, asio::buffer(buf), yield[ec]);
+                        bench::check(ec, "Failed to write");
+                    }
+
+                    wg.done();
+                });
+        }
+
+        wg.wait(yield);
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        auto& ios = service.get_io_service();
+        sys::error_code ec;
+        vector<unique_ptr<Channel>> chs;
+
+        for (size_t i = 0; i < channels; ++i) {
+            chs.emplace_back(new Channel(service));
+            chs.back()->connect(server_id, port, yield[ec]);
+            bench::check(ec, "Failed to connect");
+        }
+
+        auto allocs = bench::allocations();
+        auto start  = chrono::steady_clock::now();
+
+        bench::WaitGroup wg(ios);
+
+        for (auto& ch : chs) {
+            wg.add();
+            asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                    sys::error_code ec;
+                    vector<uint8_t> buf(size);
+
+                    for (size_t j = 0; j < per_channel; ++j) {
+                        asio::async_write(*ch, asio::buffer(buf), yield[ec]);
+                        bench::check(ec, "Failed to write");
+                        asio::async_read(*ch, asio::buffer(buf), yield[ec]);
+                        bench::check(ec, "Failed to read");
+                    }
+
+                    wg.done();
+                });
+        }
+
+        wg.wait(yield);
+
+        auto elapsed = chrono::steady_clock::now() - start;
+        size_t trips = per_channel * channels;
+
+        bench::Report r("policies", o);
+        r.param("single_threaded", single_threaded);
+        r.param("channels", channels);
+        r.param("count", trips);
+        r.param("size", size);
+        r.metric("round_trips", trips / bench::seconds(elapsed), "per_s");
+        r.metric("round_trip_mean", bench::micros(elapsed) * channels / trips, "us");
+        // Both sides when they share the process (--loopback).
+        r.metric("allocations", double(bench::allocations() - allocs) / trips, "per_trip");
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "policies"
+                          , "echo over many channels with the build's channel policy"
+                            " [channels] [count] [size]"
+                          , policies);
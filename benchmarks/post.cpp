@@ -0,0 +1,51 @@
+#include "bench.h"
+#include "cadet.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Throughput of Scheduler::post: `count` empty tasks are posted to
+// GNUnet's thread, each posting back to the io_service, with at most
+// `in_flight` of them outstanding.
+static int post(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t count     = stoul(o.arg(0, "1000000"));
+    size_t in_flight = stoul(o.arg(1, "1000"));
+
+    return bench::run_single(o, [&] (Service& service, asio::yield_context yield) {
+            auto& scheduler = service.cadet()->scheduler();
+            auto& ios = service.get_io_service();
+
+            size_t posted = 0;
+            bench::WaitGroup wg(ios);
+
+            function<void()> post_one = [&] {
+                if (posted == count) return wg.done();
+                ++posted;
+                scheduler.post([&] { scheduler.post_to_ios(post_one); });
+            };
+
+            wg.add(in_flight);
+
+            auto start = chrono::steady_clock::now();
+
+            for (size_t i = 0; i < in_flight; ++i) post_one();
+
+            wg.wait(yield);
+
+            auto elapsed = bench::seconds(chrono::steady_clock::now() - start);
+
+            bench::Report r("post", o);
+            r.param("count", count);
+            r.param("in_flight", in_flight);
+            r.metric("round_trips", count / elapsed, "per_s");
+            r.metric("round_trip_mean", elapsed * 1e6 * in_flight / count, "us");
+        });
+}
+
+static bench::Register reg( "post"
+                          , "scheduler post throughput [count] [in-flight]"
+                          , post);
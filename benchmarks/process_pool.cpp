@@ -0,0 +1,153 @@
+#include <sstream>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/process_pool.h>
+#include "bench.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// A ProcessPool with one worker per given config accepts `channels`
+// channels, over which a client peer (--config2) pushes `total` bytes each
+// in parallel, spreading its connects over the workers. Run it once with a
+// single config and once with several to see how far GNUnet's work scales
+// with more processes.
+static int process_pool(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    if (o.loopback) {
+        // The loopback stand-in only connects channels of one service.
+        cerr << "process_pool only runs with --peers" << endl;
+        return 1;
+    }
+
+    vector<string> configs;
+    {
+        stringstream ss(o.arg(0, o.config1));
+        string item;
+        while (getline(ss, item, ',')) {
+            if (!item.empty()) configs.push_back(item);
+        }
+    }
+
+    size_t channels = stoul(o.arg(1, "16"));
+    size_t total    = stoul(o.arg(2, to_string(4 << 20)));
+    size_t size     = stoul(o.arg(3, "65536"));
+
+    const string port = "process_pool_" + to_string(getpid());
+
+    int ret = 0;
+
+    asio::io_service ios;
+    ProcessPool pool(ios, configs);
+
+    asio::spawn(ios, [&] (asio::yield_context yield) {
+            sys::error_code ec;
+            pool.async_start(yield[ec]);
+            bench::check(ec, "Failed to start the pool");
+
+            pool.listen(port);
+
+            auto ids = pool.identities();
+
+            bench::Fork client(o.config2, [&] (Service& service, asio::yield_context yield) {
+                    sys::error_code ec;
+                    auto& ios = service.get_io_service();
+
+                    asio::steady_timer t(ios);
+                    t.expires_from_now(chrono::seconds(1));
+                    t.async_wait(yield[ec]);
+
+                    vector<unique_ptr<Channel>> chs;
+
+                    for (size_t i = 0; i < channels; ++i) {
+                        chs.push_back(make_unique<Channel>(service));
+                        chs.back()->connect(ids[i % ids.size()], port, yield[ec]);
+                        bench::check(ec, "Failed to connect");
+                    }
+
+                    bench::WaitGroup wg(ios);
+                    wg.add(channels);
+
+                    auto start = chrono::steady_clock::now();
+
+                    for (auto& ch : chs) {
+                        asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                                sys::error_code ec;
+                                vector<uint8_t> buf(size);
+
+                                for (size_t sent = 0; sent < total;) {
+                                    auto n = min(size, total - sent);
+                                    asio::async_write(*ch, asio::buffer(buf.data(), n), yield[ec]);
+                                    bench::check(ec, "Failed to write");
+                                    sent += n;
+                                }
+
+                                uint8_t ack;
+                                asio::async_read(*ch, asio::buffer(&ack, 1), yield[ec]);
+                                bench::check(ec, "Failed to read");
+                                wg.done();
+                            });
+                    }
+
+                    wg.wait(yield);
+
+                    auto elapsed = bench::seconds(chrono::steady_clock::now() - start);
+
+                    bench::Report r("process_pool", o);
+                    r.param("workers", configs.size());
+                    r.param("channels", channels);
+                    r.param("total", total);
+                    r.param("size", size);
+                    r.metric("throughput", channels * total / elapsed / 1e6, "MBps");
+                });
+
+            vector<unique_ptr<PoolChannel>> chs;
+
+            for (size_t i = 0; i < channels; ++i) {
+                chs.push_back(make_unique<PoolChannel>(pool));
+                pool.async_accept(*chs.back(), yield[ec]);
+                bench::check(ec, "Failed to accept");
+            }
+
+            bench::WaitGroup wg(ios);
+            wg.add(channels);
+
+            for (auto& ch : chs) {
+                asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                        sys::error_code ec;
+                        vector<uint8_t> buf(size);
+
+                        for (size_t received = 0; received < total;) {
+                            auto n = min(size, total - received);
+                            asio::async_read(*ch, asio::buffer(buf.data(), n), yield[ec]);
+                            bench::check(ec, "Failed to read");
+                            received += n;
+                        }
+
+                        uint8_t ack = 0;
+                        asio::async_write(*ch, asio::buffer(&ack, 1), yield[ec]);
+                        bench::check(ec, "Failed to write");
+                        wg.done();
+                    });
+            }
+
+            wg.wait(yield);
+
+            ret = client.join();
+            chs.clear();
+            pool.stop();
+        });
+
+    ios.run();
+
+    return ret;
+}
+
+static bench::Register reg( "process_pool"
+                          , "throughput of a ProcessPool front end "
+                            "[config,...] [channels] [total-bytes] [size]"
+                          , process_pool);
@@ -0,0 +1,96 @@
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include <gnunet_channels/rpc.h>
+#include "bench.h"
+#include "latency_histogram.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Calls per second over one channel with `c` calls kept outstanding, for
+// each `c` in the list. The server replies with the request.
+static int rpc(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    auto levels  = bench::parse_list(o.arg(0, "1,8,64"));
+    size_t calls = stoul(o.arg(1, "10000"));
+    size_t size  = stoul(o.arg(2, "64"));
+
+    const string port = "rpc_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+        Channel channel(service);
+        p.open(channel, port, yield[ec]);
+        bench::check(ec, "Failed to accept");
+
+        RpcServer server(channel, [] (RpcServer::Payload req, auto reply) {
+                reply(move(req));
+            });
+
+        server.async_run(yield[ec]);
+    };
+
+    auto client = [&] ( Service& service
+                      , const string& server_id
+                      , asio::yield_context yield) {
+        sys::error_code ec;
+        auto& ios = service.get_io_service();
+
+        Channel channel(service);
+        channel.connect(server_id, port, yield[ec]);
+        bench::check(ec, "Failed to connect");
+
+        RpcClient client(channel);
+
+        for (auto level : levels) {
+            LatencyHistogram latency;
+            size_t started = 0;
+
+            bench::WaitGroup wg(ios);
+            wg.add(level);
+
+            auto start = chrono::steady_clock::now();
+
+            for (size_t i = 0; i < level; ++i) {
+                asio::spawn(ios, [&] (asio::yield_context yield) {
+                        sys::error_code ec;
+
+                        while (started < calls) {
+                            ++started;
+                            auto t = chrono::steady_clock::now();
+                            client.async_call( RpcClient::Payload(size)
+                                             , chrono::seconds(10)
+                                             , yield[ec]);
+                            bench::check(ec, "Call failed");
+                            latency.record(chrono::steady_clock::now() - t);
+                        }
+
+                        wg.done();
+                    });
+            }
+
+            wg.wait(yield);
+
+            auto elapsed = bench::seconds(chrono::steady_clock::now() - start);
+            auto s = latency.summary();
+
+            bench::Report r("rpc", o);
+            r.param("concurrency", level);
+            r.param("calls", calls);
+            r.param("size", size);
+            r.metric("calls", calls / elapsed, "per_s");
+            r.metric("latency_p50", bench::micros(s.p50), "us");
+            r.metric("latency_p99", bench::micros(s.p99), "us");
+        }
+    };
+
+    return bench::run_pair(o, server, client);
+}
+
+static bench::Register reg( "rpc"
+                          , "calls per second by concurrency [levels,...] [calls] [size]"
+                          , rpc);
@@ -0,0 +1,135 @@
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// `channels` channels push `total` bytes each at the same time, once for
+// each number of CADET handles per service in the list. Reports the
+// aggregate throughput and how evenly the channels were spread.
+static int shards(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    auto counts     = bench::parse_list(o.arg(0, "1,2,4"));
+    size_t channels = stoul(o.arg(1, "16"));
+    size_t total    = stoul(o.arg(2, to_string(4 << 20)));
+    size_t size     = stoul(o.arg(3, "65536"));
+
+    const string port = "shards_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+        auto& ios = service.get_io_service();
+
+        vector<unique_ptr<Channel>> chs;
+
+        for (size_t i = 0; i < channels; ++i) {
+            chs.push_back(make_unique<Channel>(service));
+            p.open(*chs.back(), port, yield[ec]);
+            bench::check(ec, "Failed to accept");
+        }
+
+        bench::WaitGroup wg(ios);
+        wg.add(channels);
+
+        for (auto& ch : chs) {
+            asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                    sys::error_code ec;
+                    vector<uint8_t> buf(size);
+
+                    for (size_t received = 0; received < total;) {
+                        auto n = min(size, total - received);
+                        asio::async_read(*ch, asio::buffer(buf.data(), n), yield[ec]);
+                        bench::check(ec, "Failed to read");
+                        received += n;
+                    }
+
+                    uint8_t ack = 0;
+                    asio::async_write(*ch, asio::buffer(&ack, 1), yield[ec]);
+                    bench::check(ec, "Failed to write");
+                    wg.done();
+                });
+        }
+
+        wg.wait(yield);
+    };
+
+    int ret = 0;
+
+    for (auto handles : counts) {
+        auto client = [&] ( Service& service
+                          , const string& server_id
+                          , asio::yield_context yield) {
+            sys::error_code ec;
+            auto& ios = service.get_io_service();
+
+            vector<unique_ptr<Channel>> chs;
+
+            for (size_t i = 0; i < channels; ++i) {
+                chs.push_back(make_unique<Channel>(service));
+                chs.back()->connect(server_id, port, yield[ec]);
+                bench::check(ec, "Failed to connect");
+            }
+
+            bench::WaitGroup wg(ios);
+            wg.add(channels);
+
+            auto start = chrono::steady_clock::now();
+
+            for (auto& ch : chs) {
+                asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                        sys::error_code ec;
+                        vector<uint8_t> buf(size);
+
+                        for (size_t sent = 0; sent < total;) {
+                            auto n = min(size, total - sent);
+                            asio::async_write(*ch, asio::buffer(buf.data(), n), yield[ec]);
+                            bench::check(ec, "Failed to write");
+                            sent += n;
+                        }
+
+                        uint8_t ack;
+                        asio::async_read(*ch, asio::buffer(&ack, 1), yield[ec]);
+                        bench::check(ec, "Failed to read");
+                        wg.done();
+                    });
+            }
+
+            wg.wait(yield);
+
+            auto elapsed = bench::seconds(chrono::steady_clock::now() - start);
+
+            size_t busiest = 0;
+            for (auto& s : service.handle_stats()) {
+                busiest = max<size_t>(busiest, s.channels_open);
+            }
+
+            bench::Report r("shards", o);
+            r.param("handles", handles);
+            r.param("channels", channels);
+            r.param("total", total);
+            r.param("size", size);
+            r.metric("throughput", channels * total / elapsed / 1e6, "MBps");
+            r.metric("busiest_handle", busiest, "channels");
+        };
+
+        auto run = o;
+        run.sharding.handles = handles;
+
+        ret = bench::run_pair(run, server, client);
+        if (ret) break;
+    }
+
+    return ret;
+}
+
+static bench::Register reg( "shards"
+                          , "aggregate throughput with several CADET handles "
+                            "[handles,...] [channels] [total-bytes] [size]"
+                          , shards);
@@ -0,0 +1,147 @@
+#include <atomic>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include "bench.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Ping-pong over `channels` concurrent channels with the io_service run
+// by each number of threads in the list. Every message is checksummed on
+// both ends to give the threads some work of their own. Reports the
+// aggregate rate of round trips (GNUnet's thread stays single, so this
+// is how far the rest scales).
+static uint64_t checksum(const vector<uint8_t>& buf)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (auto b : buf) h = (h ^ b) * 1099511628211ull;
+    return h;
+}
+
+// Waits for `remaining` to drop to zero. The workers finish in various
+// threads, so just poll rather than juggle a WaitGroup between them.
+static void wait_for(asio::io_service& ios, atomic<size_t>& remaining, asio::yield_context yield)
+{
+    sys::error_code ec;
+    asio::steady_timer t(ios);
+
+    while (remaining) {
+        t.expires_from_now(chrono::milliseconds(1));
+        t.async_wait(yield[ec]);
+    }
+}
+
+static int threads(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    auto counts     = bench::parse_list(o.arg(0, "1,2,4,8"));
+    size_t channels = stoul(o.arg(1, "64"));
+    size_t rounds   = stoul(o.arg(2, "1000"));
+    size_t size     = stoul(o.arg(3, "1024"));
+
+    const string port = "threads_" + to_string(getpid());
+
+    auto server = [&] (Service& service, asio::yield_context yield) {
+        sys::error_code ec;
+        CadetPort p(service);
+        auto& ios = service.get_io_service();
+
+        vector<unique_ptr<Channel>> chs;
+
+        for (size_t i = 0; i < channels; ++i) {
+            chs.push_back(make_unique<Channel>(service));
+            p.open(*chs.back(), port, yield[ec]);
+            bench::check(ec, "Failed to accept");
+        }
+
+        atomic<size_t> remaining{channels};
+
+        for (auto& ch : chs) {
+            asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                    sys::error_code ec;
+                    vector<uint8_t> buf(size);
+
+                    for (size_t i = 0; i < rounds; ++i) {
+                        asio::async_read(*ch, asio::buffer(buf), yield[ec]);
+                        bench::check(ec, "Failed to read");
+                        buf[0] = checksum(buf);
+                        asio::async_write(*ch, asio::buffer(buf), yield[ec]);
+                        bench::check(ec, "Failed to write");
+                    }
+
+                    --remaining;
+                });
+        }
+
+        wait_for(ios, remaining, yield);
+    };
+
+    int ret = 0;
+
+    for (auto n : counts) {
+        auto client = [&] ( Service& service
+                          , const string& server_id
+                          , asio::yield_context yield) {
+            sys::error_code ec;
+            auto& ios = service.get_io_service();
+
+            vector<unique_ptr<Channel>> chs;
+
+            for (size_t i = 0; i < channels; ++i) {
+                chs.push_back(make_unique<Channel>(service));
+                chs.back()->connect(server_id, port, yield[ec]);
+                bench::check(ec, "Failed to connect");
+            }
+
+            atomic<size_t> remaining{channels};
+            auto start = chrono::steady_clock::now();
+
+            for (auto& ch : chs) {
+                asio::spawn(ios, [&, ch = ch.get()] (asio::yield_context yield) {
+                        sys::error_code ec;
+                        vector<uint8_t> buf(size, 'x');
+
+                        for (size_t i = 0; i < rounds; ++i) {
+                            buf[0] = checksum(buf);
+                            asio::async_write(*ch, asio::buffer(buf), yield[ec]);
+                            bench::check(ec, "Failed to write");
+                            asio::async_read(*ch, asio::buffer(buf), yield[ec]);
+                            bench::check(ec, "Failed to read");
+                        }
+
+                        --remaining;
+                    });
+            }
+
+            wait_for(ios, remaining, yield);
+
+            auto elapsed = chrono::steady_clock::now() - start;
+
+            bench::Report r("threads", o);
+            r.param("threads", n);
+            r.param("channels", channels);
+            r.param("rounds", rounds);
+            r.param("size", size);
+            r.metric( "round_trips"
+                    , channels * rounds / bench::seconds(elapsed)
+                    , "per_s");
+        };
+
+        auto run = o;
+        run.threads = n;
+
+        ret = bench::run_pair(run, server, client);
+        if (ret) break;
+    }
+
+    return ret;
+}
+
+static bench::Register reg( "threads"
+                          , "round trips with a multi-threaded io_service "
+                            "[threads] [channels] [rounds] [size]"
+                          , threads);
@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "timer_wheel.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Cost of keeping a deadline per channel: `channels` deadlines are armed
+// and then each of them re-armed `rounds` times (as a channel does for
+// every read or write), once with a steady_timer per channel and once
+// with the shared TimerWheel channels use.
+static int timers(const vector<string>& args)
+{
+    auto o = bench::Options::parse(args);
+
+    size_t channels = stoul(o.arg(0, "10000"));
+    size_t rounds   = stoul(o.arg(1, "100"));
+
+    const auto timeout = chrono::seconds(30);
+
+    auto measure = [&] (const string& kind, auto arm) {
+        auto start = chrono::steady_clock::now();
+
+        for (size_t r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < channels; ++i) arm(i);
+        }
+
+        auto elapsed = chrono::steady_clock::now() - start;
+        auto count = channels * rounds;
+
+        bench::Report r("timers_" + kind, o);
+        r.param("channels", channels);
+        r.param("rounds", rounds);
+        r.metric("arms", count / bench::seconds(elapsed), "per_s");
+        r.metric("arm_mean", bench::micros(elapsed) / count, "us");
+    };
+
+    {
+        asio::io_service ios;
+        vector<unique_ptr<asio::steady_timer>> ts;
+
+        for (size_t i = 0; i < channels; ++i) {
+            ts.emplace_back(new asio::steady_timer(ios));
+        }
+
+        measure("steady_timer", [&] (size_t i) {
+                ts[i]->expires_from_now(timeout);
+                ts[i]->async_wait([] (const sys::error_code&) {});
+            });
+
+        for (auto& t : ts) t->cancel();
+        ios.run();
+    }
+
+    {
+        asio::io_service ios;
+        auto wheel = make_shared<TimerWheel>(ios);
+        vector<unique_ptr<TimerWheel::Entry>> es;
+
+        for (size_t i = 0; i < channels; ++i) {
+            es.emplace_back(new TimerWheel::Entry([] {}));
+        }
+
+        measure("wheel", [&] (size_t i) { wheel->arm(*es[i], timeout); });
+
+        for (auto& e : es) wheel->cancel(*e);
+    }
+
+    return 0;
+}
+
+static bench::Register reg( "timers"
+                          , "re-arming per channel deadlines [channels] [rounds]"
+                          , timers);
@@ -37,7 +37,7 @@ static void run_chat(unique_ptr<Channel>& c, asio::yield_context yield) {
             asio::streambuf buffer(512);
 
             while (true) {
-                size_t n = asio::async_read_until(*c, buffer, '\n', yield[ec]);
+                size_t n = c->async_read_until(buffer, "\n", yield[ec]);
 
                 if (ec || !c) return;
 
@@ -0,0 +1,421 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <arpa/inet.h>
+#include <endian.h>
+
+#include <gnunet_channels/service.h>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+
+using namespace std;
+using namespace gnunet_channels;
+
+using Clock = chrono::steady_clock;
+
+//--------------------------------------------------------------------
+// Everything sent over a channel is framed so that latency probes can
+// be mixed in with the bulk data.
+enum FrameType : uint32_t {
+    HELLO = 1, // Client -> server: flags, write size
+    DATA  = 2,
+    PING  = 3, // Payload is the sender's timestamp...
+    PONG  = 4, // ...which is echoed back unchanged
+};
+
+static const uint32_t FLAG_BIDIR = 1;
+
+struct Header {
+    uint32_t type;
+    uint32_t size;
+};
+
+struct Settings {
+    string   config;
+    string   secret;
+    string   target_id;
+    size_t   parallel = 1;
+    size_t   length   = 16 * 1024;
+    Clock::duration duration = chrono::seconds(10);
+    uint64_t bytes    = 0; // 0 means no limit, run for `duration`
+    bool     bidir    = false;
+    Clock::duration interval = chrono::seconds(1);
+    Clock::duration ping_every = chrono::milliseconds(100);
+};
+
+//--------------------------------------------------------------------
+struct Meter {
+    uint64_t tx = 0;
+    uint64_t rx = 0;
+    vector<double> rtt_us;
+
+    void add(const Meter& m) {
+        tx += m.tx;
+        rx += m.rx;
+        rtt_us.insert(rtt_us.end(), m.rtt_us.begin(), m.rtt_us.end());
+    }
+};
+
+static double percentile(vector<double>& v, double p)
+{
+    if (v.empty()) return 0;
+    size_t i = min(v.size() - 1, size_t(p * v.size()));
+    nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+static void print(const char* what, double from, double to, Meter& m)
+{
+    double secs = max(to - from, 1e-9);
+
+    cout << fixed << setprecision(1)
+         << "[" << setw(5) << from << "-" << setw(5) << to << " s] "
+         << what
+         << "  tx " << setw(8) << m.tx * 8 / secs / 1e6 << " Mbit/s"
+         << "  rx " << setw(8) << m.rx * 8 / secs / 1e6 << " Mbit/s";
+
+    if (!m.rtt_us.empty()) {
+        cout << setprecision(2)
+             << "  rtt p50 " << percentile(m.rtt_us, 0.5)  / 1000 << " ms"
+             << " p99 "      << percentile(m.rtt_us, 0.99) / 1000 << " ms"
+             << " (" << m.rtt_us.size() << " probes)";
+    }
+
+    cout << endl;
+}
+
+//--------------------------------------------------------------------
+struct Perf {
+    Perf(asio::io_service& ios, Settings s)
+        : ios(ios), settings(move(s)), start(Clock::now())
+    {}
+
+    asio::io_service& ios;
+    Settings settings;
+    Clock::time_point start;
+    bool stopping = false;
+    Meter interval;
+    Meter total;
+    vector<unique_ptr<Channel>> channels;
+    // Set by the server, makes its pending accept fail.
+    function<void()> stop_accepting;
+
+    double now() const {
+        return chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    void stop() {
+        if (stopping) return;
+        stopping = true;
+        total.add(interval);
+        print("total", 0, now(), total);
+        // The pending accept holds on to the io_service, `run` wouldn't
+        // return without this.
+        if (stop_accepting) stop_accepting();
+        channels.clear();
+    }
+
+    void write_frame( Channel& ch
+                    , FrameType type
+                    , const void* payload
+                    , size_t size
+                    , asio::yield_context yield
+                    , sys::error_code& ec)
+    {
+        Header h{htonl(type), htonl(size)};
+        array<asio::const_buffer, 2> bufs{{ asio::buffer(&h, sizeof(h))
+                                          , asio::buffer(payload, size) }};
+        // A single write is never interleaved with other writes on the
+        // same channel, so the reader may answer pings concurrently.
+        asio::async_write(ch, bufs, yield[ec]);
+        if (!ec) interval.tx += sizeof(h) + size;
+    }
+
+    // Counts the received data and answers/measures latency probes.
+    void reader(Channel& ch, asio::yield_context yield) {
+        sys::error_code ec;
+        vector<uint8_t> payload;
+
+        while (!stopping) {
+            Header h;
+            asio::async_read(ch, asio::buffer(&h, sizeof(h)), yield[ec]);
+            if (ec || stopping) return;
+
+            payload.resize(ntohl(h.size));
+            asio::async_read(ch, asio::buffer(payload), yield[ec]);
+            if (ec || stopping) return;
+
+            interval.rx += sizeof(h) + payload.size();
+
+            switch (ntohl(h.type)) {
+                case HELLO:
+                    if (payload.size() >= 8) on_hello(ch, payload);
+                    break;
+                case PING:
+                    write_frame(ch, PONG, payload.data(), payload.size(), yield, ec);
+                    if (ec) return;
+                    break;
+                case PONG:
+                    if (payload.size() == 8) {
+                        uint64_t sent;
+                        memcpy(&sent, payload.data(), 8);
+                        auto rtt = Clock::now().time_since_epoch().count()
+                                 - int64_t(be64toh(sent));
+                        interval.rtt_us.push_back(rtt / 1000.0);
+                    }
+                    break;
+            }
+        }
+    }
+
+    // Server side: the client asked us to send data back.
+    void on_hello(Channel& ch, const vector<uint8_t>& payload) {
+        uint32_t flags, length;
+        memcpy(&flags, &payload[0], 4);
+        memcpy(&length, &payload[4], 4);
+
+        if (!(ntohl(flags) & FLAG_BIDIR)) return;
+
+        size_t len = ntohl(length);
+
+        asio::spawn(ios, [this, &ch, len] (asio::yield_context yield) {
+                writer(ch, len, false, yield);
+            });
+    }
+
+    void writer(Channel& ch, size_t length, bool ping, asio::yield_context yield) {
+        sys::error_code ec;
+        vector<uint8_t> data(length);
+        auto next_ping = Clock::now();
+
+        while (!stopping) {
+            if (ping && Clock::now() >= next_ping) {
+                uint64_t ts = htobe64(Clock::now().time_since_epoch().count());
+                write_frame(ch, PING, &ts, sizeof(ts), yield, ec);
+                if (ec || stopping) return;
+                next_ping += settings.ping_every;
+            }
+
+            write_frame(ch, DATA, data.data(), data.size(), yield, ec);
+            if (ec || stopping) return;
+
+            if (settings.bytes && total.tx + interval.tx >= settings.bytes) {
+                return stop();
+            }
+        }
+    }
+
+    void report(const char* what, asio::yield_context yield) {
+        asio::steady_timer t(ios);
+        double from = 0;
+
+        while (!stopping) {
+            sys::error_code ec;
+            t.expires_from_now(settings.interval);
+            t.async_wait(yield[ec]);
+            if (stopping) return;
+
+            double to = now();
+            print(what, from, to, interval);
+            total.add(interval);
+            interval = Meter();
+            from = to;
+        }
+    }
+};
+
+//--------------------------------------------------------------------
+static void run_client(Perf& perf, Service& service, asio::yield_context yield)
+{
+    auto& s = perf.settings;
+    sys::error_code ec;
+
+    cout << "Connecting " << s.parallel << " channel(s) to " << s.target_id
+         << endl;
+
+    for (size_t i = 0; i < s.parallel; ++i) {
+        perf.channels.push_back(make_unique<Channel>(service));
+        perf.channels.back()->connect(s.target_id, s.secret, yield[ec]);
+
+        if (ec) {
+            cerr << "Failed to connect: " << ec.message() << endl;
+            return perf.stop();
+        }
+    }
+
+    perf.start = Clock::now();
+
+    for (auto& c : perf.channels) {
+        Channel& ch = *c;
+
+        uint32_t hello[2] = { htonl(s.bidir ? FLAG_BIDIR : 0)
+                            , htonl(uint32_t(s.length)) };
+
+        perf.write_frame(ch, HELLO, hello, sizeof(hello), yield, ec);
+        if (ec) return perf.stop();
+
+        asio::spawn(perf.ios, [&perf, &ch] (asio::yield_context yield) {
+                perf.reader(ch, yield);
+            });
+
+        asio::spawn(perf.ios, [&perf, &ch] (asio::yield_context yield) {
+                perf.writer(ch, perf.settings.length, true, yield);
+            });
+    }
+
+    if (!s.bytes) {
+        asio::spawn(perf.ios, [&perf] (asio::yield_context yield) {
+                sys::error_code ec;
+                asio::steady_timer t(perf.ios);
+                t.expires_from_now(perf.settings.duration);
+                t.async_wait(yield[ec]);
+                perf.stop();
+            });
+    }
+
+    perf.report("client", yield);
+}
+
+static void run_server(Perf& perf, Service& service, asio::yield_context yield)
+{
+    cout << "Accepting on port \"" << perf.settings.secret << "\"" << endl;
+
+    asio::spawn(perf.ios, [&perf] (asio::yield_context yield) {
+            perf.report("server", yield);
+        });
+
+    // Destroying the port aborts its pending `open`.
+    auto p = make_unique<CadetPort>(service);
+
+    perf.stop_accepting = [&p] { p.reset(); };
+
+    while (!perf.stopping) {
+        sys::error_code ec;
+        auto ch = make_unique<Channel>(service);
+        p->open(*ch, perf.settings.secret, yield[ec]);
+
+        if (ec || perf.stopping) break;
+
+        perf.channels.push_back(move(ch));
+        Channel& c = *perf.channels.back();
+
+        asio::spawn(perf.ios, [&perf, &c] (asio::yield_context yield) {
+                perf.reader(c, yield);
+            });
+    }
+
+    perf.stop_accepting = nullptr;
+}
+
+//--------------------------------------------------------------------
+static void print_usage(const char* app_name)
+{
+    cerr << "Usage:\n";
+    cerr << "    " << app_name << " <config-file> <secret-phrase> [peer-id] [options]\n";
+    cerr << "If [peer-id] is used the app acts as a client, "
+            "otherwise it acts as a server\n";
+    cerr << "Client options:\n";
+    cerr << "    -P <n>        Number of parallel channels (1)\n";
+    cerr << "    -l <bytes>    Size of each write (16384)\n";
+    cerr << "    -t <seconds>  Duration of the test (10)\n";
+    cerr << "    -n <bytes>    Stop after sending this many bytes instead\n";
+    cerr << "    -d            Bidirectional, the server sends data back too\n";
+    cerr << "    -i <seconds>  Report interval (1)\n";
+}
+
+static bool parse_args(int argc, char* const* argv, Settings& s)
+{
+    vector<string> positional;
+
+    auto seconds = [] (const char* v) {
+        return chrono::duration_cast<Clock::duration>(
+                chrono::duration<double>(stod(v)));
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+
+        if (a == "-d") { s.bidir = true; continue; }
+
+        if (a.size() == 2 && a[0] == '-') {
+            if (++i == argc) return false;
+            const char* v = argv[i];
+
+            switch (a[1]) {
+                case 'P': s.parallel = max<size_t>(1, stoul(v)); break;
+                case 'l': s.length   = max<size_t>(1, stoul(v)); break;
+                case 't': s.duration = seconds(v); break;
+                case 'n': s.bytes    = stoull(v); break;
+                case 'i': s.interval = seconds(v); break;
+                default: return false;
+            }
+            continue;
+        }
+
+        positional.push_back(a);
+    }
+
+    if (positional.size() != 2 && positional.size() != 3) return false;
+
+    s.config = positional[0];
+    s.secret = positional[1];
+    if (positional.size() == 3) s.target_id = positional[2];
+
+    return true;
+}
+
+int main(int argc, char* const* argv)
+{
+    Settings settings;
+
+    try {
+        if (!parse_args(argc, argv, settings)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    catch (const exception&) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    asio::io_service ios;
+
+    Service service(settings.config, ios);
+    Perf perf(ios, settings);
+
+    // Capture these signals so that we can disconnect gracefully.
+    asio::signal_set signals(ios, SIGINT, SIGTERM);
+
+    signals.async_wait([&](sys::error_code, int /* signal_number */) {
+            perf.stop();
+        });
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+
+            service.async_setup(yield[ec]);
+
+            if (ec) {
+                cerr << "Failed to set up gnunet service: " << ec.message() << endl;
+                return;
+            }
+
+            if (!settings.target_id.empty()) {
+                run_client(perf, service, yield);
+            }
+            else {
+                run_server(perf, service, yield);
+            }
+
+            signals.cancel();
+        });
+
+    ios.run();
+}
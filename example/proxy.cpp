@@ -0,0 +1,223 @@
+#include <iostream>
+#include <set>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include <gnunet_channels/service.h>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include <gnunet_channels/splice.h>
+
+using namespace std;
+using namespace gnunet_channels;
+using tcp = asio::ip::tcp;
+
+// What's still running, so that a signal can wind it all down.
+struct Sessions {
+    bool stopping = false;
+    set<Splice*> splices;
+    // Makes the pending accept (TCP or channel) fail.
+    function<void()> stop_accepting;
+
+    void stop() {
+        stopping = true;
+        if (stop_accepting) stop_accepting();
+        for (auto s : splices) s->cancel();
+    }
+};
+
+static void run_session( Sessions& sessions
+                       , size_t id
+                       , tcp::socket& socket
+                       , Channel& channel
+                       , asio::yield_context yield)
+{
+    sys::error_code ec;
+
+    if (sessions.stopping) return;
+
+    Splice splice(socket, channel);
+
+    sessions.splices.insert(&splice);
+    splice.async_run(yield[ec]);
+    sessions.splices.erase(&splice);
+
+    cout << "Session " << id << " ended";
+    if (ec) cout << " (" << ec.message() << ")";
+    cout << ": " << splice.stats() << endl;
+}
+
+// Accepts TCP connections on a local port and forwards each one over
+// its own channel to the peer.
+static void listen( Service& service
+                  , Sessions& sessions
+                  , string secret
+                  , string target_id
+                  , unsigned short port
+                  , asio::yield_context yield)
+{
+    auto& ios = service.get_io_service();
+    sys::error_code ec;
+
+    tcp::acceptor acceptor(ios, tcp::endpoint(tcp::v4(), port));
+
+    sessions.stop_accepting = [&acceptor] { acceptor.close(); };
+
+    cout << "Listening on TCP port " << port << endl;
+
+    for (size_t id = 0;; ++id) {
+        auto socket = make_shared<tcp::socket>(ios);
+        acceptor.async_accept(*socket, yield[ec]);
+
+        if (sessions.stopping) break;
+
+        if (ec) {
+            cerr << "Failed to accept: " << ec.message() << endl;
+            break;
+        }
+
+        asio::spawn(ios, [&service, &sessions, secret, target_id, socket, id]
+                         (asio::yield_context yield) {
+                sys::error_code ec;
+                Channel channel(service);
+                channel.connect(target_id, secret, yield[ec]);
+
+                if (ec) {
+                    cerr << "Session " << id << " failed to connect: "
+                         << ec.message() << endl;
+                    return;
+                }
+
+                run_session(sessions, id, *socket, channel, yield);
+            });
+    }
+
+    sessions.stop_accepting = nullptr;
+}
+
+// Accepts channels and forwards each one to the given TCP endpoint.
+static void forward( Service& service
+                   , Sessions& sessions
+                   , string secret
+                   , string host
+                   , string port
+                   , asio::yield_context yield)
+{
+    auto& ios = service.get_io_service();
+    sys::error_code ec;
+
+    tcp::resolver resolver(ios);
+    auto endpoints = resolver.async_resolve(tcp::resolver::query(host, port), yield[ec]);
+
+    if (ec) {
+        cerr << "Failed to resolve " << host << ": " << ec.message() << endl;
+        return;
+    }
+
+    if (sessions.stopping) return;
+
+    cout << "Accepting on port \"" << secret << "\"" << endl;
+
+    // Destroying the port aborts its pending `open`.
+    auto p = make_unique<CadetPort>(service);
+
+    sessions.stop_accepting = [&p] { p.reset(); };
+
+    for (size_t id = 0;; ++id) {
+        auto channel = make_shared<Channel>(service);
+        p->open(*channel, secret, yield[ec]);
+
+        if (sessions.stopping) break;
+
+        if (ec) {
+            cerr << "Failed to accept: " << ec.message() << endl;
+            break;
+        }
+
+        asio::spawn(ios, [&ios, &sessions, endpoints, channel, id]
+                         (asio::yield_context yield) {
+                sys::error_code ec;
+                tcp::socket socket(ios);
+                asio::async_connect(socket, endpoints, yield[ec]);
+
+                if (ec) {
+                    cerr << "Session " << id << " failed to connect: "
+                         << ec.message() << endl;
+                    return;
+                }
+
+                run_session(sessions, id, socket, *channel, yield);
+            });
+    }
+
+    sessions.stop_accepting = nullptr;
+}
+
+static void print_usage(const char* app_name)
+{
+    cerr << "Usage:\n";
+    cerr << "    " << app_name << " <config-file> <secret-phrase> listen <tcp-port> <peer-id>\n";
+    cerr << "    " << app_name << " <config-file> <secret-phrase> forward <host> <tcp-port>\n";
+    cerr << "In \"listen\" mode each TCP connection to the local port is forwarded\n"
+            "to the peer over a new channel, in \"forward\" mode each accepted\n"
+            "channel is forwarded to <host>:<tcp-port>\n";
+}
+
+int main(int argc, char* const* argv)
+{
+    if (argc != 6) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    string mode   = argv[3];
+    string secret = argv[2];
+
+    if (mode != "listen" && mode != "forward") {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    asio::io_service ios;
+
+    Service service(argv[1], ios);
+
+    Sessions sessions;
+
+    // Capture these signals so that we can disconnect gracefully: nothing
+    // new is accepted and the running sessions are cancelled, which
+    // closes their channels and lets `run` return.
+    asio::signal_set signals(ios, SIGINT, SIGTERM);
+
+    signals.async_wait([&](sys::error_code ec, int /* signal_number */) {
+            if (ec) return;
+            sessions.stop();
+        });
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+
+            service.async_setup(yield[ec]);
+
+            if (ec) {
+                cerr << "Failed to set up gnunet service: " << ec.message() << endl;
+                return signals.cancel();
+            }
+
+            if (sessions.stopping) return;
+
+            if (mode == "listen") {
+                listen(service, sessions, secret, argv[5], stoi(argv[4]), yield);
+            }
+            else {
+                forward(service, sessions, secret, argv[4], argv[5], yield);
+            }
+
+            // No longer accepting, `run` returns once the sessions end.
+            signals.cancel();
+        });
+
+    ios.run();
+}
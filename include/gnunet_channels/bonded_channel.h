@@ -0,0 +1,191 @@
+#pragma once
+
+#include <gnunet_channels/channel.h>
+
+namespace gnunet_channels {
+
+class Service;
+class BondedPort;
+
+// A byte stream striped across several channels to the same (peer, port),
+// so that it isn't limited by a single channel's window and by there being
+// only one send in flight per channel.
+//
+// Each member channel starts with a hello carrying a random bond id, the
+// member's index and the number of members. Writes are then split into
+// stripes of at most `stripe_size` bytes, each prefixed with a sequence
+// number and sent over the member with the fewest bytes in flight. The
+// receiving side puts the stripes back in order.
+//
+// If any of the member channels fails, the whole bond does and the other
+// members are closed.
+//
+// Not thread safe: the handlers of all the member channels work on the
+// bond's state, so use it with an io_service run by a single thread.
+class BondedChannel {
+    struct State;
+
+public:
+    using OnConnect = std::function<void(sys::error_code)>;
+    using OnReceive = std::function<void(sys::error_code, size_t)>;
+    using OnWrite   = std::function<void(sys::error_code, size_t)>;
+
+    static constexpr size_t default_width = 4;
+    static constexpr size_t stripe_size   = 16 * 1024;
+
+public:
+    BondedChannel(Service&, size_t width = default_width);
+
+    BondedChannel(const BondedChannel&) = delete;
+    BondedChannel& operator=(const BondedChannel&) = delete;
+
+    asio::io_service& get_io_service();
+
+    size_t width() const;
+
+    template<class Token>
+    void
+    connect(PeerId, PortHash, Token&&);
+
+    template<class Token>
+    void
+    connect( const std::string& target_id
+           , const std::string& shared_secret
+           , Token&&);
+
+    template< class MutableBufferSequence
+            , class ReadHandler>
+    void async_read_some(const MutableBufferSequence&, ReadHandler&&);
+
+    template< class ConstBufferSequence
+            , class WriteHandler>
+    void async_write_some(const ConstBufferSequence&, WriteHandler&&);
+
+    ~BondedChannel();
+
+private:
+    friend class BondedPort;
+
+    void connect_impl(PeerId, PortHash, OnConnect);
+    void connect_impl( const std::string& target_id
+                     , const std::string& shared_secret
+                     , OnConnect);
+    void receive_impl(std::vector<asio::mutable_buffer>, OnReceive);
+    void write_impl(std::vector<uint8_t>, OnWrite);
+
+private:
+    Service& _service;
+    std::shared_ptr<State> _state;
+};
+
+// Accepts bonds made by BondedChannel::connect. Member channels of
+// different bonds may arrive interleaved, each bond is handed out once
+// all of its members are in.
+class BondedPort {
+    struct Impl;
+
+public:
+    using OnAccept = std::function<void(sys::error_code)>;
+
+public:
+    BondedPort(Service&, PortHash);
+    BondedPort(Service&, const std::string& shared_secret);
+
+    BondedPort(const BondedPort&) = delete;
+    BondedPort& operator=(const BondedPort&) = delete;
+
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code)>::type
+        >::type
+    accept(BondedChannel&, Token&&);
+
+    ~BondedPort();
+
+private:
+    void accept_impl(BondedChannel&, OnAccept);
+
+private:
+    std::shared_ptr<Impl> _impl;
+};
+
+//--------------------------------------------------------------------
+template<class Token>
+void
+BondedChannel::connect(PeerId target_id, PortHash port, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    connect_impl(target_id, port, std::move(handler));
+
+    result.get();
+}
+
+template<class Token>
+void
+BondedChannel::connect( const std::string& target_id
+                      , const std::string& shared_secret
+                      , Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    connect_impl(target_id, shared_secret, std::move(handler));
+
+    result.get();
+}
+
+template< class MutableBufferSequence
+        , class ReadHandler>
+void BondedChannel::async_read_some( const MutableBufferSequence& bufs
+                                   , ReadHandler&& h)
+{
+    using namespace std;
+
+    vector<asio::mutable_buffer> bs(distance(bufs.begin(), bufs.end()));
+    copy(bufs.begin(), bufs.end(), bs.begin());
+
+    receive_impl(move(bs), forward<ReadHandler>(h));
+}
+
+template< class ConstBufferSequence
+        , class WriteHandler>
+void BondedChannel::async_write_some( const ConstBufferSequence& bufs
+                                    , WriteHandler&& h)
+{
+    using namespace std;
+
+    vector<uint8_t> data(asio::buffer_size(bufs));
+    asio::buffer_copy(asio::buffer(data), bufs);
+
+    write_impl(move(data), forward<WriteHandler>(h));
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code)>::type
+    >::type
+BondedPort::accept(BondedChannel& ch, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    accept_impl(ch, std::move(handler));
+
+    return result.get();
+}
+
+} // gnunet_channels namespace
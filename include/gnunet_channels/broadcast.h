@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <gnunet_channels/channel.h>
+
+namespace gnunet_channels {
+
+// Sends one immutable payload to many channels. Unlike calling
+// async_write_some on each of them, the payload isn't copied per channel
+// (only into each channel's envelopes, which is unavoidable) and all the
+// channels which aren't busy sending get their envelopes built in a single
+// post to GNUnet's thread. Channels which are still sending queue the
+// shared payload like any other write.
+//
+// The handler receives one error code per channel, in the order the
+// channels were given. It's executed in the strand of one of the
+// channels. There must be at least one channel and they all must stay
+// alive until the handler is called.
+class Broadcast {
+public:
+    using Payload = std::shared_ptr<const std::vector<uint8_t>>;
+    using OnSent  = std::function<void(std::vector<sys::error_code>)>;
+
+    template<class Token>
+    static
+    typename asio::async_result
+        < typename asio::handler_type< Token
+                                     , void(std::vector<sys::error_code>)
+                                     >::type
+        >::type
+    async_send(const std::vector<Channel*>&, Payload, Token&&);
+
+private:
+    static void send_impl(const std::vector<Channel*>&, Payload, OnSent);
+};
+
+//--------------------------------------------------------------------
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type< Token
+                                 , void(std::vector<sys::error_code>)
+                                 >::type
+    >::type
+Broadcast::async_send( const std::vector<Channel*>& channels
+                     , Payload payload
+                     , Token&& token)
+{
+    using Handler = typename asio::handler_type
+                        < Token
+                        , void(std::vector<sys::error_code>)
+                        >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    send_impl(channels, std::move(payload), std::move(handler));
+
+    return result.get();
+}
+
+} // gnunet_channels namespace
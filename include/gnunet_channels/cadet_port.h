@@ -9,7 +9,10 @@ namespace gnunet_channels {
 
 class Service;
 class ChannelImpl;
+class ProcessPool;
 
+// May be used with an io_service run by several threads, the accept
+// handlers are executed in the port's strand.
 class CadetPort {
     struct Impl;
 
@@ -23,6 +26,12 @@ public:
     CadetPort(const CadetPort&)            = delete;
     CadetPort& operator=(const CadetPort&) = delete;
 
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code)>::type
+        >::type
+    open(Channel&, PortHash, Token&&);
+
     template<class Token>
     typename asio::async_result
         < typename asio::handler_type<Token, void(sys::error_code)>::type
@@ -35,7 +44,13 @@ public:
     ~CadetPort();
 
 private:
+    friend class BondedPort;
+    friend class ProcessPool;
+    friend class ResumablePort;
+
+    void open_impl(Channel&, PortHash, OnAccept);
     void open_impl(Channel&, const std::string& shared_secret, OnAccept);
+    static void do_open(std::shared_ptr<Impl>, Channel&, PortHash, OnAccept);
 
     static
     void* channel_incoming( void *cls
@@ -48,6 +63,24 @@ private:
 };
 
 //--------------------------------------------------------------------
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code)>::type
+    >::type
+CadetPort::open(Channel& ch, PortHash port, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    open_impl(ch, port, std::move(handler));
+
+    return result.get();
+}
+
 template<class Token>
 typename asio::async_result
     < typename asio::handler_type<Token, void(sys::error_code)>::type
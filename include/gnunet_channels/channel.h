@@ -1,10 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/buffers_iterator.hpp>
 #include <gnunet_channels/namespaces.h>
+#include <gnunet_channels/deadlines.h>
+#include <gnunet_channels/peer_id.h>
+#include <gnunet_channels/rate_limit.h>
+#include <gnunet_channels/stats.h>
 
 struct GNUNET_CADET_Channel;
 
@@ -15,12 +20,54 @@ class ChannelImpl;
 class Scheduler;
 class Service;
 class CadetPort;
+class Splice;
+class BondedChannel;
+class Broadcast;
+class RpcClient;
+class RpcServer;
+
+namespace detail {
+    // Holds an rvalue DynamicBuffer (e.g. dynamic_string_buffer, itself a
+    // cheap reference to the string) by value and an lvalue one (e.g. a
+    // streambuf, which can't be copied) by reference.
+    template<class B> struct DynamicBufferRef {
+        static DynamicBufferRef make(B&& b) { return {std::move(b)}; }
+        B& get() { return b; }
+        B b;
+    };
+
+    template<class B> struct DynamicBufferRef<B&> {
+        static DynamicBufferRef make(B& b) { return {&b}; }
+        B& get() { return *b; }
+        B* b;
+    };
+
+    // Appends as much of the given bytes as fits, returns how many did.
+    template<class DynamicBuffer>
+    std::function<size_t(asio::const_buffer)> append_to(DynamicBuffer&& buffer)
+    {
+        auto ref = DynamicBufferRef<DynamicBuffer>::make(std::forward<DynamicBuffer>(buffer));
+
+        return [ref] (asio::const_buffer in) mutable {
+            auto& b = ref.get();
+            size_t n = std::min(asio::buffer_size(in), b.max_size() - b.size());
+            size_t copied = asio::buffer_copy(b.prepare(n), in);
+            b.commit(copied);
+            return copied;
+        };
+    }
+} // detail namespace
 
 class Channel {
 public:
     using OnConnect = std::function<void(sys::error_code)>;
     using OnReceive = std::function<void(sys::error_code, size_t)>;
     using OnWrite   = std::function<void(sys::error_code, size_t)>;
+    using OnTake    = std::function<void(sys::error_code, std::vector<uint8_t>)>;
+    using OnWait    = std::function<void(sys::error_code)>;
+    using Views     = std::vector<asio::const_buffer>;
+    using OnPeek    = std::function<void(sys::error_code, Views)>;
+    using Append    = std::function<size_t(asio::const_buffer)>;
 
 public:
     Channel(Service&);
@@ -35,9 +82,39 @@ public:
 
     asio::io_service& get_io_service();
 
+    // Cheap snapshot of the channel's counters. Must be called from the
+    // thread running the io_service.
+    ChannelStats stats() const;
+
+    // When several channels of the same Service send at once, each gets
+    // a share of the bandwidth proportional to its weight (1 by default).
+    // Large writes are interleaved with other channels' writes instead of
+    // delaying them until done.
+    void set_send_weight(uint32_t);
+
+    // Operations waiting longer than these complete with `timed_out`. The
+    // deadlines of all channels of a Service are kept in one timer wheel
+    // with a resolution of 10ms, so setting them up for every operation
+    // is cheap. A write which timed out may still be sent unless the
+    // channel is closed (see Deadlines::close). May be changed at any
+    // time, pending operations then count from the change.
+    void set_deadlines(Deadlines);
+
+    // Optional token bucket limits of this channel's bandwidth (see also
+    // Service::set_send_limit). May be changed at any time.
+    void set_send_limit(RateLimit);
+    void set_receive_limit(RateLimit);
+
     template<class Token>
     void
-    connect( std::string target_id
+    connect(PeerId, PortHash, Token&&);
+
+    // Same as above, but parses the target id and hashes the secret first.
+    // Results of both are cached, so repeatedly connecting to the same
+    // (peer, port) doesn't pay for the decoding again.
+    template<class Token>
+    void
+    connect( const std::string& target_id
            , const std::string& shared_secret
            , Token&&);
 
@@ -45,21 +122,148 @@ public:
             , class ReadHandler>
     void async_read_some(const MutableBufferSequence&, ReadHandler&&);
 
+    // Sends the whole file. It's mapped into memory and copied from there
+    // straight into the envelopes, only a few at a time as the channel's
+    // window lets them through. Completes with the number of bytes sent.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+        >::type
+    async_send_file(const std::string& path, Token&&);
+
+    // Same as above for a region the caller has mapped (or otherwise owns).
+    // It's not copied up front, `keepalive` is released once all of it is
+    // in envelopes.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+        >::type
+    async_send_mapped( asio::const_buffer
+                     , std::shared_ptr<const void> keepalive
+                     , Token&&);
+
+    // Receives exactly `size` bytes into the file at `path` (created or
+    // truncated). The file is mapped and the received data copied straight
+    // into it. Completes with the number of bytes received.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+        >::type
+    async_receive_file(const std::string& path, uint64_t size, Token&&);
+
     template< class ConstBufferSequence
             , class WriteHandler>
     void async_write_some(const ConstBufferSequence&, WriteHandler&&);
 
+    // Readiness waits for reactor style code (protocol state machines,
+    // proxies) which doesn't want to commit a buffer in advance. They
+    // complete once received data is buffered, resp. once a write would
+    // be taken without queueing behind another one, and don't consume
+    // anything. Only one wait of each kind may be pending.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code)>::type
+        >::type
+    async_wait_readable(Token&&);
+
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code)>::type
+        >::type
+    async_wait_writable(Token&&);
+
+    // Non-blocking counterparts of async_read_some and async_write_some,
+    // done right away without a trip through the io_service. Reading
+    // drains as much of the buffered data as fits, writing takes all of
+    // the data unless another write is in progress. Otherwise they fail
+    // with `would_block`. These don't go through the channel's strand, so
+    // call them from the io_service's thread if it has only one, or from
+    // this channel's handlers.
+    template<class MutableBufferSequence>
+    size_t try_read_some(const MutableBufferSequence&, sys::error_code&);
+
+    template<class ConstBufferSequence>
+    size_t try_write_some(const ConstBufferSequence&, sys::error_code&);
+
+    // Borrowed, read-only views of the received data buffered in the
+    // channel (one per CADET message), for parsers which only look at
+    // headers or forward the bytes elsewhere and shouldn't pay for a copy.
+    // `async_peek` completes once there is at least one view. The views
+    // stay valid until the data is released by `consume` (from the front)
+    // or by any read or take; data which arrives later only adds views.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code, Views)>::type
+        >::type
+    async_peek(Token&&);
+
+    // Same as above without waiting, empty if nothing is buffered. Like
+    // try_read_some, and so is `consume`, to be called from the
+    // io_service's only thread or from this channel's handlers.
+    Views peek() const;
+    void consume(size_t);
+
+    // Appends received data straight to a DynamicBuffer (streambuf,
+    // dynamic_string_buffer, dynamic_vector_buffer...): once anything is
+    // buffered, everything that is gets appended in one step, without the
+    // intermediate buffer sequence and post of async_read_some. Completes
+    // with the number of bytes appended, or `no_buffer_space` if the
+    // DynamicBuffer is at its max_size.
+    template<class DynamicBuffer, class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+        >::type
+    async_read_into(DynamicBuffer&&, Token&&);
+
+    // Like asio::async_read_until, but the delimiter is looked for in the
+    // received messages as they are appended (stopping after the one
+    // containing it). Completes with the size of the DynamicBuffer's data
+    // up to and including the delimiter, or with `not_found` if it filled
+    // up before one was seen.
+    template<class DynamicBuffer, class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+        >::type
+    async_read_until(DynamicBuffer&&, const std::string& delimiter, Token&&);
+
     ~Channel();
 
 private:
     friend class ::gnunet_channels::CadetPort;
+    friend class ::gnunet_channels::Splice;
+    friend class ::gnunet_channels::BondedChannel;
+    friend class ::gnunet_channels::Broadcast;
+    friend class ::gnunet_channels::RpcClient;
+    friend class ::gnunet_channels::RpcServer;
 
-    void connect_impl( std::string target_id
+    void connect_impl(PeerId, PortHash, OnConnect);
+    void connect_impl( const std::string& target_id
                      , const std::string& shared_secret
                      , OnConnect);
 
     void receive_impl(std::vector<asio::mutable_buffer>, OnReceive);
     void write_impl(std::vector<uint8_t>, OnWrite);
+    void take_impl(OnTake);
+    void send_file_impl(const std::string& path, OnWrite);
+    void send_mapped_impl(asio::const_buffer, std::shared_ptr<const void>, OnWrite);
+    void receive_file_impl(const std::string& path, uint64_t size, OnReceive);
+    void wait_readable_impl(OnWait);
+    void wait_writable_impl(OnWait);
+    size_t try_read_impl(asio::mutable_buffer, sys::error_code&);
+    bool can_write(sys::error_code&) const;
+    size_t try_write_impl(std::vector<uint8_t>, sys::error_code&);
+    void peek_impl(OnPeek);
+    void read_into_impl(Append, OnReceive);
+    // `tail` is the end of what the DynamicBuffer (of `size` bytes)
+    // already holds, in case the delimiter started there.
+    void read_until_impl( Append
+                        , std::string delimiter
+                        , std::string tail
+                        , size_t size
+                        , OnReceive);
+
+    // Returns a (possibly recycled) buffer of the given size.
+    std::vector<uint8_t> acquire_buffer(size_t);
 
     ChannelImpl* get_impl() { return _impl.get(); }
     void set_impl(std::shared_ptr<ChannelImpl>);
@@ -73,7 +277,23 @@ private:
 //--------------------------------------------------------------------
 template<class Token>
 void
-Channel::connect( std::string target_id
+Channel::connect(PeerId target_id, PortHash port, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    connect_impl(target_id, port, std::move(handler));
+
+    result.get();
+}
+
+template<class Token>
+void
+Channel::connect( const std::string& target_id
                 , const std::string& shared_secret
                 , Token&& token)
 {
@@ -84,7 +304,7 @@ Channel::connect( std::string target_id
     Handler handler(std::forward<Token>(token));
     asio::async_result<Handler> result(handler);
 
-    connect_impl(std::move(target_id), shared_secret, std::move(handler));
+    connect_impl(target_id, shared_secret, std::move(handler));
 
     result.get();
 }
@@ -119,10 +339,219 @@ void Channel::async_write_some( const ConstBufferSequence& bufs
 
     // TODO: We could avoid one buffer copy if we put the data directly
     // into GNUNET_MQ_Envelope here.
-    vector<uint8_t> data(asio::buffer_size(bufs));
+    auto data = acquire_buffer(asio::buffer_size(bufs));
     asio::buffer_copy(asio::buffer(data), bufs);
 
     write_impl(move(data), forward<WriteHandler>(h));
 }
 
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code)>::type
+    >::type
+Channel::async_wait_readable(Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    wait_readable_impl(std::move(handler));
+
+    return result.get();
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code)>::type
+    >::type
+Channel::async_wait_writable(Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    wait_writable_impl(std::move(handler));
+
+    return result.get();
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code, Channel::Views)>::type
+    >::type
+Channel::async_peek(Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code, Views)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    peek_impl(std::move(handler));
+
+    return result.get();
+}
+
+template<class DynamicBuffer, class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+    >::type
+Channel::async_read_into(DynamicBuffer&& buffer, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code, size_t)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    read_into_impl( detail::append_to(std::forward<DynamicBuffer>(buffer))
+                  , std::move(handler));
+
+    return result.get();
+}
+
+template<class DynamicBuffer, class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+    >::type
+Channel::async_read_until( DynamicBuffer&& buffer
+                         , const std::string& delim
+                         , Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code, size_t)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    // The delimiter may already be in what was appended before.
+    auto data  = buffer.data();
+    auto begin = asio::buffers_begin(data);
+    auto end   = asio::buffers_end(data);
+    auto i     = std::search(begin, end, delim.begin(), delim.end());
+
+    if (delim.empty() || i != end) {
+        size_t n = (i - begin) + delim.size();
+        _ios.post([h = std::move(handler), n] () mutable {
+                h(sys::error_code(), n);
+            });
+    }
+    else {
+        size_t size = end - begin;
+        size_t keep = std::min(size, delim.size() - 1);
+        std::string tail(end - keep, end);
+
+        read_until_impl( detail::append_to(std::forward<DynamicBuffer>(buffer))
+                       , delim
+                       , std::move(tail)
+                       , size
+                       , std::move(handler));
+    }
+
+    return result.get();
+}
+
+template<class MutableBufferSequence>
+size_t Channel::try_read_some( const MutableBufferSequence& bufs
+                             , sys::error_code& ec)
+{
+    ec = sys::error_code();
+    size_t n = 0;
+
+    for (auto i = bufs.begin(); i != bufs.end(); ++i) {
+        asio::mutable_buffer b(*i);
+        size_t size = asio::buffer_size(b);
+
+        if (size == 0) continue;
+
+        size_t m = try_read_impl(b, ec);
+        n += m;
+
+        if (m < size) break;
+    }
+
+    // Having read something is a success even if the queue ran dry.
+    if (n) ec = sys::error_code();
+
+    return n;
+}
+
+template<class ConstBufferSequence>
+size_t Channel::try_write_some( const ConstBufferSequence& bufs
+                              , sys::error_code& ec)
+{
+    // Checked first so that a busy channel doesn't cost a copy.
+    if (!can_write(ec)) return 0;
+
+    auto data = acquire_buffer(asio::buffer_size(bufs));
+    asio::buffer_copy(asio::buffer(data), bufs);
+
+    return try_write_impl(std::move(data), ec);
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+    >::type
+Channel::async_send_file(const std::string& path, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code, size_t)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    send_file_impl(path, std::move(handler));
+
+    return result.get();
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+    >::type
+Channel::async_send_mapped( asio::const_buffer region
+                          , std::shared_ptr<const void> keepalive
+                          , Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code, size_t)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    send_mapped_impl(region, std::move(keepalive), std::move(handler));
+
+    return result.get();
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code, size_t)>::type
+    >::type
+Channel::async_receive_file(const std::string& path, uint64_t size, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code, size_t)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    receive_file_impl(path, size, std::move(handler));
+
+    return result.get();
+}
+
 } // gnunet_channels namespace
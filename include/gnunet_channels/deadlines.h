@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+
+namespace gnunet_channels {
+
+// See Channel::set_deadlines. Zero means no deadline.
+struct Deadlines {
+    using Duration = std::chrono::steady_clock::duration;
+
+    // How long a read (async_read_some, async_take, async_wait_readable,
+    // async_peek...) may wait for data.
+    Duration read = Duration(0);
+
+    // How long a write may take to be handed to CADET (once it's no longer
+    // queued behind other writes of the channel), or async_wait_writable
+    // may wait.
+    Duration write = Duration(0);
+
+    // How long the channel may go without sending or receiving anything.
+    // Fails whatever is pending.
+    Duration idle = Duration(0);
+
+    // Close the channel when an operation timed out (or the channel was
+    // idle for too long), rather than just failing the operation.
+    bool close = false;
+};
+
+} // gnunet_channels namespace
@@ -13,6 +13,7 @@ namespace gnunet_channels { namespace error {
         cant_create_pipes,
         invalid_target_id,
         failed_to_open_port,
+        malformed_frame,
     };
     
     struct category : public boost::system::error_category
@@ -33,6 +34,8 @@ namespace gnunet_channels { namespace error {
                     return "invalid target id";
                 case error::failed_to_open_port:
                     return "failed to open port";
+                case error::malformed_frame:
+                    return "malformed frame";
                 default:
                     return "unknown gnunet_channels error";
             }
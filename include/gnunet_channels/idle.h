@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+
+namespace gnunet_channels {
+
+// Reclamation of idle channels, see Service::set_idle_options. Zero
+// disables each of them.
+struct IdleOptions {
+    using Duration = std::chrono::steady_clock::duration;
+
+    // Close channels which didn't send or receive anything (keepalive
+    // probes from the other side included) for this long. Pending
+    // operations complete with `timed_out`.
+    Duration timeout = Duration(0);
+
+    // Send a probe on channels which didn't send anything for this long,
+    // so that the other side knows we're still there. Probes are dropped
+    // by the receiving channel, the application never sees them, but
+    // both sides need a version of this library which knows about them.
+    // With probes on both sides, `timeout` only closes channels whose
+    // other side went away without CADET noticing.
+    Duration keepalive = Duration(0);
+
+    // Maximum number of channels open in the Service at once. Opening
+    // another one closes the channel which least recently sent or
+    // received data, its pending operations complete with
+    // `operation_aborted`.
+    size_t max_channels = 0;
+};
+
+} // gnunet_channels namespace
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+
+namespace gnunet_channels {
+
+// Parameters of the in-process stand-in for CADET, see the Service
+// constructor taking these. Channels created on such a service are routed
+// (by port only, the target peer id is ignored) to ports opened on the same
+// service, so no GNUnet peer needs to be running. Other services, even in
+// the same process, can't be reached.
+struct LoopbackOptions {
+    // One way delay of every message, channel request and ack.
+    std::chrono::microseconds latency{0};
+
+    // Bytes per second of the simulated tunnel shared by all channels,
+    // zero means unlimited.
+    uint64_t bandwidth = 0;
+
+    // Number of messages a channel may have in flight before the receiving
+    // side calls receive_done.
+    unsigned window = 64;
+};
+
+} // gnunet_channels namespace
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <boost/system/error_code.hpp>
+#include <gnunet_channels/namespaces.h>
+
+namespace gnunet_channels {
+
+// Identity of a peer (its EdDSA public key). Parsing and validation happen
+// once, in `from_string`, after that the value can be copied around freely
+// and handed to `Channel::connect` without any further decoding.
+class PeerId {
+public:
+    using Bytes = std::array<uint8_t, 32>;
+
+public:
+    PeerId() = default;
+    explicit PeerId(const Bytes& bytes) : _bytes(bytes) {}
+
+    // Parses the string form as returned by `Service::identity()`.
+    static PeerId from_string(const std::string&, sys::error_code&);
+    static PeerId from_string(const std::string&);
+
+    std::string to_string() const;
+
+    const Bytes& bytes() const { return _bytes; }
+
+    bool operator==(const PeerId& o) const { return _bytes == o._bytes; }
+    bool operator!=(const PeerId& o) const { return _bytes != o._bytes; }
+    bool operator< (const PeerId& o) const { return _bytes <  o._bytes; }
+
+private:
+    Bytes _bytes{};
+};
+
+// Hash of a shared secret identifying a CADET port.
+class PortHash {
+public:
+    using Bytes = std::array<uint8_t, 64>;
+
+public:
+    PortHash() = default;
+    explicit PortHash(const Bytes& bytes) : _bytes(bytes) {}
+
+    static PortHash from_secret(const std::string&);
+
+    const Bytes& bytes() const { return _bytes; }
+
+    bool operator==(const PortHash& o) const { return _bytes == o._bytes; }
+    bool operator!=(const PortHash& o) const { return _bytes != o._bytes; }
+    bool operator< (const PortHash& o) const { return _bytes <  o._bytes; }
+
+private:
+    Bytes _bytes{};
+};
+
+} // gnunet_channels namespace
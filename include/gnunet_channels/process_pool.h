@@ -0,0 +1,228 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/buffer.hpp>
+#include <gnunet_channels/namespaces.h>
+
+namespace gnunet_channels {
+
+class PoolChannel;
+
+struct ProcessPoolOptions {
+    // Channels each worker may have open at once (accepted and connected
+    // together). Further accepted channels are closed right away, further
+    // connects fail with `no_buffer_space`.
+    size_t slots_per_worker = 64;
+
+    // Size of each of the two shared memory rings of every slot, rounded
+    // up to a power of two.
+    size_t ring_size = 256 * 1024;
+};
+
+// GNUnet allows only one node per process, so a Service (and its Scheduler
+// thread) can't use more than one core for GNUnet's work. This front end
+// forks one worker process per config, each running its own Service, and
+// hands out PoolChannels whose data is exchanged with the workers through
+// shared memory rings. The processes wake each other up over a socket pair
+// only when a ring they were waiting on changed.
+//
+// Each worker is a peer of its own. Connects are given to the worker with
+// the fewest open channels; for accepting, `listen` opens the port on all
+// workers and `async_accept` hands out whatever arrives on any of them, so
+// remote peers should spread their connects over `identities()`.
+//
+// The pool must be started before anything else in this process starts
+// GNUnet (e.g. a Service is set up), since forking a process with GNUnet
+// threads running isn't safe. Not thread safe, all calls and handlers run
+// in the given io_service.
+class ProcessPool {
+    struct Impl;
+    class WorkerProcess;
+
+public:
+    using OnStart  = std::function<void(sys::error_code)>;
+    using OnAccept = std::function<void(sys::error_code)>;
+
+public:
+    ProcessPool( asio::io_service&
+               , std::vector<std::string> configs
+               , ProcessPoolOptions = ProcessPoolOptions());
+
+    ProcessPool(const ProcessPool&) = delete;
+    ProcessPool& operator=(const ProcessPool&) = delete;
+
+    asio::io_service& get_io_service() { return _ios; }
+
+    // Forks the workers and completes once all of them have set up their
+    // Service, or as soon as one of them failed to.
+    template<class Token>
+    void async_start(Token&&);
+
+    size_t size() const;
+
+    // Peer ids of the workers, valid after `async_start`.
+    std::vector<std::string> identities() const;
+
+    // Number of channels open in each worker.
+    std::vector<size_t> load() const;
+
+    // Opens the port on every worker. Channels arriving on it are queued
+    // until taken by `async_accept`.
+    void listen(const std::string& shared_secret);
+
+    template<class Token>
+    void async_accept(PoolChannel&, Token&&);
+
+    // Asks the workers to close their channels and exit, and waits for
+    // them. Pending operations complete with `operation_aborted`.
+    void stop();
+
+    ~ProcessPool();
+
+private:
+    friend class PoolChannel;
+
+    void start_impl(OnStart);
+    void accept_impl(PoolChannel&, OnAccept);
+
+private:
+    asio::io_service& _ios;
+    std::shared_ptr<Impl> _impl;
+};
+
+// A channel owned by one of the pool's workers. Same stream interface as
+// Channel, reads and writes complete as soon as the worker's rings have
+// data or space and don't wait for CADET.
+class PoolChannel {
+public:
+    struct State;
+
+    using OnConnect = std::function<void(sys::error_code)>;
+    using OnReceive = std::function<void(sys::error_code, size_t)>;
+    using OnWrite   = std::function<void(sys::error_code, size_t)>;
+
+public:
+    PoolChannel(ProcessPool&);
+
+    PoolChannel(const PoolChannel&) = delete;
+    PoolChannel& operator=(const PoolChannel&) = delete;
+
+    asio::io_service& get_io_service();
+
+    // Index of the worker the channel lives in.
+    size_t worker() const;
+
+    template<class Token>
+    void
+    connect( const std::string& target_id
+           , const std::string& shared_secret
+           , Token&&);
+
+    template< class MutableBufferSequence
+            , class ReadHandler>
+    void async_read_some(const MutableBufferSequence&, ReadHandler&&);
+
+    template< class ConstBufferSequence
+            , class WriteHandler>
+    void async_write_some(const ConstBufferSequence&, WriteHandler&&);
+
+    void close();
+
+    ~PoolChannel();
+
+private:
+    friend class ProcessPool;
+
+    void connect_impl( const std::string& target_id
+                     , const std::string& shared_secret
+                     , OnConnect);
+    void receive_impl(std::vector<asio::mutable_buffer>, OnReceive);
+    void write_impl(std::vector<asio::const_buffer>, OnWrite);
+
+private:
+    asio::io_service& _ios;
+    std::shared_ptr<ProcessPool::Impl> _pool;
+    std::shared_ptr<State> _state;
+};
+
+//--------------------------------------------------------------------
+template<class Token>
+void ProcessPool::async_start(Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    start_impl(std::move(handler));
+
+    result.get();
+}
+
+template<class Token>
+void ProcessPool::async_accept(PoolChannel& ch, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    accept_impl(ch, std::move(handler));
+
+    result.get();
+}
+
+template<class Token>
+void
+PoolChannel::connect( const std::string& target_id
+                    , const std::string& shared_secret
+                    , Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    connect_impl(target_id, shared_secret, std::move(handler));
+
+    result.get();
+}
+
+// Data is copied straight between the buffers and the shared memory.
+template< class MutableBufferSequence
+        , class ReadHandler>
+void PoolChannel::async_read_some( const MutableBufferSequence& bufs
+                                 , ReadHandler&& h)
+{
+    using namespace std;
+
+    vector<asio::mutable_buffer> bs(distance(bufs.begin(), bufs.end()));
+    copy(bufs.begin(), bufs.end(), bs.begin());
+
+    receive_impl(move(bs), forward<ReadHandler>(h));
+}
+
+template< class ConstBufferSequence
+        , class WriteHandler>
+void PoolChannel::async_write_some( const ConstBufferSequence& bufs
+                                  , WriteHandler&& h)
+{
+    using namespace std;
+
+    vector<asio::const_buffer> bs(distance(bufs.begin(), bufs.end()));
+    copy(bufs.begin(), bufs.end(), bs.begin());
+
+    write_impl(move(bs), forward<WriteHandler>(h));
+}
+
+} // gnunet_channels namespace
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace gnunet_channels {
+
+// Token bucket parameters, see Channel::set_send_limit and friends.
+struct RateLimit {
+    // Sustained rate, zero means unlimited.
+    uint64_t bytes_per_second = 0;
+
+    // How many bytes may go through at once after a period of inactivity.
+    // Zero picks 64 KiB.
+    uint64_t burst = 0;
+};
+
+} // gnunet_channels namespace
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <chrono>
+#include <gnunet_channels/channel.h>
+
+namespace gnunet_channels {
+
+class Service;
+class ResumablePort;
+
+struct ResumableOptions {
+    using Duration = std::chrono::steady_clock::duration;
+
+    // Bytes written but not yet acknowledged by the other side, kept for
+    // resending after a reconnect. Writes wait for acknowledgements once
+    // this is full.
+    size_t replay_buffer = 1024 * 1024;
+
+    // The connecting side waits this long before the first attempt to
+    // reconnect, twice as long before the next one and so on, and gives
+    // up after `max_attempts`.
+    Duration reconnect_delay = std::chrono::milliseconds(100);
+    size_t max_attempts = 8;
+
+    // How long the accepting side waits for the other one to reconnect.
+    Duration resume_timeout = std::chrono::seconds(30);
+};
+
+// A byte stream which survives its CADET channel being ended (e.g. when
+// the tunnel is rebuilt). The connecting side then reconnects to the same
+// (peer, port) on its own and both sides carry on where they stopped;
+// pending reads and writes don't see the failure. Only when reconnecting
+// doesn't succeed (see ResumableOptions) do they fail, with the error of
+// the last channel.
+//
+// Each channel starts with a hello carrying a random session id and the
+// number of bytes received so far, which tells the other side where to
+// resume from. The data is sent in frames, and each side acknowledges
+// what it received every so often, so that the other one can drop it
+// from its replay buffer. Both sides must use ResumableChannel.
+//
+// Not thread safe, use from the io_service's thread (or a strand).
+class ResumableChannel {
+    struct State;
+
+public:
+    using OnConnect = std::function<void(sys::error_code)>;
+    using OnReceive = std::function<void(sys::error_code, size_t)>;
+    using OnWrite   = std::function<void(sys::error_code, size_t)>;
+
+public:
+    ResumableChannel(Service&, ResumableOptions = ResumableOptions());
+
+    ResumableChannel(const ResumableChannel&) = delete;
+    ResumableChannel& operator=(const ResumableChannel&) = delete;
+
+    asio::io_service& get_io_service();
+
+    // Number of times the stream was resumed on a new channel.
+    size_t resumes() const;
+
+    template<class Token>
+    void
+    connect(PeerId, PortHash, Token&&);
+
+    template<class Token>
+    void
+    connect( const std::string& target_id
+           , const std::string& shared_secret
+           , Token&&);
+
+    template< class MutableBufferSequence
+            , class ReadHandler>
+    void async_read_some(const MutableBufferSequence&, ReadHandler&&);
+
+    // Completes once the data is in the replay buffer, which may take only
+    // part of it.
+    template< class ConstBufferSequence
+            , class WriteHandler>
+    void async_write_some(const ConstBufferSequence&, WriteHandler&&);
+
+    // Tells the other side we're done (its reads then end with `eof`)
+    // and closes the channel. Also done by the destructor.
+    void close();
+
+    // Ends the current CADET channel as if CADET did, for testing.
+    void drop_channel();
+
+    ~ResumableChannel();
+
+private:
+    friend class ResumablePort;
+
+    void connect_impl(PeerId, PortHash, OnConnect);
+    void connect_impl( const std::string& target_id
+                     , const std::string& shared_secret
+                     , OnConnect);
+    void receive_impl(std::vector<asio::mutable_buffer>, OnReceive);
+    void write_impl(std::vector<asio::const_buffer>, OnWrite);
+
+private:
+    Service& _service;
+    std::shared_ptr<State> _state;
+};
+
+// Accepts streams made by ResumableChannel::connect, and hands channels
+// reconnecting to a stream accepted before to that stream.
+class ResumablePort {
+    struct Impl;
+
+public:
+    using OnAccept = std::function<void(sys::error_code)>;
+
+public:
+    ResumablePort(Service&, PortHash);
+    ResumablePort(Service&, const std::string& shared_secret);
+
+    ResumablePort(const ResumablePort&) = delete;
+    ResumablePort& operator=(const ResumablePort&) = delete;
+
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code)>::type
+        >::type
+    accept(ResumableChannel&, Token&&);
+
+    ~ResumablePort();
+
+private:
+    void accept_impl(ResumableChannel&, OnAccept);
+
+private:
+    std::shared_ptr<Impl> _impl;
+};
+
+//--------------------------------------------------------------------
+template<class Token>
+void
+ResumableChannel::connect(PeerId target_id, PortHash port, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    connect_impl(target_id, port, std::move(handler));
+
+    result.get();
+}
+
+template<class Token>
+void
+ResumableChannel::connect( const std::string& target_id
+                         , const std::string& shared_secret
+                         , Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    connect_impl(target_id, shared_secret, std::move(handler));
+
+    result.get();
+}
+
+template< class MutableBufferSequence
+        , class ReadHandler>
+void ResumableChannel::async_read_some( const MutableBufferSequence& bufs
+                                      , ReadHandler&& h)
+{
+    using namespace std;
+
+    vector<asio::mutable_buffer> bs(distance(bufs.begin(), bufs.end()));
+    copy(bufs.begin(), bufs.end(), bs.begin());
+
+    receive_impl(move(bs), forward<ReadHandler>(h));
+}
+
+template< class ConstBufferSequence
+        , class WriteHandler>
+void ResumableChannel::async_write_some( const ConstBufferSequence& bufs
+                                       , WriteHandler&& h)
+{
+    using namespace std;
+
+    vector<asio::const_buffer> bs(distance(bufs.begin(), bufs.end()));
+    copy(bufs.begin(), bufs.end(), bs.begin());
+
+    write_impl(move(bs), forward<WriteHandler>(h));
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code)>::type
+    >::type
+ResumablePort::accept(ResumableChannel& ch, Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    accept_impl(ch, std::move(handler));
+
+    return result.get();
+}
+
+} // gnunet_channels namespace
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <gnunet_channels/channel.h>
+
+namespace gnunet_channels {
+
+// Request/response calls over a Channel. Every request and response is
+// sent as one frame (a length, the call id and whether it's a request or
+// a response, followed by the payload), so any number of calls can be
+// outstanding on a channel at once and the responses may come back in any
+// order.
+//
+// The channel must outlive the client/server and shouldn't be read from or
+// written to by anything else while they exist. Their reads would otherwise
+// stay pending on it, so they close the channel when destroyed, or when the
+// peer sends something which isn't a frame they expect.
+//
+// The io_service may be run by any number of threads, the client completes
+// its calls in a strand of its own. A client or a server is still to be
+// used by one thread (or strand) at a time, like the channel itself.
+class RpcClient {
+    struct State;
+
+public:
+    using Payload  = std::vector<uint8_t>;
+    using Duration = std::chrono::steady_clock::duration;
+    using OnReply  = std::function<void(sys::error_code, Payload)>;
+
+public:
+    RpcClient(Channel&);
+
+    RpcClient(const RpcClient&) = delete;
+    RpcClient& operator=(const RpcClient&) = delete;
+
+    // Completes with asio::error::timed_out if no response arrives within
+    // `timeout`, a late response is then dropped.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code, Payload)>::type
+        >::type
+    async_call(Payload request, Duration timeout, Token&&);
+
+    // Not synchronized with the calls' completions: call it once they
+    // completed, or from the io_service's thread if it's run by one thread
+    // only.
+    size_t outstanding() const;
+
+    // Pending calls complete with asio::error::operation_aborted, the
+    // channel is closed.
+    ~RpcClient();
+
+private:
+    void call_impl(Payload, Duration, OnReply);
+    static void close(Channel&);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+class RpcServer {
+    struct State;
+
+public:
+    using Payload = std::vector<uint8_t>;
+    using Reply   = std::function<void(Payload)>;
+    // Called for every request. The reply may be sent at any later time
+    // (and from any handler), requests don't wait for each other.
+    using Handler = std::function<void(Payload request, Reply)>;
+    using OnDone  = std::function<void(sys::error_code)>;
+
+public:
+    RpcServer(Channel&, Handler);
+
+    RpcServer(const RpcServer&) = delete;
+    RpcServer& operator=(const RpcServer&) = delete;
+
+    // Dispatches requests until the channel is closed by the peer (which
+    // completes with no error) or fails. A malformed frame or a response
+    // completes with error::malformed_frame and closes the channel.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code)>::type
+        >::type
+    async_run(Token&&);
+
+    ~RpcServer();
+
+private:
+    void run_impl(OnDone);
+    static void close(Channel&);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+//--------------------------------------------------------------------
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type< Token
+                                 , void(sys::error_code, RpcClient::Payload)
+                                 >::type
+    >::type
+RpcClient::async_call(Payload request, Duration timeout, Token&& token)
+{
+    using Handler = typename asio::handler_type
+                        < Token
+                        , void(sys::error_code, Payload)
+                        >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    call_impl(std::move(request), timeout, std::move(handler));
+
+    return result.get();
+}
+
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code)>::type
+    >::type
+RpcServer::async_run(Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    run_impl(std::move(handler));
+
+    return result.get();
+}
+
+} // gnunet_channels namespace
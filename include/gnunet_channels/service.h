@@ -2,6 +2,12 @@
 
 #include <boost/asio/io_service.hpp>
 #include <gnunet_channels/namespaces.h>
+#include <gnunet_channels/idle.h>
+#include <gnunet_channels/loopback.h>
+#include <gnunet_channels/peer_id.h>
+#include <gnunet_channels/rate_limit.h>
+#include <gnunet_channels/sharding.h>
+#include <gnunet_channels/stats.h>
 
 namespace gnunet_channels {
 
@@ -14,23 +20,62 @@ class Service {
 public:
     Service(std::string config_path, asio::io_service&);
 
+    // Instead of the CADET service of a running peer, use an in-process
+    // stand-in, private to this service (see LoopbackOptions). The config is
+    // still needed to start GNUnet's scheduler, the identity is random.
+    Service(std::string config_path, asio::io_service&, LoopbackOptions);
+
     Service(const Service&) = delete;
     Service& operator=(const Service&) = delete;
 
+    // Open several CADET handles instead of one, so that channels don't
+    // all queue behind a single connection to the CADET service. Must be
+    // called before `async_setup`.
+    void set_sharding(ShardingOptions);
+
     template<class Token>
     void async_setup(Token&& token);
 
     asio::io_service& get_io_service();
 
     std::string identity() const;
+    PeerId peer_id() const;
+
+    // Counters summed over all channels created from this service.
+    ServiceStats stats() const;
+
+    // Same as above, one entry per CADET handle (see set_sharding).
+    std::vector<ServiceStats> handle_stats() const;
+
+    // Caps the bandwidth used by all channels of this service together
+    // (on top of the channels' own limits). Sending is paced by holding
+    // back envelopes, receiving by delaying GNUNET_CADET_receive_done.
+    // With several handles, each gets an equal part of the limit.
+    // Must be called after `async_setup`, may be called again to change
+    // the limits.
+    void set_send_limit(RateLimit);
+    void set_receive_limit(RateLimit);
+
+    // Keeps the number of open channels (and the memory held by them) in
+    // check, see IdleOptions. Applies to the channels already open too,
+    // their idle timeouts count from this call. May be called at any time.
+    void set_idle_options(IdleOptions);
+
+    // Latency histograms of the hand-offs between the io_service and
+    // GNUnet's thread. Only recorded when the library is built with
+    // GNUNET_CHANNELS_SCHEDULER_METRICS, otherwise `enabled` is false.
+    SchedulerStats scheduler_stats() const;
+    void reset_scheduler_stats();
 
     ~Service();
 
     // TODO: This should be private.
-    std::shared_ptr<Cadet>& cadet();
+    // Returns the least loaded handle when sharded.
+    std::shared_ptr<Cadet> cadet();
 
 private:
     void async_setup_impl(OnSetup);
+    void loopback_setup(OnSetup);
 
 private:
     std::shared_ptr<Impl> _impl;
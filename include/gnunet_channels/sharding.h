@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace gnunet_channels {
+
+// How many CADET client handles (i.e. connections to the CADET service)
+// a Service opens and how channels are spread across them, see
+// Service::set_sharding.
+struct ShardingOptions {
+    enum class Assign {
+        // To the handle with the fewest open channels.
+        by_load,
+        // By a hash of the target peer and port, so that all channels to
+        // the same destination share a handle. Channels which are accepted
+        // rather than connected are assigned by load.
+        by_hash,
+    };
+
+    size_t handles = 1;
+    Assign assign = Assign::by_load;
+};
+
+} // gnunet_channels namespace
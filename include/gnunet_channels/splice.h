@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <iosfwd>
+#include <boost/asio/ip/tcp.hpp>
+#include <gnunet_channels/channel.h>
+
+namespace gnunet_channels {
+
+struct SpliceStats {
+    uint64_t tcp_to_channel_bytes = 0;
+    uint64_t channel_to_tcp_bytes = 0;
+
+    uint64_t tcp_reads      = 0;
+    uint64_t channel_writes = 0;
+    uint64_t channel_reads  = 0;
+    uint64_t tcp_writes     = 0;
+
+    // Times reading from the socket was held back because too many
+    // channel writes were still in flight.
+    uint64_t tcp_read_stalls = 0;
+
+    std::chrono::steady_clock::duration duration{};
+};
+
+std::ostream& operator<<(std::ostream&, const SpliceStats&);
+
+// Pumps data both ways between a TCP socket and a Channel until the
+// channel ends. Data read from the socket goes straight into pooled
+// buffers which are handed over to the channel, and messages received
+// from the channel are written to the socket from the buffer they arrived
+// in, which then returns to the pool for the next socket read.
+//
+// Neither side is read from faster than the other can take: at most
+// `max_in_flight` socket reads wait for the channel, and the next message
+// is taken from the channel only once the previous one is written out
+// (which in turn holds back CADET's receive window).
+//
+// A channel can't be half closed, so EOF on the socket only stops reading
+// from it: what the peer sends is still written to the socket until it
+// ends the channel. Once done, the sending side of the socket is shut down
+// and the channel closed.
+//
+// The socket and the channel must outlive the splice's completion. The
+// splice's handlers run in a strand of its own, cancelling it or
+// destroying it before completion only stops it once that strand gets to
+// it, until then the two must stay around as well.
+class Splice {
+    struct State;
+
+public:
+    using OnDone = std::function<void(sys::error_code)>;
+
+public:
+    Splice(asio::ip::tcp::socket&, Channel&, size_t max_in_flight = 4);
+
+    Splice(const Splice&) = delete;
+    Splice& operator=(const Splice&) = delete;
+
+    // Completes once the channel ended or either side failed. The peer
+    // closing its end (reset channel, reset socket) is not an error.
+    template<class Token>
+    typename asio::async_result
+        < typename asio::handler_type<Token, void(sys::error_code)>::type
+        >::type
+    async_run(Token&&);
+
+    // Stops pumping and cancels the pending socket operations.
+    void cancel();
+
+    // Not synchronized with the splice's handlers: call it once completed,
+    // or from the io_service's thread if it's run by one thread only.
+    SpliceStats stats() const;
+
+    ~Splice();
+
+private:
+    void run_impl(OnDone);
+
+private:
+    std::shared_ptr<State> _state;
+};
+
+//--------------------------------------------------------------------
+template<class Token>
+typename asio::async_result
+    < typename asio::handler_type<Token, void(sys::error_code)>::type
+    >::type
+Splice::async_run(Token&& token)
+{
+    using Handler = typename asio::handler_type< Token
+                                               , void(sys::error_code)
+                                               >::type;
+
+    Handler handler(std::forward<Token>(token));
+    asio::async_result<Handler> result(handler);
+
+    run_impl(std::move(handler));
+
+    return result.get();
+}
+
+} // gnunet_channels namespace
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <iosfwd>
+#include <stdint.h>
+
+namespace gnunet_channels {
+
+// Snapshot of what a Channel is doing. Byte and message counts are
+// cumulative, queue values are current.
+struct ChannelStats {
+    uint64_t bytes_sent        = 0;
+    uint64_t bytes_received    = 0;
+    // Number of CADET messages (a single write may be split into many).
+    uint64_t messages_sent     = 0;
+    uint64_t messages_received = 0;
+
+    // Writes waiting for the one currently in progress.
+    uint64_t send_queue_depth  = 0;
+    uint64_t send_queue_bytes  = 0;
+
+    // Messages received from CADET but not yet read by the application.
+    uint64_t recv_queue_depth  = 0;
+    uint64_t recv_queue_bytes  = 0;
+
+    // Last window size reported by CADET.
+    int window = 0;
+
+    // How many times we held back GNUNET_CADET_receive_done because the
+    // application wasn't reading fast enough.
+    uint64_t receive_done_deferred = 0;
+
+    // Rate limits in bytes per second (zero if none) and how many times
+    // sending resp. GNUNET_CADET_receive_done was held back to honor them.
+    uint64_t send_rate_limit    = 0;
+    uint64_t receive_rate_limit = 0;
+    uint64_t send_paced         = 0;
+    uint64_t receive_paced      = 0;
+
+    // Keepalive probes (see IdleOptions), not included in the message
+    // counts above.
+    uint64_t keepalives_sent     = 0;
+    uint64_t keepalives_received = 0;
+
+    // Time from `connect` until the channel became usable. Zero for
+    // accepted channels and channels which are not connected yet.
+    std::chrono::steady_clock::duration connect_duration{};
+};
+
+// Same as above, summed over all channels of a Service (the queue values
+// only cover channels which are still open).
+struct ServiceStats {
+    uint64_t channels_created  = 0;
+    uint64_t channels_open     = 0;
+
+    uint64_t bytes_sent        = 0;
+    uint64_t bytes_received    = 0;
+    uint64_t messages_sent     = 0;
+    uint64_t messages_received = 0;
+
+    uint64_t send_queue_depth  = 0;
+    uint64_t send_queue_bytes  = 0;
+    uint64_t recv_queue_depth  = 0;
+    uint64_t recv_queue_bytes  = 0;
+
+    uint64_t receive_done_deferred = 0;
+
+    // The service wide limits, the pacing counts include the channels'
+    // own limits.
+    uint64_t send_rate_limit    = 0;
+    uint64_t receive_rate_limit = 0;
+    uint64_t send_paced         = 0;
+    uint64_t receive_paced      = 0;
+
+    uint64_t keepalives_sent     = 0;
+    uint64_t keepalives_received = 0;
+
+    // Channels closed because of IdleOptions: idle for too long, resp.
+    // the least recently used ones when over the limit.
+    uint64_t channels_idle_closed = 0;
+    uint64_t channels_evicted     = 0;
+};
+
+// Distribution of durations recorded in a log-linear (HDR style)
+// histogram, the percentiles are accurate to within ~6%.
+struct LatencyStats {
+    uint64_t count = 0;
+    std::chrono::nanoseconds mean{};
+    std::chrono::nanoseconds p50{};
+    std::chrono::nanoseconds p90{};
+    std::chrono::nanoseconds p99{};
+    std::chrono::nanoseconds p999{};
+    std::chrono::nanoseconds max{};
+};
+
+// One direction of the hand-off between the main thread and GNUnet's
+// thread.
+struct HopStats {
+    LatencyStats wait; // From posting until the task starts running
+    LatencyStats exec; // Running time of the task itself
+    uint64_t queue_depth      = 0;
+    uint64_t queue_high_water = 0;
+};
+
+struct SchedulerStats {
+    // False unless the library was built with
+    // GNUNET_CHANNELS_SCHEDULER_METRICS, in which case nothing is recorded.
+    bool enabled = false;
+
+    HopStats to_gnunet; // Main thread -> GNUnet's thread
+    HopStats to_main;   // GNUnet's thread -> io_service
+};
+
+// Sums the counters (and limits) of two services, or handles of one.
+ServiceStats& operator+=(ServiceStats&, const ServiceStats&);
+
+std::ostream& operator<<(std::ostream&, const ChannelStats&);
+std::ostream& operator<<(std::ostream&, const ServiceStats&);
+std::ostream& operator<<(std::ostream&, const LatencyStats&);
+std::ostream& operator<<(std::ostream&, const SchedulerStats&);
+
+} // gnunet_channels namespace
@@ -0,0 +1,665 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <random>
+#include <boost/asio/read.hpp>
+#include <gnunet_channels/bonded_channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include <gnunet_channels/error.h>
+#include <gnunet_channels/service.h>
+#include "channel_impl.h"
+#include "ids.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Wire format, all integers are big endian.
+namespace {
+    using BondId = array<uint8_t, 16>;
+
+    // Sent once at the start of each member channel.
+    struct Hello {
+        static constexpr size_t size = 16 + 2 + 2;
+
+        BondId   bond_id;
+        uint16_t index;
+        uint16_t width;
+
+        array<uint8_t, size> encode() const {
+            array<uint8_t, size> out;
+            copy(bond_id.begin(), bond_id.end(), out.begin());
+            out[16] = index >> 8; out[17] = index;
+            out[18] = width >> 8; out[19] = width;
+            return out;
+        }
+
+        static Hello decode(const array<uint8_t, size>& in) {
+            Hello h;
+            copy(in.begin(), in.begin() + 16, h.bond_id.begin());
+            h.index = (in[16] << 8) | in[17];
+            h.width = (in[18] << 8) | in[19];
+            return h;
+        }
+    };
+
+    // Precedes each stripe.
+    struct StripeHeader {
+        static constexpr size_t size = 8 + 4;
+
+        uint64_t seq;
+        uint32_t length;
+
+        array<uint8_t, size> encode() const {
+            array<uint8_t, size> out;
+            for (int i = 0; i < 8; ++i) out[i]     = seq    >> (56 - 8*i);
+            for (int i = 0; i < 4; ++i) out[8 + i] = length >> (24 - 8*i);
+            return out;
+        }
+
+        static StripeHeader decode(const array<uint8_t, size>& in) {
+            StripeHeader h{0, 0};
+            for (int i = 0; i < 8; ++i) h.seq    = (h.seq << 8)    | in[i];
+            for (int i = 0; i < 4; ++i) h.length = (h.length << 8) | in[8 + i];
+            return h;
+        }
+    };
+
+    // Stop reading from the members while this much in-order data waits
+    // for the application.
+    constexpr size_t max_ready_bytes = 1024 * 1024;
+
+    // Stop reading from the members which are ahead while this much data
+    // waits for a stripe which comes late.
+    constexpr size_t max_reorder_bytes = 1024 * 1024;
+
+    // Incoming bonds whose members don't all arrive in time are dropped,
+    // as are the oldest ones when there are too many.
+    constexpr auto   partial_timeout = chrono::seconds(30);
+    constexpr size_t max_partial     = 256;
+}
+
+constexpr size_t BondedChannel::default_width;
+constexpr size_t BondedChannel::stripe_size;
+
+//--------------------------------------------------------------------
+struct BondedChannel::State : public enable_shared_from_this<State> {
+    struct Member {
+        Member(Channel c) : channel(move(c)) {}
+
+        Channel channel;
+        size_t in_flight = 0; // Bytes written but not yet confirmed
+        bool reading = false;
+        uint64_t next_seq = 0; // After the last stripe read from it
+        array<uint8_t, StripeHeader::size> header;
+        vector<uint8_t> payload;
+    };
+
+    State(asio::io_service& ios, size_t width)
+        : ios(ios), width(width) {}
+
+    asio::io_service& ios;
+    size_t width;
+    vector<unique_ptr<Member>> members;
+
+    bool closed = false;
+    sys::error_code error;
+
+    uint64_t next_send_seq = 0;
+
+    uint64_t next_recv_seq = 0;
+    map<uint64_t, vector<uint8_t>> out_of_order;
+    size_t out_of_order_bytes = 0;
+    deque<vector<uint8_t>> ready;
+    size_t ready_offset = 0; // Into ready.front()
+    size_t ready_bytes  = 0;
+
+    OnReceive on_receive;
+    vector<asio::mutable_buffer> output;
+
+    void adopt(vector<Channel>);
+    void start_reading();
+    void read_stripe(Member&);
+    void on_stripe(uint64_t seq, vector<uint8_t>);
+    size_t consume();
+    void deliver();
+    void fail(sys::error_code);
+};
+
+// Used by BondedPort once all members of an incoming bond arrived.
+void BondedChannel::State::adopt(vector<Channel> channels)
+{
+    members.clear();
+    width = channels.size();
+
+    for (auto& c : channels) {
+        members.push_back(make_unique<Member>(move(c)));
+    }
+
+    start_reading();
+}
+
+void BondedChannel::State::start_reading()
+{
+    for (auto& m : members) read_stripe(*m);
+}
+
+void BondedChannel::State::read_stripe(Member& m)
+{
+    if (closed || error || m.reading) return;
+
+    if (ready_bytes >= max_ready_bytes) return; // Resumed in `deliver`
+
+    // Stripes come in order on each member, so the one we're waiting for
+    // is on a member which isn't ahead. Resumed in `on_stripe`.
+    if ( out_of_order_bytes >= max_reorder_bytes
+      && m.next_seq > next_recv_seq) return;
+
+    m.reading = true;
+
+    asio::async_read(m.channel, asio::buffer(m.header),
+        [self = shared_from_this(), &m] (sys::error_code ec, size_t) {
+            if (self->closed) return;
+            if (ec) return self->fail(ec);
+
+            auto h = StripeHeader::decode(m.header);
+
+            if (h.length == 0 || h.length > stripe_size) {
+                return self->fail(error::malformed_frame);
+            }
+
+            m.payload.resize(h.length);
+
+            asio::async_read(m.channel, asio::buffer(m.payload),
+                [self, &m, seq = h.seq] (sys::error_code ec, size_t) {
+                    if (self->closed) return;
+                    if (ec) return self->fail(ec);
+
+                    if (seq < m.next_seq) {
+                        return self->fail(error::malformed_frame);
+                    }
+
+                    auto data = move(m.payload);
+                    m.payload = vector<uint8_t>();
+                    m.reading = false;
+                    m.next_seq = seq + 1;
+
+                    self->on_stripe(seq, move(data));
+
+                    // The read handler may have destroyed the bond.
+                    if (self->closed) return;
+                    self->read_stripe(m);
+                });
+        });
+}
+
+void BondedChannel::State::on_stripe(uint64_t seq, vector<uint8_t> data)
+{
+    if (seq < next_recv_seq || out_of_order.count(seq)) {
+        return fail(error::malformed_frame);
+    }
+
+    if (seq != next_recv_seq) {
+        out_of_order_bytes += data.size();
+        out_of_order.emplace(seq, move(data));
+        return;
+    }
+
+    ready_bytes += data.size();
+    ready.push_back(move(data));
+    ++next_recv_seq;
+
+    for (auto i = out_of_order.begin();
+         i != out_of_order.end() && i->first == next_recv_seq;
+         i = out_of_order.erase(i))
+    {
+        out_of_order_bytes -= i->second.size();
+        ready_bytes += i->second.size();
+        ready.push_back(move(i->second));
+        ++next_recv_seq;
+    }
+
+    // Members paused for being ahead may be behind now.
+    for (auto& m : members) read_stripe(*m);
+
+    deliver();
+}
+
+// Copies as much of the ready data as fits into `output`.
+size_t BondedChannel::State::consume()
+{
+    size_t total = 0;
+
+    while (!ready.empty()) {
+        auto& front = ready.front();
+
+        auto n = asio::buffer_copy( output
+                                  , asio::buffer(front) + ready_offset);
+
+        // Skip what was just filled.
+        size_t skip = n;
+        while (!output.empty() && skip) {
+            auto s = min(skip, asio::buffer_size(output.front()));
+            output.front() = output.front() + s;
+            skip -= s;
+            if (asio::buffer_size(output.front()) == 0) {
+                output.erase(output.begin());
+            }
+        }
+
+        total += n;
+        ready_offset += n;
+        ready_bytes -= n;
+
+        if (ready_offset < front.size()) break;
+
+        ready.pop_front();
+        ready_offset = 0;
+    }
+
+    return total;
+}
+
+void BondedChannel::State::deliver()
+{
+    if (!on_receive || ready.empty()) return;
+
+    auto size = consume();
+    auto f = move(on_receive);
+
+    if (ready_bytes < max_ready_bytes) {
+        for (auto& m : members) read_stripe(*m);
+    }
+
+    f(sys::error_code(), size);
+}
+
+void BondedChannel::State::fail(sys::error_code ec)
+{
+    if (error) return;
+    error = ec;
+
+    // The bond is no good without any one of its members, the others'
+    // pending reads and writes are aborted.
+    for (auto& m : members) {
+        if (auto impl = m->channel.get_impl()) impl->close();
+    }
+
+    if (on_receive) {
+        ios.post(bind(move(on_receive), ec, 0));
+    }
+}
+
+//--------------------------------------------------------------------
+BondedChannel::BondedChannel(Service& service, size_t width)
+    : _service(service)
+    , _state(make_shared<State>(service.get_io_service(), max<size_t>(width, 1)))
+{
+}
+
+asio::io_service& BondedChannel::get_io_service()
+{
+    return _state->ios;
+}
+
+size_t BondedChannel::width() const
+{
+    return _state->width;
+}
+
+void BondedChannel::connect_impl( const string& target_id
+                                , const string& shared_secret
+                                , OnConnect h)
+{
+    sys::error_code ec;
+    auto pid = cached_peer_id(target_id, ec);
+
+    if (ec) {
+        return _state->ios.post([h = move(h), ec] { h(ec); });
+    }
+
+    connect_impl(pid, cached_port_hash(shared_secret), move(h));
+}
+
+void BondedChannel::connect_impl(PeerId target_id, PortHash port, OnConnect h)
+{
+    auto& s = *_state;
+
+    Hello hello;
+    hello.width = s.width;
+
+    random_device rd;
+    for (auto& b : hello.bond_id) b = rd();
+
+    s.members.clear();
+
+    for (size_t i = 0; i < s.width; ++i) {
+        s.members.push_back(make_unique<State::Member>(Channel(_service)));
+    }
+
+    struct Connecting {
+        size_t remaining;
+        OnConnect on_connect;
+    };
+
+    auto c = make_shared<Connecting>(Connecting{s.width, move(h)});
+
+    for (size_t i = 0; i < s.width; ++i) {
+        auto& m = *s.members[i];
+
+        m.channel.connect_impl(target_id, port,
+            [self = _state, c, &m, hello, i] (sys::error_code ec) mutable {
+                if (!c->on_connect) return; // Already failed
+
+                if (!ec && self->closed) ec = asio::error::operation_aborted;
+
+                if (ec) {
+                    self->fail(ec);
+                    auto f = move(c->on_connect);
+                    return f(ec);
+                }
+
+                hello.index = i;
+                auto buf = hello.encode();
+                // Copied right away, nothing to keep alive.
+                m.channel.async_write_some(asio::buffer(buf),
+                        [] (sys::error_code, size_t) {});
+
+                if (--c->remaining) return;
+
+                self->start_reading();
+
+                auto f = move(c->on_connect);
+                f(sys::error_code());
+            });
+    }
+}
+
+void BondedChannel::write_impl(vector<uint8_t> data, OnWrite h)
+{
+    auto& s = *_state;
+
+    if (s.error || s.members.empty()) {
+        auto ec = s.error ? s.error : sys::error_code(asio::error::not_connected);
+        return s.ios.post([h = move(h), ec] { h(ec, 0); });
+    }
+
+    if (data.empty()) {
+        return s.ios.post([h = move(h)] { h(sys::error_code(), 0); });
+    }
+
+    struct Writing {
+        size_t remaining;
+        size_t size;
+        OnWrite on_write;
+    };
+
+    size_t stripes = (data.size() + stripe_size - 1) / stripe_size;
+    auto w = make_shared<Writing>(Writing{stripes, data.size(), move(h)});
+
+    for (size_t offset = 0; offset < data.size(); offset += stripe_size) {
+        size_t n = min(stripe_size, data.size() - offset);
+
+        // The least busy member gets the stripe.
+        auto& m = **min_element( s.members.begin(), s.members.end()
+                               , [] (auto& a, auto& b) {
+                                     return a->in_flight < b->in_flight;
+                                 });
+
+        auto header = StripeHeader{s.next_send_seq++, uint32_t(n)}.encode();
+
+        array<asio::const_buffer, 2> bufs{{ asio::buffer(header)
+                                          , asio::buffer(data.data() + offset, n) }};
+
+        m.in_flight += n;
+
+        // The member copies the buffers before returning.
+        m.channel.async_write_some(bufs,
+            [self = _state, w, &m, n] (sys::error_code ec, size_t) {
+                if (self->closed) return;
+
+                m.in_flight -= n;
+
+                if (!w->on_write) return; // Already failed
+
+                if (ec) {
+                    self->fail(ec);
+                    auto f = move(w->on_write);
+                    return f(ec, 0);
+                }
+
+                if (--w->remaining) return;
+
+                auto f = move(w->on_write);
+                f(sys::error_code(), w->size);
+            });
+    }
+}
+
+void BondedChannel::receive_impl(vector<asio::mutable_buffer> bufs, OnReceive h)
+{
+    auto& s = *_state;
+
+    if (s.ready.empty()) {
+        if (s.error) {
+            return s.ios.post([h = move(h), ec = s.error] { h(ec, 0); });
+        }
+
+        s.output = move(bufs);
+        s.on_receive = move(h);
+        return;
+    }
+
+    s.output = move(bufs);
+    auto size = s.consume();
+
+    if (s.ready_bytes < max_ready_bytes) {
+        for (auto& m : s.members) s.read_stripe(*m);
+    }
+
+    s.ios.post([h = move(h), size] { h(sys::error_code(), size); });
+}
+
+BondedChannel::~BondedChannel()
+{
+    auto& s = *_state;
+
+    s.closed = true;
+
+    if (s.on_receive) {
+        s.ios.post(bind(move(s.on_receive), asio::error::operation_aborted, 0));
+    }
+
+    // Closes the member channels, our handlers see `closed` set.
+    s.members.clear();
+}
+
+//--------------------------------------------------------------------
+struct BondedPort::Impl : public enable_shared_from_this<Impl> {
+    Impl(Service& service, PortHash hash)
+        : service(service), port(new CadetPort(service)), hash(hash) {}
+
+    struct Partial {
+        vector<unique_ptr<Channel>> members;
+        size_t count = 0;
+        chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    };
+
+    // Not holding the channel, it may be destroyed while waiting.
+    struct Pending {
+        weak_ptr<BondedChannel::State> state;
+        OnAccept on_accept;
+    };
+
+    Service& service;
+    // Reset when the port is destroyed, which aborts the pending accept
+    // and with it the reference the accept handler holds to us.
+    unique_ptr<CadetPort> port;
+    PortHash hash;
+    bool accepting = false;
+    bool destroyed = false;
+
+    // Accepted channels until their hello is read, so that they can be
+    // closed (and the reads aborted) when the port is destroyed.
+    map<Channel*, shared_ptr<Channel>> greeting;
+
+    map<BondId, Partial> partial;
+    deque<vector<Channel>> complete;
+    deque<Pending> pending;
+
+    void accept_next();
+    void read_hello(shared_ptr<Channel>);
+    void expire_partial();
+    void dispatch();
+    void fail_pending(sys::error_code);
+};
+
+void BondedPort::Impl::accept_next()
+{
+    if (accepting || destroyed) return;
+    accepting = true;
+
+    auto ch = make_shared<Channel>(service);
+
+    port->open_impl(*ch, hash, [self = shared_from_this(), ch] (sys::error_code ec) {
+            self->accepting = false;
+
+            if (self->destroyed) return;
+            if (ec) return self->fail_pending(ec);
+
+            self->read_hello(move(ch));
+            self->accept_next();
+        });
+}
+
+void BondedPort::Impl::read_hello(shared_ptr<Channel> ch)
+{
+    auto buf = make_shared<array<uint8_t, Hello::size>>();
+    auto& c = *ch;
+
+    greeting[&c] = ch;
+
+    // Not holding `ch`, the channel would keep itself alive.
+    asio::async_read(c, asio::buffer(*buf),
+        [self = shared_from_this(), p = &c, buf] (sys::error_code ec, size_t) {
+            if (self->destroyed) return;
+
+            auto i = self->greeting.find(p);
+            if (i == self->greeting.end()) return;
+
+            auto ch = move(i->second);
+            self->greeting.erase(i);
+
+            if (ec) return;
+
+            auto h = Hello::decode(*buf);
+
+            if (h.width == 0 || h.index >= h.width) return; // Not a member
+
+            if (!self->partial.count(h.bond_id)) self->expire_partial();
+
+            auto& p = self->partial[h.bond_id];
+
+            if (p.members.empty()) p.members.resize(h.width);
+
+            if (p.members.size() != h.width || p.members[h.index]) {
+                return; // Inconsistent, drop this member
+            }
+
+            p.members[h.index] = make_unique<Channel>(move(*ch));
+
+            if (++p.count < h.width) return;
+
+            vector<Channel> chs;
+            chs.reserve(h.width);
+            for (auto& m : p.members) chs.push_back(move(*m));
+
+            self->partial.erase(h.bond_id);
+            self->complete.push_back(move(chs));
+            self->dispatch();
+        });
+}
+
+// Makes room for one more incomplete bond.
+void BondedPort::Impl::expire_partial()
+{
+    auto now = chrono::steady_clock::now();
+
+    for (auto i = partial.begin(); i != partial.end();) {
+        if (now - i->second.started >= partial_timeout) i = partial.erase(i);
+        else ++i;
+    }
+
+    if (partial.size() < max_partial) return;
+
+    auto oldest = min_element( partial.begin(), partial.end()
+                             , [] (auto& a, auto& b) {
+                                   return a.second.started < b.second.started;
+                               });
+    partial.erase(oldest);
+}
+
+void BondedPort::Impl::dispatch()
+{
+    while (!pending.empty() && !complete.empty()) {
+        auto p = move(pending.front());
+        pending.pop_front();
+
+        auto state = p.state.lock();
+
+        // The channel was destroyed while waiting, the next one gets the
+        // bond.
+        if (!state || state->closed) {
+            service.get_io_service().post([f = move(p.on_accept)] {
+                    f(asio::error::operation_aborted);
+                });
+            continue;
+        }
+
+        state->adopt(move(complete.front()));
+        complete.pop_front();
+
+        service.get_io_service().post([f = move(p.on_accept)] {
+                f(sys::error_code());
+            });
+    }
+}
+
+void BondedPort::Impl::fail_pending(sys::error_code ec)
+{
+    while (!pending.empty()) {
+        auto f = move(pending.front().on_accept);
+        pending.pop_front();
+        service.get_io_service().post([f = move(f), ec] { f(ec); });
+    }
+}
+
+//--------------------------------------------------------------------
+BondedPort::BondedPort(Service& service, PortHash hash)
+    : _impl(make_shared<Impl>(service, hash))
+{
+}
+
+BondedPort::BondedPort(Service& service, const string& shared_secret)
+    : BondedPort(service, cached_port_hash(shared_secret))
+{
+}
+
+void BondedPort::accept_impl(BondedChannel& ch, OnAccept h)
+{
+    _impl->pending.push_back(Impl::Pending{ch._state, move(h)});
+    _impl->dispatch();
+    _impl->accept_next();
+}
+
+BondedPort::~BondedPort()
+{
+    _impl->destroyed = true;
+    _impl->fail_pending(asio::error::operation_aborted);
+    _impl->greeting.clear();
+    _impl->port.reset();
+    _impl->partial.clear();
+    _impl->complete.clear();
+}
@@ -0,0 +1,104 @@
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <gnunet_channels/broadcast.h>
+#include "channel_impl.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+void Broadcast::send_impl( const vector<Channel*>& channels
+                         , Payload payload
+                         , OnSent on_sent)
+{
+    // There would be no io_service to post the handler to.
+    assert(!channels.empty());
+
+    struct State {
+        vector<sys::error_code> results;
+        // Each channel reports from its own strand.
+        atomic<size_t> remaining;
+        OnSent on_sent;
+    };
+
+    auto state = make_shared<State>();
+    state->results.resize(channels.size());
+    state->remaining = channels.size();
+    state->on_sent = move(on_sent);
+
+    auto done = [state] (size_t i, sys::error_code ec) {
+        state->results[i] = ec;
+        if (--state->remaining) return;
+        auto f = move(state->on_sent);
+        f(move(state->results));
+    };
+
+    // Channels which aren't sending right now, grouped by the scheduler
+    // (i.e. the service) they belong to, so that each group takes one post.
+    // Whether a channel is sending can only be checked in its strand, the
+    // last channel to be checked posts the groups.
+    struct Ready {
+        mutex m;
+        size_t remaining = 0;
+        map<Scheduler*, vector<shared_ptr<ChannelImpl>>> groups;
+    };
+
+    auto ready = make_shared<Ready>();
+
+    for (auto ch : channels) {
+        if (ch->get_impl()) ++ready->remaining;
+    }
+
+    auto checked = [ready, payload] (shared_ptr<ChannelImpl> impl) {
+        lock_guard<mutex> l(ready->m);
+
+        if (impl) {
+            ready->groups[&impl->scheduler()].push_back(move(impl));
+        }
+
+        if (--ready->remaining) return;
+
+        for (auto& group : ready->groups) {
+            group.first->post([ chs     = move(group.second)
+                              , payload = payload
+                              ] () mutable {
+                    for (auto& ch : chs) {
+                        ch->transmit({}, payload, asio::buffer(*payload));
+                        ch->scheduler().reclaim(move(ch));
+                    }
+                });
+        }
+    };
+
+    for (size_t i = 0; i < channels.size(); ++i) {
+        auto impl = channels[i]->get_impl();
+
+        if (!impl) {
+            channels[i]->get_io_service().post(
+                    [done, i] { done(i, asio::error::bad_descriptor); });
+            continue;
+        }
+
+        ChannelImpl::SendEntry e{ vector<uint8_t>()
+                                , payload
+                                , asio::buffer(*payload)
+                                , [done, i] (sys::error_code ec, size_t) {
+                                      done(i, ec);
+                                  }};
+
+        impl->strand().dispatch([ impl    = impl->shared_from_this()
+                                , e       = move(e)
+                                , checked
+                                ] () mutable {
+                // Nothing would ever complete the send.
+                if (auto ec = impl->failure()) {
+                    impl->strand().post(bind(move(e.on_send), ec, 0));
+                    return checked(nullptr);
+                }
+
+                if (impl->queue_if_busy(e)) return checked(nullptr);
+                impl->start_send(e);
+                checked(move(impl));
+            });
+    }
+}
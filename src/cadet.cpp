@@ -2,16 +2,38 @@
 
 using namespace gnunet_channels;
 
-Cadet::Cadet(Scheduler& scheduler, GNUNET_CADET_Handle* handle)
+Cadet::Cadet(Scheduler& scheduler, std::unique_ptr<Transport> transport)
     : _scheduler(scheduler)
-    , _handle(handle)
+    , _transport(std::move(transport))
+    , _stats(std::make_shared<ServiceCounters>())
+    , _timers(std::make_shared<TimerWheel>(scheduler.get_io_service()))
+    , _reaper(std::make_shared<ChannelReaper>())
 {}
 
+void Cadet::set_send_limit(RateLimit l)
+{
+    _stats->send_rate_limit.store(l.bytes_per_second, std::memory_order_relaxed);
+
+    _scheduler.post([self = shared_from_this(), l] () mutable {
+            self->_send_scheduler.set_limit(l);
+            self->_scheduler.reclaim(std::move(self));
+        });
+}
+
+void Cadet::set_receive_limit(RateLimit l)
+{
+    _stats->receive_rate_limit.store(l.bytes_per_second, std::memory_order_relaxed);
+
+    _scheduler.post([self = shared_from_this(), l] () mutable {
+            self->_receive_bucket.set(l);
+            self->_scheduler.reclaim(std::move(self));
+        });
+}
+
 Cadet::~Cadet()
 {
-    if (_handle) {
-        _scheduler.post([h = _handle](auto) { GNUNET_CADET_disconnect(h); });
-        _handle = nullptr;
+    if (_transport) {
+        // The transport must be destroyed in GNUnet's thread.
+        _scheduler.post([t = _transport.release()] { delete t; });
     }
 }
-
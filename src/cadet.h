@@ -3,26 +3,63 @@
 #include <gnunet/platform.h>
 #include <memory>
 #include "scheduler.h"
-#include <gnunet/gnunet_cadet_service.h>
+#include "stats.h"
+#include "transport.h"
+#include "send_scheduler.h"
+#include "timer_wheel.h"
+#include "channel_reaper.h"
+#include "token_bucket.h"
 
 namespace gnunet_channels {
 
+class Shards;
+
 class Cadet : public std::enable_shared_from_this<Cadet> {
 public:
-    Cadet(Scheduler&, GNUNET_CADET_Handle*);
+    Cadet(Scheduler&, std::unique_ptr<Transport>);
 
     Cadet(const Cadet&) = delete;
     Cadet& operator=(const Cadet&) = delete;
 
     Scheduler&           scheduler()      { return _scheduler; }
-    GNUNET_CADET_Handle* handle()         { return _handle; }
     asio::io_service&    get_io_service() { return _scheduler.get_io_service(); }
 
+    // Must only be used in GNUnet's thread.
+    Transport&           transport()      { return *_transport; }
+    // Same, shared by all channels of this handle.
+    SendScheduler&       send_scheduler() { return _send_scheduler; }
+    TokenBucket&         receive_bucket() { return _receive_bucket; }
+
+    // Set when this is one of several handles of a Service.
+    void set_shards(std::weak_ptr<Shards> s) { _shards = std::move(s); }
+    std::shared_ptr<Shards> shards() const { return _shards.lock(); }
+
+    // Deadlines of the channels, shared by all handles of a Service.
+    const std::shared_ptr<TimerWheel>& timers() const { return _timers; }
+    void set_timers(std::shared_ptr<TimerWheel> t) { _timers = std::move(t); }
+
+    // Same, for IdleOptions.
+    const std::shared_ptr<ChannelReaper>& reaper() const { return _reaper; }
+    void set_reaper(std::shared_ptr<ChannelReaper> r) { _reaper = std::move(r); }
+
+    // Limits for all channels together, may be changed at any time.
+    void set_send_limit(RateLimit);
+    void set_receive_limit(RateLimit);
+
+    // Shared with the channels, which may outlive this object.
+    const std::shared_ptr<ServiceCounters>& stats() { return _stats; }
+
     ~Cadet();
 
 private:
     Scheduler& _scheduler;
-    GNUNET_CADET_Handle* _handle;
+    std::unique_ptr<Transport> _transport;
+    SendScheduler _send_scheduler;
+    TokenBucket _receive_bucket;
+    std::weak_ptr<Shards> _shards;
+    std::shared_ptr<ServiceCounters> _stats;
+    std::shared_ptr<TimerWheel> _timers;
+    std::shared_ptr<ChannelReaper> _reaper;
 };
 
 } // gnunet_channels
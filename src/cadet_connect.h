@@ -1,6 +1,8 @@
 #pragma once
 
 #include "cadet.h"
+#include "cadet_transport.h"
+
 namespace gnunet_channels {
 
 class CadetConnect : public std::enable_shared_from_this<CadetConnect> {
@@ -31,10 +33,9 @@ inline void CadetConnect::run(Handler h)
                     (const GNUNET_CONFIGURATION_Handle* cfg) {
             GNUNET_CADET_Handle *handle = GNUNET_CADET_connect(cfg);
 
-            auto& ios = _scheduler.get_io_service();
-
-            ios.post([this, s = move(s), h = move(h), handle] {
-                         h(make_shared<Cadet>(_scheduler, handle));
+            _scheduler.post_to_ios([this, s = move(s), h = move(h), handle] {
+                         h(make_shared<Cadet>( _scheduler
+                                             , std::make_unique<CadetTransport>(handle)));
                      });
         });
 }
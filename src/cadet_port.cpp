@@ -1,6 +1,8 @@
 #include <gnunet/platform.h>
 #include "channel_impl.h"
+#include "ids.h"
 #include <iostream>
+#include <mutex>
 #include <gnunet_channels/cadet_port.h>
 #include <gnunet_channels/channel.h>
 #include <gnunet_channels/error.h>
@@ -12,22 +14,30 @@ using namespace gnunet_channels;
 struct CadetPort::Impl : public enable_shared_from_this<Impl> {
     shared_ptr<Cadet> cadet;
     GNUNET_CADET_Port *port = nullptr;
+    // Serializes access to the members below.
+    asio::io_service::strand strand;
     OnAccept on_accept;
-    ChannelImpl* channel = nullptr;
-    bool was_destroyed = false;
+    // The channel waiting in `open`. Set in the strand and taken in
+    // GNUnet's thread, hence the mutex.
+    std::mutex mutex;
+    shared_ptr<ChannelImpl> channel;
+    std::atomic<bool> was_destroyed{false};
     std::queue<shared_ptr<ChannelImpl>> queued_connections;
 
     Impl(shared_ptr<Cadet> cadet)
-        : cadet(move(cadet)) {}
+        : cadet(move(cadet))
+        , strand(this->cadet->get_io_service()) {}
 
     asio::io_service& get_io_service() {
         return cadet->get_io_service();
     }
 
+    // Executed in the strand.
     auto accept_fail(sys::error_code ec) {
-        get_io_service().post([ ec
-                              , c = cadet
-                              , f = move(on_accept)] { f(ec); });
+        if (!on_accept) return;
+        strand.post([ ec
+                    , c = cadet
+                    , f = move(on_accept)] { f(ec); });
     };
 };
 
@@ -55,22 +65,26 @@ void* CadetPort::channel_incoming( void *cls
     // NOTE: The pointer returned from this function will be used as a `cls` in
     // the ChannelImpl::connect_channel_ended callback.
 
-    // TODO: Add a mutex around port_impl->{channel, cadet}
     shared_ptr<ChannelImpl> ret;
     bool queue_it = false;
 
-    if (port_impl->channel) {
-        ret = port_impl->channel->shared_from_this();
+    {
+        lock_guard<mutex> lock(port_impl->mutex);
+        ret = move(port_impl->channel);
         port_impl->channel = nullptr;
     }
-    else {
-        ret = make_shared<ChannelImpl>(port_impl->cadet);
+
+    if (!ret) {
+        ret = ChannelImpl::create(port_impl->cadet);
         queue_it = true;
     }
 
     ret->_handle = handle;
+    ret->apply_send_settings();
+
+    ret->_scheduler.post_to_ios(ret->_strand, [ret] { ret->opened(); });
 
-    port_impl->get_io_service().post(
+    port_impl->cadet->scheduler().post_to_ios(port_impl->strand,
         [ port_impl = port_impl->shared_from_this()
         , queue_it
         , ret
@@ -101,27 +115,63 @@ void* CadetPort::channel_incoming( void *cls
 
 void CadetPort::open_impl(Channel& ch, const string& shared_secret, OnAccept on_accept)
 {
-    GNUNET_HashCode port_hash;
-    GNUNET_CRYPTO_hash(shared_secret.c_str(), shared_secret.size(), &port_hash);
+    open_impl(ch, cached_port_hash(shared_secret), move(on_accept));
+}
+
+void CadetPort::open_impl(Channel& ch, PortHash port, OnAccept on_accept)
+{
+    auto old = ch.get_impl();
+
+    if (old && old->_cadet && old->_cadet != _impl->cadet) {
+        // With sharding the channel may have been created on another
+        // handle, but incoming channels arrive on the port's.
+        auto next = ChannelImpl::create(_impl->cadet);
+        old->hand_over(next);
+        ch._impl = move(next);
+    }
+
+    _impl->strand.dispatch([ &ch
+                           , port
+                           , on_accept = move(on_accept)
+                           , impl      = _impl
+                           ] () mutable {
+            if (impl->was_destroyed) {
+                return impl->strand.post([f = move(on_accept)] {
+                        f(asio::error::operation_aborted);
+                    });
+            }
+
+            do_open(move(impl), ch, port, move(on_accept));
+        });
+}
+
+// Executed in the port's strand
+void CadetPort::do_open( shared_ptr<Impl> impl
+                       , Channel& ch
+                       , PortHash port
+                       , OnAccept on_accept)
+{
+    auto port_hash = to_gnunet(port);
 
-    if (_impl->on_accept) {
-        _impl->accept_fail(asio::error::operation_aborted);
+    if (impl->on_accept) {
+        impl->accept_fail(asio::error::operation_aborted);
     }
 
-    if (!_impl->queued_connections.empty()) {
-        auto ch_impl = move(_impl->queued_connections.front());
-        _impl->queued_connections.pop();
+    if (!impl->queued_connections.empty()) {
+        auto ch_impl = move(impl->queued_connections.front());
+        impl->queued_connections.pop();
 
-        _ios.post([ ch_impl   = move(ch_impl)
-                  , on_accept = move(on_accept)
-                  , port_impl = _impl
-                  , &ch
-                  ] {
+        impl->strand.post([ ch_impl   = move(ch_impl)
+                          , on_accept = move(on_accept)
+                          , port_impl = impl
+                          , &ch
+                          ] {
                 if (port_impl->was_destroyed) {
                     ch_impl->close();
                     return on_accept(asio::error::operation_aborted);
                 }
 
+                if (auto old = ch.get_impl()) old->replaced();
                 ch.set_impl(move(ch_impl));
                 on_accept(sys::error_code());
             });
@@ -129,20 +179,29 @@ void CadetPort::open_impl(Channel& ch, const string& shared_secret, OnAccept on_
         return;
     }
 
-    _impl->channel = ch.get_impl();
+    {
+        lock_guard<mutex> lock(impl->mutex);
+        auto c = ch.get_impl();
+        impl->channel = c ? c->shared_from_this() : nullptr;
+    }
 
     // TODO: Not sure how efficient it is to wrap the on_accept functor here.
     // We do need to create a io_service's work to prevent the main loop from
     // exiting once the lambda posted to the scheduler (below) is executed.
     // Perhaps on_accet could have a custom struct to hold OnAccept and the
     // work?
-    _impl->on_accept = [ w         = asio::io_service::work(get_io_service())
-                       , on_accept = move(on_accept)
-                       ] (sys::error_code ec) { on_accept(ec); };
+    impl->on_accept = [ w         = asio::io_service::work(impl->get_io_service())
+                      , on_accept = move(on_accept)
+                      ] (sys::error_code ec) { on_accept(ec); };
+
+    impl->cadet->scheduler().post([impl, port_hash] {
+            // on_accept belongs to the strand.
+            auto fail = [impl] (sys::error_code ec) {
+                impl->strand.post([impl, ec] { impl->accept_fail(ec); });
+            };
 
-    scheduler().post([impl = _impl, port_hash] {
             if (impl->was_destroyed) {
-                return impl->accept_fail(asio::error::operation_aborted);
+                return fail(asio::error::operation_aborted);
             }
 
             if (impl->port) return;
@@ -153,19 +212,24 @@ void CadetPort::open_impl(Channel& ch, const string& shared_secret, OnAccept on_
                                         , NULL
                                         , GNUNET_MESSAGE_TYPE_CADET_CLI
                                         , sizeof(GNUNET_MessageHeader) },
+                GNUNET_MQ_MessageHandler{ NULL
+                                        , ChannelImpl::handle_keepalive
+                                        , NULL
+                                        , MESSAGE_TYPE_KEEPALIVE
+                                        , sizeof(GNUNET_MessageHeader) },
                 GNUNET_MQ_handler_end()
             };
 
-            impl->port = GNUNET_CADET_open_port( impl->cadet->handle()
-                                               , &port_hash
-                                               , CadetPort::channel_incoming
-                                               , impl.get()
-                                               , NULL
-                                               , ChannelImpl::connect_channel_ended
-                                               , handlers);
+            impl->port = impl->cadet->transport().open_port
+                            ( &port_hash
+                            , CadetPort::channel_incoming
+                            , impl.get()
+                            , NULL
+                            , ChannelImpl::connect_channel_ended
+                            , handlers);
 
             if (!impl->port) {
-                impl->accept_fail(error::failed_to_open_port);
+                fail(error::failed_to_open_port);
             }
         });
 }
@@ -174,13 +238,29 @@ CadetPort::~CadetPort()
 {
     _impl->was_destroyed = true;
 
+    // A pending `open` holds on to the io_service (see do_open), and
+    // nothing would come to complete it any more.
+    _impl->strand.dispatch([impl = _impl] {
+            impl->accept_fail(asio::error::operation_aborted);
+
+            {
+                lock_guard<mutex> lock(impl->mutex);
+                impl->channel = nullptr;
+            }
+
+            while (!impl->queued_connections.empty()) {
+                impl->queued_connections.front()->close();
+                impl->queued_connections.pop();
+            }
+        });
+
     // Need to get the scheduler here because the function internally uses
     // _impl which is moved from in the next step.
     auto& s = scheduler();
 
     s.post([impl = move(_impl)] {
         if (!impl->port) return;
-        GNUNET_CADET_close_port(impl->port);
+        impl->cadet->transport().close_port(impl->port);
         impl->port = nullptr;
     });
 }
@@ -0,0 +1,70 @@
+#include "cadet_transport.h"
+
+using namespace gnunet_channels;
+
+CadetTransport::CadetTransport(GNUNET_CADET_Handle* handle)
+    : _handle(handle)
+{}
+
+GNUNET_CADET_Channel*
+CadetTransport::channel_create( void* channel_cls
+                              , const GNUNET_PeerIdentity* destination
+                              , const GNUNET_HashCode* port
+                              , GNUNET_CADET_WindowSizeEventHandler window_changes
+                              , GNUNET_CADET_DisconnectEventHandler disconnects
+                              , const GNUNET_MQ_MessageHandler* handlers)
+{
+    int flags = GNUNET_CADET_OPTION_DEFAULT
+              | GNUNET_CADET_OPTION_RELIABLE;
+
+    return GNUNET_CADET_channel_create( _handle
+                                      , channel_cls
+                                      , destination
+                                      , port
+                                      , (GNUNET_CADET_ChannelOption)flags
+                                      , window_changes
+                                      , disconnects
+                                      , handlers);
+}
+
+void CadetTransport::channel_destroy(GNUNET_CADET_Channel* channel)
+{
+    GNUNET_CADET_channel_destroy(channel);
+}
+
+GNUNET_MQ_Handle* CadetTransport::get_mq(GNUNET_CADET_Channel* channel)
+{
+    return GNUNET_CADET_get_mq(channel);
+}
+
+void CadetTransport::receive_done(GNUNET_CADET_Channel* channel)
+{
+    GNUNET_CADET_receive_done(channel);
+}
+
+GNUNET_CADET_Port*
+CadetTransport::open_port( const GNUNET_HashCode* port
+                         , GNUNET_CADET_ConnectEventHandler connects
+                         , void* connects_cls
+                         , GNUNET_CADET_WindowSizeEventHandler window_changes
+                         , GNUNET_CADET_DisconnectEventHandler disconnects
+                         , const GNUNET_MQ_MessageHandler* handlers)
+{
+    return GNUNET_CADET_open_port( _handle
+                                 , port
+                                 , connects
+                                 , connects_cls
+                                 , window_changes
+                                 , disconnects
+                                 , handlers);
+}
+
+void CadetTransport::close_port(GNUNET_CADET_Port* port)
+{
+    GNUNET_CADET_close_port(port);
+}
+
+CadetTransport::~CadetTransport()
+{
+    if (_handle) GNUNET_CADET_disconnect(_handle);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "transport.h"
+
+namespace gnunet_channels {
+
+// Transport talking to the CADET service of the local GNUnet peer.
+class CadetTransport : public Transport {
+public:
+    CadetTransport(GNUNET_CADET_Handle*);
+
+    CadetTransport(const CadetTransport&) = delete;
+    CadetTransport& operator=(const CadetTransport&) = delete;
+
+    GNUNET_CADET_Channel*
+    channel_create( void* channel_cls
+                  , const GNUNET_PeerIdentity*
+                  , const GNUNET_HashCode*
+                  , GNUNET_CADET_WindowSizeEventHandler
+                  , GNUNET_CADET_DisconnectEventHandler
+                  , const GNUNET_MQ_MessageHandler*) override;
+
+    void channel_destroy(GNUNET_CADET_Channel*) override;
+
+    GNUNET_MQ_Handle* get_mq(GNUNET_CADET_Channel*) override;
+
+    void receive_done(GNUNET_CADET_Channel*) override;
+
+    GNUNET_CADET_Port*
+    open_port( const GNUNET_HashCode*
+             , GNUNET_CADET_ConnectEventHandler
+             , void* connects_cls
+             , GNUNET_CADET_WindowSizeEventHandler
+             , GNUNET_CADET_DisconnectEventHandler
+             , const GNUNET_MQ_MessageHandler*) override;
+
+    void close_port(GNUNET_CADET_Port*) override;
+
+    ~CadetTransport();
+
+private:
+    GNUNET_CADET_Handle* _handle;
+};
+
+} // gnunet_channels namespace
@@ -1,6 +1,11 @@
+#include <cstring>
 #include <gnunet_channels/service.h>
 #include <gnunet_channels/channel.h>
+#include <gnunet_channels/error.h>
 #include "channel_impl.h"
+#include "ids.h"
+#include "mapped_file.h"
+#include "shards.h"
 
 using namespace std;
 using namespace gnunet_channels;
@@ -13,7 +18,7 @@ Channel::Channel(Service& service)
 Channel::Channel(std::shared_ptr<Cadet> cadet)
     : _scheduler(cadet->scheduler())
     , _ios(cadet->get_io_service())
-    , _impl(make_shared<ChannelImpl>(move(cadet)))
+    , _impl(ChannelImpl::create(move(cadet)))
 {
 }
 
@@ -52,11 +57,38 @@ asio::io_service& Channel::get_io_service()
     return _ios;
 }
 
-void Channel::connect_impl( std::string target_id
+void Channel::connect_impl(PeerId target_id, PortHash port, OnConnect h)
+{
+    auto shards = _impl->_cadet ? _impl->_cadet->shards() : nullptr;
+
+    if (shards && shards->by_hash()) {
+        // The handle was picked by load when the channel was created, now
+        // that the destination is known it may belong to another one.
+        auto cadet = shards->pick(target_id, port);
+
+        if (cadet != _impl->_cadet) {
+            auto next = ChannelImpl::create(move(cadet));
+            _impl->hand_over(next);
+            _impl = move(next);
+        }
+    }
+
+    _impl->connect(target_id, port, move(h));
+}
+
+void Channel::connect_impl( const std::string& target_id
                           , const std::string& shared_secret
                           , OnConnect h)
 {
-    _impl->connect(move(target_id), shared_secret, move(h));
+    sys::error_code ec;
+    auto pid = cached_peer_id(target_id, ec);
+
+    if (ec) {
+        // Reject before bothering GNUnet's thread.
+        return _ios.post([h = move(h), ec] { h(ec); });
+    }
+
+    connect_impl(pid, cached_port_hash(shared_secret), move(h));
 }
 
 void Channel::write_impl(vector<uint8_t> data, OnWrite on_write)
@@ -64,11 +96,285 @@ void Channel::write_impl(vector<uint8_t> data, OnWrite on_write)
     _impl->send(move(data), move(on_write));
 }
 
+ChannelStats Channel::stats() const
+{
+    if (!_impl) return ChannelStats();
+    return _impl->stats();
+}
+
+void Channel::set_deadlines(Deadlines d)
+{
+    if (_impl) _impl->set_deadlines(d);
+}
+
+void Channel::set_send_weight(uint32_t weight)
+{
+    if (_impl) _impl->set_send_weight(weight);
+}
+
+void Channel::set_send_limit(RateLimit l)
+{
+    if (_impl) _impl->set_send_limit(l);
+}
+
+void Channel::set_receive_limit(RateLimit l)
+{
+    if (_impl) _impl->set_receive_limit(l);
+}
+
+void Channel::wait_readable_impl(OnWait h)
+{
+    _impl->wait_readable(move(h));
+}
+
+void Channel::wait_writable_impl(OnWait h)
+{
+    _impl->wait_writable(move(h));
+}
+
+size_t Channel::try_read_impl(asio::mutable_buffer b, sys::error_code& ec)
+{
+    return _impl->try_receive(b, ec);
+}
+
+bool Channel::can_write(sys::error_code& ec) const
+{
+    return _impl->can_send(ec);
+}
+
+size_t Channel::try_write_impl(vector<uint8_t> data, sys::error_code& ec)
+{
+    ec = sys::error_code();
+    size_t size = data.size();
+
+    if (size == 0) {
+        Pool::instance().release_buffer(move(data));
+        return 0;
+    }
+
+    _impl->try_send(move(data));
+    return size;
+}
+
+void Channel::peek_impl(OnPeek h)
+{
+    _impl->peek(move(h));
+}
+
+Channel::Views Channel::peek() const
+{
+    return _impl->views();
+}
+
+void Channel::consume(size_t n)
+{
+    _impl->consume(n);
+}
+
+void Channel::read_into_impl(Append append, OnReceive h)
+{
+    _impl->wait_readable([ impl   = _impl
+                         , append = move(append)
+                         , h      = move(h)
+                         ] (sys::error_code ec) {
+            if (ec) return h(ec, 0);
+
+            const bool stop = false;
+            size_t n = impl->drain(append, stop);
+
+            // There was data, so taking none of it means there's no room.
+            if (n == 0) return h(asio::error::no_buffer_space, 0);
+
+            h(sys::error_code(), n);
+        });
+}
+
+namespace {
+    // Finds a delimiter in a stream seen one chunk at a time, also when
+    // it spans chunks.
+    class DelimiterScanner {
+    public:
+        DelimiterScanner(string delim, string tail)
+            : _delim(move(delim)), _tail(move(tail))
+        {}
+
+        // Offset in `chunk` just past the delimiter, zero if not found.
+        size_t scan(asio::const_buffer chunk) {
+            auto p = asio::buffer_cast<const char*>(chunk);
+            auto n = asio::buffer_size(chunk);
+            auto end = p + n;
+
+            if (!_tail.empty()) {
+                string joint = _tail + string(p, min(n, _delim.size() - 1));
+                auto i = joint.find(_delim);
+                if (i != string::npos) return i + _delim.size() - _tail.size();
+            }
+
+            const char* i = end;
+
+            if (_delim.size() == 1) {
+                auto c = static_cast<const char*>(memchr(p, _delim[0], n));
+                if (c) i = c;
+            }
+            else {
+                i = search(p, end, _delim.begin(), _delim.end());
+            }
+
+            if (i != end) return (i - p) + _delim.size();
+
+            _tail.append(p, n);
+            _tail.erase(0, _tail.size() - min(_tail.size(), _delim.size() - 1));
+
+            return 0;
+        }
+
+    private:
+        string _delim;
+        string _tail;
+    };
+
+    struct ReadUntil {
+        Channel::Append append;
+        DelimiterScanner scanner;
+        size_t size;
+        Channel::OnReceive handler;
+    };
+}
+
+static void read_until(shared_ptr<ChannelImpl> impl, shared_ptr<ReadUntil> op)
+{
+    auto& i = *impl;
+
+    i.wait_readable([impl = move(impl), op = move(op)] (sys::error_code ec) mutable {
+            if (ec) return op->handler(ec, 0);
+
+            bool found = false;
+            bool full  = false;
+            size_t past = 0;
+
+            Channel::Append take = [&] (asio::const_buffer in) {
+                size_t at = op->scanner.scan(in);
+                size_t n  = op->append(in);
+
+                if (at && at <= n) {
+                    found = true;
+                    past  = op->size + at;
+                }
+
+                full = n < asio::buffer_size(in);
+                op->size += n;
+                return n;
+            };
+
+            impl->drain(take, found);
+
+            if (found) return op->handler(sys::error_code(), past);
+            if (full)  return op->handler(asio::error::not_found, 0);
+
+            read_until(move(impl), move(op));
+        });
+}
+
+void Channel::read_until_impl( Append append
+                             , string delimiter
+                             , string tail
+                             , size_t size
+                             , OnReceive h)
+{
+    auto op = make_shared<ReadUntil>(ReadUntil{ move(append)
+                                              , DelimiterScanner(move(delimiter), move(tail))
+                                              , size
+                                              , move(h) });
+    read_until(_impl, move(op));
+}
+
+vector<uint8_t> Channel::acquire_buffer(size_t size)
+{
+    auto buffer = Pool::instance().acquire_buffer();
+    buffer.resize(size);
+    return buffer;
+}
+
 void Channel::receive_impl(vector<asio::mutable_buffer> bufs, OnReceive h)
 {
     _impl->receive(move(bufs), move(h));
 }
 
+void Channel::take_impl(OnTake h)
+{
+    _impl->take(move(h));
+}
+
+void Channel::send_file_impl(const string& path, OnWrite h)
+{
+    sys::error_code ec;
+    auto file = MappedFile::open(path, ec);
+
+    if (ec) {
+        return _ios.post([h = move(h), ec] { h(ec, 0); });
+    }
+
+    auto region = static_cast<const MappedFile&>(*file).data();
+    _impl->send(move(file), region, move(h));
+}
+
+void Channel::send_mapped_impl( asio::const_buffer region
+                              , shared_ptr<const void> keepalive
+                              , OnWrite h)
+{
+    if (!keepalive) {
+        // An empty keepalive would make ChannelImpl send its (empty)
+        // owned buffer instead.
+        keepalive = make_shared<int>();
+    }
+
+    _impl->send(move(keepalive), region, move(h));
+}
+
+// Reads into the rest of the file, one received message (or as much of
+// it as fits) at a time.
+static void receive_into( shared_ptr<ChannelImpl> impl
+                        , shared_ptr<MappedFile> file
+                        , size_t offset
+                        , Channel::OnReceive h)
+{
+    vector<asio::mutable_buffer> output{ file->data() + offset };
+
+    impl->receive(move(output),
+        [ impl
+        , file   = move(file)
+        , offset
+        , h      = move(h)
+        ] (sys::error_code ec, size_t size) mutable {
+            offset += size;
+
+            if (ec) return h(ec, offset);
+
+            if (offset == file->size()) {
+                file.reset(); // Unmap before reporting completion
+                return h(sys::error_code(), offset);
+            }
+
+            receive_into(move(impl), move(file), offset, move(h));
+        });
+}
+
+void Channel::receive_file_impl(const string& path, uint64_t size, OnReceive h)
+{
+    sys::error_code ec;
+    auto file = MappedFile::create(path, size, ec);
+
+    if (ec) {
+        return _ios.post([h = move(h), ec] { h(ec, 0); });
+    }
+
+    if (size == 0) {
+        return _ios.post([h = move(h)] { h(sys::error_code(), 0); });
+    }
+
+    receive_into(_impl, move(file), 0, move(h));
+}
+
 Channel::~Channel()
 {
     // Could have been moved from.
@@ -1,5 +1,6 @@
 #include <iostream>
 #include "channel_impl.h"
+#include "ids.h"
 #include "gnunet_channels/error.h"
 
 using namespace std;
@@ -8,64 +9,177 @@ using namespace gnunet_channels;
 // Makes sure the destructor is called in the main thread.
 template<class T>
 static void preserve(shared_ptr<T>&& c) {
-    auto p = c.get();
-    p->get_io_service().post([c = move(c)] {});
+    auto& s = c->scheduler();
+    s.reclaim(move(c));
 }
 
 ChannelImpl::ChannelImpl(shared_ptr<Cadet> cadet)
-    : _cadet(move(cadet))
+    : _strand(cadet->get_io_service())
+    , _timers(cadet->timers())
+    , _read_deadline ([this] { expired(_read_deadline);  })
+    , _write_deadline([this] { expired(_write_deadline); })
+    , _idle_deadline ([this] { expired(_idle_deadline);  })
+    , _reclaim_deadline([this] { expired(_reclaim_deadline); })
+    , _keepalive       ([this] { expired(_keepalive);        })
+    , _reaper(cadet->reaper())
+    , _cadet(move(cadet))
     , _scheduler(_cadet->scheduler())
+    , _transport(&_cadet->transport())
+    , _send_scheduler(&_cadet->send_scheduler())
+    , _service_receive_bucket(&_cadet->receive_bucket())
+    , _service_stats(_cadet->stats())
 {
     assert(_cadet);
+    _service_stats->channels_created.fetch_add(1, memory_order_relaxed);
+    _service_stats->channels_open.fetch_add(1, memory_order_relaxed);
+}
+
+shared_ptr<ChannelImpl> ChannelImpl::create(shared_ptr<Cadet> cadet)
+{
+    // Not in the ChannelReaper until it's connected or accepted (see
+    // `opened`), a placeholder must not evict a live channel.
+    return allocate_shared<ChannelImpl>( Policy::Allocator<ChannelImpl>()
+                                       , move(cadet));
 }
 
 void ChannelImpl::send(vector<uint8_t> data, OnSend on_send)
 {
-    if (_on_send) {
-        // We're already sending, so queue this request.
-        _send_queue.push(SendEntry{data, move(on_send)});
-        return;
-    }
+    send(SendEntry{move(data), nullptr, asio::const_buffer(), move(on_send)});
+}
+
+void ChannelImpl::send( shared_ptr<const void> keepalive
+                      , asio::const_buffer view
+                      , OnSend on_send)
+{
+    send(SendEntry{vector<uint8_t>(), move(keepalive), view, move(on_send)});
+}
+
+void ChannelImpl::send(SendEntry e)
+{
+    _strand.dispatch([self = shared_from_this(), e = move(e)] () mutable {
+            if (auto ec = self->failure()) {
+                return self->_strand.post(bind(move(e.on_send), ec, 0));
+            }
+            if (self->queue_if_busy(e)) return;
+            self->do_send(move(e));
+        });
+}
+
+bool ChannelImpl::queue_if_busy(SendEntry& e)
+{
+    if (!_on_send) return false;
 
-    do_send(data, move(on_send));
+    // We're already sending, so queue this request.
+    count(&ChannelCounters::send_queue_depth, 1);
+    count(&ChannelCounters::send_queue_bytes, e.size());
+    _send_queue.push(move(e));
+    return true;
 }
 
-void ChannelImpl::do_send(vector<uint8_t> data, OnSend on_send)
+void ChannelImpl::start_send(SendEntry& e)
 {
-    size_t size = data.size();
-    _on_send = [h = move(on_send), size] (auto ec) { h(ec, size); };
+    size_t size = e.size();
+    _on_send = [h = move(e.on_send), size] (auto ec) { h(ec, size); };
+    arm(_write_deadline, _deadlines.write);
+}
+
+void ChannelImpl::do_send(SendEntry e)
+{
+    start_send(e);
 
     scheduler().post([ self = shared_from_this()
-                     , data = move(data)
+                     , e    = move(e)
                      ] () mutable {
-        if (!self->_handle) return;
+        self->transmit(move(e.data), move(e.keepalive), e.view);
+        preserve(move(self));
+    });
+}
 
-        constexpr size_t max_size = GNUNET_CONSTANTS_MAX_CADET_MESSAGE_SIZE
-                                  - sizeof(GNUNET_MessageHeader);
+// Executed in GNUnet's thread
+void ChannelImpl::transmit( vector<uint8_t> data
+                          , shared_ptr<const void> keepalive
+                          , asio::const_buffer view)
+{
+    _out.data      = move(data);
+    _out.keepalive = move(keepalive);
+    _out.rest      = _out.keepalive ? view : asio::buffer(_out.data);
 
-        asio::const_buffer buf(data.data(), data.size());
+    if (!_handle) return;
 
-        while (auto size = min(max_size, asio::buffer_size(buf))) {
-            GNUNET_MessageHeader *msg;
-            GNUNET_MQ_Envelope *env
-                = GNUNET_MQ_msg_extra( msg
-                                     , size
-                                     , GNUNET_MESSAGE_TYPE_CADET_CLI);
+    if (asio::buffer_size(_out.rest) == 0) {
+        return finish_send();
+    }
 
-            GNUNET_memcpy(&msg[1], asio::buffer_cast<const void*>(buf), size);
+    // The scheduler decides when (and how many of) the envelopes are put
+    // into the MQ. Each is copied from `_out.rest` only then, so large
+    // (e.g. mapped) payloads are never duplicated in memory as a whole.
+    _send_scheduler->activate(*this);
+}
 
-            // Only get notification once the last buffer has been sent.
-            if (asio::buffer_size(buf) <= max_size) {
-                GNUNET_MQ_notify_sent(env, ChannelImpl::data_sent, self.get());
-            }
+// Executed in GNUnet's thread
+size_t ChannelImpl::next_size() const
+{
+    constexpr size_t max_size = GNUNET_CONSTANTS_MAX_CADET_MESSAGE_SIZE
+                              - sizeof(GNUNET_MessageHeader);
 
-            GNUNET_MQ_send(GNUNET_CADET_get_mq(self->_handle), env);
+    if (!_handle) return 0;
 
-            buf = buf + size;
-        }
+    return min(max_size, asio::buffer_size(_out.rest));
+}
 
-        preserve(move(self));
-    });
+// Executed in GNUnet's thread
+void ChannelImpl::emit()
+{
+    auto size = next_size();
+
+    GNUNET_MessageHeader *msg;
+    GNUNET_MQ_Envelope *env
+        = GNUNET_MQ_msg_extra( msg
+                             , size
+                             , GNUNET_MESSAGE_TYPE_CADET_CLI);
+
+    GNUNET_memcpy(&msg[1], asio::buffer_cast<const void*>(_out.rest), size);
+
+    _out.rest = _out.rest + size;
+
+    count(&ChannelCounters::messages_sent, 1);
+    count(&ChannelCounters::bytes_sent, size);
+
+    GNUNET_MQ_notify_sent(env, ChannelImpl::envelope_sent, this);
+    GNUNET_MQ_send(_transport->get_mq(_handle), env);
+}
+
+// Executed in GNUnet's thread
+void ChannelImpl::paced()
+{
+    count(&ChannelCounters::send_paced, 1);
+}
+
+// Executed in GNUnet's thread
+void ChannelImpl::envelope_sent(void *cls)
+{
+    auto self = static_cast<ChannelImpl*>(cls);
+
+    if (!self->_handle) return;
+
+    self->_send_scheduler->sent(*self);
+
+    if ( self->in_flight() == 0
+      && asio::buffer_size(self->_out.rest) == 0)
+    {
+        self->finish_send();
+    }
+}
+
+// Executed in GNUnet's thread
+void ChannelImpl::finish_send()
+{
+    // The data has been copied into the envelopes, let the next write
+    // reuse the memory.
+    Pool::instance().release_buffer(move(_out.data));
+    _out = Outgoing();
+
+    data_sent(this);
 }
 
 // Executed in GNUnet's thread
@@ -73,7 +187,7 @@ void ChannelImpl::data_sent(void *cls)
 {
     auto self = static_cast<ChannelImpl*>(cls);
 
-    self->get_io_service().post([s = self->shared_from_this()] {
+    self->_scheduler.post_to_ios(self->_strand, [s = self->shared_from_this()] {
             auto f = move(s->_on_send);
 
             if (!f) {
@@ -87,37 +201,244 @@ void ChannelImpl::data_sent(void *cls)
             if (!s->_send_queue.empty()) {
                 auto e = move(s->_send_queue.front());
                 s->_send_queue.pop();
-                s->do_send(move(e.data), move(e.on_send));
+                s->uncount(&ChannelCounters::send_queue_depth, 1);
+                s->uncount(&ChannelCounters::send_queue_bytes, e.size());
+                s->do_send(move(e));
             }
 
+            s->active(Activity::sent);
+
             f(sys::error_code());
+
+            if (!s->_on_send && s->_on_writable) {
+                auto w = move(s->_on_writable);
+                w(sys::error_code());
+            }
+
+            if (!s->_on_send && !s->_on_writable) {
+                s->_timers->cancel(s->_write_deadline);
+            }
         });
 }
 
 void ChannelImpl::receive(vector<asio::mutable_buffer> output, OnReceive h)
+{
+    _strand.dispatch([ self   = shared_from_this()
+                     , output = move(output)
+                     , h      = move(h)
+                     ] () mutable {
+            self->do_receive(move(output), move(h));
+        });
+}
+
+void ChannelImpl::advance_front(size_t n)
+{
+    auto& input = _recv_queue.front();
+
+    input.info = input.info + n;
+    uncount(&ChannelCounters::recv_queue_bytes, n);
+
+    if (asio::buffer_size(input.info) == 0) {
+        Pool::instance().release_buffer(move(input.data));
+        _recv_queue.pop_front();
+        message_consumed();
+    }
+}
+
+template<class Buffers>
+size_t ChannelImpl::read_front(const Buffers& output)
+{
+    size_t size = asio::buffer_copy(output, _recv_queue.front().info);
+    advance_front(size);
+    return size;
+}
+
+void ChannelImpl::do_receive(vector<asio::mutable_buffer> output, OnReceive h)
 {
     if (_recv_queue.empty()) {
+        if (auto ec = failure()) {
+            return _strand.post(bind(move(h), ec, 0));
+        }
         _on_receive = move(h);
         _output = move(output);
+        arm(_read_deadline, _deadlines.read);
     }
     else {
-        auto& input = _recv_queue.front();
+        size_t size = read_front(output);
 
-        size_t size = asio::buffer_copy(output, input.info);
+        _strand.post([ size
+                     , self = shared_from_this()
+                     , h    = move(h) ] {
+                         // TODO: Check whether `close` was called?
+                         h(sys::error_code(), size);
+                     });
+    }
+}
 
-        input.info = input.info + size;
+void ChannelImpl::take(OnTake h)
+{
+    _strand.dispatch([self = shared_from_this(), h = move(h)] () mutable {
+            self->do_take(move(h));
+        });
+}
 
-        if (asio::buffer_size(input.info) == 0) {
-            _recv_queue.pop();
+void ChannelImpl::do_take(OnTake h)
+{
+    if (_recv_queue.empty()) {
+        if (auto ec = failure()) {
+            return _strand.post(bind(move(h), ec, vector<uint8_t>()));
         }
+        _on_take = move(h);
+        arm(_read_deadline, _deadlines.read);
+        return;
+    }
+
+    auto& input = _recv_queue.front();
+    auto data = move(input.data);
+    auto offset = data.size() - asio::buffer_size(input.info);
+
+    // Partially read by `receive` before.
+    data.erase(data.begin(), data.begin() + offset);
+
+    _recv_queue.pop_front();
+    uncount(&ChannelCounters::recv_queue_bytes, data.size());
+    message_consumed();
+
+    _strand.post([ self = shared_from_this()
+                 , data = move(data)
+                 , h    = move(h) ] () mutable {
+                     h(sys::error_code(), move(data));
+                 });
+}
+
+sys::error_code ChannelImpl::failure() const
+{
+    if (!_cadet) return asio::error::operation_aborted;
+    if (_ended)  return asio::error::connection_reset;
+    return sys::error_code();
+}
+
+void ChannelImpl::wait_readable(OnWait h)
+{
+    _strand.dispatch([self = shared_from_this(), h = move(h)] () mutable {
+            // What arrived before the failure is still to be read.
+            if (!self->_recv_queue.empty()) {
+                return self->_strand.post(bind(move(h), sys::error_code()));
+            }
+
+            if (auto ec = self->failure()) {
+                return self->_strand.post(bind(move(h), ec));
+            }
+
+            self->_on_readable = move(h);
+            self->arm(self->_read_deadline, self->_deadlines.read);
+        });
+}
+
+void ChannelImpl::wait_writable(OnWait h)
+{
+    _strand.dispatch([self = shared_from_this(), h = move(h)] () mutable {
+            auto ec = self->failure();
+
+            if (!self->_on_send || ec) {
+                return self->_strand.post(bind(move(h), ec));
+            }
 
-        get_io_service().post([ size
-                              , self = shared_from_this()
-                              , h    = move(h) ] {
-                                  // TODO: Check whether `close` was called?
-                                  h(sys::error_code(), size);
-                              });
+            self->_on_writable = move(h);
+            self->arm(self->_write_deadline, self->_deadlines.write);
+        });
+}
+
+size_t ChannelImpl::try_receive(asio::mutable_buffer output, sys::error_code& ec)
+{
+    size_t n = 0;
+
+    while (!_recv_queue.empty() && asio::buffer_size(output) != 0) {
+        size_t size = read_front(asio::buffer(output));
+        output = output + size;
+        n += size;
     }
+
+    if (n || asio::buffer_size(output) == 0) {
+        ec = sys::error_code();
+        return n;
+    }
+
+    ec = failure();
+    if (!ec) ec = asio::error::would_block;
+
+    return 0;
+}
+
+void ChannelImpl::peek(OnPeek h)
+{
+    _strand.dispatch([self = shared_from_this(), h = move(h)] () mutable {
+            // Reported only once what arrived before it is consumed.
+            auto ec = self->_recv_queue.empty() ? self->failure()
+                                                : sys::error_code();
+
+            if (self->_recv_queue.empty() && !ec) {
+                self->_on_peek = move(h);
+                self->arm(self->_read_deadline, self->_deadlines.read);
+                return;
+            }
+
+            // The views are taken when the handler runs, so that they
+            // include whatever arrived in the meantime.
+            self->_strand.post([self, h = move(h), ec] {
+                    h(ec, self->views());
+                });
+        });
+}
+
+Channel::Views ChannelImpl::views() const
+{
+    Channel::Views ret;
+    ret.reserve(_recv_queue.size());
+
+    for (auto& b : _recv_queue) ret.push_back(b.info);
+
+    return ret;
+}
+
+void ChannelImpl::consume(size_t n)
+{
+    while (n && !_recv_queue.empty()) {
+        size_t size = min(n, asio::buffer_size(_recv_queue.front().info));
+        advance_front(size);
+        n -= size;
+    }
+}
+
+size_t ChannelImpl::drain(const Channel::Append& append, const bool& stop)
+{
+    size_t total = 0;
+
+    while (!_recv_queue.empty() && !stop) {
+        auto in = _recv_queue.front().info;
+        size_t n = append(in);
+
+        advance_front(n);
+        total += n;
+
+        if (n < asio::buffer_size(in)) break;
+    }
+
+    return total;
+}
+
+bool ChannelImpl::can_send(sys::error_code& ec) const
+{
+    ec = failure();
+    if (!ec && _on_send) ec = asio::error::would_block;
+    return !ec;
+}
+
+void ChannelImpl::try_send(vector<uint8_t> data)
+{
+    // Nobody waits for this one, writability is reported to
+    // `_on_writable` once it's done (see data_sent).
+    do_send(SendEntry{move(data), nullptr, asio::const_buffer(), [] (auto, auto) {}});
 }
 
 // Executed in GNUnet's thread
@@ -127,84 +448,222 @@ void ChannelImpl::handle_data(void *cls, const GNUNET_MessageHeader *m)
 
     size_t payload_size = ntohs(m->size) - sizeof(*m);
     uint8_t* begin = (uint8_t*) &m[1];
-    std::vector<uint8_t> payload(begin, begin + payload_size);
+    auto payload = Pool::instance().acquire_buffer();
+    payload.assign(begin, begin + payload_size);
+
+    ch->count(&ChannelCounters::messages_received, 1);
+    ch->count(&ChannelCounters::bytes_received, payload_size);
+    ch->count(&ChannelCounters::recv_queue_bytes, payload_size);
+
+    ch->_receive_bucket.consume(payload_size);
+    ch->_service_receive_bucket->consume(payload_size);
 
-    // TODO: Would be nice to only call this when the _recv_queue is empty.
-    // But that requires some locking.
-    GNUNET_CADET_receive_done(ch->_handle);
+    // Let CADET deliver the next message right away only if the application
+    // has read everything we gave it so far. Otherwise wait until it
+    // catches up (see message_consumed) so that we don't buffer without
+    // bounds.
+    ch->_service_stats->recv_queue_depth.fetch_add(1, memory_order_relaxed);
 
-    ch->get_io_service().post([ s = ch->shared_from_this()
-                              , d = move(payload) ] {
-            // TODO: Check whether `close` was called?
+    if (ch->_stats.recv_queue_depth.fetch_add(1) == 0) {
+        ch->receive_done();
+    }
+    else {
+        ch->count(&ChannelCounters::receive_done_deferred, 1);
+        // Must be set before the message is posted below.
+        ch->_receive_done_pending = true;
+    }
+
+    ch->_scheduler.post_to_ios(ch->_strand, [ s = ch->shared_from_this()
+                                            , d = move(payload) ] () mutable {
+            if (!s->_cadet) {
+                // Closed, nobody is going to read this.
+                s->uncount(&ChannelCounters::recv_queue_bytes, d.size());
+                s->message_consumed();
+                Pool::instance().release_buffer(move(d));
+                return;
+            }
 
-            if (s->_on_receive) {
+            s->active(Activity::received);
+
+            // Whoever was waiting is going to be done, unless they
+            // start waiting again.
+            s->_timers->cancel(s->_read_deadline);
+
+            if (s->_on_take) {
+                s->uncount(&ChannelCounters::recv_queue_bytes, d.size());
+                s->message_consumed();
+
+                auto f = move(s->_on_take);
+                f(sys::error_code(), move(d));
+            }
+            else if (s->_on_receive) {
                 size_t size = asio::buffer_copy(s->_output, asio::buffer(d));
 
+                s->uncount(&ChannelCounters::recv_queue_bytes, size);
+
                 if (size < d.size()) {
-                    s->_recv_queue.emplace(move(d), size);
+                    s->_recv_queue.emplace_back(move(d), size);
+                }
+                else {
+                    Pool::instance().release_buffer(move(d));
+                    s->message_consumed();
                 }
 
                 auto f = move(s->_on_receive);
                 f(sys::error_code(), size);
             }
             else {
-                s->_recv_queue.emplace(move(d));
+                s->_recv_queue.emplace_back(move(d));
+
+                if (s->_on_readable) {
+                    auto f = move(s->_on_readable);
+                    f(sys::error_code());
+                }
+
+                if (s->_on_peek) {
+                    auto f = move(s->_on_peek);
+                    f(sys::error_code(), s->views());
+                }
+            }
+        });
+}
+
+// Executed in GNUnet's thread
+void ChannelImpl::handle_keepalive(void *cls, const GNUNET_MessageHeader*)
+{
+    auto ch = static_cast<ChannelImpl*>(cls);
+
+    ch->count(&ChannelCounters::keepalives_received, 1);
+
+    // Goes through the same receive_done bookkeeping as data (see
+    // handle_data), it's just consumed as soon as it gets to the strand.
+    ch->_service_stats->recv_queue_depth.fetch_add(1, memory_order_relaxed);
+
+    if (ch->_stats.recv_queue_depth.fetch_add(1) == 0) {
+        ch->receive_done();
+    }
+    else {
+        ch->_receive_done_pending = true;
+    }
+
+    ch->_scheduler.post_to_ios(ch->_strand, [s = ch->shared_from_this()] {
+            if (s->_cadet) s->active(Activity::probed);
+            s->message_consumed();
+        });
+}
+
+// Executed in the strand
+void ChannelImpl::message_consumed()
+{
+    _service_stats->recv_queue_depth.fetch_sub(1, memory_order_relaxed);
+
+    if (_stats.recv_queue_depth.fetch_sub(1) != 1) return;
+
+    // That was the last unread message, if GNUnet's thread held back
+    // receive_done, call it now.
+    if (!_receive_done_pending.exchange(false)) return;
+
+    _scheduler.post([self = shared_from_this()] () mutable {
+            if (self->_handle) {
+                self->receive_done();
             }
+            preserve(move(self));
         });
 }
 
-void ChannelImpl::connect( string target_id
-                         , const string& port
-                         , OnConnect h)
+// Executed in GNUnet's thread
+void ChannelImpl::receive_done()
 {
-    GNUNET_HashCode port_hash;
-    GNUNET_CRYPTO_hash(port.c_str(), port.size(), &port_hash);
+    auto delay = max( _receive_bucket.delay()
+                    , _service_receive_bucket->delay());
 
-    _on_connect = move(h);
+    if (delay == delay.zero()) {
+        return _transport->receive_done(_handle);
+    }
+
+    count(&ChannelCounters::receive_paced, 1);
+
+    auto us = chrono::duration_cast<chrono::microseconds>(delay).count();
+
+    _receive_done_task = GNUNET_SCHEDULER_add_delayed
+        ( GNUNET_TIME_relative_multiply(GNUNET_TIME_UNIT_MICROSECONDS, us + 1)
+        , ChannelImpl::receive_done_timer
+        , this);
+}
 
+// Executed in GNUnet's thread
+void ChannelImpl::receive_done_timer(void *cls)
+{
+    auto self = static_cast<ChannelImpl*>(cls);
+    self->_receive_done_task = nullptr;
+
+    if (self->_handle) self->_transport->receive_done(self->_handle);
+}
+
+// Executed in GNUnet's thread
+static void cancel(GNUNET_SCHEDULER_Task*& task)
+{
+    if (!task) return;
+    GNUNET_SCHEDULER_cancel(task);
+    task = nullptr;
+}
+
+void ChannelImpl::connect(PeerId target_id, PortHash port, OnConnect h)
+{
+    _strand.dispatch([ self = shared_from_this()
+                     , target_id
+                     , port
+                     , h    = move(h)
+                     ] () mutable {
+            self->_on_connect = move(h);
+            self->_connect_start = chrono::steady_clock::now();
+            self->do_connect(target_id, port);
+        });
+}
+
+void ChannelImpl::do_connect(PeerId target_id, PortHash port)
+{
     _scheduler.post([ cadet     = _cadet
-                    , tid       = move(target_id)
-                    , port_hash = port_hash
+                    , pid       = to_gnunet(target_id)
+                    , port_hash = to_gnunet(port)
                     , self      = shared_from_this()
                     ] () mutable {
-        GNUNET_PeerIdentity pid;
-        auto& ios = cadet->scheduler().get_io_service();
-
-        // TODO: We can do this check before 'post'.
-        if (GNUNET_OK !=
-            GNUNET_CRYPTO_eddsa_public_key_from_string (tid.c_str(),
-                                                        tid.size(),
-                                                        &pid.public_key)) {
-            return ios.post([self] {
-                       self->_on_connect(error::invalid_target_id);
-                   });
-        }
-
         GNUNET_MQ_MessageHandler handlers[] = {
             GNUNET_MQ_MessageHandler{ ChannelImpl::check_data
                                     , ChannelImpl::handle_data
                                     , NULL
                                     , GNUNET_MESSAGE_TYPE_CADET_CLI
                                     , sizeof(GNUNET_MessageHeader) },
+            GNUNET_MQ_MessageHandler{ NULL
+                                    , ChannelImpl::handle_keepalive
+                                    , NULL
+                                    , MESSAGE_TYPE_KEEPALIVE
+                                    , sizeof(GNUNET_MessageHeader) },
             GNUNET_MQ_handler_end()
         };
 
-        int flags = GNUNET_CADET_OPTION_DEFAULT
-                  | GNUNET_CADET_OPTION_RELIABLE;
-
         self->_handle
-            = GNUNET_CADET_channel_create( cadet->handle()
-                                         , self.get()
-                                         , &pid
-                                         , &port_hash
-                                         , (GNUNET_CADET_ChannelOption)flags
-                                         , ChannelImpl::connect_window_change
-                                         , ChannelImpl::connect_channel_ended
-                                         , handlers);
+            = cadet->transport().channel_create
+                ( self.get()
+                , &pid
+                , &port_hash
+                , ChannelImpl::connect_window_change
+                , ChannelImpl::connect_channel_ended
+                , handlers);
+
+        if (self->_handle) self->apply_send_settings();
+
         preserve(move(self));
     });
 }
 
+// Executed in GNUnet's thread
+void ChannelImpl::apply_send_settings()
+{
+    _send_scheduler->set_weight(*this, _send_weight);
+    _send_scheduler->set_limit(*this, _send_limit);
+}
+
 // Executed in GNUnet's thread
 int ChannelImpl::check_data(void *cls, const GNUNET_MessageHeader *message)
 {
@@ -216,16 +675,25 @@ void ChannelImpl::connect_channel_ended( void *cls
                                        , const GNUNET_CADET_Channel *channel)
 {
     auto ch = static_cast<ChannelImpl*>(cls);
+    ch->_send_scheduler->remove(*ch);
+    cancel(ch->_receive_done_task);
     ch->_handle = nullptr;
 
-    ch->get_io_service().post([ch = ch->shared_from_this()] {
+    ch->_scheduler.post_to_ios(ch->_strand, [ch = ch->shared_from_this()] {
             auto flush = [] (auto f, auto... args) {
                 if (f) f(asio::error::connection_reset, args...);
             };
 
+            ch->_ended = true;
+            ch->cancel_deadlines();
+
             flush(move(ch->_on_receive), 0);
+            flush(move(ch->_on_take), vector<uint8_t>());
             flush(move(ch->_on_send));
             flush(move(ch->_on_connect));
+            flush(move(ch->_on_readable));
+            flush(move(ch->_on_writable));
+            flush(move(ch->_on_peek), Channel::Views());
         });
 }
 
@@ -236,9 +704,15 @@ void ChannelImpl::connect_window_change( void *cls
 {
     auto ch = static_cast<ChannelImpl*>(cls);
 
-    ch->get_io_service().post([ch = ch->shared_from_this()] {
+    ch->_window.store(window_size, memory_order_relaxed);
+
+    ch->_scheduler.post_to_ios(ch->_strand, [ch = ch->shared_from_this()] {
             if (!ch->_on_connect) return;
+            ch->_connect_duration.store( chrono::steady_clock::now()
+                                       - ch->_connect_start
+                                       , memory_order_relaxed);
             auto f = move(ch->_on_connect);
+            ch->opened();
             f(sys::error_code());
         });
 }
@@ -254,10 +728,68 @@ asio::io_service& ChannelImpl::get_io_service()
 }
 
 void ChannelImpl::close()
+{
+    // The object is kept alive until this is done.
+    _strand.dispatch([self = shared_from_this()] {
+            self->do_close();
+        });
+}
+
+void ChannelImpl::replaced()
+{
+    _service_stats->channels_created.fetch_sub(1, memory_order_relaxed);
+}
+
+void ChannelImpl::hand_over(shared_ptr<ChannelImpl> next)
+{
+    replaced();
+
+    // Posted right away, so that settings made on `next` from now on are
+    // applied after these.
+    _scheduler.post([self = shared_from_this(), next] () mutable {
+            next->_send_weight   = self->_send_weight;
+            next->_send_limit    = self->_send_limit;
+            next->_receive_limit = self->_receive_limit;
+            next->_receive_bucket.set(self->_receive_limit);
+
+            if (next->_handle) next->apply_send_settings();
+
+            preserve(move(self));
+            preserve(move(next));
+        });
+
+    for (auto c : { &ChannelCounters::send_rate_limit
+                  , &ChannelCounters::receive_rate_limit }) {
+        (next->_stats.*c).store( (_stats.*c).load(memory_order_relaxed)
+                               , memory_order_relaxed);
+    }
+
+    _strand.dispatch([self = shared_from_this(), next = move(next)] {
+            auto take = [] (auto& f) { auto r = move(f); f = nullptr; return r; };
+
+            next->set_deadlines(self->_deadlines);
+
+            if (self->_on_receive) {
+                next->receive(move(self->_output), take(self->_on_receive));
+            }
+
+            if (self->_on_take)     next->take(take(self->_on_take));
+            if (self->_on_readable) next->wait_readable(take(self->_on_readable));
+            if (self->_on_writable) next->wait_writable(take(self->_on_writable));
+            if (self->_on_peek)     next->peek(take(self->_on_peek));
+
+            self->do_close();
+        });
+}
+
+void ChannelImpl::do_close()
 {
     if (!_cadet) return; // Already closed.
 
-    auto& ios = get_io_service();
+    cancel_deadlines();
+    _reaper->remove(*this);
+
+    auto& ios = _strand;
 
     if (_on_send) {
         ios.post(bind(move(_on_send), asio::error::operation_aborted));
@@ -267,17 +799,47 @@ void ChannelImpl::close()
         ios.post(bind(move(_on_receive), asio::error::operation_aborted, 0));
     }
 
+    if (_on_connect) {
+        ios.post(bind(move(_on_connect), asio::error::operation_aborted));
+    }
+
+    if (_on_take) {
+        ios.post(bind(move(_on_take), asio::error::operation_aborted, vector<uint8_t>()));
+    }
+
+    for (auto* w : { &_on_readable, &_on_writable }) {
+        if (*w) ios.post(bind(move(*w), asio::error::operation_aborted));
+    }
+
+    if (_on_peek) {
+        ios.post(bind(move(_on_peek), asio::error::operation_aborted, Channel::Views()));
+    }
+
     while (!_send_queue.empty()) {
         auto e = _send_queue.front();
         _send_queue.pop();
+        uncount(&ChannelCounters::send_queue_depth, 1);
+        uncount(&ChannelCounters::send_queue_bytes, e.size());
         ios.post(bind(move(e.on_send), asio::error::operation_aborted, 0));
     }
 
+    while (!_recv_queue.empty()) {
+        auto& b = _recv_queue.front();
+        uncount(&ChannelCounters::recv_queue_bytes, asio::buffer_size(b.info));
+        Pool::instance().release_buffer(move(b.data));
+        _recv_queue.pop_front();
+        message_consumed();
+    }
+
+    _service_stats->channels_open.fetch_sub(1, memory_order_relaxed);
+
     _scheduler.post([ s = shared_from_this()
                     , c = move(_cadet)
                     ] () mutable {
             if (s->_handle) {
-                GNUNET_CADET_channel_destroy(s->_handle);
+                s->_send_scheduler->remove(*s);
+                cancel(s->_receive_done_task);
+                s->_transport->channel_destroy(s->_handle);
                 s->_handle = nullptr;
             }
 
@@ -286,6 +848,212 @@ void ChannelImpl::close()
         });
 }
 
+void ChannelImpl::set_deadlines(Deadlines d)
+{
+    _strand.dispatch([self = shared_from_this(), d] {
+            self->_deadlines = d;
+
+            auto reset = [&] (TimerWheel::Entry& e, Deadlines::Duration t, bool active) {
+                if (active && t.count()) self->arm(e, t);
+                else self->_timers->cancel(e);
+            };
+
+            // Already pending operations get the new deadlines from now.
+            reset(self->_read_deadline,  d.read,  self->reading());
+            reset(self->_write_deadline, d.write, self->_on_send || self->_on_writable);
+            reset(self->_idle_deadline,  d.idle,  self->_opened);
+        });
+}
+
+void ChannelImpl::arm(TimerWheel::Entry& e, Deadlines::Duration timeout)
+{
+    if (!_cadet || timeout.count() == 0) return;
+    _timers->arm(e, timeout);
+}
+
+bool ChannelImpl::reading() const
+{
+    return _on_receive || _on_take || _on_readable || _on_peek;
+}
+
+// Executed by the wheel with its lock held, can't be done anywhere else
+// than in the strand. The object is alive until `close` cancels the
+// entries, which needs the lock.
+void ChannelImpl::expired(TimerWheel::Entry& e)
+{
+    _strand.post([self = shared_from_this(), &e] {
+            self->deadline_expired(e);
+        });
+}
+
+void ChannelImpl::deadline_expired(TimerWheel::Entry& e)
+{
+    // Closed, or re-armed by an operation started since.
+    if (!_cadet || _timers->armed(e)) return;
+
+    if (&e == &_keepalive) return send_keepalive();
+
+    sys::error_code ec = asio::error::timed_out;
+    bool timed_out = &e == &_idle_deadline;
+    bool reclaim   = &e == &_reclaim_deadline;
+
+    auto fail = [&] (auto& f, auto... args) {
+        if (!f) return;
+        timed_out = true;
+        auto h = move(f);
+        h(ec, args...);
+    };
+
+    if (&e != &_write_deadline) {
+        fail(_on_receive, 0);
+        fail(_on_take, vector<uint8_t>());
+        fail(_on_readable);
+        fail(_on_peek, Channel::Views());
+    }
+
+    if (&e != &_read_deadline) {
+        if (_on_send) {
+            // The data is already on its way to CADET, let it finish
+            // (and the queued writes follow) unless we're closing.
+            auto f = move(_on_send);
+            _on_send = [] (auto) {};
+            timed_out = true;
+            f(ec);
+        }
+
+        fail(_on_writable);
+    }
+
+    if (reclaim) {
+        _service_stats->channels_idle_closed.fetch_add(1, memory_order_relaxed);
+        return do_close();
+    }
+
+    if (timed_out && _deadlines.close) do_close();
+}
+
+void ChannelImpl::cancel_deadlines()
+{
+    for (auto* e : { &_read_deadline
+                   , &_write_deadline
+                   , &_idle_deadline
+                   , &_reclaim_deadline
+                   , &_keepalive }) {
+        _timers->cancel(*e);
+    }
+}
+
+void ChannelImpl::evict()
+{
+    _service_stats->channels_evicted.fetch_add(1, memory_order_relaxed);
+    close();
+}
+
+void ChannelImpl::idle_options_changed()
+{
+    _strand.dispatch([self = shared_from_this()] {
+            self->active(Activity::opened);
+        });
+}
+
+void ChannelImpl::opened()
+{
+    if (!_cadet || _opened) return;
+
+    _opened = true;
+    _reaper->add(*this);
+
+    arm(_idle_deadline, _deadlines.idle);
+    active(Activity::opened);
+}
+
+void ChannelImpl::active(Activity a)
+{
+    if (!_opened) return;
+
+    bool data = a == Activity::sent || a == Activity::received;
+
+    auto o = data ? _reaper->touch(*this) : _reaper->options();
+
+    auto rearm = [&] (TimerWheel::Entry& e, IdleOptions::Duration t) {
+        if (t.count()) arm(e, t);
+        else _timers->cancel(e);
+    };
+
+    if (data) arm(_idle_deadline, _deadlines.idle);
+
+    rearm(_reclaim_deadline, o.timeout);
+
+    if (a == Activity::sent || a == Activity::opened) {
+        rearm(_keepalive, o.keepalive);
+    }
+}
+
+void ChannelImpl::send_keepalive()
+{
+    // Our own probes don't restart the idle timeout, only the other side's.
+    auto t = _reaper->options().keepalive;
+    if (t.count()) arm(_keepalive, t);
+
+    // Anything being sent tells the other side as much.
+    if (_on_send || _ended) return;
+
+    _scheduler.post([self = shared_from_this()] () mutable {
+            if (self->_handle) {
+                GNUNET_MessageHeader *msg;
+                GNUNET_MQ_Envelope *env
+                    = GNUNET_MQ_msg_extra(msg, 0, MESSAGE_TYPE_KEEPALIVE);
+
+                self->count(&ChannelCounters::keepalives_sent, 1);
+                GNUNET_MQ_send(self->_transport->get_mq(self->_handle), env);
+            }
+            preserve(move(self));
+        });
+}
+
+void ChannelImpl::set_send_weight(uint32_t weight)
+{
+    _scheduler.post([self = shared_from_this(), weight] () mutable {
+            self->_send_weight = weight;
+            if (self->_handle) {
+                self->_send_scheduler->set_weight(*self, weight);
+            }
+            preserve(move(self));
+        });
+}
+
+void ChannelImpl::set_send_limit(RateLimit l)
+{
+    _stats.send_rate_limit.store(l.bytes_per_second, memory_order_relaxed);
+
+    _scheduler.post([self = shared_from_this(), l] () mutable {
+            self->_send_limit = l;
+            if (self->_handle) {
+                self->_send_scheduler->set_limit(*self, l);
+            }
+            preserve(move(self));
+        });
+}
+
+void ChannelImpl::set_receive_limit(RateLimit l)
+{
+    _stats.receive_rate_limit.store(l.bytes_per_second, memory_order_relaxed);
+
+    _scheduler.post([self = shared_from_this(), l] () mutable {
+            self->_receive_limit = l;
+            self->_receive_bucket.set(l);
+            preserve(move(self));
+        });
+}
+
+ChannelStats ChannelImpl::stats() const
+{
+    auto s = snapshot(_stats);
+    s.window = _window.load(memory_order_relaxed);
+    s.connect_duration = _connect_duration.load(memory_order_relaxed);
+    return s;
+}
+
 ChannelImpl::~ChannelImpl()
 {
     // Make sure the `close` method was called explicitly.
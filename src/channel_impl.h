@@ -2,16 +2,29 @@
 
 #include <gnunet/platform.h>
 #include "cadet.h"
+#include "channel_policy.h"
+#include "pool.h"
+#include "timer_wheel.h"
+#include "stats.h"
 #include <gnunet_channels/namespaces.h>
 #include <gnunet_channels/channel.h>
 
 namespace gnunet_channels {
 
-class ChannelImpl : public std::enable_shared_from_this<ChannelImpl> {
+// CADET message type of the keepalive probes (see IdleOptions), the data
+// goes in GNUNET_MESSAGE_TYPE_CADET_CLI messages. Picked from the top of
+// the 16 bit range, away from GNUnet's own types.
+static const uint16_t MESSAGE_TYPE_KEEPALIVE = 65000;
+
+class ChannelImpl : public std::enable_shared_from_this<ChannelImpl>
+                  , private SendScheduler::Flow {
 public:
     using OnConnect = std::function<void(sys::error_code)>;
     using OnReceive = std::function<void(sys::error_code, size_t)>;
     using OnSend    = std::function<void(sys::error_code, size_t)>;
+    using OnTake    = std::function<void(sys::error_code, std::vector<uint8_t>)>;
+    using OnWait    = std::function<void(sys::error_code)>;
+    using OnPeek    = Channel::OnPeek;
 
 private:
     struct Buffer {
@@ -28,51 +41,266 @@ private:
 
     struct SendEntry {
         std::vector<uint8_t> data;
+        // When set, `view` is sent instead of `data` and this keeps the
+        // memory behind it alive (e.g. a payload shared with other channels
+        // or a mapped file).
+        std::shared_ptr<const void> keepalive;
+        asio::const_buffer view;
         OnSend on_send;
+
+        asio::const_buffer buffer() const {
+            return keepalive ? view : asio::buffer(data);
+        }
+
+        size_t size() const { return asio::buffer_size(buffer()); }
+    };
+
+    // What's being sent right now, only touched in GNUnet's thread.
+    struct Outgoing {
+        std::vector<uint8_t> data;
+        std::shared_ptr<const void> keepalive;
+        asio::const_buffer rest;   // Not yet put into envelopes
     };
 
+    using Policy = DefaultChannelPolicy;
+
+    template<class T>
+    using Deque = Policy::Deque<T>;
+
+    template<class T>
+    using Queue = Policy::Queue<T>;
+
 public:
     ChannelImpl(std::shared_ptr<Cadet>);
 
+    // Allocates the object (together with the shared_ptr's control
+    // block) as the Policy says, from the Pool by default. Prefer this
+    // over make_shared.
+    static std::shared_ptr<ChannelImpl> create(std::shared_ptr<Cadet>);
+
     Scheduler& scheduler();
     asio::io_service& get_io_service();
 
-    void connect( std::string target_id
-                , const std::string& shared_secret
-                , OnConnect);
+    void connect(PeerId, PortHash, OnConnect);
 
+    // These may be called from any thread running the io_service, the
+    // work is dispatched to the channel's strand. The handlers are always
+    // executed in the strand.
     void send(std::vector<uint8_t>, OnSend);
+    // Sends `view` without copying it first, `keepalive` is released
+    // once all of it is in envelopes.
+    void send(std::shared_ptr<const void> keepalive, asio::const_buffer view, OnSend);
     void receive(std::vector<asio::mutable_buffer>, OnReceive);
+    // Hands over the next received message (or what's left of it) without
+    // copying. The buffer comes from the Pool, give it back once done.
+    void take(OnTake);
     void close();
 
+    // Moves everything set up on this (not yet connected) channel to
+    // `next`: deadlines, send weight and limits and pending waits and
+    // reads. Then closes this one.
+    void hand_over(std::shared_ptr<ChannelImpl> next);
+
+    // This (not yet connected) impl of a Channel is being replaced by
+    // another one, which is then the one counted as created.
+    void replaced();
+
+    // Complete once there is something to read, resp. once no send is in
+    // progress (or the channel failed).
+    void wait_readable(OnWait);
+    void wait_writable(OnWait);
+
+    // Non-blocking versions of `receive` and `send`, to be called in the
+    // strand. `try_send` must only follow a successful `can_send`.
+    size_t try_receive(asio::mutable_buffer, sys::error_code&);
+    bool can_send(sys::error_code&) const;
+    void try_send(std::vector<uint8_t>);
+
+    // Completes with views() once the receive queue isn't empty. The
+    // views themselves and `consume` are to be used in the strand.
+    void peek(OnPeek);
+    Channel::Views views() const;
+    void consume(size_t);
+
+    // Hands the buffered messages to `append` one by one, releasing what it
+    // took, until the queue is empty, `append` takes less than it was given
+    // or `stop` is set. Returns the number of bytes taken. In the strand.
+    size_t drain(const Channel::Append& append, const bool& stop);
+
+    // Expired operations complete with `timed_out`, see Deadlines.
+    void set_deadlines(Deadlines);
+
+    // Relative share of the CADET handle's bandwidth this channel gets
+    // when other channels are sending too (see SendScheduler).
+    void set_send_weight(uint32_t);
+    void set_send_limit(RateLimit);
+    void set_receive_limit(RateLimit);
+
+    ChannelStats stats() const;
+
+    // Serializes everything touching the state below which isn't marked
+    // as GNUnet's thread only, so that the io_service may be run by more
+    // than one thread. Just the io_service when built for a single one
+    // (see channel_policy.h).
+    Policy::Executor& strand() { return _strand; }
+
     ~ChannelImpl();
 
 private:
     friend class CadetPort;
+    friend class ChannelReaper;
     friend class ::gnunet_channels::Channel;
 
+    // What restarts the idle timeouts, see `active`.
+    enum class Activity { opened, sent, received, probed };
+
     static void  handle_data(void *cls, const GNUNET_MessageHeader*);
+    static void  handle_keepalive(void *cls, const GNUNET_MessageHeader*);
     static int   check_data(void *cls, const GNUNET_MessageHeader*);
     static void  connect_channel_ended(void *cls, const GNUNET_CADET_Channel*);
     static void  connect_window_change(void *cls, const GNUNET_CADET_Channel*, int);
     static void* channel_incoming(void *, GNUNET_CADET_Channel*, const GNUNET_PeerIdentity*);
     static void  data_sent(void *cls);
 
-    void do_send(std::vector<uint8_t>, OnSend);
+    friend class Broadcast;
+
+    void send(SendEntry);
+    void do_connect(PeerId, PortHash);
+    void do_receive(std::vector<asio::mutable_buffer>, OnReceive);
+    void do_take(OnTake);
+    void do_close();
+    // Copies from the first message of the receive queue, popping it once
+    // fully read.
+    template<class Buffers> size_t read_front(const Buffers&);
+    // Drops `n` bytes from the first message of the receive queue.
+    void advance_front(size_t n);
+    // Why the channel can't be used any more, if so.
+    sys::error_code failure() const;
+    // These are executed in the strand. Arming is a no-op for a zero
+    // duration or a closed channel.
+    void arm(TimerWheel::Entry&, Deadlines::Duration);
+    bool reading() const;
+    void expired(TimerWheel::Entry&);
+    void deadline_expired(TimerWheel::Entry&);
+    void cancel_deadlines();
+
+    // These are used by the ChannelReaper, from any thread.
+    void evict();
+    void idle_options_changed();
+
+    // In the strand, once connected or accepted: from then on the channel
+    // counts against the Service's IdleOptions and its idle timeouts run.
+    void opened();
+    // In the strand: restarts the idle deadline and the Service's idle
+    // timeout, and (if sending or just opened) the keepalive interval.
+    // Nothing until the channel is opened.
+    void active(Activity);
+    void send_keepalive();
+    // Queues the entry if another send is in progress.
+    bool queue_if_busy(SendEntry&);
+    // Sets _on_send from the entry's handler, the entry's data is then
+    // to be emitted in GNUnet's thread.
+    void start_send(SendEntry&);
+    void do_send(SendEntry);
+
+    // These are executed in GNUnet's thread.
+    void transmit(std::vector<uint8_t>, std::shared_ptr<const void>, asio::const_buffer);
+    size_t next_size() const override;
+    void emit() override;
+    void paced() override;
+    void finish_send();
+    static void envelope_sent(void *cls);
+
+    // Called in the strand once a received message has been fully
+    // read by the application.
+    void message_consumed();
+
+    // Executed in GNUnet's thread. Calls GNUNET_CADET_receive_done now or,
+    // if over the receive limits, once those allow it.
+    void receive_done();
+    static void receive_done_timer(void *cls);
+
+    // Executed in GNUnet's thread once _handle is set, hands the send
+    // settings made before that to the SendScheduler.
+    void apply_send_settings();
+
+    using Counter = ChannelCounters::Counter;
+
+    // Update this channel's counter together with the service's one.
+    void count(Counter ChannelCounters::*c, uint64_t n) {
+        (_stats.*c).fetch_add(n, std::memory_order_relaxed);
+        ((*_service_stats).*c).fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void uncount(Counter ChannelCounters::*c, uint64_t n) {
+        (_stats.*c).fetch_sub(n, std::memory_order_relaxed);
+        ((*_service_stats).*c).fetch_sub(n, std::memory_order_relaxed);
+    }
+
 private:
+    Policy::Executor _strand;
+
     OnConnect _on_connect;
     OnReceive _on_receive;
+    OnTake    _on_take;
+    OnWait    _on_readable;
+    OnWait    _on_writable;
+    OnPeek    _on_peek;
     std::function<void(sys::error_code)> _on_send;
+    // Set in the strand once CADET ended the channel.
+    bool _ended = false;
+    // Set in the strand once connected or accepted, see `opened`.
+    bool _opened = false;
+
+    // Deadlines and the wheel entries tracking them, armed in the strand.
+    Deadlines _deadlines;
+    std::shared_ptr<TimerWheel> _timers;
+    TimerWheel::Entry _read_deadline;
+    TimerWheel::Entry _write_deadline;
+    TimerWheel::Entry _idle_deadline;
+    // Same for the Service's IdleOptions.
+    TimerWheel::Entry _reclaim_deadline;
+    TimerWheel::Entry _keepalive;
+
+    std::shared_ptr<ChannelReaper> _reaper;
+    // Guarded by the _reaper's mutex.
+    ChannelReaper::List::iterator _lru_pos;
+    bool _in_lru = false;
 
     // This one is mutable and can only be modified (and read) inside the
     // GNUnet's thread.
     GNUNET_CADET_Channel* _handle = nullptr;
     std::shared_ptr<Cadet> _cadet;
     Scheduler& _scheduler;
+    // Owned by _cadet. Only used in GNUnet's thread while _handle is set,
+    // at which point the _cadet is still alive.
+    Transport* _transport;
+    // Same as above.
+    SendScheduler* _send_scheduler;
+    TokenBucket* _service_receive_bucket;
+    TokenBucket _receive_bucket;
+    GNUNET_SCHEDULER_Task* _receive_done_task = nullptr;
+    // Also only in GNUnet's thread, kept for when the handle is set.
+    uint32_t _send_weight = 1;
+    RateLimit _send_limit;
+    RateLimit _receive_limit;
 
-    std::queue<Buffer> _recv_queue;
-    std::queue<SendEntry> _send_queue;
+    // A deque rather than a queue so that peek can iterate it.
+    Deque<Buffer> _recv_queue;
+    Queue<SendEntry> _send_queue;
+    Outgoing _out;
     std::vector<asio::mutable_buffer> _output;
+
+    ChannelCounters _stats;
+    std::shared_ptr<ServiceCounters> _service_stats;
+    std::atomic<int> _window{0};
+    // Set in GNUnet's thread when it didn't call GNUNET_CADET_receive_done
+    // because the application still has unread messages. The main thread
+    // calls it once the last of those messages is read.
+    std::atomic<bool> _receive_done_pending{false};
+    std::chrono::steady_clock::time_point _connect_start;
+    std::atomic<std::chrono::steady_clock::duration> _connect_duration{
+        std::chrono::steady_clock::duration(0)};
 };
 
 } // gnunet_channels namespace
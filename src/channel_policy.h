@@ -0,0 +1,77 @@
+#pragma once
+
+#include <deque>
+#include <utility>
+#include <queue>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/io_service_strand.hpp>
+#include <gnunet_channels/namespaces.h>
+#include "pool.h"
+
+namespace gnunet_channels {
+
+//--------------------------------------------------------------------
+// Threading policies, they decide what serializes the work of a channel
+// done in the main thread(s). GNUnet's thread is there either way, so
+// what's shared with it (reference counts, counters, the Scheduler's
+// queue) stays thread safe under both.
+
+// The io_service may be run by any number of threads, each channel's
+// handlers go through the channel's own strand.
+struct MultiThreaded {
+    using Executor = asio::io_service::strand;
+};
+
+// The io_service is run by a single thread, which already serializes
+// everything, so the channel's handlers go straight to the io_service
+// without taking the strand's lock and queue. Dispatching from that
+// thread runs the handler right away, same as a strand dispatching from
+// within itself.
+struct SingleThreaded {
+    class Executor {
+    public:
+        explicit Executor(asio::io_service& ios) : _ios(ios) {}
+
+        asio::io_service& get_io_service() { return _ios; }
+
+        template<class F> void dispatch(F&& f) { _ios.dispatch(std::forward<F>(f)); }
+        template<class F> void post(F&& f)     { _ios.post(std::forward<F>(f)); }
+
+    private:
+        asio::io_service& _ios;
+    };
+};
+
+//--------------------------------------------------------------------
+// Buffer strategies, where a channel and its queues get their memory.
+
+// Recycled through the Pool (see PoolAllocator).
+struct PooledBuffers {
+    template<class T> using Allocator = PoolAllocator<T>;
+};
+
+//--------------------------------------------------------------------
+// The types a ChannelImpl is built from. Which policy it uses is picked at
+// build time (see GNUNET_CHANNELS_SINGLE_THREADED in CMakeLists.txt), the
+// default being the one which works with any number of threads.
+template<class Threading, class Buffers>
+struct ChannelPolicy {
+    using Executor = typename Threading::Executor;
+
+    template<class T>
+    using Allocator = typename Buffers::template Allocator<T>;
+
+    template<class T>
+    using Deque = std::deque<T, Allocator<T>>;
+
+    template<class T>
+    using Queue = std::queue<T, Deque<T>>;
+};
+
+#if GNUNET_CHANNELS_SINGLE_THREADED
+using DefaultChannelPolicy = ChannelPolicy<SingleThreaded, PooledBuffers>;
+#else
+using DefaultChannelPolicy = ChannelPolicy<MultiThreaded, PooledBuffers>;
+#endif
+
+} // gnunet_channels namespace
@@ -0,0 +1,83 @@
+#include "channel_reaper.h"
+#include "channel_impl.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+IdleOptions ChannelReaper::options() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _options;
+}
+
+void ChannelReaper::set_options(IdleOptions o)
+{
+    vector<shared_ptr<ChannelImpl>> evicted, kept;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+
+        _options = o;
+
+        while (o.max_channels && _lru.size() > o.max_channels) {
+            auto ch = _lru.back();
+            _lru.pop_back();
+            ch->_in_lru = false;
+            evicted.push_back(ch->shared_from_this());
+        }
+
+        kept.reserve(_lru.size());
+        for (auto ch : _lru) kept.push_back(ch->shared_from_this());
+    }
+
+    // Not under the lock, closing removes the channel from the list.
+    for (auto& ch : evicted) ch->evict();
+    for (auto& ch : kept)    ch->idle_options_changed();
+}
+
+void ChannelReaper::add(ChannelImpl& ch)
+{
+    shared_ptr<ChannelImpl> evicted;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+
+        _lru.push_front(&ch);
+        ch._lru_pos = _lru.begin();
+        ch._in_lru  = true;
+
+        if (_options.max_channels && _lru.size() > _options.max_channels) {
+            auto victim = _lru.back();
+            _lru.pop_back();
+            victim->_in_lru = false;
+            evicted = victim->shared_from_this();
+        }
+    }
+
+    if (evicted) evicted->evict();
+}
+
+IdleOptions ChannelReaper::touch(ChannelImpl& ch)
+{
+    lock_guard<mutex> lock(_mutex);
+
+    if (ch._in_lru) _lru.splice(_lru.begin(), _lru, ch._lru_pos);
+
+    return _options;
+}
+
+void ChannelReaper::remove(ChannelImpl& ch)
+{
+    lock_guard<mutex> lock(_mutex);
+
+    if (!ch._in_lru) return;
+
+    _lru.erase(ch._lru_pos);
+    ch._in_lru = false;
+}
+
+size_t ChannelReaper::size() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _lru.size();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <gnunet_channels/idle.h>
+
+namespace gnunet_channels {
+
+class ChannelImpl;
+
+// Open channels of a Service in least recently used order, together with
+// the Service's IdleOptions. ChannelImpls add themselves once connected or
+// accepted and remove themselves when closed, in between they're moved to
+// the front whenever they send or receive data. May be used from any
+// thread.
+class ChannelReaper {
+public:
+    using List = std::list<ChannelImpl*>;
+
+public:
+    ChannelReaper() = default;
+
+    ChannelReaper(const ChannelReaper&) = delete;
+    ChannelReaper& operator=(const ChannelReaper&) = delete;
+
+    IdleOptions options() const;
+
+    // Open channels over the new limit are closed, the others restart
+    // their idle timeouts.
+    void set_options(IdleOptions);
+
+    // Closes the least recently used channel if this one makes too many.
+    void add(ChannelImpl&);
+
+    // Returns the options too, saving the channel a second lock.
+    IdleOptions touch(ChannelImpl&);
+
+    void remove(ChannelImpl&);
+
+    size_t size() const;
+
+private:
+    mutable std::mutex _mutex;
+    IdleOptions _options;
+    List _lru;   // Most recently used first
+};
+
+} // gnunet_channels namespace
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace gnunet_channels {
+
+// Hands values over from any number of threads to a single consumer
+// without a lock. Producers push onto an atomic list, the consumer takes
+// all of it at once (so it never races a producer over a node) and gets
+// it back in the order it was pushed.
+template<class T>
+class HandoffQueue {
+    struct Node {
+        T value;
+        Node* next;
+    };
+
+public:
+    // What one `take_all` got, values are popped in the order pushed.
+    class Batch {
+    public:
+        Batch(Batch&& other) : _first(other._first) { other._first = nullptr; }
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+        bool empty() const { return !_first; }
+
+        T pop() {
+            auto n = _first;
+            _first = n->next;
+            T v = std::move(n->value);
+            delete n;
+            return v;
+        }
+
+        // Whatever wasn't popped is dropped.
+        ~Batch() { while (!empty()) pop(); }
+
+    private:
+        friend class HandoffQueue;
+        explicit Batch(Node* first) : _first(first) {}
+
+        Node* _first;
+    };
+
+public:
+    HandoffQueue() = default;
+
+    HandoffQueue(const HandoffQueue&) = delete;
+    HandoffQueue& operator=(const HandoffQueue&) = delete;
+
+    // From any thread. Returns true if the queue was empty, in which case
+    // the consumer may need waking up.
+    bool push(T value) {
+        auto n = new Node{std::move(value), _head.load(std::memory_order_relaxed)};
+
+        while (!_head.compare_exchange_weak( n->next, n
+                                           , std::memory_order_release
+                                           , std::memory_order_relaxed)) {}
+
+        return n->next == nullptr;
+    }
+
+    // From the consumer's thread only.
+    Batch take_all() {
+        Node* n = _head.exchange(nullptr, std::memory_order_acquire);
+
+        // Pushed last is first in the list.
+        Node* first = nullptr;
+
+        while (n) {
+            auto next = n->next;
+            n->next = first;
+            first = n;
+            n = next;
+        }
+
+        return Batch(first);
+    }
+
+    ~HandoffQueue() { take_all(); }
+
+private:
+    std::atomic<Node*> _head{nullptr};
+};
+
+} // gnunet_channels namespace
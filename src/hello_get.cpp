@@ -28,14 +28,14 @@ void HelloGet::run(Handler h)
                 static void call(void* ctx, const GNUNET_MessageHeader* hello)
                 {
                     auto t = static_cast<Task*>(ctx);
-                    auto& ios = t->s->get_io_service();
+                    auto& scheduler = t->s->_scheduler;
 
                     GNUNET_TRANSPORT_hello_get_cancel(t->get);
                     t->get = nullptr;
 
                     auto m = (GNUNET_HELLO_Message*) GNUNET_copy_message(hello);
 
-                    ios.post([t, m = move(m)]() mutable {
+                    scheduler.post_to_ios([t, m = move(m)]() mutable {
                             auto h = move(t->h);
                             delete t;
                             h(HelloMessage(m));
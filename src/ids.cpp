@@ -0,0 +1,92 @@
+#include <cstring>
+#include <mutex>
+#include <gnunet_channels/error.h>
+#include "ids.h"
+#include "lru_cache.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+// Most applications talk to only a handful of peers on a handful of ports,
+// so the caches don't need to be big.
+static const size_t cache_capacity = 64;
+
+PeerId PeerId::from_string(const string& s, sys::error_code& ec)
+{
+    GNUNET_PeerIdentity pid;
+
+    if (GNUNET_OK !=
+        GNUNET_CRYPTO_eddsa_public_key_from_string( s.c_str()
+                                                  , s.size()
+                                                  , &pid.public_key)) {
+        ec = error::invalid_target_id;
+        return PeerId();
+    }
+
+    return from_gnunet(pid);
+}
+
+PeerId PeerId::from_string(const string& s)
+{
+    sys::error_code ec;
+    auto ret = from_string(s, ec);
+    if (ec) throw sys::system_error(ec);
+    return ret;
+}
+
+string PeerId::to_string() const
+{
+    auto pid = to_gnunet(*this);
+    char* s = GNUNET_CRYPTO_eddsa_public_key_to_string(&pid.public_key);
+    string ret(s);
+    GNUNET_free(s);
+    return ret;
+}
+
+PortHash PortHash::from_secret(const string& secret)
+{
+    GNUNET_HashCode hash;
+    GNUNET_CRYPTO_hash(secret.c_str(), secret.size(), &hash);
+
+    PortHash::Bytes bytes;
+    memcpy(bytes.data(), &hash, bytes.size());
+    return PortHash(bytes);
+}
+
+PeerId gnunet_channels::cached_peer_id(const string& s, sys::error_code& ec)
+{
+    static mutex m;
+    static LruCache<string, PeerId> cache(cache_capacity);
+
+    {
+        lock_guard<mutex> lock(m);
+        if (auto id = cache.find(s)) return *id;
+    }
+
+    auto id = PeerId::from_string(s, ec);
+
+    // Don't cache invalid ids, a misbehaving caller could otherwise
+    // flush the valid ones.
+    if (ec) return id;
+
+    lock_guard<mutex> lock(m);
+    cache.insert(s, id);
+    return id;
+}
+
+PortHash gnunet_channels::cached_port_hash(const string& secret)
+{
+    static mutex m;
+    static LruCache<string, PortHash> cache(cache_capacity);
+
+    {
+        lock_guard<mutex> lock(m);
+        if (auto hash = cache.find(secret)) return *hash;
+    }
+
+    auto hash = PortHash::from_secret(secret);
+
+    lock_guard<mutex> lock(m);
+    cache.insert(secret, hash);
+    return hash;
+}
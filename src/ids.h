@@ -0,0 +1,45 @@
+#pragma once
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_util_lib.h>
+#include <gnunet_channels/peer_id.h>
+
+namespace gnunet_channels {
+
+static_assert( sizeof(GNUNET_PeerIdentity) == sizeof(PeerId::Bytes)
+             , "PeerId size mismatch");
+
+static_assert( sizeof(GNUNET_HashCode) == sizeof(PortHash::Bytes)
+             , "PortHash size mismatch");
+
+inline
+GNUNET_PeerIdentity to_gnunet(const PeerId& id)
+{
+    GNUNET_PeerIdentity ret;
+    memcpy(&ret, id.bytes().data(), sizeof(ret));
+    return ret;
+}
+
+inline
+GNUNET_HashCode to_gnunet(const PortHash& hash)
+{
+    GNUNET_HashCode ret;
+    memcpy(&ret, hash.bytes().data(), sizeof(ret));
+    return ret;
+}
+
+inline
+PeerId from_gnunet(const GNUNET_PeerIdentity& pid)
+{
+    PeerId::Bytes bytes;
+    memcpy(bytes.data(), &pid, bytes.size());
+    return PeerId(bytes);
+}
+
+// Thread safe cached versions of PeerId::from_string and
+// PortHash::from_secret used by the string overloads of
+// `Channel::connect` and `CadetPort::open`.
+PeerId   cached_peer_id(const std::string&, sys::error_code&);
+PortHash cached_port_hash(const std::string&);
+
+} // gnunet_channels namespace
@@ -0,0 +1,93 @@
+#include "latency_histogram.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+constexpr unsigned LatencyHistogram::sub_bits;
+constexpr unsigned LatencyHistogram::sub_count;
+constexpr unsigned LatencyHistogram::bucket_count;
+
+size_t LatencyHistogram::index_of(uint64_t v)
+{
+    if (v < sub_count) return v;
+
+    unsigned magnitude = 63 - __builtin_clzll(v);
+    unsigned shift = magnitude - sub_bits;
+    size_t sub = (v >> shift) - sub_count;
+
+    return sub_count + shift * sub_count + sub;
+}
+
+uint64_t LatencyHistogram::value_of(size_t i)
+{
+    if (i < sub_count) return i;
+
+    unsigned shift = (i - sub_count) / sub_count;
+    uint64_t sub = (i - sub_count) % sub_count;
+    uint64_t lowest = (sub_count + sub) << shift;
+
+    return lowest + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(chrono::nanoseconds d)
+{
+    uint64_t v = d.count() > 0 ? d.count() : 0;
+
+    _buckets[index_of(v)].fetch_add(1, memory_order_relaxed);
+    _count.fetch_add(1, memory_order_relaxed);
+    _sum.fetch_add(v, memory_order_relaxed);
+
+    uint64_t max = _max.load(memory_order_relaxed);
+    while (v > max && !_max.compare_exchange_weak(max, v, memory_order_relaxed)) {}
+}
+
+uint64_t LatencyHistogram::percentile(double q) const
+{
+    uint64_t total = 0;
+
+    for (auto& b : _buckets) total += b.load(memory_order_relaxed);
+
+    if (total == 0) return 0;
+
+    uint64_t rank = uint64_t(q * total + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < bucket_count; ++i) {
+        seen += _buckets[i].load(memory_order_relaxed);
+        if (seen >= rank) {
+            return min(value_of(i), _max.load(memory_order_relaxed));
+        }
+    }
+
+    return _max.load(memory_order_relaxed);
+}
+
+LatencyStats LatencyHistogram::summary() const
+{
+    using chrono::nanoseconds;
+
+    LatencyStats s;
+
+    s.count = _count.load(memory_order_relaxed);
+
+    if (s.count == 0) return s;
+
+    s.mean = nanoseconds(_sum.load(memory_order_relaxed) / s.count);
+    s.p50  = nanoseconds(percentile(0.5));
+    s.p90  = nanoseconds(percentile(0.9));
+    s.p99  = nanoseconds(percentile(0.99));
+    s.p999 = nanoseconds(percentile(0.999));
+    s.max  = nanoseconds(_max.load(memory_order_relaxed));
+
+    return s;
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto& b : _buckets) b.store(0, memory_order_relaxed);
+    _count.store(0, memory_order_relaxed);
+    _sum.store(0, memory_order_relaxed);
+    _max.store(0, memory_order_relaxed);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <gnunet_channels/stats.h>
+
+namespace gnunet_channels {
+
+// Lock free log-linear histogram of nanosecond durations, in the spirit of
+// HdrHistogram: each power of two is split into `sub_count` linear buckets,
+// so any recorded value is known to within 1/sub_count (~6%).
+class LatencyHistogram {
+public:
+    void record(std::chrono::nanoseconds);
+
+    LatencyStats summary() const;
+
+    // Not atomic with respect to concurrent `record` calls, a few samples
+    // may survive (or get lost in) the reset.
+    void reset();
+
+private:
+    static constexpr unsigned sub_bits     = 4;
+    static constexpr unsigned sub_count    = 1 << sub_bits;
+    static constexpr unsigned bucket_count = sub_count + (64 - sub_bits) * sub_count;
+
+    static size_t index_of(uint64_t);
+    // Highest value falling into the bucket.
+    static uint64_t value_of(size_t);
+
+    uint64_t percentile(double) const;
+
+private:
+    std::array<std::atomic<uint64_t>, bucket_count> _buckets = {};
+    std::atomic<uint64_t> _count{0};
+    std::atomic<uint64_t> _sum{0};
+    std::atomic<uint64_t> _max{0};
+};
+
+} // gnunet_channels namespace
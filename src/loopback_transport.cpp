@@ -0,0 +1,496 @@
+#include <algorithm>
+#include "loopback_transport.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+struct LoopbackTransport::Port {
+    LoopbackTransport* owner;
+    GNUNET_HashCode hash;
+    GNUNET_CADET_ConnectEventHandler connects;
+    void* connects_cls;
+    GNUNET_CADET_WindowSizeEventHandler window_changes;
+    GNUNET_CADET_DisconnectEventHandler disconnects;
+    std::vector<GNUNET_MQ_MessageHandler> handlers;
+};
+
+struct LoopbackTransport::Endpoint {
+    LoopbackTransport* owner;
+    uint64_t id;
+    uint64_t peer = 0;
+
+    void* cls = nullptr;
+    vector<GNUNET_MQ_MessageHandler> handlers;
+    GNUNET_CADET_WindowSizeEventHandler window_changes = nullptr;
+    GNUNET_CADET_DisconnectEventHandler disconnects = nullptr;
+    GNUNET_MQ_Handle* mq = nullptr;
+
+    bool connected = false;
+    // Messages we may still send before the peer calls receive_done.
+    int window = 0;
+
+    // Message handed to us by the MQ which didn't go out yet.
+    Message outgoing;
+    bool has_outgoing = false;
+    bool transmitting = false;
+
+    deque<Message> inbox;
+    // A message was given to the handlers, waiting for receive_done.
+    bool delivering = false;
+    // The peer is gone, report it once the inbox is drained.
+    bool ended = false;
+
+    GNUNET_CADET_Channel* handle() {
+        return reinterpret_cast<GNUNET_CADET_Channel*>(this);
+    }
+
+    static Endpoint* from(const GNUNET_CADET_Channel* ch) {
+        return reinterpret_cast<Endpoint*>(const_cast<GNUNET_CADET_Channel*>(ch));
+    }
+
+    void set_cls(void* c) {
+        cls = c;
+        for (auto& h : handlers) if (h.cb) h.cls = c;
+    }
+};
+
+//--------------------------------------------------------------------
+// Shared by the instances living in one GNUnet thread, that is the
+// handles of one Service. Each Service has a thread of its own, so
+// nothing here is ever touched from two threads and no callback runs in
+// another Service's thread.
+namespace {
+    struct Registry {
+        uint64_t next_id = 1;
+        vector<LoopbackTransport*> transports;
+        map<uint64_t, void*> endpoints;
+    };
+
+    Registry& registry() {
+        static thread_local Registry r;
+        return r;
+    }
+}
+
+LoopbackTransport::Endpoint* LoopbackTransport::find(uint64_t id)
+{
+    auto& eps = registry().endpoints;
+    auto i = eps.find(id);
+    if (i == eps.end()) return nullptr;
+    return static_cast<Endpoint*>(i->second);
+}
+
+//--------------------------------------------------------------------
+LoopbackTransport::LoopbackTransport( LoopbackOptions options
+                                    , const GNUNET_PeerIdentity& identity)
+    : _options(options)
+    , _identity(identity)
+{
+    registry().transports.push_back(this);
+}
+
+LoopbackTransport::Endpoint*
+LoopbackTransport::make_endpoint( void* cls
+                                , GNUNET_CADET_WindowSizeEventHandler window_changes
+                                , GNUNET_CADET_DisconnectEventHandler disconnects
+                                , const GNUNET_MQ_MessageHandler* handlers)
+{
+    auto ep = make_unique<Endpoint>();
+
+    ep->owner          = this;
+    ep->id             = registry().next_id++;
+    ep->window_changes = window_changes;
+    ep->disconnects    = disconnects;
+
+    for (auto h = handlers; h; ++h) {
+        ep->handlers.push_back(*h);
+        if (!h->cb) break;
+    }
+
+    ep->set_cls(cls);
+
+    ep->mq = GNUNET_MQ_queue_for_callbacks( mq_send
+                                          , mq_destroy
+                                          , mq_cancel
+                                          , ep.get()
+                                          , NULL
+                                          , NULL
+                                          , NULL);
+
+    auto ret = ep.get();
+    registry().endpoints[ret->id] = ret;
+    _endpoints[ret->id] = move(ep);
+    return ret;
+}
+
+GNUNET_CADET_Channel*
+LoopbackTransport::channel_create( void* channel_cls
+                                 , const GNUNET_PeerIdentity*
+                                 , const GNUNET_HashCode* port
+                                 , GNUNET_CADET_WindowSizeEventHandler window_changes
+                                 , GNUNET_CADET_DisconnectEventHandler disconnects
+                                 , const GNUNET_MQ_MessageHandler* handlers)
+{
+    auto ep = make_endpoint(channel_cls, window_changes, disconnects, handlers);
+
+    schedule( Clock::now() + _options.latency
+            , [this, id = ep->id, port = *port] { arrive_request(id, port); });
+
+    return ep->handle();
+}
+
+void LoopbackTransport::arrive_request(uint64_t initiator_id, GNUNET_HashCode hash)
+{
+    auto initiator = find(initiator_id);
+    if (!initiator) return;
+
+    Port* port = nullptr;
+
+    for (auto t : registry().transports) {
+        for (auto& p : t->_ports) {
+            if (memcmp(&p->hash, &hash, sizeof(hash)) == 0) {
+                port = p.get();
+                break;
+            }
+        }
+        if (port) break;
+    }
+
+    if (!port) {
+        // Nobody listening, CADET would eventually give up as well.
+        return schedule( Clock::now() + _options.latency
+                       , [this, initiator_id] { arrive_end(initiator_id); });
+    }
+
+    auto acceptor = port->owner->make_endpoint( nullptr
+                                              , port->window_changes
+                                              , port->disconnects
+                                              , port->handlers.data());
+
+    acceptor->peer      = initiator_id;
+    acceptor->connected = true;
+    acceptor->window    = _options.window;
+    initiator->peer     = acceptor->id;
+
+    acceptor->set_cls(port->connects( port->connects_cls
+                                    , acceptor->handle()
+                                    , &_identity));
+
+    schedule( Clock::now() + _options.latency
+            , [this, initiator_id] { arrive_ack(initiator_id); });
+}
+
+void LoopbackTransport::arrive_ack(uint64_t id)
+{
+    auto ep = find(id);
+    if (!ep) return;
+
+    ep->connected = true;
+    ep->window    = _options.window;
+
+    if (ep->window_changes) {
+        ep->window_changes(ep->cls, ep->handle(), ep->window);
+    }
+
+    try_transmit(*ep);
+}
+
+void LoopbackTransport::channel_destroy(GNUNET_CADET_Channel* ch)
+{
+    destroy(*Endpoint::from(ch), true);
+}
+
+GNUNET_MQ_Handle* LoopbackTransport::get_mq(GNUNET_CADET_Channel* ch)
+{
+    return Endpoint::from(ch)->mq;
+}
+
+//--------------------------------------------------------------------
+// Sending
+void LoopbackTransport::mq_send( GNUNET_MQ_Handle*
+                               , const GNUNET_MessageHeader* msg
+                               , void* impl_state)
+{
+    auto ep = static_cast<Endpoint*>(impl_state);
+    auto begin = reinterpret_cast<const uint8_t*>(msg);
+
+    ep->outgoing.assign(begin, begin + ntohs(msg->size));
+    ep->has_outgoing = true;
+
+    ep->owner->try_transmit(*ep);
+}
+
+void LoopbackTransport::mq_destroy(GNUNET_MQ_Handle*, void*)
+{
+    // The endpoint owns the MQ, not the other way around.
+}
+
+void LoopbackTransport::mq_cancel(GNUNET_MQ_Handle*, void* impl_state)
+{
+    auto ep = static_cast<Endpoint*>(impl_state);
+    ep->has_outgoing = false;
+    ep->outgoing.clear();
+}
+
+LoopbackTransport::Clock::time_point LoopbackTransport::transmit(size_t size)
+{
+    auto start = max(Clock::now(), _wire_free);
+
+    Clock::duration duration(0);
+
+    if (_options.bandwidth) {
+        duration = chrono::duration_cast<Clock::duration>(
+                chrono::duration<double>(double(size) / _options.bandwidth));
+    }
+
+    _wire_free = start + duration;
+    return _wire_free;
+}
+
+void LoopbackTransport::try_transmit(Endpoint& ep)
+{
+    if (!ep.has_outgoing || ep.transmitting) return;
+    if (!ep.connected || ep.window <= 0) return;
+
+    --ep.window;
+    ep.transmitting = true;
+    ep.has_outgoing = false;
+
+    auto sent = transmit(ep.outgoing.size());
+
+    schedule(sent, [this, id = ep.id] { message_sent(id); });
+
+    schedule( sent + _options.latency
+            , [this, peer = ep.peer, m = move(ep.outgoing)] () mutable {
+                  arrive_message(peer, move(m));
+              });
+
+    ep.outgoing = Message();
+}
+
+void LoopbackTransport::message_sent(uint64_t id)
+{
+    auto ep = find(id);
+    if (!ep) return;
+
+    ep->transmitting = false;
+
+    // Fires the envelope's notify_sent callback and hands us the next
+    // message (if any) through mq_send.
+    GNUNET_MQ_impl_send_continue(ep->mq);
+}
+
+void LoopbackTransport::arrive_credit(uint64_t id)
+{
+    auto ep = find(id);
+    if (!ep) return;
+
+    ++ep->window;
+
+    if (ep->window_changes) {
+        ep->window_changes(ep->cls, ep->handle(), ep->window);
+    }
+
+    try_transmit(*ep);
+}
+
+//--------------------------------------------------------------------
+// Receiving
+void LoopbackTransport::arrive_message(uint64_t id, Message m)
+{
+    auto ep = find(id);
+    if (!ep) return;
+
+    ep->inbox.push_back(move(m));
+    deliver_next(*ep);
+}
+
+void LoopbackTransport::deliver_next(Endpoint& ep)
+{
+    if (ep.delivering) return;
+
+    if (ep.inbox.empty()) {
+        if (ep.ended) end(ep);
+        return;
+    }
+
+    // Like CADET, hand out one message at a time until receive_done.
+    ep.delivering = true;
+
+    auto m = move(ep.inbox.front());
+    ep.inbox.pop_front();
+
+    GNUNET_MQ_handle_message( ep.handlers.data()
+                            , reinterpret_cast<GNUNET_MessageHeader*>(m.data()));
+}
+
+void LoopbackTransport::receive_done(GNUNET_CADET_Channel* ch)
+{
+    auto ep = Endpoint::from(ch);
+    auto now = Clock::now();
+
+    ep->delivering = false;
+
+    if (ep->peer) {
+        schedule( now + _options.latency
+                , [this, peer = ep->peer] { arrive_credit(peer); });
+    }
+
+    // Not directly, we may be inside the message handler.
+    schedule(now, [this, id = ep->id] {
+            if (auto ep = find(id)) deliver_next(*ep);
+        });
+}
+
+//--------------------------------------------------------------------
+// Tear down
+void LoopbackTransport::arrive_end(uint64_t id)
+{
+    auto ep = find(id);
+    if (!ep) return;
+
+    ep->ended = true;
+    ep->peer  = 0;
+
+    if (!ep->delivering && ep->inbox.empty()) end(*ep);
+}
+
+void LoopbackTransport::end(Endpoint& ep)
+{
+    // Same as CADET, the handle is invalid once the callback returns.
+    if (ep.disconnects) ep.disconnects(ep.cls, ep.handle());
+    destroy(ep, false);
+}
+
+void LoopbackTransport::destroy(Endpoint& ep, bool notify_peer)
+{
+    if (notify_peer && ep.peer) {
+        // Don't overtake data which is still on the wire.
+        auto at = max(Clock::now(), _wire_free) + _options.latency;
+        schedule(at, [this, peer = ep.peer] { arrive_end(peer); });
+    }
+
+    GNUNET_MQ_destroy(ep.mq);
+
+    auto id = ep.id;
+    auto owner = ep.owner;
+
+    registry().endpoints.erase(id);
+    owner->_endpoints.erase(id);
+}
+
+//--------------------------------------------------------------------
+// Ports
+GNUNET_CADET_Port*
+LoopbackTransport::open_port( const GNUNET_HashCode* hash
+                            , GNUNET_CADET_ConnectEventHandler connects
+                            , void* connects_cls
+                            , GNUNET_CADET_WindowSizeEventHandler window_changes
+                            , GNUNET_CADET_DisconnectEventHandler disconnects
+                            , const GNUNET_MQ_MessageHandler* handlers)
+{
+    for (auto t : registry().transports) {
+        for (auto& p : t->_ports) {
+            if (memcmp(&p->hash, hash, sizeof(*hash)) == 0) {
+                return nullptr; // Already open
+            }
+        }
+    }
+
+    // Like CADET, copy the handlers, the caller's array may be temporary.
+    vector<GNUNET_MQ_MessageHandler> hs;
+
+    for (auto h = handlers; h; ++h) {
+        hs.push_back(*h);
+        if (!h->cb) break;
+    }
+
+    _ports.push_back(unique_ptr<Port>(new Port{ this
+                                              , *hash
+                                              , connects
+                                              , connects_cls
+                                              , window_changes
+                                              , disconnects
+                                              , move(hs) }));
+
+    return reinterpret_cast<GNUNET_CADET_Port*>(_ports.back().get());
+}
+
+void LoopbackTransport::close_port(GNUNET_CADET_Port* port)
+{
+    auto p = reinterpret_cast<Port*>(port);
+
+    _ports.erase(remove_if( _ports.begin(), _ports.end()
+                          , [p] (auto& e) { return e.get() == p; })
+                , _ports.end());
+}
+
+//--------------------------------------------------------------------
+// Events
+void LoopbackTransport::schedule(Clock::time_point at, function<void()> f)
+{
+    _events.emplace(at, move(f));
+    rearm();
+}
+
+void LoopbackTransport::rearm()
+{
+    if (_events.empty()) return;
+
+    auto at = _events.begin()->first;
+
+    if (_timer) {
+        if (_timer_at <= at) return;
+        GNUNET_SCHEDULER_cancel(_timer);
+    }
+
+    auto delay = chrono::duration_cast<chrono::microseconds>(at - Clock::now());
+
+    _timer_at = at;
+    _timer = GNUNET_SCHEDULER_add_delayed
+                ( GNUNET_TIME_relative_multiply( GNUNET_TIME_UNIT_MICROSECONDS
+                                               , max<int64_t>(0, delay.count()))
+                , on_timer
+                , this);
+}
+
+void LoopbackTransport::on_timer(void* cls)
+{
+    auto self = static_cast<LoopbackTransport*>(cls);
+    self->_timer = nullptr;
+
+    auto now = Clock::now();
+    auto& events = self->_events;
+
+    while (!events.empty() && events.begin()->first <= now) {
+        auto f = move(events.begin()->second);
+        events.erase(events.begin());
+        f();
+    }
+
+    self->rearm();
+}
+
+//--------------------------------------------------------------------
+LoopbackTransport::~LoopbackTransport()
+{
+    if (_timer) GNUNET_SCHEDULER_cancel(_timer);
+
+    auto& ts = registry().transports;
+    ts.erase(remove(ts.begin(), ts.end(), this), ts.end());
+
+    while (!_endpoints.empty()) {
+        auto& ep = *_endpoints.begin()->second;
+
+        // Our event queue is going away, so notify peers living in other
+        // transports through theirs.
+        if (auto peer = find(ep.peer)) {
+            if (peer->owner != this) {
+                auto o = peer->owner;
+                o->schedule(Clock::now(), [o, id = peer->id] { o->arrive_end(id); });
+            }
+        }
+
+        destroy(ep, false);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+#include <gnunet_channels/loopback.h>
+#include "transport.h"
+
+namespace gnunet_channels {
+
+// In-process emulation of the CADET client API with the same channel
+// create, MQ send, window change and channel ended semantics, plus
+// configurable latency, bandwidth and window. Used for deterministic
+// tests and benchmarks of the library's own overhead.
+//
+// Everything happens in GNUnet's thread: the instances of that thread
+// (the handles of one Service) share one registry of ports, so channels
+// created on one of them may land on a port opened on another. Instances
+// of other Services, running in threads of their own, are out of reach.
+class LoopbackTransport : public Transport {
+    using Clock = std::chrono::steady_clock;
+    using Message = std::vector<uint8_t>;
+
+    struct Port;
+    struct Endpoint;
+
+public:
+    LoopbackTransport(LoopbackOptions, const GNUNET_PeerIdentity&);
+
+    LoopbackTransport(const LoopbackTransport&) = delete;
+    LoopbackTransport& operator=(const LoopbackTransport&) = delete;
+
+    GNUNET_CADET_Channel*
+    channel_create( void* channel_cls
+                  , const GNUNET_PeerIdentity*
+                  , const GNUNET_HashCode*
+                  , GNUNET_CADET_WindowSizeEventHandler
+                  , GNUNET_CADET_DisconnectEventHandler
+                  , const GNUNET_MQ_MessageHandler*) override;
+
+    void channel_destroy(GNUNET_CADET_Channel*) override;
+
+    GNUNET_MQ_Handle* get_mq(GNUNET_CADET_Channel*) override;
+
+    void receive_done(GNUNET_CADET_Channel*) override;
+
+    GNUNET_CADET_Port*
+    open_port( const GNUNET_HashCode*
+             , GNUNET_CADET_ConnectEventHandler
+             , void* connects_cls
+             , GNUNET_CADET_WindowSizeEventHandler
+             , GNUNET_CADET_DisconnectEventHandler
+             , const GNUNET_MQ_MessageHandler*) override;
+
+    void close_port(GNUNET_CADET_Port*) override;
+
+    ~LoopbackTransport();
+
+private:
+    Endpoint* make_endpoint( void* cls
+                           , GNUNET_CADET_WindowSizeEventHandler
+                           , GNUNET_CADET_DisconnectEventHandler
+                           , const GNUNET_MQ_MessageHandler*);
+
+    // Event handlers, `id`s refer to endpoints which may have been
+    // destroyed in the mean time.
+    void arrive_request(uint64_t initiator, GNUNET_HashCode port);
+    void arrive_ack(uint64_t id);
+    void arrive_message(uint64_t id, Message);
+    void arrive_credit(uint64_t id);
+    void arrive_end(uint64_t id);
+    void message_sent(uint64_t id);
+
+    void try_transmit(Endpoint&);
+    void deliver_next(Endpoint&);
+    void destroy(Endpoint&, bool notify_peer);
+    void end(Endpoint&);
+
+    Endpoint* find(uint64_t id);
+
+    static void mq_send(GNUNET_MQ_Handle*, const GNUNET_MessageHeader*, void*);
+    static void mq_destroy(GNUNET_MQ_Handle*, void*);
+    static void mq_cancel(GNUNET_MQ_Handle*, void*);
+
+    // Runs `f` once the time `at` has come.
+    void schedule(Clock::time_point at, std::function<void()> f);
+    void rearm();
+    static void on_timer(void*);
+
+    // When would a message of the given size arriving now reach the other
+    // side, and when would its transmission end.
+    Clock::time_point transmit(size_t size);
+
+private:
+    LoopbackOptions _options;
+    GNUNET_PeerIdentity _identity;
+
+    std::map<uint64_t, std::unique_ptr<Endpoint>> _endpoints;
+    std::vector<std::unique_ptr<Port>> _ports;
+
+    // The simulated tunnel is busy transmitting until this time.
+    Clock::time_point _wire_free;
+
+    std::multimap<Clock::time_point, std::function<void()>> _events;
+    GNUNET_SCHEDULER_Task* _timer = nullptr;
+    Clock::time_point _timer_at;
+};
+
+} // gnunet_channels namespace
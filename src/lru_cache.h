@@ -0,0 +1,61 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+namespace gnunet_channels {
+
+// A small least-recently-used map. Not thread safe.
+template<class Key, class Value>
+class LruCache {
+    using Entry = std::pair<Key, Value>;
+    using List  = std::list<Entry>;
+
+public:
+    LruCache(size_t capacity) : _capacity(capacity) {}
+
+    // Returns nullptr if the key isn't cached.
+    const Value* find(const Key&);
+
+    void insert(Key, Value);
+
+    size_t size() const { return _list.size(); }
+
+private:
+    size_t _capacity;
+    List _list;
+    std::unordered_map<Key, typename List::iterator> _map;
+};
+
+//--------------------------------------------------------------------
+template<class Key, class Value>
+const Value* LruCache<Key, Value>::find(const Key& key)
+{
+    auto i = _map.find(key);
+    if (i == _map.end()) return nullptr;
+    // Move the entry to the front.
+    _list.splice(_list.begin(), _list, i->second);
+    return &i->second->second;
+}
+
+template<class Key, class Value>
+void LruCache<Key, Value>::insert(Key key, Value value)
+{
+    auto i = _map.find(key);
+
+    if (i != _map.end()) {
+        i->second->second = std::move(value);
+        _list.splice(_list.begin(), _list, i->second);
+        return;
+    }
+
+    if (_list.size() >= _capacity && !_list.empty()) {
+        _map.erase(_list.back().first);
+        _list.pop_back();
+    }
+
+    _list.emplace_front(key, std::move(value));
+    _map.emplace(std::move(key), _list.begin());
+}
+
+} // gnunet_channels namespace
@@ -0,0 +1,73 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+static sys::error_code last_error()
+{
+    return sys::error_code(errno, sys::system_category());
+}
+
+shared_ptr<MappedFile> MappedFile::open(const string& path, sys::error_code& ec)
+{
+    shared_ptr<MappedFile> f(new MappedFile());
+
+    f->_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f->_fd == -1) { ec = last_error(); return nullptr; }
+
+    struct stat st;
+    if (fstat(f->_fd, &st) == -1) { ec = last_error(); return nullptr; }
+
+    f->_size = st.st_size;
+
+    if (!f->map(PROT_READ, ec)) return nullptr;
+
+    // The file is going to be read front to back exactly once.
+    if (f->_data) madvise(f->_data, f->_size, MADV_SEQUENTIAL);
+
+    return f;
+}
+
+shared_ptr<MappedFile> MappedFile::create( const string& path
+                                         , size_t size
+                                         , sys::error_code& ec)
+{
+    shared_ptr<MappedFile> f(new MappedFile());
+
+    f->_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (f->_fd == -1) { ec = last_error(); return nullptr; }
+
+    if (ftruncate(f->_fd, size) == -1) { ec = last_error(); return nullptr; }
+
+    f->_size = size;
+
+    if (!f->map(PROT_READ | PROT_WRITE, ec)) return nullptr;
+
+    return f;
+}
+
+bool MappedFile::map(int prot, sys::error_code& ec)
+{
+    // Zero length mappings are not allowed.
+    if (_size == 0) return true;
+
+    void* p = mmap(nullptr, _size, prot, MAP_SHARED, _fd, 0);
+
+    if (p == MAP_FAILED) {
+        ec = last_error();
+        return false;
+    }
+
+    _data = p;
+    return true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data) munmap(_data, _size);
+    if (_fd != -1) ::close(_fd);
+}
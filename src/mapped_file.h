@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <boost/asio/buffer.hpp>
+#include <boost/system/error_code.hpp>
+#include <gnunet_channels/namespaces.h>
+
+namespace gnunet_channels {
+
+// A whole file mapped into memory, unmapped (and closed) on destruction.
+class MappedFile {
+public:
+    // Maps an existing file for reading.
+    static std::shared_ptr<MappedFile> open(const std::string& path, sys::error_code&);
+
+    // Creates (or truncates) the file, resizes it to `size` and maps it
+    // for writing.
+    static std::shared_ptr<MappedFile> create( const std::string& path
+                                             , size_t size
+                                             , sys::error_code&);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    size_t size() const { return _size; }
+
+    asio::const_buffer   data() const   { return asio::const_buffer(_data, _size); }
+    asio::mutable_buffer data()         { return asio::mutable_buffer(_data, _size); }
+
+    ~MappedFile();
+
+private:
+    MappedFile() = default;
+
+    bool map(int prot, sys::error_code&);
+
+private:
+    int _fd = -1;
+    void* _data = nullptr;
+    size_t _size = 0;
+};
+
+} // gnunet_channels namespace
@@ -0,0 +1,102 @@
+#include <new>
+#include "pool.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+Pool& Pool::instance()
+{
+    // Intentionally leaked: blocks may still be returned during static
+    // destruction.
+    static Pool* pool = new Pool();
+    return *pool;
+}
+
+size_t Pool::class_of(size_t size)
+{
+    size_t c = 0;
+    size_t block = size_t(1) << min_shift;
+
+    while (block < size) {
+        block <<= 1;
+        if (++c == class_count) break;
+    }
+
+    return c;
+}
+
+void* Pool::allocate(size_t size)
+{
+    auto c = class_of(size);
+
+    if (c == class_count) {
+        return ::operator new(size);
+    }
+
+    auto& list = _classes[c];
+
+    {
+        lock_guard<mutex> lock(list.mutex);
+
+        if (!list.blocks.empty()) {
+            void* p = list.blocks.back();
+            list.blocks.pop_back();
+            _recycled.fetch_add(1, memory_order_relaxed);
+            return p;
+        }
+    }
+
+    _fresh.fetch_add(1, memory_order_relaxed);
+    return ::operator new(size_t(1) << (c + min_shift));
+}
+
+void Pool::deallocate(void* p, size_t size)
+{
+    auto c = class_of(size);
+
+    if (c != class_count) {
+        auto& list = _classes[c];
+        lock_guard<mutex> lock(list.mutex);
+
+        if (list.blocks.size() < max_free) {
+            list.blocks.push_back(p);
+            return;
+        }
+    }
+
+    ::operator delete(p);
+}
+
+vector<uint8_t> Pool::acquire_buffer()
+{
+    lock_guard<mutex> lock(_buffers_mutex);
+
+    if (_buffers.empty()) return vector<uint8_t>();
+
+    auto ret = move(_buffers.back());
+    _buffers.pop_back();
+    return ret;
+}
+
+void Pool::release_buffer(vector<uint8_t>&& buffer)
+{
+    if (buffer.capacity() == 0 || buffer.capacity() > max_capacity) {
+        return;
+    }
+
+    buffer.clear();
+
+    lock_guard<mutex> lock(_buffers_mutex);
+
+    if (_buffers.size() < max_buffers) {
+        _buffers.push_back(move(buffer));
+    }
+}
+
+Pool::Stats Pool::stats() const
+{
+    Stats s;
+    s.fresh    = _fresh.load(memory_order_relaxed);
+    s.recycled = _recycled.load(memory_order_relaxed);
+    return s;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace gnunet_channels {
+
+// Recycles small memory blocks and payload buffers. What gets allocated
+// here is usually created in one thread (e.g. a ChannelImpl for an incoming
+// channel is created in GNUnet's thread) and freed in the other, so the
+// free lists are guarded by mutexes.
+class Pool {
+public:
+    struct Stats {
+        uint64_t fresh    = 0; // Blocks that had to come from operator new
+        uint64_t recycled = 0; // Blocks served from a free list
+    };
+
+public:
+    static Pool& instance();
+
+    void* allocate(size_t);
+    void deallocate(void*, size_t);
+
+    // Returns an empty vector, possibly with capacity left over from
+    // its previous use.
+    std::vector<uint8_t> acquire_buffer();
+    void release_buffer(std::vector<uint8_t>&&);
+
+    Stats stats() const;
+
+private:
+    Pool() = default;
+
+    static constexpr size_t min_shift     = 5; // 32 bytes
+    static constexpr size_t class_count   = 8; // ... up to 4096 bytes
+    static constexpr size_t max_free      = 4096;
+    static constexpr size_t max_buffers   = 1024;
+    static constexpr size_t max_capacity  = 64 * 1024;
+
+    struct FreeList {
+        std::mutex mutex;
+        std::vector<void*> blocks;
+    };
+
+    // Returns class_count if the size is too big to be pooled.
+    static size_t class_of(size_t size);
+
+private:
+    std::array<FreeList, class_count> _classes;
+
+    std::mutex _buffers_mutex;
+    std::vector<std::vector<uint8_t>> _buffers;
+
+    std::atomic<uint64_t> _fresh{0};
+    std::atomic<uint64_t> _recycled{0};
+};
+
+// Standard allocator backed by the Pool. Used with `allocate_shared` so
+// that the ChannelImpl and its control block land in a recycled block, and
+// with the containers inside ChannelImpl.
+template<class T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template<class U> PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(Pool::instance().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        Pool::instance().deallocate(p, n * sizeof(T));
+    }
+
+    template<class U> bool operator==(const PoolAllocator<U>&) const { return true; }
+    template<class U> bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+} // gnunet_channels namespace
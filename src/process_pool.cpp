@@ -0,0 +1,1157 @@
+#include <array>
+#include <deque>
+#include <list>
+#include <map>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet_channels/process_pool.h>
+#include <gnunet_channels/cadet_port.h>
+#include <gnunet_channels/channel.h>
+#include <gnunet_channels/error.h>
+#include <gnunet_channels/service.h>
+#include "shm_ring.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Besides the data rings of each slot, the front and every worker talk
+// through a pair of control rings carrying these records, each followed by
+// `size` bytes of text.
+namespace {
+    enum Op : uint32_t {
+        // Front -> worker
+        LISTEN = 1, // text: shared secret
+        CONNECT,    // request, text: target id '\0' shared secret
+        CLOSE,      // slot
+        // Worker -> front
+        READY,      // text: identity, or the error setting up failed with
+        CONNECTED,  // request, slot or error
+        ACCEPTED,   // slot
+        ENDED,      // slot, error the worker's channel failed with
+    };
+
+    struct Record {
+        uint32_t op;
+        uint32_t slot;
+        uint32_t request;
+        int32_t  value;    // Error code...
+        uint32_t category; // ...and its category, see encode/decode
+        uint32_t size;
+    };
+
+    enum Dir { to_worker = 0, to_front = 1 };
+
+    constexpr size_t control_ring_size = 64 * 1024;
+    constexpr size_t min_ring_size = 4096;
+
+    // Asking the channel for more than this at once gains nothing.
+    constexpr size_t max_read_size = 64 * 1024;
+
+    void encode(const sys::error_code& ec, Record& r)
+    {
+        r.value = ec.value();
+
+        if (!ec) {
+            r.category = 0;
+        }
+        else if (ec.category() == asio::error::get_misc_category()) {
+            r.category = 2;
+        }
+        else if (ec.category() == error::make_error_code(error::malformed_frame).category()) {
+            r.category = 3;
+        }
+        else {
+            r.category = 1;
+        }
+    }
+
+    sys::error_code decode(const Record& r)
+    {
+        switch (r.category) {
+            case 0:  return sys::error_code();
+            case 2:  return sys::error_code(r.value, asio::error::get_misc_category());
+            case 3:  return error::make_error_code(error::error_t(r.value));
+            default: return sys::error_code(r.value, sys::system_category());
+        }
+    }
+
+    size_t round_up_pow2(size_t n)
+    {
+        size_t r = min_ring_size;
+        while (r < n) r <<= 1;
+        return r;
+    }
+
+    // Where the rings are in the memory shared with one worker.
+    struct Layout {
+        Layout(const ProcessPoolOptions& o)
+            : slots(o.slots_per_worker)
+            , ring_size(round_up_pow2(o.ring_size))
+        {}
+
+        size_t control(Dir d) const {
+            return d * ShmRing::footprint(control_ring_size);
+        }
+
+        size_t ring(size_t slot, Dir d) const {
+            return 2 * ShmRing::footprint(control_ring_size)
+                 + (2 * slot + d) * ShmRing::footprint(ring_size);
+        }
+
+        size_t total() const { return ring(slots, to_worker); }
+
+        size_t slots;
+        size_t ring_size;
+    };
+
+    // The same mapping is seen by both processes at the same address since
+    // it's made before forking.
+    struct Link {
+        Link(Layout l) : layout(l) {}
+
+        bool map(sys::error_code& ec) {
+            void* p = mmap( nullptr, layout.total(), PROT_READ | PROT_WRITE
+                          , MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+            if (p == MAP_FAILED) {
+                ec = sys::error_code(errno, sys::system_category());
+                return false;
+            }
+
+            base = static_cast<uint8_t*>(p);
+
+            ShmRing::construct(base + layout.control(to_worker), control_ring_size);
+            ShmRing::construct(base + layout.control(to_front),  control_ring_size);
+
+            for (size_t i = 0; i < layout.slots; ++i) {
+                ShmRing::construct(base + layout.ring(i, to_worker), layout.ring_size);
+                ShmRing::construct(base + layout.ring(i, to_front),  layout.ring_size);
+            }
+
+            return true;
+        }
+
+        void unmap() {
+            if (!base) return;
+            munmap(base, layout.total());
+            base = nullptr;
+        }
+
+        ShmRing& control(Dir d) {
+            return *reinterpret_cast<ShmRing*>(base + layout.control(d));
+        }
+
+        ShmRing& ring(size_t slot, Dir d) {
+            return *reinterpret_cast<ShmRing*>(base + layout.ring(slot, d));
+        }
+
+        Layout layout;
+        uint8_t* base = nullptr;
+    };
+
+    // Records which didn't fit into the control ring yet, sent in order as
+    // the other side makes room.
+    struct Outbox {
+        void send(ShmRing& r, Record rec, string text) {
+            rec.size = text.size();
+            _queue.emplace_back(rec, move(text));
+            flush(r);
+        }
+
+        void flush(ShmRing& r) {
+            while (!_queue.empty()) {
+                auto& e = _queue.front();
+                if (r.writable() < sizeof(Record) + e.second.size()) return;
+
+                // One commit, so the reader never sees half a record.
+                array<asio::const_buffer, 2> bufs{{ asio::buffer(&e.first, sizeof(Record))
+                                                  , asio::buffer(e.second) }};
+                r.write(bufs);
+                _queue.pop_front();
+            }
+        }
+
+    private:
+        deque<pair<Record, string>> _queue;
+    };
+
+    bool receive(ShmRing& r, Record& rec, string& text)
+    {
+        if (r.readable() < sizeof(Record)) return false;
+
+        asio::buffer_copy(asio::buffer(&rec, sizeof(rec)), r.data(sizeof(rec)));
+
+        if (r.readable() < sizeof(Record) + rec.size) return false;
+
+        r.consume(sizeof(rec));
+        text.resize(rec.size);
+        r.read(asio::buffer(&text[0], text.size()));
+
+        return true;
+    }
+
+    // Wakes up the other end. It only needs to know that something
+    // changed, so a full socket buffer is as good as a sent byte.
+    void ring_bell(int fd)
+    {
+        char c = 0;
+        ::send(fd, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+} // anonymous namespace
+
+//--------------------------------------------------------------------
+// Everything below up to ProcessPool::Impl runs in the forked worker.
+class ProcessPool::WorkerProcess {
+    struct Slot {
+        unique_ptr<Channel> channel;
+        bool used       = false;
+        bool connecting = false;
+        bool reading    = false;
+        bool writing    = false;
+        bool ended      = false; // ENDED was sent
+        bool closing    = false; // Freed once nothing is in flight
+    };
+
+    struct Listener {
+        string secret;
+        unique_ptr<CadetPort> port;
+        unique_ptr<Channel> next;
+    };
+
+public:
+    WorkerProcess(const string& config, Link link, int fd)
+        : _service(config, _ios)
+        , _link(link)
+        , _fd(fd)
+        , _bell(_ios, fd)
+        , _slots(link.layout.slots)
+    {}
+
+    int run();
+
+private:
+    void wait_bell();
+    void on_bell();
+    void handle(const Record&, const string&);
+    void listen(const string& secret);
+    void accept_next(Listener&);
+    void connect(uint32_t request, const string& target, const string& secret);
+    void pump(uint32_t slot);
+    void ended(uint32_t slot, sys::error_code);
+    void close(uint32_t slot);
+    void maybe_free(uint32_t slot);
+    int  allocate();
+    void send(Record, string = string());
+    void notify();
+    void shutdown();
+
+    ShmRing& ring(uint32_t slot, Dir d) { return _link.ring(slot, d); }
+
+private:
+    asio::io_service _ios;
+    Service _service;
+    Link _link;
+    int _fd;
+    asio::posix::stream_descriptor _bell;
+    array<char, 256> _bell_buf;
+    vector<Slot> _slots;
+    list<Listener> _listeners;
+    Outbox _outbox;
+    bool _notify_posted = false;
+    bool _stopping = false;
+    int _exit_code = 0;
+};
+
+int ProcessPool::WorkerProcess::run()
+{
+    _service.async_setup([this] (sys::error_code ec) {
+            if (_stopping) return;
+
+            Record r{READY, 0, 0, 0, 0, 0};
+            encode(ec, r);
+
+            if (ec) {
+                _exit_code = 1;
+                send(r);
+                // The notification posted by `send` wouldn't ring any more.
+                ring_bell(_fd);
+                return shutdown();
+            }
+
+            send(r, _service.identity());
+        });
+
+    wait_bell();
+
+    _ios.run();
+
+    return _exit_code;
+}
+
+void ProcessPool::WorkerProcess::wait_bell()
+{
+    _bell.async_read_some(asio::buffer(_bell_buf), [this] (sys::error_code ec, size_t) {
+            // The front closed its end: it's stopping the pool or is gone.
+            if (ec) return shutdown();
+            on_bell();
+            wait_bell();
+        });
+}
+
+void ProcessPool::WorkerProcess::on_bell()
+{
+    auto& commands = _link.control(to_worker);
+
+    Record r;
+    string text;
+    bool consumed = false;
+
+    while (!_stopping && receive(commands, r, text)) {
+        consumed = true;
+        handle(r, text);
+    }
+
+    _outbox.flush(_link.control(to_front));
+
+    for (uint32_t i = 0; i < _slots.size(); ++i) {
+        if (_slots[i].used) pump(i);
+    }
+
+    // The front may be waiting for room in the control ring.
+    if (consumed) notify();
+}
+
+void ProcessPool::WorkerProcess::handle(const Record& r, const string& text)
+{
+    switch (r.op) {
+        case LISTEN:
+            return listen(text);
+        case CONNECT: {
+            auto nul = text.find('\0');
+            if (nul == string::npos) return;
+            return connect(r.request, text.substr(0, nul), text.substr(nul + 1));
+        }
+        case CLOSE:
+            if (r.slot < _slots.size()) close(r.slot);
+            return;
+    }
+}
+
+void ProcessPool::WorkerProcess::listen(const string& secret)
+{
+    _listeners.emplace_back();
+
+    auto& l = _listeners.back();
+    l.secret = secret;
+    l.port = make_unique<CadetPort>(_service);
+
+    accept_next(l);
+}
+
+void ProcessPool::WorkerProcess::accept_next(Listener& l)
+{
+    l.next = make_unique<Channel>(_service);
+
+    l.port->open_impl(*l.next, l.secret, [this, &l] (sys::error_code ec) {
+            // Without a usable port there's nothing more to accept.
+            if (_stopping || ec) return;
+
+            auto ch = move(l.next);
+            int slot = allocate();
+
+            // Out of slots, `ch` closes the channel as it goes out of scope.
+            if (slot >= 0) {
+                _slots[slot].channel = move(ch);
+                send(Record{ACCEPTED, uint32_t(slot), 0, 0, 0, 0});
+                pump(slot);
+            }
+
+            accept_next(l);
+        });
+}
+
+void ProcessPool::WorkerProcess::connect( uint32_t request
+                                        , const string& target
+                                        , const string& secret)
+{
+    int slot = allocate();
+
+    if (slot < 0) {
+        Record r{CONNECTED, 0, request, 0, 0, 0};
+        encode(asio::error::no_buffer_space, r);
+        return send(r);
+    }
+
+    auto& s = _slots[slot];
+    s.connecting = true;
+    s.channel = make_unique<Channel>(_service);
+
+    s.channel->connect(target, secret, [this, request, slot] (sys::error_code ec) {
+            if (_stopping) return;
+
+            auto& s = _slots[slot];
+            s.connecting = false;
+
+            if (s.closing) {
+                s.channel.reset();
+                return maybe_free(slot);
+            }
+
+            Record r{CONNECTED, uint32_t(slot), request, 0, 0, 0};
+            encode(ec, r);
+            send(r);
+
+            if (ec) {
+                s.closing = true;
+                s.channel.reset();
+                return maybe_free(slot);
+            }
+
+            pump(slot);
+        });
+}
+
+// Moves data between the slot's rings and its channel, with at most one
+// read and one write in flight. Both work on the shared memory directly.
+void ProcessPool::WorkerProcess::pump(uint32_t slot)
+{
+    auto& s = _slots[slot];
+
+    if (!s.channel || s.connecting || s.closing) return;
+
+    auto& up   = ring(slot, to_worker);
+    auto& down = ring(slot, to_front);
+
+    if (!s.writing && up.readable()) {
+        s.writing = true;
+
+        asio::async_write(*s.channel, up.data(up.readable()),
+            [this, slot] (sys::error_code ec, size_t n) {
+                if (_stopping) return;
+
+                auto& s = _slots[slot];
+                s.writing = false;
+
+                if (s.closing) return maybe_free(slot);
+
+                ring(slot, to_worker).consume(n);
+                notify();
+
+                if (ec) return ended(slot, ec);
+                pump(slot);
+            });
+    }
+
+    if (!s.reading && !s.ended && down.writable()) {
+        s.reading = true;
+
+        s.channel->async_read_some(down.prepare(max_read_size),
+            [this, slot] (sys::error_code ec, size_t n) {
+                if (_stopping) return;
+
+                auto& s = _slots[slot];
+                s.reading = false;
+
+                if (s.closing) return maybe_free(slot);
+
+                if (n) {
+                    ring(slot, to_front).commit(n);
+                    notify();
+                }
+
+                if (ec) return ended(slot, ec);
+                pump(slot);
+            });
+    }
+}
+
+void ProcessPool::WorkerProcess::ended(uint32_t slot, sys::error_code ec)
+{
+    auto& s = _slots[slot];
+    if (s.ended) return;
+    s.ended = true;
+
+    Record r{ENDED, slot, 0, 0, 0, 0};
+    encode(ec, r);
+    send(r);
+}
+
+void ProcessPool::WorkerProcess::close(uint32_t slot)
+{
+    auto& s = _slots[slot];
+    if (!s.used || s.closing) return;
+
+    s.closing = true;
+
+    // A connecting channel is closed once the connect completes, the
+    // pending reads and writes are aborted by this.
+    if (!s.connecting) s.channel.reset();
+
+    maybe_free(slot);
+}
+
+void ProcessPool::WorkerProcess::maybe_free(uint32_t slot)
+{
+    auto& s = _slots[slot];
+
+    if (!s.closing || s.connecting || s.reading || s.writing) return;
+
+    // Neither side touches the rings any more.
+    ring(slot, to_worker).reset();
+    ring(slot, to_front).reset();
+
+    s = Slot();
+}
+
+int ProcessPool::WorkerProcess::allocate()
+{
+    for (size_t i = 0; i < _slots.size(); ++i) {
+        if (_slots[i].used) continue;
+        _slots[i].used = true;
+        return i;
+    }
+    return -1;
+}
+
+void ProcessPool::WorkerProcess::send(Record r, string text)
+{
+    _outbox.send(_link.control(to_front), r, move(text));
+    notify();
+}
+
+// Rings the front's bell once for everything done in this handler.
+void ProcessPool::WorkerProcess::notify()
+{
+    if (_notify_posted) return;
+    _notify_posted = true;
+
+    _ios.post([this] {
+            _notify_posted = false;
+            if (!_stopping) ring_bell(_fd);
+        });
+}
+
+void ProcessPool::WorkerProcess::shutdown()
+{
+    if (_stopping) return;
+    _stopping = true;
+
+    // Whatever is still in flight completes with `operation_aborted` and
+    // is ignored, after which the io_service runs out of work.
+    for (auto& s : _slots) s.channel.reset();
+    _listeners.clear();
+
+    sys::error_code ignored;
+    _bell.close(ignored);
+}
+
+//--------------------------------------------------------------------
+struct PoolChannel::State {
+    size_t   worker  = 0;
+    uint32_t slot    = 0;
+    uint32_t request = 0;    // While connecting
+    bool     open    = false;
+    bool     closed  = false; // By the user, before the connect completed
+
+    // Set once the worker's channel failed, reported after the data
+    // received before that is read.
+    sys::error_code ended;
+
+    OnConnect on_connect;
+
+    vector<asio::mutable_buffer> rx;
+    OnReceive on_receive;
+
+    vector<asio::const_buffer> tx;
+    OnWrite on_write;
+};
+
+//--------------------------------------------------------------------
+struct ProcessPool::Impl : public enable_shared_from_this<Impl> {
+    using State = PoolChannel::State;
+
+    struct Worker {
+        Worker(size_t index, Layout layout) : index(index), link(layout) {}
+
+        size_t index;
+        Link link;
+        pid_t pid = -1;
+        int fd = -1;
+        unique_ptr<asio::posix::stream_descriptor> bell;
+        array<char, 256> bell_buf;
+        bool notify_posted = false;
+        bool gone = false;
+        string identity;
+        Outbox outbox;
+        map<uint32_t, shared_ptr<State>> slots;
+        map<uint32_t, shared_ptr<State>> connecting;
+    };
+
+    Impl(asio::io_service& ios, vector<string> configs, ProcessPoolOptions o)
+        : ios(ios)
+        , configs(move(configs))
+        , layout(o)
+    {}
+
+    asio::io_service& ios;
+    vector<string> configs;
+    Layout layout;
+    vector<unique_ptr<Worker>> workers;
+
+    OnStart on_start;
+    size_t not_ready = 0;
+    bool stopped = false;
+
+    uint32_t next_request = 0;
+
+    deque<shared_ptr<State>> accepted;
+    deque<pair<shared_ptr<State>*, OnAccept>> acceptors;
+
+    void start(OnStart);
+    void fork_worker(size_t index, sys::error_code&);
+    void start_done(sys::error_code);
+
+    void wait_bell(Worker&);
+    void on_bell(Worker&);
+    void handle(Worker&, const Record&, const string&);
+    void worker_gone(Worker&);
+    void notify(Worker&);
+    void wake(Worker&);
+    void send(Worker&, Record, string = string());
+
+    void connect(shared_ptr<State>, const string& target, const string& secret);
+    void match_acceptors();
+    bool try_receive(State&);
+    bool try_write(State&);
+    void abort(State&, sys::error_code);
+    void close(State&);
+    void stop();
+
+    ShmRing& ring(const State& st, Dir d) {
+        return workers[st.worker]->link.ring(st.slot, d);
+    }
+};
+
+void ProcessPool::Impl::start(OnStart h)
+{
+    if (stopped || !workers.empty()) {
+        return ios.post(bind(move(h), asio::error::operation_not_supported));
+    }
+
+    on_start = move(h);
+    not_ready = configs.size();
+
+    for (size_t i = 0; i < configs.size(); ++i) {
+        sys::error_code ec;
+        fork_worker(i, ec);
+        if (ec) return start_done(ec);
+    }
+
+    if (configs.empty()) start_done(sys::error_code());
+}
+
+void ProcessPool::Impl::fork_worker(size_t index, sys::error_code& ec)
+{
+    auto w = make_unique<Worker>(index, layout);
+
+    if (!w->link.map(ec)) return;
+
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        ec = sys::error_code(errno, sys::system_category());
+        w->link.unmap();
+        return;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        ec = sys::error_code(errno, sys::system_category());
+        ::close(sv[0]);
+        ::close(sv[1]);
+        w->link.unmap();
+        return;
+    }
+
+    if (pid == 0) {
+        // Only this worker's end of its own socket pair stays open, so that
+        // every worker notices when the front goes away.
+        for (auto& other : workers) ::close(other->fd);
+        ::close(sv[0]);
+
+        int code = 0;
+
+        {
+            WorkerProcess worker(configs[index], w->link, sv[1]);
+            code = worker.run();
+        }
+
+        _exit(code);
+    }
+
+    ::close(sv[1]);
+
+    w->pid  = pid;
+    w->fd   = sv[0];
+    w->bell = make_unique<asio::posix::stream_descriptor>(ios, sv[0]);
+
+    workers.push_back(move(w));
+    wait_bell(*workers.back());
+}
+
+void ProcessPool::Impl::start_done(sys::error_code ec)
+{
+    if (!on_start) return;
+    ios.post(bind(move(on_start), ec));
+    on_start = nullptr;
+}
+
+void ProcessPool::Impl::wait_bell(Worker& w)
+{
+    w.bell->async_read_some(asio::buffer(w.bell_buf),
+        [self = shared_from_this(), &w] (sys::error_code ec, size_t) {
+            if (self->stopped) return;
+            if (ec) return self->worker_gone(w);
+            self->on_bell(w);
+            self->wait_bell(w);
+        });
+}
+
+void ProcessPool::Impl::on_bell(Worker& w)
+{
+    auto& events = w.link.control(to_front);
+
+    Record r;
+    string text;
+    bool changed = false;
+
+    while (receive(events, r, text)) {
+        changed = true;
+        handle(w, r, text);
+    }
+
+    w.outbox.flush(w.link.control(to_worker));
+
+    for (auto& p : w.slots) {
+        if (try_receive(*p.second)) changed = true;
+        if (try_write(*p.second))   changed = true;
+    }
+
+    if (changed) notify(w);
+}
+
+void ProcessPool::Impl::handle(Worker& w, const Record& r, const string& text)
+{
+    auto ec = decode(r);
+
+    switch (r.op) {
+        case READY: {
+            if (ec) return start_done(ec);
+            w.identity = text;
+            if (--not_ready == 0) start_done(sys::error_code());
+            return;
+        }
+        case CONNECTED: {
+            auto i = w.connecting.find(r.request);
+            if (i == w.connecting.end()) return;
+
+            auto st = move(i->second);
+            w.connecting.erase(i);
+            st->request = 0;
+
+            if (st->closed) {
+                if (!ec) send(w, Record{CLOSE, r.slot, 0, 0, 0, 0});
+                return;
+            }
+
+            if (!ec) {
+                st->slot = r.slot;
+                st->open = true;
+                w.slots[r.slot] = st;
+            }
+
+            ios.post(bind(move(st->on_connect), ec));
+            st->on_connect = nullptr;
+            return;
+        }
+        case ACCEPTED: {
+            auto st = make_shared<State>();
+            st->worker = w.index;
+            st->slot   = r.slot;
+            st->open   = true;
+
+            w.slots[r.slot] = st;
+            accepted.push_back(move(st));
+            return match_acceptors();
+        }
+        case ENDED: {
+            auto i = w.slots.find(r.slot);
+            if (i == w.slots.end()) return;
+            i->second->ended = ec ? ec : sys::error_code(asio::error::eof);
+            return;
+        }
+    }
+}
+
+void ProcessPool::Impl::worker_gone(Worker& w)
+{
+    if (w.gone) return;
+    w.gone = true;
+
+    if (w.identity.empty()) start_done(asio::error::connection_refused);
+
+    for (auto& p : w.slots) {
+        p.second->ended = asio::error::connection_reset;
+        try_receive(*p.second);
+        try_write(*p.second);
+    }
+
+    for (auto& p : w.connecting) {
+        auto& st = *p.second;
+        st.request = 0;
+        if (!st.on_connect) continue;
+        ios.post(bind(move(st.on_connect), asio::error::connection_reset));
+        st.on_connect = nullptr;
+    }
+
+    w.connecting.clear();
+}
+
+// Rings the worker's bell once for everything done in this handler.
+void ProcessPool::Impl::notify(Worker& w)
+{
+    if (w.notify_posted) return;
+    w.notify_posted = true;
+
+    ios.post([self = shared_from_this(), &w] {
+            w.notify_posted = false;
+            if (!self->stopped && !w.gone) ring_bell(w.fd);
+        });
+}
+
+// Rings the bell right away. Used when the application gave the worker
+// something to do, since it may block this thread right after.
+void ProcessPool::Impl::wake(Worker& w)
+{
+    if (!stopped && !w.gone) ring_bell(w.fd);
+}
+
+void ProcessPool::Impl::send(Worker& w, Record r, string text)
+{
+    w.outbox.send(w.link.control(to_worker), r, move(text));
+    notify(w);
+}
+
+void ProcessPool::Impl::connect( shared_ptr<State> st
+                               , const string& target
+                               , const string& secret)
+{
+    Worker* best = nullptr;
+
+    for (auto& w : workers) {
+        if (w->gone || w->identity.empty()) continue;
+
+        auto load = w->slots.size() + w->connecting.size();
+
+        if (!best || load < best->slots.size() + best->connecting.size()) {
+            best = w.get();
+        }
+    }
+
+    if (stopped || !best) {
+        auto ec = stopped ? asio::error::operation_aborted : asio::error::not_connected;
+        ios.post(bind(move(st->on_connect), ec));
+        st->on_connect = nullptr;
+        return;
+    }
+
+    st->worker  = best->index;
+    st->request = ++next_request;
+    best->connecting[st->request] = st;
+
+    send(*best, Record{CONNECT, 0, st->request, 0, 0, 0}, target + '\0' + secret);
+}
+
+void ProcessPool::Impl::match_acceptors()
+{
+    while (!accepted.empty() && !acceptors.empty()) {
+        auto& a = acceptors.front();
+
+        *a.first = move(accepted.front());
+        ios.post(bind(move(a.second), sys::error_code()));
+
+        accepted.pop_front();
+        acceptors.pop_front();
+    }
+}
+
+// Completes the pending read if the worker's ring has data for it (or the
+// channel ended). Returns true if room was made for the worker.
+bool ProcessPool::Impl::try_receive(State& st)
+{
+    if (!st.on_receive) return false;
+
+    auto& r = ring(st, to_front);
+    size_t n = asio::buffer_copy(st.rx, r.data(r.readable()));
+
+    if (n == 0 && asio::buffer_size(st.rx) != 0) {
+        if (st.ended) abort(st, st.ended);
+        return false;
+    }
+
+    r.consume(n);
+    st.rx.clear();
+    ios.post(bind(move(st.on_receive), sys::error_code(), n));
+    st.on_receive = nullptr;
+
+    return n != 0;
+}
+
+// Same as above for the pending write. Returns true if data was queued for
+// the worker.
+bool ProcessPool::Impl::try_write(State& st)
+{
+    if (!st.on_write) return false;
+
+    if (st.ended) {
+        abort(st, st.ended);
+        return false;
+    }
+
+    size_t n = ring(st, to_worker).write(st.tx);
+
+    if (n == 0 && asio::buffer_size(st.tx) != 0) return false;
+
+    st.tx.clear();
+    ios.post(bind(move(st.on_write), sys::error_code(), n));
+    st.on_write = nullptr;
+
+    return n != 0;
+}
+
+// Fails whatever operation is pending on `st`.
+void ProcessPool::Impl::abort(State& st, sys::error_code ec)
+{
+    if (st.on_connect) {
+        ios.post(bind(move(st.on_connect), ec));
+        st.on_connect = nullptr;
+    }
+
+    if (st.on_receive) {
+        ios.post(bind(move(st.on_receive), ec, 0));
+        st.on_receive = nullptr;
+        st.rx.clear();
+    }
+
+    if (st.on_write) {
+        ios.post(bind(move(st.on_write), ec, 0));
+        st.on_write = nullptr;
+        st.tx.clear();
+    }
+}
+
+void ProcessPool::Impl::close(State& st)
+{
+    abort(st, asio::error::operation_aborted);
+
+    if (st.request) {
+        // The worker is told to close it once it's connected.
+        st.closed = true;
+        return;
+    }
+
+    if (!st.open) return;
+    st.open = false;
+
+    auto& w = *workers[st.worker];
+
+    if (!stopped && !w.gone) send(w, Record{CLOSE, st.slot, 0, 0, 0, 0});
+
+    w.slots.erase(st.slot);
+}
+
+void ProcessPool::Impl::stop()
+{
+    if (stopped) return;
+    stopped = true;
+
+    // Closing our end of the socket is what tells a worker to exit.
+    for (auto& w : workers) ::shutdown(w->fd, SHUT_RDWR);
+
+    for (auto& w : workers) {
+        int status;
+        waitpid(w->pid, &status, 0);
+
+        for (auto& p : w->slots) {
+            p.second->open = false;
+            abort(*p.second, asio::error::operation_aborted);
+        }
+
+        for (auto& p : w->connecting) {
+            p.second->request = 0;
+            abort(*p.second, asio::error::operation_aborted);
+        }
+
+        w->slots.clear();
+        w->connecting.clear();
+
+        sys::error_code ignored;
+        w->bell->close(ignored);
+        w->link.unmap();
+    }
+
+    start_done(asio::error::operation_aborted);
+
+    for (auto& a : acceptors) {
+        ios.post(bind(move(a.second), asio::error::operation_aborted));
+    }
+
+    acceptors.clear();
+    accepted.clear();
+}
+
+//--------------------------------------------------------------------
+ProcessPool::ProcessPool( asio::io_service& ios
+                        , vector<string> configs
+                        , ProcessPoolOptions options)
+    : _ios(ios)
+    , _impl(make_shared<Impl>(ios, move(configs), options))
+{
+}
+
+void ProcessPool::start_impl(OnStart h)
+{
+    _impl->start(move(h));
+}
+
+size_t ProcessPool::size() const
+{
+    return _impl->configs.size();
+}
+
+vector<string> ProcessPool::identities() const
+{
+    vector<string> ret;
+    for (auto& w : _impl->workers) ret.push_back(w->identity);
+    return ret;
+}
+
+vector<size_t> ProcessPool::load() const
+{
+    vector<size_t> ret;
+    for (auto& w : _impl->workers) ret.push_back(w->slots.size());
+    return ret;
+}
+
+void ProcessPool::listen(const string& shared_secret)
+{
+    for (auto& w : _impl->workers) {
+        if (w->gone) continue;
+        _impl->send(*w, Record{LISTEN, 0, 0, 0, 0, 0}, shared_secret);
+    }
+}
+
+void ProcessPool::accept_impl(PoolChannel& ch, OnAccept h)
+{
+    if (_impl->stopped) {
+        return _ios.post(bind(move(h), asio::error::operation_aborted));
+    }
+
+    _impl->close(*ch._state);
+    _impl->acceptors.emplace_back(&ch._state, move(h));
+    _impl->match_acceptors();
+}
+
+void ProcessPool::stop()
+{
+    _impl->stop();
+}
+
+ProcessPool::~ProcessPool()
+{
+    _impl->stop();
+}
+
+//--------------------------------------------------------------------
+PoolChannel::PoolChannel(ProcessPool& pool)
+    : _ios(pool.get_io_service())
+    , _pool(pool._impl)
+    , _state(make_shared<State>())
+{
+}
+
+asio::io_service& PoolChannel::get_io_service()
+{
+    return _ios;
+}
+
+size_t PoolChannel::worker() const
+{
+    return _state->worker;
+}
+
+void PoolChannel::connect_impl( const string& target_id
+                              , const string& shared_secret
+                              , OnConnect h)
+{
+    _pool->close(*_state);
+    _state = make_shared<State>();
+    _state->on_connect = move(h);
+
+    _pool->connect(_state, target_id, shared_secret);
+}
+
+void PoolChannel::receive_impl(vector<asio::mutable_buffer> bufs, OnReceive h)
+{
+    auto& st = *_state;
+
+    if (!st.open || st.on_receive) {
+        auto ec = st.open ? asio::error::in_progress : asio::error::not_connected;
+        return _ios.post(bind(move(h), ec, 0));
+    }
+
+    st.rx = move(bufs);
+    st.on_receive = move(h);
+
+    if (_pool->try_receive(st)) _pool->wake(*_pool->workers[st.worker]);
+}
+
+void PoolChannel::write_impl(vector<asio::const_buffer> bufs, OnWrite h)
+{
+    auto& st = *_state;
+
+    if (!st.open || st.on_write) {
+        auto ec = st.open ? asio::error::in_progress : asio::error::not_connected;
+        return _ios.post(bind(move(h), ec, 0));
+    }
+
+    st.tx = move(bufs);
+    st.on_write = move(h);
+
+    if (_pool->try_write(st)) _pool->wake(*_pool->workers[st.worker]);
+}
+
+void PoolChannel::close()
+{
+    _pool->close(*_state);
+}
+
+PoolChannel::~PoolChannel()
+{
+    auto& as = _pool->acceptors;
+
+    for (auto i = as.begin(); i != as.end();) {
+        if (i->first != &_state) { ++i; continue; }
+        _ios.post(bind(move(i->second), asio::error::operation_aborted));
+        i = as.erase(i);
+    }
+
+    _pool->close(*_state);
+}
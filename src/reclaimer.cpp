@@ -0,0 +1,42 @@
+#include "reclaimer.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+Reclaimer::Reclaimer(asio::io_service& ios)
+    : _ios(ios)
+{}
+
+void Reclaimer::retire(shared_ptr<void> p)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _retired.push_back(move(p));
+        if (_drain_posted) return;
+        _drain_posted = true;
+    }
+
+    _ios.post([self = shared_from_this()] { self->drain(); });
+}
+
+// Executed in the main thread
+void Reclaimer::drain()
+{
+    vector<shared_ptr<void>> batch;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        batch = move(_retired);
+        _retired = move(_spare);
+        _drain_posted = false;
+    }
+
+    // Destructors run here, outside of the lock, they may retire more
+    // objects.
+    batch.clear();
+
+    lock_guard<mutex> lock(_mutex);
+    if (_spare.capacity() < batch.capacity()) {
+        _spare = move(batch);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+
+#include <gnunet_channels/namespaces.h>
+
+namespace gnunet_channels {
+
+// Collects objects whose last reference is dropped outside of the main
+// thread, so that they get destroyed in the main thread. Instead of posting
+// one handler per object, objects are batched and only one drain handler is
+// in the io_service's queue at any time.
+class Reclaimer : public std::enable_shared_from_this<Reclaimer> {
+public:
+    Reclaimer(asio::io_service&);
+
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+
+    // Thread safe.
+    void retire(std::shared_ptr<void>);
+
+private:
+    void drain();
+
+private:
+    asio::io_service& _ios;
+    std::mutex _mutex;
+    bool _drain_posted = false;
+    std::vector<std::shared_ptr<void>> _retired;
+    // Storage of the previous batch, kept so that retiring doesn't
+    // allocate in the common case.
+    std::vector<std::shared_ptr<void>> _spare;
+};
+
+} // gnunet_channels namespace
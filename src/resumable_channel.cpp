@@ -0,0 +1,939 @@
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <random>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <gnunet_channels/resumable_channel.h>
+#include <gnunet_channels/cadet_port.h>
+#include <gnunet_channels/error.h>
+#include <gnunet_channels/service.h>
+#include "ids.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Wire format, all integers are big endian.
+namespace {
+    using SessionId = array<uint8_t, 16>;
+
+    void put(uint8_t* p, uint64_t v, size_t n) {
+        for (size_t i = 0; i < n; ++i) p[i] = v >> (8 * (n - 1 - i));
+    }
+
+    uint64_t get(const uint8_t* p, size_t n) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < n; ++i) v = (v << 8) | p[i];
+        return v;
+    }
+
+    // Sent by the connecting side at the start of each channel and
+    // answered by the accepting side.
+    struct Hello {
+        static constexpr size_t size = 16 + 1 + 8 + 4;
+
+        enum : uint8_t {
+            resume  = 1, // Not the first channel of the session
+            unknown = 2, // Answer to a resume of a session we don't have
+        };
+
+        SessionId session;
+        uint8_t   flags;
+        uint64_t  received;      // Bytes of the other side's stream
+        uint32_t  replay_buffer; // Of the sender, see ResumableOptions
+
+        array<uint8_t, size> encode() const {
+            array<uint8_t, size> out;
+            copy(session.begin(), session.end(), out.begin());
+            out[16] = flags;
+            put(&out[17], received, 8);
+            put(&out[25], replay_buffer, 4);
+            return out;
+        }
+
+        static Hello decode(const array<uint8_t, size>& in) {
+            Hello h;
+            copy(in.begin(), in.begin() + 16, h.session.begin());
+            h.flags         = in[16];
+            h.received      = get(&in[17], 8);
+            h.replay_buffer = get(&in[25], 4);
+            return h;
+        }
+    };
+
+    // Precedes each frame. `value` is the payload's length for data, the
+    // number of bytes received so far for acks and unused for fin.
+    struct FrameHeader {
+        static constexpr size_t size = 1 + 8;
+
+        enum : uint8_t { data = 1, ack = 2, fin = 3 };
+
+        uint8_t  type;
+        uint64_t value;
+
+        array<uint8_t, size> encode() const {
+            array<uint8_t, size> out;
+            out[0] = type;
+            put(&out[1], value, 8);
+            return out;
+        }
+
+        static FrameHeader decode(const array<uint8_t, size>& in) {
+            return FrameHeader{in[0], get(&in[1], 8)};
+        }
+    };
+
+    constexpr size_t max_frame = 64 * 1024;
+
+    // Stop reading from the channel while this much data waits for the
+    // application.
+    constexpr size_t max_ready_bytes = 1024 * 1024;
+}
+
+//--------------------------------------------------------------------
+struct ResumableChannel::State : public enable_shared_from_this<State> {
+    // One CADET channel of the session. Handlers of a link which was
+    // replaced find it's no longer `link` and do nothing, the buffers are
+    // per link so that they can't interfere with the next one's.
+    struct Link {
+        Link(shared_ptr<Channel> c) : channel(move(c)) {}
+
+        shared_ptr<Channel> channel;
+        array<uint8_t, FrameHeader::size> header;
+        vector<uint8_t> payload;
+        bool reading = false;
+        bool sending = false;
+    };
+
+    State(Service& service, ResumableOptions options)
+        : service(service)
+        , ios(service.get_io_service())
+        , options(options)
+        , timer(ios)
+    {}
+
+    Service& service;
+    asio::io_service& ios;
+    ResumableOptions options;
+    asio::steady_timer timer; // Reconnect delay resp. resume timeout
+
+    SessionId session;
+    bool initiator = false;
+    PeerId peer;
+    PortHash port;
+    OnConnect on_connect;     // Only during the first connect
+
+    shared_ptr<Link> link;
+    bool started = false;     // Had a link before
+    size_t attempts = 0;
+    size_t resumes = 0;
+    sys::error_code last_error;
+
+    bool closing = false;     // By us, fin goes out after the data
+    bool peer_done = false;   // Fin received
+    sys::error_code error;    // Gave up
+
+    // The replay buffer holds the stream from `acked` to `written`, in
+    // chunks of up to max_frame bytes, `acked` being `front_offset` into
+    // the first one. The current link has sent up to `sent`.
+    deque<vector<uint8_t>> replay;
+    size_t front_offset = 0;
+    uint64_t acked   = 0;
+    uint64_t sent    = 0;
+    uint64_t written = 0;
+
+    OnWrite on_write;         // Waiting for room in the replay buffer
+    vector<asio::const_buffer> input;
+
+    uint64_t received = 0;
+    uint64_t ack_sent = 0;
+    bool ack_due = false;
+    size_t ack_every = 1;     // A quarter of the other side's replay buffer
+
+    deque<vector<uint8_t>> ready;
+    size_t ready_offset = 0;  // Into ready.front()
+    size_t ready_bytes  = 0;
+
+    OnReceive on_receive;
+    vector<asio::mutable_buffer> output;
+
+    void connect();
+    void handshake(shared_ptr<Channel>);
+    void connect_failed(sys::error_code);
+    void reconnect();
+    void accept(shared_ptr<Channel>, const Hello&, OnConnect);
+    void start(shared_ptr<Channel>, const Hello& peer_hello);
+    void unlink(sys::error_code);
+    void drop_link();
+
+    size_t append(const vector<asio::const_buffer>&);
+    void trim(uint64_t upto);
+    void pump();
+    void read_frame();
+    void on_data(vector<uint8_t>);
+    void on_ack(uint64_t);
+    size_t consume();
+    void deliver();
+    void fail(sys::error_code);
+
+    Hello hello(uint8_t flags) const {
+        return Hello{ session
+                    , flags
+                    , received
+                    , uint32_t(min<size_t>(options.replay_buffer, UINT32_MAX)) };
+    }
+};
+
+void ResumableChannel::State::connect()
+{
+    auto ch = make_shared<Channel>(service);
+
+    ch->connect(peer, port, [self = shared_from_this(), ch] (sys::error_code ec) {
+            if (self->closing) return;
+            if (ec) return self->connect_failed(ec);
+            self->handshake(move(ch));
+        });
+}
+
+void ResumableChannel::State::handshake(shared_ptr<Channel> ch)
+{
+    auto buf = make_shared<array<uint8_t, Hello::size>>
+        (hello(on_connect ? 0 : Hello::resume).encode());
+
+    asio::async_write(*ch, asio::buffer(*buf),
+        [self = shared_from_this(), ch, buf] (sys::error_code ec, size_t) {
+            if (self->closing) return;
+            if (ec) return self->connect_failed(ec);
+
+            asio::async_read(*ch, asio::buffer(*buf),
+                [self, ch, buf] (sys::error_code ec, size_t) {
+                    if (self->closing) return;
+                    if (ec) return self->connect_failed(ec);
+
+                    auto h = Hello::decode(*buf);
+
+                    if (h.session != self->session || (h.flags & Hello::unknown)) {
+                        // The other side is gone for good.
+                        if (self->on_connect) {
+                            return self->connect_failed(error::malformed_frame);
+                        }
+                        return self->fail(asio::error::connection_reset);
+                    }
+
+                    bool first = bool(self->on_connect);
+
+                    self->start(ch, h);
+                    if (self->error) return;
+
+                    if (first) {
+                        auto f = move(self->on_connect);
+                        f(sys::error_code());
+                    }
+                });
+        });
+}
+
+void ResumableChannel::State::connect_failed(sys::error_code ec)
+{
+    if (on_connect) {
+        auto f = move(on_connect);
+        return f(ec);
+    }
+
+    last_error = ec;
+    reconnect();
+}
+
+void ResumableChannel::State::reconnect()
+{
+    if (error || closing) return;
+
+    if (attempts >= options.max_attempts) return fail(last_error);
+
+    auto delay = options.reconnect_delay * (1 << min<size_t>(attempts, 16));
+    ++attempts;
+
+    timer.expires_from_now(delay);
+    timer.async_wait([self = shared_from_this()] (sys::error_code ec) {
+            if (ec || self->error || self->closing || self->link) return;
+            self->connect();
+        });
+}
+
+// The accepting side, for new sessions as well as for resumed ones.
+void ResumableChannel::State::accept( shared_ptr<Channel> ch
+                                    , const Hello& peer_hello
+                                    , OnConnect on_accept)
+{
+    bool first = !(peer_hello.flags & Hello::resume);
+
+    if (first) session = peer_hello.session;
+
+    auto buf = make_shared<array<uint8_t, Hello::size>>
+        (hello(first ? 0 : Hello::resume).encode());
+
+    asio::async_write(*ch, asio::buffer(*buf),
+        [ self = shared_from_this()
+        , ch, buf, peer_hello
+        , on_accept = move(on_accept)
+        ] (sys::error_code ec, size_t) {
+            // A failed resume is left to the resume timeout, or to the
+            // other side trying again.
+            if (ec || self->closing || self->error) {
+                if (on_accept) on_accept(ec ? ec : asio::error::operation_aborted);
+                return;
+            }
+
+            self->start(ch, peer_hello);
+
+            if (on_accept) on_accept(self->error);
+        });
+}
+
+void ResumableChannel::State::start(shared_ptr<Channel> ch, const Hello& peer_hello)
+{
+    // The other side can't have received what we never wrote or what it
+    // already acknowledged.
+    if (peer_hello.received < acked || peer_hello.received > written) {
+        return fail(error::malformed_frame);
+    }
+
+    if (started) ++resumes;
+    started = true;
+
+    // Replaces the old link if we didn't notice it failed yet.
+    drop_link();
+    timer.cancel();
+
+    link = make_shared<Link>(move(ch));
+    attempts = 0;
+
+    // Everything the other side got is as good as acknowledged, the rest
+    // is sent again.
+    trim(peer_hello.received);
+    sent = peer_hello.received;
+
+    // Our hello told it how much we have.
+    ack_sent = received;
+    ack_due  = false;
+    ack_every = max<size_t>(1, peer_hello.replay_buffer / 4);
+
+    pump();
+    read_frame();
+}
+
+// The link failed, try to get another one.
+void ResumableChannel::State::unlink(sys::error_code ec)
+{
+    drop_link();
+
+    if (closing || error) return;
+
+    // The other side finished, there's nothing to resume.
+    if (peer_done) return fail(ec);
+
+    last_error = ec;
+
+    if (initiator) return reconnect();
+
+    timer.expires_from_now(options.resume_timeout);
+    timer.async_wait([self = shared_from_this(), ec] (sys::error_code e) {
+            if (e || self->link) return;
+            self->fail(ec);
+        });
+}
+
+void ResumableChannel::State::drop_link()
+{
+    if (!link) return;
+
+    // Not from within the channel's own handlers.
+    ios.post([c = move(link->channel)] {});
+    link = nullptr;
+}
+
+size_t ResumableChannel::State::append(const vector<asio::const_buffer>& bufs)
+{
+    size_t room = options.replay_buffer - (written - acked);
+    size_t size = min(room, asio::buffer_size(bufs));
+    size_t left = size;
+
+    for (auto& b : bufs) {
+        if (!left) break;
+
+        auto p = asio::buffer_cast<const uint8_t*>(b);
+        size_t n = min(left, asio::buffer_size(b));
+        left -= n;
+
+        while (n) {
+            if (replay.empty() || replay.back().size() == max_frame) {
+                replay.emplace_back();
+                replay.back().reserve(max_frame);
+            }
+
+            auto& chunk = replay.back();
+            size_t k = min(n, max_frame - chunk.size());
+
+            chunk.insert(chunk.end(), p, p + k);
+            p += k;
+            n -= k;
+        }
+    }
+
+    written += size;
+    return size;
+}
+
+void ResumableChannel::State::trim(uint64_t upto)
+{
+    while (acked < upto) {
+        auto& front = replay.front();
+        size_t n = min<uint64_t>(front.size() - front_offset, upto - acked);
+
+        front_offset += n;
+        acked += n;
+
+        if (front_offset == front.size()) {
+            replay.pop_front();
+            front_offset = 0;
+        }
+    }
+
+    if (!on_write) return;
+
+    size_t n = append(input);
+    if (n == 0) return;
+
+    input.clear();
+    ios.post(bind(move(on_write), sys::error_code(), n));
+    on_write = nullptr;
+}
+
+void ResumableChannel::State::pump()
+{
+    if (!link || link->sending) return;
+
+    vector<uint8_t> frame;
+    FrameHeader h{0, 0};
+    size_t n = 0;
+
+    if (ack_due) {
+        h = FrameHeader{FrameHeader::ack, received};
+        ack_sent = received;
+        ack_due = false;
+    }
+    else if (sent < written) {
+        // Find the chunk `sent` is in.
+        size_t offset = front_offset + (sent - acked);
+        auto chunk = replay.begin();
+
+        while (offset >= chunk->size()) {
+            offset -= chunk->size();
+            ++chunk;
+        }
+
+        n = min<uint64_t>(chunk->size() - offset, written - sent);
+        h = FrameHeader{FrameHeader::data, n};
+
+        frame.reserve(FrameHeader::size + n);
+        auto hdr = h.encode();
+        frame.insert(frame.end(), hdr.begin(), hdr.end());
+        frame.insert(frame.end(), chunk->begin() + offset, chunk->begin() + offset + n);
+    }
+    else if (closing) {
+        h = FrameHeader{FrameHeader::fin, 0};
+    }
+    else {
+        return;
+    }
+
+    if (frame.empty()) {
+        auto hdr = h.encode();
+        frame.assign(hdr.begin(), hdr.end());
+    }
+
+    link->sending = true;
+
+    // The channel copies the frame before returning.
+    link->channel->async_write_some(asio::buffer(frame),
+        [self = shared_from_this(), l = link, h, end = sent + n] (sys::error_code ec, size_t) {
+            if (self->link != l) return;
+
+            l->sending = false;
+
+            if (ec) return self->unlink(ec);
+
+            if (h.type == FrameHeader::data) self->sent = max(self->sent, end);
+
+            // Done, with everything acknowledged or not.
+            if (h.type == FrameHeader::fin) return self->drop_link();
+
+            self->pump();
+        });
+}
+
+void ResumableChannel::State::read_frame()
+{
+    if (!link || link->reading || closing) return;
+
+    if (ready_bytes >= max_ready_bytes) return; // Resumed in `deliver`
+
+    auto l = link;
+    l->reading = true;
+
+    asio::async_read(*l->channel, asio::buffer(l->header),
+        [self = shared_from_this(), l] (sys::error_code ec, size_t) {
+            if (self->link != l || self->closing) return;
+
+            if (ec) return self->unlink(ec);
+
+            auto h = FrameHeader::decode(l->header);
+
+            switch (h.type) {
+                case FrameHeader::ack:
+                    l->reading = false;
+                    self->on_ack(h.value);
+                    return self->read_frame();
+
+                case FrameHeader::fin:
+                    l->reading = false;
+                    self->peer_done = true;
+                    return self->deliver();
+
+                case FrameHeader::data:
+                    if (h.value != 0 && h.value <= max_frame) break;
+                    // Fall through
+                default:
+                    return self->fail(error::malformed_frame);
+            }
+
+            l->payload.resize(h.value);
+
+            asio::async_read(*l->channel, asio::buffer(l->payload),
+                [self, l] (sys::error_code ec, size_t) {
+                    if (self->link != l || self->closing) return;
+
+                    if (ec) return self->unlink(ec);
+
+                    auto data = move(l->payload);
+                    l->payload = vector<uint8_t>();
+                    l->reading = false;
+
+                    self->on_data(move(data));
+
+                    // The read handler may have closed the channel.
+                    self->read_frame();
+                });
+        });
+}
+
+void ResumableChannel::State::on_data(vector<uint8_t> data)
+{
+    received += data.size();
+    ready_bytes += data.size();
+    ready.push_back(move(data));
+
+    if (received - ack_sent >= ack_every) {
+        ack_due = true;
+        pump();
+    }
+
+    deliver();
+}
+
+void ResumableChannel::State::on_ack(uint64_t upto)
+{
+    if (upto < acked || upto > written) return fail(error::malformed_frame);
+    trim(upto);
+
+    // The ack may overtake the completion of the frame's write.
+    sent = max(sent, acked);
+
+    // Writes waiting for room may have added data.
+    pump();
+}
+
+// Copies as much of the ready data as fits into `output`.
+size_t ResumableChannel::State::consume()
+{
+    size_t total = 0;
+
+    while (!ready.empty()) {
+        auto& front = ready.front();
+
+        auto n = asio::buffer_copy( output
+                                  , asio::buffer(front) + ready_offset);
+
+        // Skip what was just filled.
+        size_t skip = n;
+        while (!output.empty() && skip) {
+            auto s = min(skip, asio::buffer_size(output.front()));
+            output.front() = output.front() + s;
+            skip -= s;
+            if (asio::buffer_size(output.front()) == 0) {
+                output.erase(output.begin());
+            }
+        }
+
+        total += n;
+        ready_offset += n;
+        ready_bytes -= n;
+
+        if (ready_offset < front.size()) break;
+
+        ready.pop_front();
+        ready_offset = 0;
+    }
+
+    return total;
+}
+
+void ResumableChannel::State::deliver()
+{
+    if (!on_receive) return;
+
+    if (ready.empty()) {
+        if (!peer_done) return;
+        auto f = move(on_receive);
+        return f(asio::error::eof, 0);
+    }
+
+    auto size = consume();
+    auto f = move(on_receive);
+
+    read_frame();
+
+    f(sys::error_code(), size);
+}
+
+void ResumableChannel::State::fail(sys::error_code ec)
+{
+    if (error) return;
+    error = ec;
+
+    timer.cancel();
+    drop_link();
+
+    if (on_receive) {
+        ios.post(bind(move(on_receive), ec, 0));
+    }
+
+    if (on_write) {
+        ios.post(bind(move(on_write), ec, 0));
+    }
+
+    if (on_connect) {
+        ios.post(bind(move(on_connect), ec));
+    }
+}
+
+//--------------------------------------------------------------------
+ResumableChannel::ResumableChannel(Service& service, ResumableOptions options)
+    : _service(service)
+    , _state(make_shared<State>(service, options))
+{
+}
+
+asio::io_service& ResumableChannel::get_io_service()
+{
+    return _state->ios;
+}
+
+size_t ResumableChannel::resumes() const
+{
+    return _state->resumes;
+}
+
+void ResumableChannel::connect_impl( const string& target_id
+                                   , const string& shared_secret
+                                   , OnConnect h)
+{
+    sys::error_code ec;
+    auto pid = cached_peer_id(target_id, ec);
+
+    if (ec) {
+        return _state->ios.post([h = move(h), ec] { h(ec); });
+    }
+
+    connect_impl(pid, cached_port_hash(shared_secret), move(h));
+}
+
+void ResumableChannel::connect_impl(PeerId target_id, PortHash port, OnConnect h)
+{
+    auto& s = *_state;
+
+    random_device rd;
+    for (auto& b : s.session) b = rd();
+
+    s.initiator  = true;
+    s.peer       = target_id;
+    s.port       = port;
+    s.on_connect = move(h);
+
+    s.connect();
+}
+
+void ResumableChannel::write_impl(vector<asio::const_buffer> bufs, OnWrite h)
+{
+    auto& s = *_state;
+
+    auto ec = s.error;
+    if (s.closing) ec = asio::error::operation_aborted;
+    if (!ec && s.on_write) ec = asio::error::in_progress;
+
+    if (ec) {
+        return s.ios.post([h = move(h), ec] { h(ec, 0); });
+    }
+
+    size_t n = s.append(bufs);
+
+    if (n == 0 && asio::buffer_size(bufs) != 0) {
+        // Full, waits for acknowledgements (see trim).
+        s.input = move(bufs);
+        s.on_write = move(h);
+        return;
+    }
+
+    s.pump();
+    s.ios.post([h = move(h), n] { h(sys::error_code(), n); });
+}
+
+void ResumableChannel::receive_impl(vector<asio::mutable_buffer> bufs, OnReceive h)
+{
+    auto& s = *_state;
+
+    if (s.ready.empty()) {
+        sys::error_code ec = s.error;
+        if (s.peer_done) ec = asio::error::eof;
+        if (s.closing)   ec = asio::error::operation_aborted;
+
+        if (ec) {
+            return s.ios.post([h = move(h), ec] { h(ec, 0); });
+        }
+
+        s.output = move(bufs);
+        s.on_receive = move(h);
+        return;
+    }
+
+    s.output = move(bufs);
+    auto size = s.consume();
+
+    s.read_frame();
+
+    s.ios.post([h = move(h), size] { h(sys::error_code(), size); });
+}
+
+void ResumableChannel::drop_channel()
+{
+    auto& s = *_state;
+    if (s.link) s.unlink(asio::error::connection_reset);
+}
+
+void ResumableChannel::close()
+{
+    auto& s = *_state;
+
+    if (s.closing) return;
+    s.closing = true;
+
+    s.timer.cancel();
+
+    auto abort = asio::error::operation_aborted;
+
+    if (s.on_receive) s.ios.post(bind(move(s.on_receive), abort, 0));
+    if (s.on_write)   s.ios.post(bind(move(s.on_write), abort, 0));
+    if (s.on_connect) s.ios.post(bind(move(s.on_connect), abort));
+
+    // Unsent data and the fin go out first, the link is dropped once the
+    // fin is sent (see pump).
+    if (s.link && !s.error) s.pump();
+    else s.drop_link();
+}
+
+ResumableChannel::~ResumableChannel()
+{
+    close();
+}
+
+//--------------------------------------------------------------------
+struct ResumablePort::Impl : public enable_shared_from_this<Impl> {
+    Impl(Service& service, PortHash hash)
+        : service(service), port(new CadetPort(service)), hash(hash) {}
+
+    struct Incoming {
+        shared_ptr<Channel> channel;
+        Hello hello;
+    };
+
+    using StatePtr = weak_ptr<ResumableChannel::State>;
+
+    // Not holding the channel, it may be destroyed while waiting.
+    struct Pending {
+        StatePtr state;
+        OnAccept on_accept;
+    };
+
+    Service& service;
+    // Reset when the port is destroyed, which aborts the pending accept
+    // and with it the reference the accept handler holds to us.
+    unique_ptr<CadetPort> port;
+    PortHash hash;
+    bool accepting = false;
+    bool destroyed = false;
+
+    // Accepted channels until their hello is read, so that they can be
+    // closed (and the reads aborted) when the port is destroyed.
+    map<Channel*, shared_ptr<Channel>> greeting;
+
+    map<SessionId, StatePtr> sessions;
+    deque<Incoming> incoming;
+    deque<Pending> pending;
+
+    void accept_next();
+    void read_hello(shared_ptr<Channel>);
+    void resume(shared_ptr<Channel>, const Hello&);
+    void dispatch();
+    void fail_pending(sys::error_code);
+};
+
+void ResumablePort::Impl::accept_next()
+{
+    if (accepting || destroyed) return;
+    accepting = true;
+
+    auto ch = make_shared<Channel>(service);
+
+    port->open_impl(*ch, hash, [self = shared_from_this(), ch] (sys::error_code ec) {
+            self->accepting = false;
+
+            if (self->destroyed) return;
+            if (ec) return self->fail_pending(ec);
+
+            self->read_hello(move(ch));
+            self->accept_next();
+        });
+}
+
+void ResumablePort::Impl::read_hello(shared_ptr<Channel> ch)
+{
+    auto buf = make_shared<array<uint8_t, Hello::size>>();
+    auto& c = *ch;
+
+    greeting[&c] = ch;
+
+    // Not holding `ch`, the channel would keep itself alive.
+    asio::async_read(c, asio::buffer(*buf),
+        [self = shared_from_this(), p = &c, buf] (sys::error_code ec, size_t) {
+            if (self->destroyed) return;
+
+            auto i = self->greeting.find(p);
+            if (i == self->greeting.end()) return;
+
+            auto ch = move(i->second);
+            self->greeting.erase(i);
+
+            if (ec) return;
+
+            auto h = Hello::decode(*buf);
+
+            if (h.flags & Hello::resume) return self->resume(move(ch), h);
+
+            self->incoming.push_back(Incoming{move(ch), h});
+            self->dispatch();
+        });
+}
+
+void ResumablePort::Impl::resume(shared_ptr<Channel> ch, const Hello& h)
+{
+    auto i = sessions.find(h.session);
+    auto state = i == sessions.end() ? nullptr : i->second.lock();
+
+    if (state && !state->error && !state->closing) {
+        return state->accept(move(ch), h, nullptr);
+    }
+
+    if (i != sessions.end()) sessions.erase(i);
+
+    // Let the other side know it needn't try again.
+    Hello reply{h.session, Hello::unknown, 0, 0};
+    auto buf = make_shared<array<uint8_t, Hello::size>>(reply.encode());
+
+    asio::async_write(*ch, asio::buffer(*buf), [ch, buf] (sys::error_code, size_t) {});
+}
+
+void ResumablePort::Impl::dispatch()
+{
+    while (!pending.empty() && !incoming.empty()) {
+        auto p = move(pending.front());
+        pending.pop_front();
+
+        auto state = p.state.lock();
+
+        // The channel was closed or destroyed while waiting, the next one
+        // gets the stream.
+        if (!state || state->closing) {
+            service.get_io_service().post([f = move(p.on_accept)] {
+                    f(asio::error::operation_aborted);
+                });
+            continue;
+        }
+
+        auto in = move(incoming.front());
+        incoming.pop_front();
+
+        // Forget sessions which are gone.
+        for (auto i = sessions.begin(); i != sessions.end();) {
+            if (i->second.expired()) i = sessions.erase(i);
+            else ++i;
+        }
+
+        sessions[in.hello.session] = state;
+
+        state->accept(move(in.channel), in.hello,
+            [ ios = &service.get_io_service()
+            , f = move(p.on_accept)
+            ] (sys::error_code ec) {
+                ios->post([f, ec] { f(ec); });
+            });
+    }
+}
+
+void ResumablePort::Impl::fail_pending(sys::error_code ec)
+{
+    while (!pending.empty()) {
+        auto f = move(pending.front().on_accept);
+        pending.pop_front();
+        service.get_io_service().post([f = move(f), ec] { f(ec); });
+    }
+}
+
+//--------------------------------------------------------------------
+ResumablePort::ResumablePort(Service& service, PortHash hash)
+    : _impl(make_shared<Impl>(service, hash))
+{
+}
+
+ResumablePort::ResumablePort(Service& service, const string& shared_secret)
+    : ResumablePort(service, cached_port_hash(shared_secret))
+{
+}
+
+void ResumablePort::accept_impl(ResumableChannel& ch, OnAccept h)
+{
+    _impl->pending.push_back(Impl::Pending{ch._state, move(h)});
+    _impl->dispatch();
+    _impl->accept_next();
+}
+
+ResumablePort::~ResumablePort()
+{
+    _impl->destroyed = true;
+    _impl->fail_pending(asio::error::operation_aborted);
+    _impl->greeting.clear();
+    _impl->port.reset();
+    _impl->incoming.clear();
+}
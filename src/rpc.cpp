@@ -0,0 +1,330 @@
+#include <array>
+#include <atomic>
+#include <map>
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <gnunet_channels/rpc.h>
+#include <gnunet_channels/error.h>
+#include "channel_impl.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+//--------------------------------------------------------------------
+// Frame layout, integers are big endian:
+//
+//     u32 payload length | u64 call id | u8 kind | payload
+namespace {
+    enum Kind : uint8_t { REQUEST = 0, RESPONSE = 1 };
+
+    constexpr size_t header_size = 4 + 8 + 1;
+    constexpr size_t max_payload = 16 * 1024 * 1024;
+
+    using Header = array<uint8_t, header_size>;
+
+    Header encode(uint32_t length, uint64_t id, Kind kind)
+    {
+        Header h;
+        for (int i = 0; i < 4; ++i) h[i]     = length >> (24 - 8*i);
+        for (int i = 0; i < 8; ++i) h[4 + i] = id     >> (56 - 8*i);
+        h[12] = kind;
+        return h;
+    }
+
+    void write_frame( Channel& ch
+                    , uint64_t id
+                    , Kind kind
+                    , const vector<uint8_t>& payload
+                    , Channel::OnWrite on_write)
+    {
+        auto h = encode(payload.size(), id, kind);
+        array<asio::const_buffer, 2> bufs{{ asio::buffer(h)
+                                          , asio::buffer(payload) }};
+        // Copied (and queued behind other writes) as a whole, so frames of
+        // concurrent calls never interleave.
+        ch.async_write_some(bufs, move(on_write));
+    }
+
+    // Reads frames from the channel one after another until an error. Its
+    // owner closes the channel when stopping it, otherwise the read
+    // pending there would eat the next frame.
+    struct FrameReader : public enable_shared_from_this<FrameReader> {
+        using OnFrame = function<void(Kind, uint64_t, vector<uint8_t>)>;
+        using OnError = function<void(sys::error_code)>;
+
+        FrameReader(Channel& ch, OnFrame on_frame, OnError on_error)
+            : channel(ch)
+            , on_frame(move(on_frame))
+            , on_error(move(on_error))
+        {}
+
+        Channel& channel;
+        OnFrame on_frame;
+        OnError on_error;
+        bool stopped = false;
+        Header header;
+        vector<uint8_t> payload;
+
+        void stop() {
+            stopped = true;
+            on_frame = nullptr;
+            on_error = nullptr;
+        }
+
+        void read_next() {
+            asio::async_read(channel, asio::buffer(header),
+                [self = shared_from_this()] (sys::error_code ec, size_t) {
+                    if (self->stopped) return;
+                    if (ec) return self->on_error(ec);
+
+                    uint32_t length = 0;
+                    for (int i = 0; i < 4; ++i) length = (length << 8) | self->header[i];
+
+                    if (length > max_payload || self->header[12] > RESPONSE) {
+                        return self->on_error(error::malformed_frame);
+                    }
+
+                    self->payload.resize(length);
+
+                    asio::async_read(self->channel, asio::buffer(self->payload),
+                        [self] (sys::error_code ec, size_t) {
+                            if (self->stopped) return;
+                            if (ec) return self->on_error(ec);
+
+                            uint64_t id = 0;
+                            for (int i = 0; i < 8; ++i) id = (id << 8) | self->header[4 + i];
+
+                            auto p = move(self->payload);
+                            self->payload = vector<uint8_t>();
+
+                            self->on_frame(Kind(self->header[12]), id, move(p));
+
+                            if (!self->stopped) self->read_next();
+                        });
+                });
+        }
+    };
+}
+
+//--------------------------------------------------------------------
+struct RpcClient::State : public enable_shared_from_this<State> {
+    struct Call {
+        OnReply on_reply;
+        unique_ptr<asio::steady_timer> timer;
+    };
+
+    State(Channel& ch)
+        : channel(ch)
+        , ios(ch.get_io_service())
+        , strand(ios)
+    {}
+
+    Channel& channel;
+    asio::io_service& ios;
+    // The calls are completed by the reader (in the channel's strand), by
+    // their timers and by failed writes, all of which go through here.
+    asio::io_service::strand strand;
+    shared_ptr<FrameReader> reader;
+    uint64_t next_id = 0;
+    // In the strand.
+    map<uint64_t, Call> calls;
+    sys::error_code error;
+
+    void complete(uint64_t id, sys::error_code ec, Payload p) {
+        auto i = calls.find(id);
+        if (i == calls.end()) return; // Timed out or aborted before
+
+        auto f = move(i->second.on_reply);
+        i->second.timer->cancel();
+        calls.erase(i);
+        f(ec, move(p));
+    }
+
+    void fail_all(sys::error_code ec) {
+        error = ec;
+
+        auto calls = move(this->calls);
+        this->calls.clear();
+
+        for (auto& c : calls) {
+            c.second.timer->cancel();
+            ios.post(bind(move(c.second.on_reply), ec, Payload()));
+        }
+    }
+};
+
+RpcClient::RpcClient(Channel& channel)
+    : _state(make_shared<State>(channel))
+{
+    weak_ptr<State> w = _state;
+
+    _state->reader = make_shared<FrameReader>(channel,
+        [w] (Kind kind, uint64_t id, Payload p) {
+            auto s = w.lock();
+            if (!s) return;
+
+            if (kind != RESPONSE) {
+                s->reader->stop();
+                close(s->channel);
+                return s->strand.dispatch([s] {
+                        s->fail_all(error::malformed_frame);
+                    });
+            }
+
+            s->strand.dispatch([s, id, p = move(p)] () mutable {
+                    s->complete(id, sys::error_code(), move(p));
+                });
+        },
+        [w] (sys::error_code ec) {
+            auto s = w.lock();
+            if (!s) return;
+            // Nothing more will be read, a malformed frame may be half way.
+            if (ec == error::malformed_frame) close(s->channel);
+            s->strand.dispatch([s, ec] { s->fail_all(ec); });
+        });
+
+    _state->reader->read_next();
+}
+
+void RpcClient::call_impl(Payload request, Duration timeout, OnReply h)
+{
+    auto& ios = _state->ios;
+
+    if (request.size() > max_payload) {
+        return ios.post([h = move(h)] {
+                h(asio::error::message_size, Payload());
+            });
+    }
+
+    auto id = _state->next_id++;
+
+    // Queued in the strand ahead of anything the write below leads to, so
+    // the call is there by the time its response (or write error) is.
+    _state->strand.dispatch([s = _state, id, timeout, h = move(h)] () mutable {
+            if (s->error) {
+                return s->ios.post([h = move(h), ec = s->error] { h(ec, Payload()); });
+            }
+
+            auto& call = s->calls[id];
+            call.on_reply = move(h);
+            call.timer = make_unique<asio::steady_timer>(s->ios);
+            call.timer->expires_from_now(timeout);
+
+            weak_ptr<State> w = s;
+
+            call.timer->async_wait(s->strand.wrap([w, id] (sys::error_code ec) {
+                    if (ec) return; // Cancelled
+                    if (auto s = w.lock()) {
+                        s->complete(id, asio::error::timed_out, Payload());
+                    }
+                }));
+        });
+
+    weak_ptr<State> w = _state;
+
+    write_frame(_state->channel, id, REQUEST, request,
+        [w, id] (sys::error_code ec, size_t) {
+            if (!ec) return;
+            auto s = w.lock();
+            if (!s) return;
+            s->strand.dispatch([s, id, ec] { s->complete(id, ec, Payload()); });
+        });
+}
+
+size_t RpcClient::outstanding() const
+{
+    return _state->calls.size();
+}
+
+void RpcClient::close(Channel& ch)
+{
+    if (auto impl = ch.get_impl()) impl->close();
+}
+
+RpcClient::~RpcClient()
+{
+    _state->reader->stop();
+    close(_state->channel);
+    // Doesn't touch the channel, which may be gone by the time it runs.
+    _state->strand.dispatch([s = _state] {
+            s->fail_all(asio::error::operation_aborted);
+        });
+}
+
+//--------------------------------------------------------------------
+struct RpcServer::State : public enable_shared_from_this<State> {
+    State(Channel& ch, Handler h) : channel(ch), handler(move(h)) {}
+
+    Channel& channel;
+    Handler handler;
+    shared_ptr<FrameReader> reader;
+    OnDone on_done;
+    // Set by the destructor, replies may be sent from any thread.
+    atomic<bool> closed{false};
+
+    void finish(sys::error_code ec) {
+        if (ec == asio::error::connection_reset) ec = sys::error_code();
+        auto f = move(on_done);
+        if (f) f(ec);
+    }
+};
+
+RpcServer::RpcServer(Channel& channel, Handler handler)
+    : _state(make_shared<State>(channel, move(handler)))
+{
+}
+
+void RpcServer::run_impl(OnDone h)
+{
+    _state->on_done = move(h);
+
+    weak_ptr<State> w = _state;
+
+    _state->reader = make_shared<FrameReader>(_state->channel,
+        [w] (Kind kind, uint64_t id, Payload request) {
+            auto s = w.lock();
+            if (!s) return;
+
+            if (kind != REQUEST) {
+                s->reader->stop();
+                close(s->channel);
+                return s->finish(error::malformed_frame);
+            }
+
+            s->handler(move(request), [w, id] (Payload response) {
+                    auto s = w.lock();
+                    if (!s || s->closed) return;
+                    write_frame(s->channel, id, RESPONSE, response,
+                                [] (sys::error_code, size_t) {});
+                });
+        },
+        [w] (sys::error_code ec) {
+            auto s = w.lock();
+            if (!s) return;
+            if (ec == error::malformed_frame) close(s->channel);
+            s->finish(ec);
+        });
+
+    _state->reader->read_next();
+}
+
+void RpcServer::close(Channel& ch)
+{
+    if (auto impl = ch.get_impl()) impl->close();
+}
+
+RpcServer::~RpcServer()
+{
+    _state->closed = true;
+
+    if (_state->reader) {
+        _state->reader->stop();
+        close(_state->channel);
+    }
+
+    if (auto f = move(_state->on_done)) {
+        _state->channel.get_io_service().post([f = move(f)] {
+                f(asio::error::operation_aborted);
+            });
+    }
+}
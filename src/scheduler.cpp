@@ -15,6 +15,10 @@ static void throw_error(const error::error_t& ec)
 
 Scheduler::Scheduler(string config, asio::io_service& ios)
     : _ios(ios)
+    , _reclaimer(make_shared<Reclaimer>(ios))
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+    , _metrics(make_shared<SchedulerMetrics>())
+#endif
 {
     if (pipe2(_pipes, O_NONBLOCK) != 0) {
         throw_error(error::cant_create_pipes);
@@ -81,15 +85,11 @@ void Scheduler::wait_for_job()
             drain_pipe(self->_pipes[0]);
 
             while(true) {
-                queue<Handler> handlers;
-                {
-                    lock_guard<mutex> lock(self->_mutex);
-                    handlers = move(self->_handlers);
-                    if (handlers.empty()) break;
-                }
+                auto handlers = self->_handlers.take_all();
+                if (handlers.empty()) break;
+
                 while (!handlers.empty()) {
-                    auto h = move(handlers.front());
-                    handlers.pop();
+                    auto h = handlers.pop();
                     h(self->_cfg);
                     if (self->_shutdown) return;
                 }
@@ -110,12 +110,22 @@ void Scheduler::wait_for_job()
 
 void Scheduler::post(Handler f)
 {
-    {
-        lock_guard<mutex> lock(_mutex);
-        _handlers.push([ w = asio::io_service::work(_ios)
-                       , f = move(f)
-                       ] (auto arg) { f(arg); });
-    }
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+    _metrics->to_gnunet.enqueued();
+    f = [ m      = _metrics
+        , posted = HopMetrics::Clock::now()
+        , f      = move(f)
+        ] (auto arg) { m->to_gnunet.run(posted, f, arg); };
+#endif
+
+    bool was_empty = _handlers.push([ w = asio::io_service::work(_ios)
+                                    , f = move(f)
+                                    ] (auto arg) { f(arg); });
+
+    // Otherwise GNUnet's thread was already woken up and hasn't taken the
+    // queue yet, it'll find this one there as well.
+    if (!was_empty) return;
+
     static char b = 0;
     write(_pipes[1], &b, 1);
 }
@@ -125,6 +135,30 @@ void Scheduler::post(function<void()> f)
     post([f = move(f)](auto) { f(); });
 }
 
+SchedulerStats Scheduler::stats() const
+{
+    SchedulerStats s;
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+    s.enabled   = true;
+    s.to_gnunet = _metrics->to_gnunet.stats();
+    s.to_main   = _metrics->to_main.stats();
+#endif
+    return s;
+}
+
+void Scheduler::reset_stats()
+{
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+    _metrics->to_gnunet.reset();
+    _metrics->to_main.reset();
+#endif
+}
+
+void Scheduler::reclaim(shared_ptr<void> p)
+{
+    _reclaimer->retire(move(p));
+}
+
 Scheduler::~Scheduler()
 {
     post([this] { 
@@ -1,11 +1,17 @@
 #pragma once
 
 #include <thread>
-#include <mutex>
-#include <queue>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/io_service_strand.hpp>
 
 #include <gnunet_channels/namespaces.h>
+#include <gnunet_channels/stats.h>
+#include "handoff_queue.h"
+#include "reclaimer.h"
+
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+#   include "scheduler_metrics.h"
+#endif
 
 struct GNUNET_CONFIGURATION_Handle;
 struct GNUNET_SCHEDULER_Task;
@@ -25,6 +31,25 @@ public:
 
     asio::io_service& get_io_service();
 
+    // Post a handler from GNUnet's thread to the main thread. Same as
+    // `get_io_service().post(f)`, except that the hop is accounted for in
+    // the scheduler's metrics (when those are compiled in).
+    template<class F> void post_to_ios(F&&);
+
+    // Same as above, but the handler is executed in the strand (or any
+    // executor with a `post`, see channel_policy.h).
+    template<class Executor, class F> void post_to_ios(Executor&, F&&);
+
+    // Returns a disabled SchedulerStats unless built with
+    // GNUNET_CHANNELS_SCHEDULER_METRICS.
+    SchedulerStats stats() const;
+    void reset_stats();
+
+    // Destroy the object in the main thread. Called from GNUnet's thread
+    // to drop the last reference to objects that must not be destroyed
+    // there.
+    void reclaim(std::shared_ptr<void>);
+
     ~Scheduler();
 
 private:
@@ -46,8 +71,43 @@ private:
     bool _shutdown = false;
     const GNUNET_CONFIGURATION_Handle* _cfg = nullptr;
     GNUNET_SCHEDULER_Task* _pipe_task = nullptr;
-    std::mutex _mutex;
-    std::queue<Handler> _handlers;
+    // Posted from the main thread(s) (and from GNUnet's own), drained in
+    // GNUnet's thread. The pipe is only written to when it was empty.
+    HandoffQueue<Handler> _handlers;
+    std::shared_ptr<Reclaimer> _reclaimer;
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+    // Shared with the posted handlers which may outlive the scheduler.
+    std::shared_ptr<SchedulerMetrics> _metrics;
+#endif
 };
 
+//--------------------------------------------------------------------
+template<class F>
+inline void Scheduler::post_to_ios(F&& f)
+{
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+    _metrics->to_main.enqueued();
+    _ios.post([ m      = _metrics
+              , posted = HopMetrics::Clock::now()
+              , f      = std::forward<F>(f)
+              ] () mutable { m->to_main.run(posted, f); });
+#else
+    _ios.post(std::forward<F>(f));
+#endif
+}
+
+template<class Executor, class F>
+inline void Scheduler::post_to_ios(Executor& strand, F&& f)
+{
+#if GNUNET_CHANNELS_SCHEDULER_METRICS
+    _metrics->to_main.enqueued();
+    strand.post([ m      = _metrics
+                , posted = HopMetrics::Clock::now()
+                , f      = std::forward<F>(f)
+                ] () mutable { m->to_main.run(posted, f); });
+#else
+    strand.post(std::forward<F>(f));
+#endif
+}
+
 } // gnunet_channels namespace
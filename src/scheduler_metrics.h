@@ -0,0 +1,53 @@
+#pragma once
+
+#include "latency_histogram.h"
+
+namespace gnunet_channels {
+
+// Latency of one direction of the hand-off between threads. Only used when
+// built with GNUNET_CHANNELS_SCHEDULER_METRICS.
+struct HopMetrics {
+    using Clock = std::chrono::steady_clock;
+
+    LatencyHistogram wait;
+    LatencyHistogram exec;
+    std::atomic<uint64_t> depth{0};
+    std::atomic<uint64_t> high_water{0};
+
+    void enqueued() {
+        uint64_t d  = depth.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint64_t hw = high_water.load(std::memory_order_relaxed);
+        while (d > hw && !high_water.compare_exchange_weak(hw, d)) {}
+    }
+
+    template<class F, class... Args>
+    void run(Clock::time_point posted, F& f, Args&&... args) {
+        auto start = Clock::now();
+        depth.fetch_sub(1, std::memory_order_relaxed);
+        wait.record(start - posted);
+        f(std::forward<Args>(args)...);
+        exec.record(Clock::now() - start);
+    }
+
+    HopStats stats() const {
+        HopStats s;
+        s.wait             = wait.summary();
+        s.exec             = exec.summary();
+        s.queue_depth      = depth.load(std::memory_order_relaxed);
+        s.queue_high_water = high_water.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void reset() {
+        wait.reset();
+        exec.reset();
+        high_water.store(depth.load(std::memory_order_relaxed));
+    }
+};
+
+struct SchedulerMetrics {
+    HopMetrics to_gnunet;
+    HopMetrics to_main;
+};
+
+} // gnunet_channels namespace
@@ -0,0 +1,182 @@
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_cadet_service.h>
+#include <gnunet/gnunet_util_lib.h>
+#include <algorithm>
+#include <cassert>
+#include "send_scheduler.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+const size_t SendScheduler::quantum = GNUNET_CONSTANTS_MAX_CADET_MESSAGE_SIZE
+                                    - sizeof(GNUNET_MessageHeader);
+
+constexpr size_t SendScheduler::max_in_flight;
+constexpr size_t SendScheduler::max_in_flight_per_flow;
+
+void SendScheduler::set_weight(Flow& f, uint32_t weight)
+{
+    f._weight = max<uint32_t>(1, weight);
+}
+
+void SendScheduler::set_limit(Flow& f, RateLimit l)
+{
+    f._bucket.set(l);
+
+    // The new limit may let a paced flow through sooner.
+    if (f._pacing_timer) {
+        GNUNET_SCHEDULER_cancel(f._pacing_timer);
+        f._pacing_timer = nullptr;
+        activate(f);
+    }
+}
+
+void SendScheduler::set_limit(RateLimit l)
+{
+    // Flows already paced keep waiting for their timers.
+    _bucket.set(l);
+    run();
+}
+
+void SendScheduler::activate(Flow& f)
+{
+    if (f._removed) return;
+
+    if (f._pacing_timer) {
+        // It'll be activated once the rate limits allow it.
+        return;
+    }
+
+    if (!f._active) {
+        f._active = true;
+        _active.push_back(&f);
+    }
+
+    // Let a flow which has nothing in flight through even if the other
+    // flows used up all the slots, it's charged for it in its deficit.
+    if (_in_flight >= max_in_flight && f._in_flight == 0) {
+        auto size = f.next_size();
+        if (size && pace(f)) emit(f, size);
+    }
+
+    run();
+}
+
+void SendScheduler::sent(Flow& f)
+{
+    if (f._removed) return;
+
+    assert(f._in_flight && _in_flight);
+
+    --f._in_flight;
+    --_in_flight;
+
+    if (!f._active && !f._pacing_timer && f.next_size()) {
+        f._active = true;
+        _active.push_back(&f);
+    }
+
+    run();
+}
+
+void SendScheduler::remove(Flow& f)
+{
+    f._removed = true;
+
+    _in_flight -= f._in_flight;
+    f._in_flight = 0;
+
+    if (f._pacing_timer) {
+        GNUNET_SCHEDULER_cancel(f._pacing_timer);
+        f._pacing_timer = nullptr;
+    }
+
+    if (f._active) {
+        _active.erase(find(_active.begin(), _active.end(), &f));
+        f._active = false;
+    }
+}
+
+void SendScheduler::emit(Flow& f, size_t size)
+{
+    ++f._in_flight;
+    ++_in_flight;
+    f._deficit -= size;
+    f._bucket.consume(size);
+    _bucket.consume(size);
+    f.emit();
+}
+
+bool SendScheduler::pace(Flow& f)
+{
+    auto delay = max(f._bucket.delay(), _bucket.delay());
+
+    if (delay == delay.zero()) return true;
+
+    if (f._active) {
+        _active.erase(find(_active.begin(), _active.end(), &f));
+        f._active = false;
+    }
+
+    auto us = chrono::duration_cast<chrono::microseconds>(delay).count();
+
+    f._scheduler = this;
+    f._pacing_timer = GNUNET_SCHEDULER_add_delayed
+        ( GNUNET_TIME_relative_multiply(GNUNET_TIME_UNIT_MICROSECONDS, us + 1)
+        , on_pacing_timer
+        , &f);
+
+    f.paced();
+    return false;
+}
+
+void SendScheduler::on_pacing_timer(void* cls)
+{
+    auto& f = *static_cast<Flow*>(cls);
+    f._pacing_timer = nullptr;
+    f._scheduler->activate(f);
+}
+
+void SendScheduler::run()
+{
+    if (_running) {
+        _rerun = true;
+        return;
+    }
+
+    _running = true;
+
+    do {
+        _rerun = false;
+
+        while (!_active.empty() && _in_flight < max_in_flight) {
+            Flow& f = *_active.front();
+            size_t size = f.next_size();
+
+            if (size == 0 || f._in_flight >= max_in_flight_per_flow) {
+                // Done, or waiting for its envelopes to leave the MQ. In
+                // the latter case it's put back by `sent` and keeps the
+                // credit it has.
+                _active.pop_front();
+                f._active = false;
+                if (size == 0) f._deficit = min<int64_t>(f._deficit, 0);
+                continue;
+            }
+
+            if (f._deficit < int64_t(size)) {
+                // Next round for this one.
+                f._deficit += quantum * f._weight;
+                _active.pop_front();
+                _active.push_back(&f);
+                continue;
+            }
+
+            if (!pace(f)) continue;
+
+            emit(f, size);
+        }
+    }
+    while (_rerun);
+
+    _running = false;
+}
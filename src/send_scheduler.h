@@ -0,0 +1,100 @@
+#pragma once
+
+#include <deque>
+#include <stdint.h>
+#include <stddef.h>
+#include "token_bucket.h"
+
+struct GNUNET_SCHEDULER_Task;
+
+namespace gnunet_channels {
+
+// Decides which of the channels sharing one CADET handle puts the next
+// envelope into its MQ, using deficit round robin: each channel with data
+// ready is given `quantum * weight` bytes worth of credit per round and
+// sends envelopes while it has credit left. A channel writing a huge
+// buffer thus only gets its share of the handle and can't push small
+// writes of other channels behind a backlog of its own envelopes.
+//
+// Only a limited number of envelopes may wait in the MQs at once (across
+// all channels), the rest stay in the channels' buffers until the
+// scheduler picks them. A channel with nothing in flight may always send
+// one envelope though, so that channels stuck on CADET's window can't
+// starve the rest.
+//
+// Sending can further be paced by token buckets, one per flow and one
+// for the whole handle. A flow which would exceed either is taken out of
+// the rotation until the buckets allow it to send again.
+//
+// Must only be used in GNUnet's thread.
+class SendScheduler {
+public:
+    class Flow {
+    public:
+        // Size of the envelope `emit` would send next, zero if there is
+        // nothing to send.
+        virtual size_t next_size() const = 0;
+        // Puts one envelope into the MQ. Its notify_sent callback must
+        // call SendScheduler::sent.
+        virtual void emit() = 0;
+        // Called when sending is held back by a rate limit.
+        virtual void paced() {}
+
+        size_t in_flight() const { return _in_flight; }
+
+    protected:
+        ~Flow() {}
+
+    private:
+        friend class SendScheduler;
+
+        uint32_t _weight = 1;
+        int64_t  _deficit = 0;
+        size_t   _in_flight = 0;
+        bool     _active = false;
+        bool     _removed = false;
+        TokenBucket _bucket;
+        GNUNET_SCHEDULER_Task* _pacing_timer = nullptr;
+        SendScheduler* _scheduler = nullptr;
+    };
+
+    // Bytes of credit a flow of weight 1 receives per round, one full
+    // CADET message.
+    static const size_t quantum;
+    static constexpr size_t max_in_flight = 16;
+    static constexpr size_t max_in_flight_per_flow = 8;
+
+public:
+    void set_weight(Flow&, uint32_t weight);
+    void set_limit(Flow&, RateLimit);
+    // Limit for all flows together.
+    void set_limit(RateLimit);
+
+    // The flow has (more) data ready to be sent.
+    void activate(Flow&);
+    // One of the flow's envelopes left the MQ.
+    void sent(Flow&);
+    // The flow won't send anymore (the channel was closed or destroyed),
+    // its envelopes still in the MQ are forgotten.
+    void remove(Flow&);
+
+    size_t in_flight() const { return _in_flight; }
+
+private:
+    void run();
+    void emit(Flow&, size_t size);
+    // Returns false (and arranges for the flow to be activated later) if
+    // the flow must wait for the rate limits.
+    bool pace(Flow&);
+    static void on_pacing_timer(void*);
+
+private:
+    std::deque<Flow*> _active;
+    TokenBucket _bucket;
+    size_t _in_flight = 0;
+    // `emit` may re-enter through the MQ's notify_sent callbacks.
+    bool _running = false;
+    bool _rerun = false;
+};
+
+} // gnunet_channels namespace
@@ -2,6 +2,9 @@
 #include "scheduler.h"
 #include "cadet_connect.h"
 #include "hello_get.h"
+#include "ids.h"
+#include "loopback_transport.h"
+#include "shards.h"
 
 using namespace std;
 using namespace gnunet_channels;
@@ -9,16 +12,56 @@ using namespace gnunet_channels;
 struct Service::Impl {
     Impl(string config_path, asio::io_service& ios)
         : scheduler(move(config_path), ios)
+        , timers(make_shared<TimerWheel>(ios))
+        , reaper(make_shared<ChannelReaper>())
     {}
 
     bool was_destroyed = false;
 
+    // Set when using the in-process stand-in instead of CADET.
+    std::unique_ptr<LoopbackOptions> loopback;
+
+    ShardingOptions sharding;
+
     Scheduler                     scheduler;
     std::shared_ptr<CadetConnect> cadet_connect;
+    // The first handle, all of them are in `shards` if there's more.
     std::shared_ptr<Cadet>        cadet;
+    std::shared_ptr<Shards>       shards;
     std::shared_ptr<HelloGet>     hello_get;
+    // Deadlines of all the channels, whichever handle they use.
+    std::shared_ptr<TimerWheel>   timers;
+    std::shared_ptr<ChannelReaper> reaper;
     // TODO: This is currently unused, but may come in handy in the future.
     GNUNET_PeerIdentity           identity;
+
+    // Executed in the main thread once a handle is ready, returns true
+    // when all of them are.
+    bool add_handle(shared_ptr<Cadet> c) {
+        c->set_timers(timers);
+        c->set_reaper(reaper);
+
+        if (sharding.handles == 1) {
+            cadet = move(c);
+            return true;
+        }
+
+        if (!shards) {
+            shards = make_shared<Shards>(sharding);
+            cadet = c;
+        }
+
+        c->set_shards(shards);
+        shards->add(move(c));
+
+        return shards->all().size() == sharding.handles;
+    }
+
+    vector<shared_ptr<Cadet>> handles() const {
+        if (shards) return shards->all();
+        if (cadet) return { cadet };
+        return {};
+    }
 };
 
 Service::Service(string config_path, asio::io_service& ios)
@@ -26,13 +69,29 @@ Service::Service(string config_path, asio::io_service& ios)
 {
 }
 
+Service::Service( string config_path
+                , asio::io_service& ios
+                , LoopbackOptions options)
+    : _impl(make_shared<Impl>(config_path, ios))
+{
+    _impl->loopback = make_unique<LoopbackOptions>(options);
+}
+
 asio::io_service& Service::get_io_service()
 {
     return _impl->scheduler.get_io_service();
 }
 
-shared_ptr<Cadet>& Service::cadet()
+void Service::set_sharding(ShardingOptions options)
 {
+    assert(!_impl->cadet_connect && !_impl->cadet);
+    options.handles = max<size_t>(1, options.handles);
+    _impl->sharding = options;
+}
+
+shared_ptr<Cadet> Service::cadet()
+{
+    if (_impl->shards) return _impl->shards->pick();
     return _impl->cadet;
 }
 
@@ -41,20 +100,83 @@ string Service::identity() const
 	return GNUNET_i2s_full(&_impl->identity);
 }
 
+PeerId Service::peer_id() const
+{
+    return from_gnunet(_impl->identity);
+}
+
+ServiceStats Service::stats() const
+{
+    ServiceStats s;
+    for (auto& c : _impl->handles()) s += c->stats()->snapshot();
+    return s;
+}
+
+vector<ServiceStats> Service::handle_stats() const
+{
+    vector<ServiceStats> ret;
+    for (auto& c : _impl->handles()) ret.push_back(c->stats()->snapshot());
+    return ret;
+}
+
+// Each of the handles gets an equal part.
+static RateLimit split(RateLimit l, size_t parts)
+{
+    if (l.bytes_per_second) {
+        l.bytes_per_second = max<uint64_t>(1, l.bytes_per_second / parts);
+    }
+    return l;
+}
+
+void Service::set_send_limit(RateLimit l)
+{
+    auto cs = _impl->handles();
+    for (auto& c : cs) c->set_send_limit(split(l, cs.size()));
+}
+
+void Service::set_receive_limit(RateLimit l)
+{
+    auto cs = _impl->handles();
+    for (auto& c : cs) c->set_receive_limit(split(l, cs.size()));
+}
+
+void Service::set_idle_options(IdleOptions o)
+{
+    _impl->reaper->set_options(o);
+}
+
+SchedulerStats Service::scheduler_stats() const
+{
+    return _impl->scheduler.stats();
+}
+
+void Service::reset_scheduler_stats()
+{
+    _impl->scheduler.reset_stats();
+}
+
 void Service::async_setup_impl(OnSetup on_setup)
 {
     // TODO: Return error code
     assert(!_impl->cadet_connect);
 
+    if (_impl->loopback) {
+        return loopback_setup(move(on_setup));
+    }
+
     _impl->cadet_connect = make_shared<CadetConnect>(_impl->scheduler);
 
-    // TODO: Timeout
-    _impl->cadet_connect->run([ impl     = _impl
-                              , on_setup = move(on_setup)
-                              ] (shared_ptr<Cadet> cadet) {
+    // Shared by the handles, only the last one to connect continues.
+    auto on_ready = make_shared<OnSetup>(move(on_setup));
+
+    auto on_handle = [ impl = _impl
+                     , on_ready
+                     ] (shared_ptr<Cadet> cadet) {
             if (impl->was_destroyed) return;
 
-            impl->cadet = move(cadet);
+            if (!impl->add_handle(move(cadet))) return;
+
+            auto on_setup = move(*on_ready);
 
             impl->hello_get = make_shared<HelloGet>(impl->scheduler);
             impl->hello_get->run([ impl     = move(impl)
@@ -64,6 +186,50 @@ void Service::async_setup_impl(OnSetup on_setup)
                     impl->identity = m.peer_identity();
                     on_setup(sys::error_code());
                 });
+        };
+
+    // TODO: Timeout
+    for (size_t i = 0; i < _impl->sharding.handles; ++i) {
+        _impl->cadet_connect->run(on_handle);
+    }
+}
+
+void Service::loopback_setup(OnSetup on_setup)
+{
+    _impl->scheduler.post([ impl     = _impl
+                          , on_setup = move(on_setup)
+                          ] {
+            GNUNET_PeerIdentity identity;
+            GNUNET_CRYPTO_random_block( GNUNET_CRYPTO_QUALITY_WEAK
+                                      , &identity
+                                      , sizeof(identity));
+
+            // All the handles are the same peer.
+            vector<Transport*> transports;
+
+            for (size_t i = 0; i < impl->sharding.handles; ++i) {
+                transports.push_back(new LoopbackTransport( *impl->loopback
+                                                          , identity));
+            }
+
+            impl->scheduler.post_to_ios([ impl
+                                        , on_setup  = move(on_setup)
+                                        , transports
+                                        , identity ] {
+                    vector<shared_ptr<Cadet>> cadets;
+
+                    for (auto t : transports) {
+                        cadets.push_back(make_shared<Cadet>( impl->scheduler
+                                                           , unique_ptr<Transport>(t)));
+                    }
+
+                    if (impl->was_destroyed) return;
+
+                    for (auto& c : cadets) impl->add_handle(move(c));
+
+                    impl->identity = identity;
+                    on_setup(sys::error_code());
+                });
         });
 }
 
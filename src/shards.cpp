@@ -0,0 +1,34 @@
+#include <algorithm>
+#include "shards.h"
+#include "cadet.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+void Shards::add(shared_ptr<Cadet> cadet)
+{
+    _cadets.push_back(move(cadet));
+}
+
+shared_ptr<Cadet> Shards::pick() const
+{
+    auto load = [] (const shared_ptr<Cadet>& c) {
+        return c->stats()->channels_open.load(memory_order_relaxed);
+    };
+
+    return *min_element( _cadets.begin(), _cadets.end()
+                       , [&] (auto& a, auto& b) { return load(a) < load(b); });
+}
+
+shared_ptr<Cadet> Shards::pick(const PeerId& peer, const PortHash& port) const
+{
+    if (_options.assign != ShardingOptions::Assign::by_hash) return pick();
+
+    // FNV-1a over both.
+    uint64_t h = 14695981039346656037ull;
+
+    for (auto b : peer.bytes()) h = (h ^ b) * 1099511628211ull;
+    for (auto b : port.bytes()) h = (h ^ b) * 1099511628211ull;
+
+    return _cadets[h % _cadets.size()];
+}
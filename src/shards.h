@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <gnunet_channels/peer_id.h>
+#include <gnunet_channels/sharding.h>
+
+namespace gnunet_channels {
+
+class Cadet;
+
+// The CADET handles of a sharded Service. Only used in the main thread.
+class Shards {
+public:
+    Shards(ShardingOptions options) : _options(options) {}
+
+    void add(std::shared_ptr<Cadet>);
+
+    const std::vector<std::shared_ptr<Cadet>>& all() const { return _cadets; }
+
+    // Whether the handle of a connecting channel depends on where it goes.
+    bool by_hash() const {
+        return _options.assign == ShardingOptions::Assign::by_hash;
+    }
+
+    // For channels (and ports) whose destination isn't known (yet).
+    std::shared_ptr<Cadet> pick() const;
+
+    // For channels connecting to the given peer and port. Returns the
+    // same as above unless assigning by hash.
+    std::shared_ptr<Cadet> pick(const PeerId&, const PortHash&) const;
+
+private:
+    ShardingOptions _options;
+    std::vector<std::shared_ptr<Cadet>> _cadets;
+};
+
+} // gnunet_channels namespace
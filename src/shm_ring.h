@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <boost/asio/buffer.hpp>
+#include <gnunet_channels/namespaces.h>
+
+namespace gnunet_channels {
+
+// Single producer, single consumer byte ring living in memory shared by
+// two processes. Only the producer moves `_tail` and only the consumer
+// moves `_head`; both run freely and are taken modulo the capacity, which
+// is a power of two. The data follows the object in memory.
+class ShmRing {
+public:
+    // Bytes needed for a ring of `capacity` bytes, including this header.
+    static size_t footprint(size_t capacity) {
+        return sizeof(ShmRing) + capacity;
+    }
+
+    static ShmRing* construct(void* at, size_t capacity) {
+        return new (at) ShmRing(capacity);
+    }
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    size_t capacity() const { return _capacity; }
+
+    size_t readable() const {
+        return _tail.load(std::memory_order_acquire)
+             - _head.load(std::memory_order_relaxed);
+    }
+
+    size_t writable() const {
+        return _capacity - ( _tail.load(std::memory_order_relaxed)
+                           - _head.load(std::memory_order_acquire));
+    }
+
+    // Producer side: up to `max` bytes of free space (in two pieces when
+    // it wraps around), made visible to the consumer by `commit`.
+    std::array<asio::mutable_buffer, 2> prepare(size_t max) {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        return split<asio::mutable_buffer>(tail, std::min(max, writable()));
+    }
+
+    void commit(size_t n) {
+        _tail.store(_tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // Consumer side: up to `max` readable bytes, released by `consume`.
+    std::array<asio::const_buffer, 2> data(size_t max) const {
+        auto head = _head.load(std::memory_order_relaxed);
+        return split<asio::const_buffer>(head, std::min(max, readable()));
+    }
+
+    void consume(size_t n) {
+        _head.store(_head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // Copying versions of the above, return the number of bytes copied.
+    template<class ConstBufferSequence>
+    size_t write(const ConstBufferSequence& bufs) {
+        size_t n = asio::buffer_copy(prepare(asio::buffer_size(bufs)), bufs);
+        commit(n);
+        return n;
+    }
+
+    template<class MutableBufferSequence>
+    size_t read(const MutableBufferSequence& bufs) {
+        size_t n = asio::buffer_copy(bufs, data(asio::buffer_size(bufs)));
+        consume(n);
+        return n;
+    }
+
+    // Only while neither side is using the ring.
+    void reset() {
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    explicit ShmRing(size_t capacity) : _capacity(capacity) {}
+
+    template<class Buffer>
+    std::array<Buffer, 2> split(uint64_t pos, size_t size) const {
+        auto at    = pos & (_capacity - 1);
+        auto first = std::min<size_t>(size, _capacity - at);
+        auto base  = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(this + 1));
+
+        return {{ Buffer(base + at, first), Buffer(base, size - first) }};
+    }
+
+private:
+    // On separate cache lines so that the two sides don't fight over them.
+    alignas(64) std::atomic<uint64_t> _head{0};
+    alignas(64) std::atomic<uint64_t> _tail{0};
+    alignas(64) uint64_t _capacity;
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory rings need lock free atomics");
+
+} // gnunet_channels namespace
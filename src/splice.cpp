@@ -0,0 +1,232 @@
+#include <iostream>
+#include <boost/asio/io_service_strand.hpp>
+#include <boost/asio/write.hpp>
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_cadet_service.h>
+#include <gnunet_channels/splice.h>
+#include "channel_impl.h"
+#include "pool.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+struct Splice::State : public enable_shared_from_this<State> {
+    using Clock = chrono::steady_clock;
+
+    // What fits into one CADET message, which is also less than the
+    // largest buffer the Pool keeps.
+    static constexpr size_t chunk_size = GNUNET_CONSTANTS_MAX_CADET_MESSAGE_SIZE
+                                       - sizeof(GNUNET_MessageHeader);
+
+    State(asio::ip::tcp::socket& socket, Channel& channel, size_t max_in_flight)
+        : strand(channel.get_io_service())
+        , socket(socket)
+        , channel(channel)
+        , max_in_flight(max(max_in_flight, size_t(1)))
+    {}
+
+    // The socket's handlers and the channel's (which come from the
+    // channel's own strand) both touch what's below, so all of them are
+    // executed in here.
+    asio::io_service::strand strand;
+
+    asio::ip::tcp::socket& socket;
+    Channel& channel;
+    const size_t max_in_flight;
+
+    OnDone on_done;
+    bool done = false;
+    bool tcp_eof = false;
+    bool reading_tcp = false;
+    size_t in_flight = 0;
+
+    Clock::time_point start;
+    SpliceStats stats;
+
+    void read_tcp();
+    void take_channel();
+    void finish(sys::error_code);
+};
+
+//--------------------------------------------------------------------
+// TCP -> Channel
+void Splice::State::read_tcp()
+{
+    if (done || tcp_eof || reading_tcp) return;
+
+    if (in_flight >= max_in_flight) {
+        ++stats.tcp_read_stalls;
+        return;
+    }
+
+    auto buffer = Pool::instance().acquire_buffer();
+    buffer.resize(chunk_size);
+
+    reading_tcp = true;
+
+    // The buffer must stay put while the read is pending, so keep it in a
+    // shared_ptr instead of moving it into the handler.
+    auto b = make_shared<vector<uint8_t>>(move(buffer));
+
+    socket.async_read_some(asio::buffer(*b), strand.wrap(
+        [self = shared_from_this(), b] (sys::error_code ec, size_t size) {
+            self->reading_tcp = false;
+
+            if (self->done) {
+                return Pool::instance().release_buffer(move(*b));
+            }
+
+            if (ec) {
+                Pool::instance().release_buffer(move(*b));
+
+                if (ec != asio::error::eof) return self->finish(ec);
+
+                // A channel can't be half closed, so the peer doesn't
+                // learn about it. What it sends is still written to the
+                // socket until it ends the channel (see take_channel).
+                self->tcp_eof = true;
+                return;
+            }
+
+            b->resize(size);
+
+            ++self->stats.tcp_reads;
+            ++self->stats.channel_writes;
+            self->stats.tcp_to_channel_bytes += size;
+            ++self->in_flight;
+
+            // No copy here, ChannelImpl puts it into the MQ envelopes and
+            // then returns it to the Pool.
+            self->channel.write_impl(move(*b),
+                self->strand.wrap([self] (sys::error_code ec, size_t) {
+                    --self->in_flight;
+
+                    if (self->done) return;
+                    if (ec) return self->finish(ec);
+
+                    self->read_tcp();
+                }));
+
+            self->read_tcp();
+        }));
+}
+
+//--------------------------------------------------------------------
+// Channel -> TCP
+void Splice::State::take_channel()
+{
+    if (done) return;
+
+    // Not through strand.wrap, it would copy the message.
+    channel.take_impl([self = shared_from_this()] ( sys::error_code ec
+                                                  , vector<uint8_t> data) {
+        self->strand.dispatch([self, ec, data = move(data)] () mutable {
+            if (self->done) {
+                return Pool::instance().release_buffer(move(data));
+            }
+
+            if (ec) return self->finish(ec);
+
+            ++self->stats.channel_reads;
+
+            auto d = make_shared<vector<uint8_t>>(move(data));
+
+            asio::async_write(self->socket, asio::buffer(*d), self->strand.wrap(
+                [self, d] (sys::error_code ec, size_t size) {
+                    Pool::instance().release_buffer(move(*d));
+
+                    if (self->done) return;
+                    if (ec) return self->finish(ec);
+
+                    ++self->stats.tcp_writes;
+                    self->stats.channel_to_tcp_bytes += size;
+
+                    self->take_channel();
+                }));
+        });
+    });
+}
+
+//--------------------------------------------------------------------
+void Splice::State::finish(sys::error_code ec)
+{
+    if (done) return;
+    done = true;
+
+    stats.duration = Clock::now() - start;
+
+    // The peer going away is how a proxied session normally ends.
+    if (ec == asio::error::eof || ec == asio::error::connection_reset) {
+        ec = sys::error_code();
+    }
+
+    // Everything the channel sent was written out, the other end of the
+    // socket gets an EOF. Closing the channel aborts the pending take,
+    // the channel has nothing more to do once the splice is done.
+    sys::error_code ignored;
+    socket.shutdown(asio::ip::tcp::socket::shutdown_send, ignored);
+    socket.cancel(ignored);
+
+    if (auto impl = channel.get_impl()) impl->close();
+
+    auto h = move(on_done);
+    if (h) channel.get_io_service().post([h = move(h), ec] { h(ec); });
+}
+
+//--------------------------------------------------------------------
+Splice::Splice( asio::ip::tcp::socket& socket
+              , Channel& channel
+              , size_t max_in_flight)
+    : _state(make_shared<State>(socket, channel, max_in_flight))
+{
+}
+
+void Splice::run_impl(OnDone h)
+{
+    _state->strand.dispatch([s = _state, h = move(h)] () mutable {
+            s->on_done = move(h);
+            s->start = State::Clock::now();
+            s->read_tcp();
+            s->take_channel();
+        });
+}
+
+void Splice::cancel()
+{
+    _state->strand.dispatch([s = _state] {
+            s->finish(asio::error::operation_aborted);
+        });
+}
+
+SpliceStats Splice::stats() const
+{
+    auto s = _state->stats;
+
+    if (!_state->done) {
+        s.duration = State::Clock::now() - _state->start;
+    }
+
+    return s;
+}
+
+Splice::~Splice()
+{
+    _state->strand.dispatch([s = _state] {
+            s->on_done = nullptr;
+            s->finish(asio::error::operation_aborted);
+        });
+}
+
+//--------------------------------------------------------------------
+std::ostream& gnunet_channels::operator<<(std::ostream& os, const SpliceStats& s)
+{
+    auto secs = chrono::duration<double>(s.duration).count();
+
+    return os << "SpliceStats{"
+              << "tcp->channel: " << s.tcp_to_channel_bytes << "B"
+              << " (" << s.tcp_reads << " reads, "
+              << s.tcp_read_stalls << " stalls), "
+              << "channel->tcp: " << s.channel_to_tcp_bytes << "B"
+              << " (" << s.channel_reads << " messages), "
+              << "duration: " << secs << "s}";
+}
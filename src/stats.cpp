@@ -0,0 +1,157 @@
+#include <ostream>
+#include "stats.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+static uint64_t load(const atomic<uint64_t>& c)
+{
+    return c.load(memory_order_relaxed);
+}
+
+ChannelStats gnunet_channels::snapshot(const ChannelCounters& c)
+{
+    ChannelStats s;
+
+    s.bytes_sent            = load(c.bytes_sent);
+    s.bytes_received        = load(c.bytes_received);
+    s.messages_sent         = load(c.messages_sent);
+    s.messages_received     = load(c.messages_received);
+    s.send_queue_depth      = load(c.send_queue_depth);
+    s.send_queue_bytes      = load(c.send_queue_bytes);
+    s.recv_queue_depth      = load(c.recv_queue_depth);
+    s.recv_queue_bytes      = load(c.recv_queue_bytes);
+    s.receive_done_deferred = load(c.receive_done_deferred);
+    s.send_rate_limit       = load(c.send_rate_limit);
+    s.receive_rate_limit    = load(c.receive_rate_limit);
+    s.send_paced            = load(c.send_paced);
+    s.receive_paced         = load(c.receive_paced);
+    s.keepalives_sent       = load(c.keepalives_sent);
+    s.keepalives_received   = load(c.keepalives_received);
+
+    return s;
+}
+
+ServiceStats ServiceCounters::snapshot() const
+{
+    ServiceStats s;
+
+    s.channels_created      = load(channels_created);
+    s.channels_open         = load(channels_open);
+    s.bytes_sent            = load(bytes_sent);
+    s.bytes_received        = load(bytes_received);
+    s.messages_sent         = load(messages_sent);
+    s.messages_received     = load(messages_received);
+    s.send_queue_depth      = load(send_queue_depth);
+    s.send_queue_bytes      = load(send_queue_bytes);
+    s.recv_queue_depth      = load(recv_queue_depth);
+    s.recv_queue_bytes      = load(recv_queue_bytes);
+    s.receive_done_deferred = load(receive_done_deferred);
+    s.send_rate_limit       = load(send_rate_limit);
+    s.receive_rate_limit    = load(receive_rate_limit);
+    s.send_paced            = load(send_paced);
+    s.receive_paced         = load(receive_paced);
+    s.keepalives_sent       = load(keepalives_sent);
+    s.keepalives_received   = load(keepalives_received);
+    s.channels_idle_closed  = load(channels_idle_closed);
+    s.channels_evicted      = load(channels_evicted);
+
+    return s;
+}
+
+ServiceStats& gnunet_channels::operator+=(ServiceStats& a, const ServiceStats& b)
+{
+    a.channels_created      += b.channels_created;
+    a.channels_open         += b.channels_open;
+    a.bytes_sent            += b.bytes_sent;
+    a.bytes_received        += b.bytes_received;
+    a.messages_sent         += b.messages_sent;
+    a.messages_received     += b.messages_received;
+    a.send_queue_depth      += b.send_queue_depth;
+    a.send_queue_bytes      += b.send_queue_bytes;
+    a.recv_queue_depth      += b.recv_queue_depth;
+    a.recv_queue_bytes      += b.recv_queue_bytes;
+    a.receive_done_deferred += b.receive_done_deferred;
+    a.send_rate_limit       += b.send_rate_limit;
+    a.receive_rate_limit    += b.receive_rate_limit;
+    a.send_paced            += b.send_paced;
+    a.receive_paced         += b.receive_paced;
+    a.keepalives_sent       += b.keepalives_sent;
+    a.keepalives_received   += b.keepalives_received;
+    a.channels_idle_closed  += b.channels_idle_closed;
+    a.channels_evicted      += b.channels_evicted;
+
+    return a;
+}
+
+ostream& gnunet_channels::operator<<(ostream& os, const ChannelStats& s)
+{
+    using namespace chrono;
+
+    return os
+        << "sent=" << s.bytes_sent << "B/" << s.messages_sent << "msg"
+        << " received=" << s.bytes_received << "B/" << s.messages_received << "msg"
+        << " send_queue=" << s.send_queue_depth << "/" << s.send_queue_bytes << "B"
+        << " recv_queue=" << s.recv_queue_depth << "/" << s.recv_queue_bytes << "B"
+        << " window=" << s.window
+        << " receive_done_deferred=" << s.receive_done_deferred
+        << " rate_limit=" << s.send_rate_limit << "/" << s.receive_rate_limit << "B/s"
+        << " paced=" << s.send_paced << "/" << s.receive_paced
+        << " keepalives=" << s.keepalives_sent << "/" << s.keepalives_received
+        << " connect_duration="
+        << duration_cast<microseconds>(s.connect_duration).count() << "us";
+}
+
+ostream& gnunet_channels::operator<<(ostream& os, const ServiceStats& s)
+{
+    return os
+        << "channels=" << s.channels_open << "/" << s.channels_created
+        << " idle_closed=" << s.channels_idle_closed
+        << " evicted=" << s.channels_evicted
+        << " sent=" << s.bytes_sent << "B/" << s.messages_sent << "msg"
+        << " received=" << s.bytes_received << "B/" << s.messages_received << "msg"
+        << " send_queue=" << s.send_queue_depth << "/" << s.send_queue_bytes << "B"
+        << " recv_queue=" << s.recv_queue_depth << "/" << s.recv_queue_bytes << "B"
+        << " receive_done_deferred=" << s.receive_done_deferred
+        << " rate_limit=" << s.send_rate_limit << "/" << s.receive_rate_limit << "B/s"
+        << " paced=" << s.send_paced << "/" << s.receive_paced
+        << " keepalives=" << s.keepalives_sent << "/" << s.keepalives_received;
+}
+
+ostream& gnunet_channels::operator<<(ostream& os, const LatencyStats& s)
+{
+    using namespace chrono;
+
+    auto us = [] (nanoseconds d) {
+        return duration_cast<duration<double, micro>>(d).count();
+    };
+
+    return os
+        << "n=" << s.count
+        << " mean=" << us(s.mean) << "us"
+        << " p50=" << us(s.p50) << "us"
+        << " p90=" << us(s.p90) << "us"
+        << " p99=" << us(s.p99) << "us"
+        << " p999=" << us(s.p999) << "us"
+        << " max=" << us(s.max) << "us";
+}
+
+static ostream& print(ostream& os, const char* name, const HopStats& s)
+{
+    return os
+        << name << ".wait: " << s.wait << "\n"
+        << name << ".exec: " << s.exec << "\n"
+        << name << ".queue: depth=" << s.queue_depth
+        << " high_water=" << s.queue_high_water << "\n";
+}
+
+ostream& gnunet_channels::operator<<(ostream& os, const SchedulerStats& s)
+{
+    if (!s.enabled) {
+        return os << "scheduler metrics not compiled in\n";
+    }
+
+    print(os, "to_gnunet", s.to_gnunet);
+    print(os, "to_main",   s.to_main);
+    return os;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <gnunet_channels/stats.h>
+
+namespace gnunet_channels {
+
+// Lock free counters behind ChannelStats and ServiceStats. Updated from
+// both threads with relaxed atomics, unless noted otherwise.
+struct ChannelCounters {
+    using Counter = std::atomic<uint64_t>;
+
+    Counter bytes_sent{0};
+    Counter bytes_received{0};
+    Counter messages_sent{0};
+    Counter messages_received{0};
+    Counter send_queue_depth{0};
+    Counter send_queue_bytes{0};
+    // Incremented in GNUnet's thread when a message arrives, decremented in
+    // the main thread once the message has been read. The receive_done
+    // deferral logic relies on these operations being sequentially
+    // consistent.
+    Counter recv_queue_depth{0};
+    Counter recv_queue_bytes{0};
+    Counter receive_done_deferred{0};
+    Counter send_paced{0};
+    Counter receive_paced{0};
+    Counter keepalives_sent{0};
+    Counter keepalives_received{0};
+    // Current limits (bytes per second), only set from the main thread.
+    Counter send_rate_limit{0};
+    Counter receive_rate_limit{0};
+};
+
+struct ServiceCounters : public ChannelCounters {
+    Counter channels_created{0};
+    Counter channels_open{0};
+    Counter channels_idle_closed{0};
+    Counter channels_evicted{0};
+
+    ServiceStats snapshot() const;
+};
+
+ChannelStats snapshot(const ChannelCounters&);
+
+} // gnunet_channels namespace
@@ -0,0 +1,176 @@
+#include "timer_wheel.h"
+
+using namespace std;
+using namespace gnunet_channels;
+
+TimerWheel::TimerWheel(asio::io_service& ios, Duration resolution)
+    : _timer(ios)
+    , _resolution(resolution)
+    , _start(Clock::now())
+    , _tick(0)
+{
+    _slots[0].resize(root_mask + 1, nullptr);
+
+    for (unsigned l = 1; l <= levels; ++l) {
+        _slots[l].resize(level_mask + 1, nullptr);
+    }
+}
+
+uint64_t TimerWheel::now_tick() const
+{
+    return (Clock::now() - _start) / _resolution;
+}
+
+void TimerWheel::arm(Entry& e, Duration timeout)
+{
+    auto at = Clock::now() - _start + max(timeout, Duration(0));
+    // Rounded up, so that entries never expire early.
+    uint64_t expires = (at + _resolution - Duration(1)) / _resolution;
+
+    lock_guard<mutex> lock(_mutex);
+
+    if (e._pprev) {
+        unlink(e);
+    }
+    else {
+        // Nothing was due while the wheel was idle, let it catch up.
+        if (_size++ == 0 && !_scheduled) _tick = now_tick();
+    }
+
+    e._expires = min(expires, _tick + max_ticks);
+    link(e);
+
+    if (!_scheduled) schedule();
+}
+
+void TimerWheel::cancel(Entry& e)
+{
+    lock_guard<mutex> lock(_mutex);
+
+    if (!e._pprev) return;
+
+    unlink(e);
+    --_size;
+}
+
+bool TimerWheel::armed(const Entry& e) const
+{
+    lock_guard<mutex> lock(_mutex);
+    return e._pprev != nullptr;
+}
+
+size_t TimerWheel::size() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _size;
+}
+
+void TimerWheel::link(Entry& e)
+{
+    Entry** head;
+
+    if (e._expires < _tick) {
+        head = &_slots[0][_tick & root_mask];
+    }
+    else {
+        uint64_t delta = e._expires - _tick;
+
+        if (delta <= root_mask) {
+            head = &_slots[0][e._expires & root_mask];
+        }
+        else {
+            unsigned l = 1;
+            while (l < levels && delta >> (root_bits + l * level_bits)) ++l;
+
+            auto shift = root_bits + (l - 1) * level_bits;
+            head = &_slots[l][(e._expires >> shift) & level_mask];
+        }
+    }
+
+    e._next  = *head;
+    e._pprev = head;
+
+    if (e._next) e._next->_pprev = &e._next;
+    *head = &e;
+}
+
+void TimerWheel::unlink(Entry& e)
+{
+    *e._pprev = e._next;
+    if (e._next) e._next->_pprev = e._pprev;
+
+    e._next  = nullptr;
+    e._pprev = nullptr;
+}
+
+unsigned TimerWheel::cascade(unsigned l)
+{
+    auto shift = root_bits + (l - 1) * level_bits;
+    unsigned i = (_tick >> shift) & level_mask;
+
+    Entry* e = _slots[l][i];
+    _slots[l][i] = nullptr;
+
+    while (e) {
+        Entry* next = e->_next;
+        link(*e);
+        e = next;
+    }
+
+    return i;
+}
+
+void TimerWheel::step()
+{
+    unsigned i = _tick & root_mask;
+
+    // The root went around, bring the entries due in the next round down
+    // from the level above (and from further up when that one went around
+    // too).
+    if (i == 0) {
+        for (unsigned l = 1; l <= levels && cascade(l) == 0; ++l) {}
+    }
+
+    Entry* e = _slots[0][i];
+    _slots[0][i] = nullptr;
+
+    ++_tick;
+
+    while (e) {
+        Entry* next = e->_next;
+
+        e->_next  = nullptr;
+        e->_pprev = nullptr;
+        --_size;
+
+        e->_on_expire();
+        e = next;
+    }
+}
+
+void TimerWheel::schedule()
+{
+    _scheduled = true;
+
+    _timer.expires_at(_start + _tick * _resolution);
+    _timer.async_wait([w = weak_ptr<TimerWheel>(shared_from_this())]
+                      (const sys::error_code& ec) {
+            if (ec) return;
+            if (auto self = w.lock()) self->on_timer();
+        });
+}
+
+void TimerWheel::on_timer()
+{
+    lock_guard<mutex> lock(_mutex);
+
+    _scheduled = false;
+
+    for (auto now = now_tick(); _size && _tick <= now;) step();
+
+    if (_size) schedule();
+}
+
+TimerWheel::~TimerWheel()
+{
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <gnunet_channels/namespaces.h>
+
+namespace gnunet_channels {
+
+// Hierarchical timer wheel (as in the classic Linux kernel timers) shared
+// by all channels of a Service, so that their deadlines don't each add an
+// entry to the reactor's timer heap. Arming, re-arming and cancelling are
+// O(1): an entry is linked into the slot of the level its deadline falls
+// in, and moved to lower levels as the wheel turns. The wheel is driven by
+// a single steady_timer which only runs while something is armed.
+//
+// Deadlines are rounded up to whole ticks. May be used from any thread.
+class TimerWheel : public std::enable_shared_from_this<TimerWheel> {
+public:
+    using Clock    = std::chrono::steady_clock;
+    using Duration = Clock::duration;
+
+    class Entry {
+    public:
+        // Called by the wheel with its lock held, so it mustn't use the
+        // wheel and should only post the actual work elsewhere.
+        explicit Entry(std::function<void()> on_expire)
+            : _on_expire(std::move(on_expire))
+        {}
+
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+
+        // Must not be armed any more.
+        ~Entry() { assert(!_pprev); }
+
+    private:
+        friend class TimerWheel;
+
+        Entry*  _next  = nullptr;
+        Entry** _pprev = nullptr;   // Null when not armed
+        uint64_t _expires = 0;      // In ticks
+        std::function<void()> _on_expire;
+    };
+
+public:
+    TimerWheel(asio::io_service&, Duration resolution = std::chrono::milliseconds(10));
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    Duration resolution() const { return _resolution; }
+
+    // (Re)arms the entry to expire `timeout` from now.
+    void arm(Entry&, Duration timeout);
+    void cancel(Entry&);
+    bool armed(const Entry&) const;
+
+    // Number of armed entries.
+    size_t size() const;
+
+    ~TimerWheel();
+
+private:
+    static constexpr unsigned root_bits  = 8;
+    static constexpr unsigned level_bits = 6;
+    static constexpr unsigned levels     = 4;   // Besides the root
+    static constexpr uint64_t root_mask  = (1u << root_bits) - 1;
+    static constexpr uint64_t level_mask = (1u << level_bits) - 1;
+    static constexpr uint64_t max_ticks  = (1ull << (root_bits + levels * level_bits)) - 1;
+
+    using Slots = std::vector<Entry*>;
+
+    uint64_t now_tick() const;
+    void link(Entry&);
+    static void unlink(Entry&);
+    // Moves the entries of one slot of level `l` (1 based) to lower
+    // levels, returns the slot's index.
+    unsigned cascade(unsigned l);
+    // Expires the entries due at `_tick` and advances it by one.
+    void step();
+    void schedule();
+    void on_timer();
+
+private:
+    asio::steady_timer _timer;
+    const Duration _resolution;
+    const Clock::time_point _start;
+
+    mutable std::mutex _mutex;
+    uint64_t _tick;             // Next tick to be processed
+    size_t _size = 0;
+    bool _scheduled = false;
+    std::array<Slots, levels + 1> _slots;
+};
+
+} // gnunet_channels namespace
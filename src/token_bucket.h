@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <gnunet_channels/rate_limit.h>
+
+namespace gnunet_channels {
+
+// Paces a stream of messages to a RateLimit. A message is let through as
+// soon as the bucket is not in debt and then takes all of its size from
+// it, so messages larger than the burst still pass (followed by a longer
+// pause). Not thread safe.
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint64_t default_burst = 64 * 1024;
+
+public:
+    void set(RateLimit l) {
+        refill();
+        _rate  = l.bytes_per_second;
+        _burst = l.burst ? double(l.burst) : double(default_burst);
+        _tokens = std::min(_tokens, _burst);
+    }
+
+    bool unlimited() const { return _rate == 0; }
+
+    // How long until the next message may go through.
+    Clock::duration delay() {
+        if (unlimited()) return Clock::duration(0);
+
+        refill();
+
+        if (_tokens >= 0) return Clock::duration(0);
+
+        return std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(-_tokens / _rate));
+    }
+
+    void consume(size_t size) {
+        if (unlimited()) return;
+        refill();
+        _tokens -= size;
+    }
+
+private:
+    void refill() {
+        auto now = Clock::now();
+
+        if (_rate) {
+            auto elapsed = std::chrono::duration<double>(now - _last).count();
+            _tokens = std::min(_burst, _tokens + elapsed * _rate);
+        }
+
+        _last = now;
+    }
+
+private:
+    double _rate = 0;
+    double _burst = default_burst;
+    double _tokens = default_burst;
+    Clock::time_point _last = Clock::now();
+};
+
+} // gnunet_channels namespace
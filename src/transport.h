@@ -0,0 +1,41 @@
+#pragma once
+
+#include <gnunet/platform.h>
+#include <gnunet/gnunet_cadet_service.h>
+
+namespace gnunet_channels {
+
+// The subset of the CADET client API used by ChannelImpl and CadetPort.
+// `CadetTransport` forwards it to the CADET service, `LoopbackTransport`
+// emulates it inside the process. All methods must be called from GNUnet's
+// thread and the callbacks are invoked there too.
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    virtual GNUNET_CADET_Channel*
+    channel_create( void* channel_cls
+                  , const GNUNET_PeerIdentity* destination
+                  , const GNUNET_HashCode* port
+                  , GNUNET_CADET_WindowSizeEventHandler
+                  , GNUNET_CADET_DisconnectEventHandler
+                  , const GNUNET_MQ_MessageHandler*) = 0;
+
+    virtual void channel_destroy(GNUNET_CADET_Channel*) = 0;
+
+    virtual GNUNET_MQ_Handle* get_mq(GNUNET_CADET_Channel*) = 0;
+
+    virtual void receive_done(GNUNET_CADET_Channel*) = 0;
+
+    virtual GNUNET_CADET_Port*
+    open_port( const GNUNET_HashCode* port
+             , GNUNET_CADET_ConnectEventHandler
+             , void* connects_cls
+             , GNUNET_CADET_WindowSizeEventHandler
+             , GNUNET_CADET_DisconnectEventHandler
+             , const GNUNET_MQ_MessageHandler*) = 0;
+
+    virtual void close_port(GNUNET_CADET_Port*) = 0;
+};
+
+} // gnunet_channels namespace
@@ -4,11 +4,20 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <fstream>
 
 #include <gnunet_channels/channel.h>
 #include <gnunet_channels/cadet_port.h>
 #include <gnunet_channels/service.h>
 #include <gnunet_channels/namespaces.h>
+#include <gnunet_channels/error.h>
+#include <gnunet_channels/splice.h>
+#include <gnunet_channels/bonded_channel.h>
+#include <gnunet_channels/broadcast.h>
+#include <gnunet_channels/rpc.h>
+#include <gnunet_channels/rate_limit.h>
+#include <gnunet_channels/process_pool.h>
+#include <gnunet_channels/resumable_channel.h>
 
 #include <boost/asio.hpp>
 #include <boost/asio/spawn.hpp>
@@ -189,6 +198,23 @@ BOOST_AUTO_TEST_CASE(test_get_id_config2)
     BOOST_REQUIRE(!server_id.empty());
 }
 
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_peer_id)
+{
+    string server_id = get_id(config1);
+
+    sys::error_code ec;
+    PeerId id = PeerId::from_string(server_id, ec);
+    BOOST_REQUIRE(!ec);
+    BOOST_REQUIRE(id.to_string() == server_id);
+
+    PeerId::from_string("not a peer id", ec);
+    BOOST_REQUIRE(ec == error::invalid_target_id);
+
+    BOOST_REQUIRE(PortHash::from_secret("a") == PortHash::from_secret("a"));
+    BOOST_REQUIRE(PortHash::from_secret("a") != PortHash::from_secret("b"));
+}
+
 //--------------------------------------------------------------------
 BOOST_AUTO_TEST_CASE(test_connect)
 {
@@ -312,3 +338,1552 @@ BOOST_AUTO_TEST_CASE(test_two_connects)
 }
 
 //--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_stats)
+{
+    const string port = random_port();
+
+    string server_id = get_id(config1);
+
+    Fork n1("server", config1, [&](Service& service, auto yield) {
+            FailTimeout ft(4s, "server");
+
+            sys::error_code ec;
+            Channel channel(service);
+            CadetPort p(service);
+            p.open(channel, port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            string msg = "hello";
+            asio::async_write(channel, asio::buffer(msg), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            auto s = channel.stats();
+            BOOST_CHECK(s.bytes_sent == msg.size());
+            BOOST_CHECK(s.messages_sent == 1);
+            BOOST_CHECK(service.stats().channels_open == 1);
+
+            // Wait for the client to close the channel.
+            uint8_t byte_buf = 0;
+            asio::async_read(channel, asio::buffer(&byte_buf, 1), yield[ec]);
+        });
+
+    Fork n2("client", config2, [&](Service& service, auto yield) {
+            FailTimeout ft(4s, "client");
+
+            sys::error_code ec;
+            asio::steady_timer t(service.get_io_service());
+            t.expires_from_now(1s);
+            t.async_wait(yield[ec]);
+
+            Channel channel(service);
+            channel.connect(server_id, port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            string msg(5, '\0');
+            asio::async_read(channel, asio::buffer(&msg[0], msg.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(msg == "hello");
+
+            auto s = channel.stats();
+            BOOST_CHECK(s.bytes_received == msg.size());
+            BOOST_CHECK(s.recv_queue_depth == 0);
+            BOOST_CHECK(s.recv_queue_bytes == 0);
+            BOOST_CHECK(s.connect_duration > 0s);
+        });
+
+    // TODO: Why is this needed?
+    int status; wait(&status);
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_loopback)
+{
+    FailTimeout ft(4s, "loopback");
+
+    const string port = random_port();
+
+    LoopbackOptions options;
+    options.latency = 1ms;
+
+    asio::io_service ios;
+    Service service(config1, ios, options);
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            Channel server(service);
+            CadetPort p(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(server, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+
+                    string msg(5, '\0');
+                    asio::async_read(server, asio::buffer(&msg[0], msg.size()), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    asio::async_write(server, asio::buffer(msg), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+
+                    // Wait for the client to close the channel.
+                    uint8_t byte_buf = 0;
+                    asio::async_read(server, asio::buffer(&byte_buf, 1), yield[ec]);
+                    BOOST_CHECK(ec == asio::error::connection_reset);
+                });
+
+            {
+                Channel client(service);
+                client.connect(service.identity(), port, yield[ec]);
+                BOOST_REQUIRE(!ec);
+
+                string msg = "hello";
+                asio::async_write(client, asio::buffer(msg), yield[ec]);
+                BOOST_REQUIRE(!ec);
+
+                string reply(5, '\0');
+                asio::async_read(client, asio::buffer(&reply[0], reply.size()), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(reply == msg);
+            }
+
+            // Let the server see the channel close before tearing down.
+            asio::steady_timer t(ios);
+            t.expires_from_now(100ms);
+            t.async_wait(yield[ec]);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_splice)
+{
+    using tcp = asio::ip::tcp;
+
+    FailTimeout ft(4s, "splice");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            tcp::acceptor acceptor(ios, tcp::endpoint(tcp::v4(), 0));
+            tcp::socket client(ios);
+            tcp::socket server(ios);
+
+            client.async_connect(acceptor.local_endpoint(), [](auto){});
+            acceptor.async_accept(server, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            Channel a(service);
+            auto b = make_unique<Channel>(service);
+            CadetPort p(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(a, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            b->connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            Splice splice(server, a);
+            bool done = false;
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    splice.async_run(yield[ec]);
+                    BOOST_CHECK(!ec);
+                    done = true;
+                });
+
+            string msg(5, '\0');
+
+            asio::async_write(client, asio::buffer(string("hello")), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            asio::async_read(*b, asio::buffer(&msg[0], msg.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(msg == "hello");
+
+            // EOF on the socket doesn't stop the other direction.
+            client.shutdown(tcp::socket::shutdown_send);
+
+            asio::async_write(*b, asio::buffer(string("world")), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            asio::async_read(client, asio::buffer(&msg[0], msg.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(msg == "world");
+            BOOST_REQUIRE(!done);
+
+            // The channel ending does, the socket then gets an EOF too.
+            b.reset();
+
+            char c;
+            asio::async_read(client, asio::buffer(&c, 1), yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::eof);
+
+            asio::steady_timer t(ios);
+            t.expires_from_now(100ms);
+            t.async_wait(yield[ec]);
+
+            BOOST_REQUIRE(done);
+            BOOST_CHECK(splice.stats().tcp_to_channel_bytes == 5);
+            BOOST_CHECK(splice.stats().channel_to_tcp_bytes == 5);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_bonded_channel)
+{
+    FailTimeout ft(4s, "bonded_channel");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    // Several stripes per member, not a multiple of the stripe size.
+    vector<uint8_t> data(10 * BondedChannel::stripe_size + 123);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = i * 7;
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            BondedPort p(service, port);
+            BondedChannel server(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.accept(server, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    BOOST_REQUIRE(server.width() == 3);
+
+                    vector<uint8_t> received(data.size());
+                    asio::async_read(server, asio::buffer(received), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    BOOST_REQUIRE(received == data);
+
+                    asio::async_write(server, asio::buffer("ok", 2), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            BondedChannel client(service, 3);
+            client.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            asio::async_write(client, asio::buffer(data), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            string reply(2, '\0');
+            asio::async_read(client, asio::buffer(&reply[0], reply.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(reply == "ok");
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_broadcast)
+{
+    FailTimeout ft(4s, "broadcast");
+
+    const string port = random_port();
+    const size_t n = 3;
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            vector<unique_ptr<Channel>> subscribers;
+            vector<unique_ptr<Channel>> publishers;
+            vector<Channel*> targets;
+
+            for (size_t i = 0; i < n; ++i) {
+                subscribers.push_back(make_unique<Channel>(service));
+                publishers.push_back(make_unique<Channel>(service));
+                targets.push_back(publishers.back().get());
+
+                asio::spawn(ios, [&, s = subscribers.back().get()] (auto yield) {
+                        sys::error_code ec;
+                        p.open(*s, port, yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                    });
+
+                publishers.back()->connect(service.identity(), port, yield[ec]);
+                BOOST_REQUIRE(!ec);
+            }
+
+            auto payload = make_shared<const vector<uint8_t>>(100000, 42);
+
+            auto results = Broadcast::async_send(targets, payload, yield);
+            BOOST_REQUIRE(results.size() == n);
+
+            for (auto& r : results) BOOST_REQUIRE(!r);
+
+            for (auto& s : subscribers) {
+                vector<uint8_t> received(payload->size());
+                asio::async_read(*s, asio::buffer(received), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(received == *payload);
+            }
+
+            // One target ended by its peer, one closed on a deadline.
+            subscribers[0].reset();
+            publishers[0]->async_wait_readable(yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::connection_reset);
+
+            Deadlines d;
+            d.read  = 10ms;
+            d.close = true;
+            publishers[1]->set_deadlines(d);
+            publishers[1]->async_wait_readable(yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::timed_out);
+
+            results = Broadcast::async_send(targets, payload, yield);
+            BOOST_REQUIRE(results.size() == n);
+            BOOST_REQUIRE(results[0] == asio::error::connection_reset);
+            BOOST_REQUIRE(results[1] == asio::error::operation_aborted);
+            BOOST_REQUIRE(!results[2]);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_rpc)
+{
+    FailTimeout ft(4s, "rpc");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    using Payload = RpcClient::Payload;
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            Channel server_channel(service);
+            CadetPort p(service);
+
+            // Replies to "slow" only after "fast" was answered, and
+            // never to "never".
+            RpcServer::Reply slow_reply;
+
+            RpcServer server(server_channel, [&] (Payload req, auto reply) {
+                    string r(req.begin(), req.end());
+
+                    if (r == "slow") { slow_reply = reply; return; }
+                    if (r == "never") return;
+
+                    reply(Payload(r.rbegin(), r.rend()));
+                    if (slow_reply) slow_reply(Payload{'s'});
+                });
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(server_channel, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    server.async_run(yield[ec]);
+                });
+
+            Channel client_channel(service);
+            client_channel.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            RpcClient client(client_channel);
+
+            bool slow_done = false;
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    auto r = client.async_call(Payload{'s','l','o','w'}, 2s, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    BOOST_REQUIRE(r == Payload{'s'});
+                    slow_done = true;
+                });
+
+            auto r = client.async_call(Payload{'a','b','c'}, 2s, yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(r == (Payload{'c','b','a'}));
+
+            client.async_call(Payload{'n','e','v','e','r'}, 100ms, yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::timed_out);
+
+            BOOST_REQUIRE(slow_done);
+            BOOST_REQUIRE(client.outstanding() == 0);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_rpc_malformed)
+{
+    FailTimeout ft(4s, "rpc_malformed");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    using Payload = RpcClient::Payload;
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            Channel peer(service);
+            CadetPort p(service);
+
+            // Answers the first request with a request of its own.
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(peer, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+
+                    vector<uint8_t> frame(13 + 3);
+                    asio::async_read(peer, asio::buffer(frame), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+
+                    vector<uint8_t> request(13, 0);
+                    asio::async_write(peer, asio::buffer(request), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            Channel channel(service);
+            channel.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            RpcClient client(channel);
+
+            client.async_call(Payload{'a','b','c'}, 2s, yield[ec]);
+            BOOST_REQUIRE(ec == error::malformed_frame);
+
+            // Nothing is left reading from the channel.
+            channel.async_wait_readable(yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::operation_aborted);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_send_file)
+{
+    FailTimeout ft(4s, "send_file");
+
+    const string port = random_port();
+    const string src_path = "/tmp/gnunet-channels-test-src";
+    const string dst_path = "/tmp/gnunet-channels-test-dst";
+
+    vector<uint8_t> content(200 * 1000);
+    for (size_t i = 0; i < content.size(); ++i) content[i] = i * 7;
+
+    {
+        std::ofstream f(src_path, std::ios::binary);
+        f.write((const char*) content.data(), content.size());
+    }
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            Channel receiver(service);
+            CadetPort p(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(receiver, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            Channel sender(service);
+            sender.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    size_t n = sender.async_send_file(src_path, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    BOOST_REQUIRE(n == content.size());
+                });
+
+            size_t n = receiver.async_receive_file(dst_path, content.size(), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(n == content.size());
+
+            std::ifstream f(dst_path, std::ios::binary);
+            vector<uint8_t> received((std::istreambuf_iterator<char>(f)),
+                                      std::istreambuf_iterator<char>());
+            BOOST_REQUIRE(received == content);
+
+            sender.async_send_file("/nonexistent/file", yield[ec]);
+            BOOST_REQUIRE(ec == sys::errc::no_such_file_or_directory);
+        });
+
+    ios.run();
+
+    ::unlink(src_path.c_str());
+    ::unlink(dst_path.c_str());
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_send_fairness)
+{
+    FailTimeout ft(4s, "send_fairness");
+
+    const string port = random_port();
+
+    LoopbackOptions options;
+    options.bandwidth = 10 * 1000 * 1000;
+
+    asio::io_service ios;
+    Service service(config1, ios, options);
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            Channel bulk_rx(service), small_rx(service);
+            Channel bulk_tx(service), small_tx(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(bulk_rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    p.open(small_rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            // Before connecting, kept until the channel has a handle.
+            small_tx.set_send_weight(4);
+
+            bulk_tx.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+            small_tx.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            // Takes ~0.4s over the simulated tunnel.
+            vector<uint8_t> bulk(4 * 1000 * 1000, 'b');
+            bool bulk_done = false;
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    asio::async_write(bulk_tx, asio::buffer(bulk), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    bulk_done = true;
+                });
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    vector<uint8_t> rx(bulk.size());
+                    asio::async_read(bulk_rx, asio::buffer(rx), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    BOOST_REQUIRE(rx == bulk);
+                });
+
+            // The small write must not wait for the bulk one.
+            asio::steady_timer t(ios);
+            t.expires_from_now(20ms);
+            t.async_wait(yield[ec]);
+
+            string small = "small";
+            asio::async_write(small_tx, asio::buffer(small), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            string rx(small.size(), '\0');
+            asio::async_read(small_rx, asio::buffer(&rx[0], rx.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(rx == small);
+            BOOST_REQUIRE(!bulk_done);
+
+            while (!bulk_done) {
+                t.expires_from_now(10ms);
+                t.async_wait(yield[ec]);
+            }
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_rate_limit)
+{
+    FailTimeout ft(4s, "rate_limit");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            Channel rx(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            RateLimit limit;
+            limit.bytes_per_second = 1000 * 1000;
+
+            // Set before there's a CADET channel to apply it to.
+            Channel tx(service);
+            tx.set_send_limit(limit);
+            tx.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            vector<uint8_t> data(300 * 1000, 'x');
+            vector<uint8_t> received(data.size());
+
+            // ~236kB over the 64kB burst takes at least ~0.2s at 1MB/s,
+            // once limited on each side.
+            auto transfer = [&] (auto yield) {
+                auto start = chrono::steady_clock::now();
+
+                asio::spawn(ios, [&] (auto yield) {
+                        sys::error_code ec;
+                        asio::async_write(tx, asio::buffer(data), yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                    });
+
+                sys::error_code ec;
+                asio::async_read(rx, asio::buffer(received), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(received == data);
+
+                return chrono::steady_clock::now() - start;
+            };
+
+            BOOST_REQUIRE(transfer(yield) >= 150ms);
+            BOOST_REQUIRE(tx.stats().send_rate_limit == limit.bytes_per_second);
+            BOOST_REQUIRE(tx.stats().send_paced > 0);
+
+            tx.set_send_limit(RateLimit());
+            rx.set_receive_limit(limit);
+            BOOST_REQUIRE(transfer(yield) >= 150ms);
+            BOOST_REQUIRE(rx.stats().receive_paced > 0);
+            BOOST_REQUIRE(service.stats().receive_paced > 0);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+// Channels built for a single thread have no strands to keep them safe.
+#if !GNUNET_CHANNELS_SINGLE_THREADED
+BOOST_AUTO_TEST_CASE(test_multithreaded_io_service)
+{
+    FailTimeout ft(8s, "multithreaded_io_service");
+
+    const string port = random_port();
+    const size_t n = 16;
+    const size_t rounds = 200;
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    // Boost.Test assertions aren't thread safe, the workers only count
+    // what went wrong.
+    atomic<size_t> errors{0};
+    atomic<size_t> remaining{2 * n};
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            if (ec) { ++errors; return; }
+
+            CadetPort p(service);
+            vector<unique_ptr<Channel>> rx, tx;
+
+            for (size_t i = 0; i < n; ++i) {
+                rx.push_back(make_unique<Channel>(service));
+                tx.push_back(make_unique<Channel>(service));
+            }
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    for (auto& ch : rx) {
+                        p.open(*ch, port, yield[ec]);
+                        if (ec) { ++errors; return; }
+                    }
+                });
+
+            for (auto& ch : tx) {
+                ch->connect(service.identity(), port, yield[ec]);
+                if (ec) { ++errors; return; }
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                asio::spawn(ios, [&, ch = rx[i].get()] (auto yield) {
+                        sys::error_code ec;
+                        uint32_t v;
+                        for (size_t r = 0; r < rounds; ++r) {
+                            asio::async_read(*ch, asio::buffer(&v, sizeof(v)), yield[ec]);
+                            if (ec) { ++errors; break; }
+                            ++v;
+                            asio::async_write(*ch, asio::buffer(&v, sizeof(v)), yield[ec]);
+                            if (ec) { ++errors; break; }
+                        }
+                        --remaining;
+                    });
+
+                asio::spawn(ios, [&, ch = tx[i].get()] (auto yield) {
+                        sys::error_code ec;
+                        for (uint32_t r = 0; r < rounds; ++r) {
+                            uint32_t v = r;
+                            asio::async_write(*ch, asio::buffer(&v, sizeof(v)), yield[ec]);
+                            if (ec) { ++errors; break; }
+                            asio::async_read(*ch, asio::buffer(&v, sizeof(v)), yield[ec]);
+                            if (ec || v != r + 1) { ++errors; break; }
+                        }
+                        --remaining;
+                    });
+            }
+
+            asio::steady_timer t(ios);
+
+            while (remaining) {
+                t.expires_from_now(1ms);
+                t.async_wait(yield[ec]);
+            }
+        });
+
+    vector<thread> threads;
+
+    for (size_t i = 0; i < 3; ++i) {
+        threads.emplace_back([&ios] { ios.run(); });
+    }
+
+    ios.run();
+
+    for (auto& t : threads) t.join();
+
+    BOOST_REQUIRE(errors == 0);
+}
+#endif
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_sharded_service)
+{
+    FailTimeout ft(4s, "sharded_service");
+
+    const string port = random_port();
+    const size_t n = 8;
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    ShardingOptions sharding;
+    sharding.handles = 4;
+    service.set_sharding(sharding);
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(service.handle_stats().size() == 4);
+
+            CadetPort p(service);
+            vector<unique_ptr<Channel>> rx, tx;
+
+            for (size_t i = 0; i < n; ++i) {
+                rx.push_back(make_unique<Channel>(service));
+                tx.push_back(make_unique<Channel>(service));
+            }
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    for (auto& ch : rx) {
+                        p.open(*ch, port, yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                    }
+                });
+
+            for (auto& ch : tx) {
+                ch->connect(service.identity(), port, yield[ec]);
+                BOOST_REQUIRE(!ec);
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t v = i;
+                asio::async_write(*tx[i], asio::buffer(&v, sizeof(v)), yield[ec]);
+                BOOST_REQUIRE(!ec);
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t v;
+                asio::async_read(*rx[i], asio::buffer(&v, sizeof(v)), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(v == i);
+            }
+
+            // Outgoing channels are spread over the handles, so no
+            // single handle carries all of them.
+            size_t sum = 0, busiest = 0;
+            for (auto& s : service.handle_stats()) {
+                sum += s.channels_open;
+                busiest = max<size_t>(busiest, s.channels_open);
+            }
+
+            BOOST_REQUIRE(sum == service.stats().channels_open);
+            BOOST_REQUIRE(busiest < 2 * n);
+
+            // Whatever handle the `rx` channels were created on, once
+            // accepted they're on the port's, which received everything.
+            size_t receiving = 0;
+            for (auto& s : service.handle_stats()) {
+                if (!s.bytes_received) continue;
+                ++receiving;
+                BOOST_REQUIRE(s.bytes_received == n * sizeof(uint32_t));
+            }
+
+            BOOST_REQUIRE(receiving == 1);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_process_pool)
+{
+    FailTimeout ft(10s, "process_pool");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    ProcessPool pool(ios, {config1});
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            pool.async_start(yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(pool.identities().size() == 1);
+            BOOST_REQUIRE(!pool.identities()[0].empty());
+
+            pool.listen(port);
+
+            auto server_id = pool.identities()[0];
+
+            {
+                Fork client("client", config2, [&] (Service& service, auto yield) {
+                        sys::error_code ec;
+                        Channel ch(service);
+                        ch.connect(server_id, port, yield[ec]);
+                        BOOST_REQUIRE(!ec);
+
+                        string tx = "hello", rx(tx.size(), '\0');
+                        asio::async_write(ch, asio::buffer(tx), yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                        asio::async_read(ch, asio::buffer(&rx[0], rx.size()), yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                        BOOST_REQUIRE(rx == tx);
+                    });
+
+                // Echo back whatever comes through the worker.
+                PoolChannel ch(pool);
+                pool.async_accept(ch, yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(pool.load()[0] == 1);
+
+                string buf(5, '\0');
+                asio::async_read(ch, asio::buffer(&buf[0], buf.size()), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                asio::async_write(ch, asio::buffer(buf), yield[ec]);
+                BOOST_REQUIRE(!ec);
+            }
+
+            pool.stop();
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_readiness)
+{
+    FailTimeout ft(4s, "readiness");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            Channel rx(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            Channel tx(service);
+            tx.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            // Nothing was received yet.
+            char c;
+            BOOST_REQUIRE(rx.try_read_some(asio::buffer(&c, 1), ec) == 0);
+            BOOST_REQUIRE(ec == asio::error::would_block);
+
+            string a = "abc", b = "def";
+
+            BOOST_REQUIRE(tx.try_write_some(asio::buffer(a), ec) == a.size());
+            BOOST_REQUIRE(!ec);
+
+            // The first write is still in progress.
+            BOOST_REQUIRE(tx.try_write_some(asio::buffer(b), ec) == 0);
+            BOOST_REQUIRE(ec == asio::error::would_block);
+
+            tx.async_wait_writable(yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(tx.try_write_some(asio::buffer(b), ec) == b.size());
+            BOOST_REQUIRE(!ec);
+
+            string received;
+
+            while (received.size() < a.size() + b.size()) {
+                rx.async_wait_readable(yield[ec]);
+                BOOST_REQUIRE(!ec);
+
+                char buf[16];
+                size_t n = rx.try_read_some(asio::buffer(buf), ec);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(n > 0);
+                received.append(buf, n);
+            }
+
+            BOOST_REQUIRE(received == a + b);
+            BOOST_REQUIRE(rx.try_read_some(asio::buffer(&c, 1), ec) == 0);
+            BOOST_REQUIRE(ec == asio::error::would_block);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_peek_consume)
+{
+    FailTimeout ft(4s, "peek_consume");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            Channel rx(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            Channel tx(service);
+            tx.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            BOOST_REQUIRE(rx.peek().empty());
+
+            string data = "header:payload";
+            asio::async_write(tx, asio::buffer(data), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            auto views = rx.async_peek(yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(!views.empty());
+
+            // Wait for everything, later messages only add views.
+            while (asio::buffer_size(views) < data.size()) {
+                asio::steady_timer t(ios);
+                t.expires_from_now(10ms);
+                t.async_wait(yield[ec]);
+                views = rx.peek();
+            }
+
+            string seen(asio::buffer_size(views), '\0');
+            asio::buffer_copy(asio::buffer(&seen[0], seen.size()), views);
+            BOOST_REQUIRE(seen == data);
+
+            // Drop the header, the rest is still there for a normal read.
+            rx.consume(strlen("header:"));
+            BOOST_REQUIRE(asio::buffer_size(rx.peek()) == strlen("payload"));
+
+            string rest(strlen("payload"), '\0');
+            asio::async_read(rx, asio::buffer(&rest[0], rest.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(rest == "payload");
+            BOOST_REQUIRE(rx.peek().empty());
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_dynamic_buffer)
+{
+    FailTimeout ft(4s, "dynamic_buffer");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            Channel rx(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            Channel tx(service);
+            tx.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            // The second line and its delimiter span two messages.
+            for (string m : { "one\ntw", "o\r", "\nthree" }) {
+                asio::async_write(tx, asio::buffer(m), yield[ec]);
+                BOOST_REQUIRE(!ec);
+            }
+
+            asio::streambuf buffer;
+
+            auto line = [&] (size_t n) {
+                string s( asio::buffers_begin(buffer.data())
+                        , asio::buffers_begin(buffer.data()) + n);
+                buffer.consume(n);
+                return s;
+            };
+
+            size_t n = rx.async_read_until(buffer, "\r\n", yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE_EQUAL(line(n), "one\ntwo\r\n");
+
+            // Like asio::async_read_until, the rest of the last message
+            // stays in the DynamicBuffer.
+            BOOST_REQUIRE_EQUAL(line(buffer.size()), "three");
+
+            asio::async_write(tx, asio::buffer(string("four")), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            string rest;
+            while (rest.size() < strlen("four")) {
+                n = rx.async_read_into(asio::dynamic_buffer(rest), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(n > 0);
+            }
+            BOOST_REQUIRE_EQUAL(rest, "four");
+
+            // A full DynamicBuffer without the delimiter.
+            asio::async_write(tx, asio::buffer(string("abcdef")), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            asio::streambuf small(4);
+            rx.async_read_until(small, "\n", yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::not_found);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_read_after_end)
+{
+    FailTimeout ft(4s, "read_after_end");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            Channel rx(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            {
+                Channel tx(service);
+                tx.connect(service.identity(), port, yield[ec]);
+                BOOST_REQUIRE(!ec);
+
+                asio::async_write(tx, asio::buffer(string("tail\n")), yield[ec]);
+                BOOST_REQUIRE(!ec);
+            }
+
+            // Let the end of the channel arrive after the data.
+            asio::steady_timer t(ios);
+            t.expires_from_now(100ms);
+            t.async_wait(yield[ec]);
+
+            // What was sent before the end is still there to be read.
+            rx.async_wait_readable(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            asio::streambuf buffer;
+            size_t n = rx.async_read_until(buffer, "\n", yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE_EQUAL(n, strlen("tail\n"));
+
+            // And once it's all read, the end is reported.
+            rx.async_wait_readable(yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::connection_reset);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_deadlines)
+{
+    FailTimeout ft(4s, "deadlines");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            Channel rx(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.open(rx, port, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            Channel tx(service);
+            tx.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            Deadlines d;
+            d.read = 100ms;
+            rx.set_deadlines(d);
+
+            // Nothing is sent, the read times out but the channel stays.
+            char c;
+            auto start = chrono::steady_clock::now();
+            asio::async_read(rx, asio::buffer(&c, 1), yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::timed_out);
+            BOOST_REQUIRE(chrono::steady_clock::now() - start >= 100ms);
+
+            asio::async_write(tx, asio::buffer(string("x")), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            asio::async_read(rx, asio::buffer(&c, 1), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(c == 'x');
+
+            // Now with an idle deadline which closes the channel.
+            d = Deadlines();
+            d.idle  = 100ms;
+            d.close = true;
+            rx.set_deadlines(d);
+
+            rx.async_wait_readable(yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::timed_out);
+
+            asio::async_read(rx, asio::buffer(&c, 1), yield[ec]);
+            BOOST_REQUIRE(ec == asio::error::operation_aborted);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_idle_reclaim)
+{
+    FailTimeout ft(4s, "idle_reclaim");
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    auto sleep = [&] (auto d, auto yield) {
+        sys::error_code ec;
+        asio::steady_timer t(ios);
+        t.expires_from_now(d);
+        t.async_wait(yield[ec]);
+    };
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            // Connects `tx` to `rx` over a port of its own.
+            auto pair = [&] (Channel& tx, Channel& rx, auto yield) {
+                const string port = random_port();
+                auto p = make_shared<CadetPort>(service);
+
+                asio::spawn(ios, [&, p] (auto yield) {
+                        sys::error_code ec;
+                        p->open(rx, port, yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                    });
+
+                sys::error_code ec;
+                tx.connect(service.identity(), port, yield[ec]);
+                BOOST_REQUIRE(!ec);
+            };
+
+            IdleOptions o;
+            o.timeout   = 300ms;
+            o.keepalive = 50ms;
+            service.set_idle_options(o);
+
+            // Probes keep the channels from timing out.
+            {
+                Channel tx(service), rx(service);
+                pair(tx, rx, yield);
+
+                sleep(500ms, yield);
+
+                char c;
+                asio::async_write(tx, asio::buffer(string("x")), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                asio::async_read(rx, asio::buffer(&c, 1), yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(rx.stats().keepalives_received > 0);
+            }
+
+            o.keepalive = 0s;
+            o.timeout   = 100ms;
+            service.set_idle_options(o);
+
+            // Without them they're closed.
+            {
+                Channel tx(service), rx(service);
+                pair(tx, rx, yield);
+
+                // Unless `tx` got closed first and ended it.
+                rx.async_wait_readable(yield[ec]);
+                BOOST_REQUIRE( ec == asio::error::timed_out
+                            || ec == asio::error::connection_reset);
+                BOOST_REQUIRE(service.stats().channels_idle_closed > 0);
+            }
+
+            o.timeout      = 0s;
+            o.max_channels = 3;
+            service.set_idle_options(o);
+
+            // Channels not yet connected don't count.
+            Channel tx1(service), rx1(service);
+            Channel tx2(service), rx2(service);
+            BOOST_REQUIRE(service.stats().channels_evicted == 0);
+
+            // The least recently used channel makes room for new ones.
+            pair(tx1, rx1, yield);
+            pair(tx2, rx2, yield);
+
+            BOOST_REQUIRE(service.stats().channels_evicted > 0);
+
+            // Whichever end of the first pair was opened first, the other
+            // one is ended with it.
+            char c;
+            asio::async_read(tx1, asio::buffer(&c, 1), yield[ec]);
+            BOOST_REQUIRE( ec == asio::error::operation_aborted
+                        || ec == asio::error::connection_reset);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_resumable_channel)
+{
+    FailTimeout ft(4s, "resumable_channel");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    // Small enough for the writer to wait for acknowledgements.
+    ResumableOptions opts;
+    opts.replay_buffer = 64 * 1024;
+    opts.reconnect_delay = 10ms;
+
+    vector<uint8_t> data(300 * 1000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = i * 7;
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            ResumablePort p(service, port);
+            ResumableChannel server(service, opts);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.accept(server, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+
+                    vector<uint8_t> received(data.size());
+                    asio::async_read(server, asio::buffer(received), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    BOOST_REQUIRE(received == data);
+                    BOOST_REQUIRE_EQUAL(server.resumes(), 1);
+
+                    asio::async_write(server, asio::buffer("ok", 2), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            ResumableChannel client(service, opts);
+            client.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            size_t half = data.size() / 2;
+
+            asio::async_write(client, asio::buffer(data.data(), half), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            // Neither side's reads nor writes see this.
+            client.drop_channel();
+
+            asio::async_write(client, asio::buffer(data.data() + half, data.size() - half), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            string reply(2, '\0');
+            asio::async_read(client, asio::buffer(&reply[0], reply.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(reply == "ok");
+            BOOST_REQUIRE_EQUAL(client.resumes(), 1);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_resumable_accept_destroyed)
+{
+    FailTimeout ft(4s, "resumable_accept_destroyed");
+
+    const string port = random_port();
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            ResumablePort p(service, port);
+
+            // Destroyed with its accept pending, the stream goes to the
+            // channel accepting after it.
+            auto gone = make_unique<ResumableChannel>(service);
+            bool aborted = false;
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.accept(*gone, yield[ec]);
+                    BOOST_REQUIRE(ec == asio::error::operation_aborted);
+                    aborted = true;
+                });
+
+            asio::spawn(ios, [&] (auto) { gone.reset(); });
+
+            ResumableChannel server(service);
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    p.accept(server, yield[ec]);
+                    BOOST_REQUIRE(!ec);
+
+                    string hello(2, '\0');
+                    asio::async_read(server, asio::buffer(&hello[0], hello.size()), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                    BOOST_REQUIRE(hello == "hi");
+
+                    asio::async_write(server, asio::buffer("ok", 2), yield[ec]);
+                    BOOST_REQUIRE(!ec);
+                });
+
+            ResumableChannel client(service);
+            client.connect(service.identity(), port, yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            asio::async_write(client, asio::buffer("hi", 2), yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            string reply(2, '\0');
+            asio::async_read(client, asio::buffer(&reply[0], reply.size()), yield[ec]);
+            BOOST_REQUIRE(!ec);
+            BOOST_REQUIRE(reply == "ok");
+            BOOST_REQUIRE(aborted);
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------
+BOOST_AUTO_TEST_CASE(test_sharded_settings)
+{
+    FailTimeout ft(4s, "sharded_settings");
+
+    const string port = random_port();
+    const size_t n = 8;
+
+    asio::io_service ios;
+    Service service(config1, ios, LoopbackOptions());
+
+    // Connecting channels move to the handle their destination hashes to,
+    // whatever was set up on them before has to move along.
+    ShardingOptions sharding;
+    sharding.handles = 4;
+    sharding.assign = ShardingOptions::Assign::by_hash;
+    service.set_sharding(sharding);
+
+    asio::spawn(ios, [&] (auto yield) {
+            sys::error_code ec;
+            service.async_setup(yield[ec]);
+            BOOST_REQUIRE(!ec);
+
+            CadetPort p(service);
+            vector<unique_ptr<Channel>> rx, tx;
+
+            for (size_t i = 0; i < n; ++i) {
+                rx.push_back(make_unique<Channel>(service));
+                tx.push_back(make_unique<Channel>(service));
+            }
+
+            asio::spawn(ios, [&] (auto yield) {
+                    sys::error_code ec;
+                    for (auto& ch : rx) {
+                        p.open(*ch, port, yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                    }
+                });
+
+            RateLimit limit;
+            limit.bytes_per_second = 1000 * 1000;
+
+            Deadlines d;
+            d.read = 500ms;
+
+            size_t readable = 0;
+
+            for (auto& ch : tx) {
+                // All before connecting.
+                ch->set_send_limit(limit);
+                ch->set_deadlines(d);
+                asio::spawn(ios, [&, ch = ch.get()] (auto yield) {
+                        sys::error_code ec;
+                        ch->async_wait_readable(yield[ec]);
+                        BOOST_REQUIRE(!ec);
+                        ++readable;
+                    });
+
+                ch->connect(service.identity(), port, yield[ec]);
+                BOOST_REQUIRE(!ec);
+                BOOST_REQUIRE(ch->stats().send_rate_limit == limit.bytes_per_second);
+            }
+
+            for (auto& ch : rx) {
+                asio::async_write(*ch, asio::buffer("x", 1), yield[ec]);
+                BOOST_REQUIRE(!ec);
+            }
+
+            asio::steady_timer t(ios);
+
+            while (readable < n) {
+                t.expires_from_now(1ms);
+                t.async_wait(yield[ec]);
+            }
+
+            // Impls replaced while connecting or accepting don't count.
+            BOOST_REQUIRE_EQUAL(service.stats().channels_created, 2 * n);
+
+            // The read deadline still applies.
+            size_t timed_out = 0;
+
+            for (auto& ch : tx) {
+                char c;
+                asio::async_read(*ch, asio::buffer(&c, 1), yield[ec]);
+                BOOST_REQUIRE(!ec);
+
+                asio::async_read(*ch, asio::buffer(&c, 1),
+                    [&] (sys::error_code ec, size_t) {
+                        BOOST_REQUIRE(ec == asio::error::timed_out);
+                        ++timed_out;
+                    });
+            }
+
+            while (timed_out < n) {
+                t.expires_from_now(1ms);
+                t.async_wait(yield[ec]);
+            }
+        });
+
+    ios.run();
+}
+
+//--------------------------------------------------------------------